@@ -54,6 +54,17 @@ case "$OS" in
                     echo "Failed to build native agent"
                 fi
             fi
+
+            # Offline recording analyzer (no JNI dependency)
+            clang++ -std=c++17 -O2 \
+                -o "$LIB_DIR/jma-analyzer" \
+                "$CPP_DIR/recording_analyzer.cpp"
+
+            if [ -f "$LIB_DIR/jma-analyzer" ]; then
+                echo "Recording analyzer built successfully: $LIB_DIR/jma-analyzer"
+            else
+                echo "Failed to build recording analyzer"
+            fi
         fi
         ;;
 
@@ -83,6 +94,29 @@ case "$OS" in
                 echo "Failed to build native agent"
             fi
         fi
+
+        # Offline recording analyzer (no JNI dependency)
+        g++ -std=c++17 -O2 \
+            -o "$LIB_DIR/jma-analyzer" \
+            "$CPP_DIR/recording_analyzer.cpp" \
+            -lpthread
+
+        if [ -f "$LIB_DIR/jma-analyzer" ]; then
+            echo "Recording analyzer built successfully: $LIB_DIR/jma-analyzer"
+        else
+            echo "Failed to build recording analyzer"
+        fi
+
+        # Host-wide collector daemon (epoll, Linux only)
+        g++ -std=c++17 -O2 \
+            -o "$LIB_DIR/jma-collector" \
+            "$CPP_DIR/jma_collector.cpp"
+
+        if [ -f "$LIB_DIR/jma-collector" ]; then
+            echo "Collector built successfully: $LIB_DIR/jma-collector"
+        else
+            echo "Failed to build collector"
+        fi
         ;;
 
     *)
@@ -0,0 +1,356 @@
+/**
+ * Event Stream - Java Memory Analyzer
+ *
+ * Live out-of-process streaming of agent events. The agent listens on a
+ * Unix domain socket ("<tmp>/jma-stream-<pid>.sock"); when a consumer
+ * connects it creates a shared-memory ring (memfd) and an eventfd and
+ * passes both over the socket (SCM_RIGHTS) after a StreamHello. One
+ * consumer at a time; the ring is discarded when the consumer hangs up.
+ *
+ * The ring is single-producer (the agent's event processor thread),
+ * single-consumer. Producer and consumer positions are monotonically
+ * increasing byte counts on separate cache lines; records are 8-byte
+ * aligned and never wrap (a STREAM_PAD record fills the end of the ring).
+ *
+ *   StreamRecordHeader { type, length }   length includes the header
+ *   STREAM_CLASS / STREAM_SITE            uint32 id, uint32 name length, name
+ *   STREAM_EVENT                          RecordedEvent; class_index and
+ *                                         site_index are the agent's ids
+ *
+ * A name record precedes the first event that refers to the id. When the
+ * ring is full the producer drops events (counted in the ring header).
+ * A consumer that runs dry sets consumer_waiting and sleeps on the
+ * eventfd; the producer only signals the eventfd when that flag is set.
+ *
+ * Linux only (memfd_create, eventfd).
+ *
+ * @author Java Memory Analyzer Team
+ * @version 1.0.0
+ */
+
+#ifndef JMA_EVENT_STREAM_H
+#define JMA_EVENT_STREAM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <atomic>
+#include <string>
+#include <string_view>
+
+#include "recording_format.h"
+
+namespace jma {
+
+static const char STREAM_MAGIC[8] = {'J', 'M', 'A', 'S', 'T', 'R', 'M', '1'};
+static const uint32_t STREAM_VERSION = 1;
+
+enum StreamRecordType : uint32_t {
+    STREAM_PAD = 0,
+    STREAM_CLASS = 1,
+    STREAM_SITE = 2,
+    STREAM_EVENT = 3
+};
+
+struct StreamRecordHeader {
+    uint32_t type;
+    uint32_t length;
+};
+
+/**
+ * Ring control block at offset 0 of the shared mapping; data follows at
+ * STREAM_DATA_OFFSET
+ */
+struct StreamRingHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pid;
+    uint64_t capacity;                      // Data bytes (power of two)
+    char pad0[40];
+
+    // Producer line
+    std::atomic<uint64_t> head;             // Bytes written
+    std::atomic<uint64_t> dropped;          // Events not written (ring full)
+    char pad1[48];
+
+    // Consumer line
+    std::atomic<uint64_t> tail;             // Bytes consumed
+    std::atomic<uint32_t> consumer_waiting;
+    char pad2[52];
+};
+
+static_assert(sizeof(StreamRingHeader) == 192, "StreamRingHeader layout");
+static const size_t STREAM_DATA_OFFSET = 256;
+
+/**
+ * Sent with the ring and eventfd descriptors
+ */
+struct StreamHello {
+    char magic[8];
+    uint32_t version;
+    uint32_t pid;
+    uint64_t mapping_size;                  // STREAM_DATA_OFFSET + capacity
+};
+
+inline std::string stream_socket_path(uint32_t pid) {
+    const char* tmp = getenv("TMPDIR");
+    std::string dir = (tmp && *tmp) ? tmp : "/tmp";
+    if (dir.back() != '/') dir += '/';
+    char name[64];
+    snprintf(name, sizeof(name), "jma-stream-%u.sock", pid);
+    return dir + name;
+}
+
+/**
+ * Send a message with file descriptors attached
+ */
+inline bool send_with_fds(int socket_fd, const void* data, size_t length, const int* fds, int fd_count) {
+    struct iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len = length;
+
+    char control[CMSG_SPACE(sizeof(int) * 4)];
+    memset(control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+
+    return sendmsg(socket_fd, &msg, MSG_NOSIGNAL) == (ssize_t)length;
+}
+
+/**
+ * Receive a message and up to max_fds descriptors. Returns the number of
+ * descriptors received, or -1 on error.
+ */
+inline int recv_with_fds(int socket_fd, void* data, size_t length, int* fds, int max_fds) {
+    struct iovec iov;
+    iov.iov_base = data;
+    iov.iov_len = length;
+
+    char control[CMSG_SPACE(sizeof(int) * 4)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    if (recvmsg(socket_fd, &msg, MSG_WAITALL) != (ssize_t)length) {
+        return -1;
+    }
+    int received = 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            int n = (int)((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            for (int i = 0; i < n; i++) {
+                int fd;
+                memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                if (received < max_fds) fds[received++] = fd;
+                else close(fd);
+            }
+        }
+    }
+    return received;
+}
+
+/**
+ * Consumer side of a stream
+ *
+ * Usage: connect(pid), then call poll() in a loop; it returns false once
+ * the agent closes the stream.
+ */
+class StreamConsumer {
+private:
+    int socket_fd = -1;
+    int wake_fd = -1;
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+    StreamRingHeader* ring = nullptr;
+    const char* data = nullptr;
+    uint64_t mask = 0;
+
+public:
+    ~StreamConsumer() { close(); }
+
+    bool connect(uint32_t pid, std::string* error) {
+        std::string path = stream_socket_path(pid);
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            if (error) *error = "socket path too long: " + path;
+            return false;
+        }
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        socket_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket_fd < 0 || ::connect(socket_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            if (error) *error = "cannot connect to " + path + " (agent option stream)";
+            close();
+            return false;
+        }
+
+        StreamHello hello;
+        int fds[2] = {-1, -1};
+        if (recv_with_fds(socket_fd, &hello, sizeof(hello), fds, 2) != 2 ||
+            memcmp(hello.magic, STREAM_MAGIC, sizeof(hello.magic)) != 0 ||
+            hello.version != STREAM_VERSION) {
+            if (fds[0] >= 0) ::close(fds[0]);
+            if (fds[1] >= 0) ::close(fds[1]);
+            if (error) *error = "stream handshake failed (another consumer attached?)";
+            close();
+            return false;
+        }
+
+        wake_fd = fds[1];
+        mapping_size = (size_t)hello.mapping_size;
+        mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+        ::close(fds[0]);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            if (error) *error = "cannot map stream ring";
+            close();
+            return false;
+        }
+        ring = (StreamRingHeader*)mapping;
+        data = (const char*)mapping + STREAM_DATA_OFFSET;
+        mask = ring->capacity - 1;
+        return true;
+    }
+
+    void close() {
+        if (mapping) munmap(mapping, mapping_size);
+        if (wake_fd >= 0) ::close(wake_fd);
+        if (socket_fd >= 0) ::close(socket_fd);
+        mapping = nullptr;
+        ring = nullptr;
+        wake_fd = socket_fd = -1;
+    }
+
+    uint32_t pid() const { return ring ? ring->pid : 0; }
+    uint64_t dropped() const { return ring ? ring->dropped.load(std::memory_order_relaxed) : 0; }
+
+    int wake_descriptor() const { return wake_fd; }
+    int socket_descriptor() const { return socket_fd; }
+
+    /**
+     * Deliver the records available now, without waiting. Handler
+     * signature: void(const StreamRecordHeader&, const char* payload).
+     * Returns false if the ring is corrupt.
+     */
+    template <typename Handler>
+    bool drain(Handler&& handler) {
+        if (!ring) {
+            return false;
+        }
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        while (tail < head) {
+            const StreamRecordHeader* rh = (const StreamRecordHeader*)(data + (tail & mask));
+            if (rh->length < sizeof(StreamRecordHeader) || rh->length > ring->capacity) {
+                return false;
+            }
+            if (rh->type != STREAM_PAD) {
+                handler(*rh, (const char*)(rh + 1));
+            }
+            tail += rh->length;
+        }
+        ring->tail.store(tail, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Ask the producer to signal the eventfd on its next publish. Returns
+     * false if records arrived meanwhile (drain again instead of waiting).
+     */
+    bool arm() {
+        ring->consumer_waiting.store(1, std::memory_order_seq_cst);
+        if (ring->head.load(std::memory_order_seq_cst) != ring->tail.load(std::memory_order_relaxed)) {
+            ring->consumer_waiting.store(0, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Reset the eventfd after it became readable
+     */
+    void consume_wakeup() {
+        uint64_t count;
+        if (read(wake_fd, &count, sizeof(count)) < 0) {
+            // EAGAIN: already consumed
+        }
+        ring->consumer_waiting.store(0, std::memory_order_relaxed);
+    }
+
+    /**
+     * True once the agent closed the stream socket
+     */
+    bool hung_up() {
+        char byte;
+        return recv(socket_fd, &byte, 1, MSG_DONTWAIT) == 0;
+    }
+
+    /**
+     * Deliver all available records, then wait up to timeout_ms for more.
+     * Returns false when the stream has ended.
+     */
+    template <typename Handler>
+    bool poll(Handler&& handler, int timeout_ms) {
+        if (!ring) {
+            return false;
+        }
+
+        if (ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed) && arm()) {
+            struct pollfd pfd[2];
+            pfd[0].fd = wake_fd;
+            pfd[0].events = POLLIN;
+            pfd[1].fd = socket_fd;
+            pfd[1].events = POLLIN;
+            int ready = ::poll(pfd, 2, timeout_ms);
+            if (ready > 0 && (pfd[0].revents & POLLIN)) {
+                consume_wakeup();
+            }
+            ring->consumer_waiting.store(0, std::memory_order_relaxed);
+            if (ready > 0 && (pfd[1].revents & (POLLIN | POLLHUP)) && hung_up()) {
+                return false;   // Agent closed the stream
+            }
+        }
+        return drain(handler);
+    }
+
+    /**
+     * Decode a STREAM_CLASS / STREAM_SITE payload
+     */
+    static bool parse_name(const StreamRecordHeader& rh, const char* payload, uint32_t* id,
+                           std::string_view* name) {
+        if (rh.length < sizeof(StreamRecordHeader) + 8) return false;
+        uint32_t len;
+        memcpy(id, payload, sizeof(*id));
+        memcpy(&len, payload + 4, sizeof(len));
+        if (len > rh.length - sizeof(StreamRecordHeader) - 8) return false;
+        *name = std::string_view(payload + 8, len);
+        return true;
+    }
+};
+
+} // namespace jma
+
+#endif // JMA_EVENT_STREAM_H
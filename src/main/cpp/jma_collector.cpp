@@ -0,0 +1,673 @@
+/**
+ * Collector - Java Memory Analyzer
+ *
+ * Host-wide collector daemon. Every JVM running the agent announces
+ * itself through its query socket ("<tmp>/jma-query-<pid>.sock", see
+ * query_protocol.h). The collector discovers those sockets, starts and
+ * attaches each agent's event stream (event_stream.h), polls its counters,
+ * and keeps per-JVM and host-wide aggregates, all from a single epoll
+ * loop on one thread.
+ *
+ * Aggregates are served on one local endpoint ("<tmp>/jma-collector.sock"
+ * by default): a client connects, writes one request line and reads a
+ * JSON document.
+ *
+ *   summary              JVMs with their counters, top host sites and classes
+ *   jvms                 JVMs with their counters
+ *   sites [k]            host-wide allocation sites (merged by name)
+ *   classes [k]          host-wide classes (merged by name)
+ *   jvm <pid> [k]        one JVM's counters, sites and classes
+ *
+ * Usage: jma-collector [-s socket] [-m ring_mb] [-d discover_ms] [-p stats_ms]
+ *
+ * Linux only (epoll, memfd, eventfd).
+ *
+ * @author Java Memory Analyzer Team
+ * @version 1.0.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "event_stream.h"
+#include "json_writer.h"
+#include "query_protocol.h"
+#include "stats_page.h"
+
+using jma::JsonWriter;
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+#define DEFAULT_RING_MB 4               // Event stream ring requested per JVM
+#define DEFAULT_DISCOVER_MS 2000
+#define DEFAULT_STATS_MS 1000
+#define DEFAULT_TOP 20
+#define MAX_EPOLL_EVENTS 64
+#define MAX_REQUEST_LINE 256
+
+static const char* const STATS_FIELD_NAMES[jma::STATS_FIELD_COUNT] = {
+    "updateTime", "totalAllocated", "totalFreed", "currentUsage", "allocationCount",
+    "freeCount", "queueDepth", "droppedEvents", "gcCount", "gcTimeMs",
+    "samplingInterval", "heapUsed", "heapCommitted", "heapMax", "agentOverheadPpm",
+    "governorLevel"
+};
+
+static volatile sig_atomic_t g_stop = 0;
+
+static int64_t now_ms() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// ============================================================================
+// Aggregates
+// ============================================================================
+
+/**
+ * Streamed allocation and free totals of one class or site
+ */
+struct Totals {
+    int64_t alloc_count = 0;
+    int64_t alloc_bytes = 0;
+    int64_t free_count = 0;
+    int64_t free_bytes = 0;
+
+    int64_t live_bytes() const { return alloc_bytes - free_bytes; }
+
+    void merge(const Totals& o) {
+        alloc_count += o.alloc_count;
+        alloc_bytes += o.alloc_bytes;
+        free_count += o.free_count;
+        free_bytes += o.free_bytes;
+    }
+};
+
+/**
+ * One monitored JVM
+ */
+struct Jvm {
+    uint32_t pid = 0;
+    int64_t attached_at = 0;
+    jma::QueryClient query;
+    bool stats_pending = false;
+    int64_t stats[jma::STATS_FIELD_COUNT] = {};
+    jma::StreamConsumer stream;
+    bool streaming = false;
+
+    std::unordered_map<uint32_t, std::string> class_names;
+    std::unordered_map<uint32_t, std::string> site_names;
+    std::unordered_map<uint32_t, Totals> classes;
+    std::unordered_map<uint32_t, Totals> sites;
+    int64_t events = 0;
+    int64_t gcs = 0;
+
+    void on_record(const jma::StreamRecordHeader& rh, const char* payload) {
+        if (rh.type == jma::STREAM_CLASS || rh.type == jma::STREAM_SITE) {
+            uint32_t id;
+            std::string_view name;
+            if (jma::StreamConsumer::parse_name(rh, payload, &id, &name)) {
+                (rh.type == jma::STREAM_CLASS ? class_names : site_names)[id] = std::string(name);
+            }
+            return;
+        }
+        if (rh.type != jma::STREAM_EVENT || rh.length < sizeof(rh) + sizeof(jma::RecordedEvent)) {
+            return;
+        }
+
+        jma::RecordedEvent event;
+        memcpy(&event, payload, sizeof(event));
+        events++;
+        if (event.type == jma::REC_ALLOC || event.type == jma::REC_FREE) {
+            bool alloc = event.type == jma::REC_ALLOC;
+            int64_t w = (int64_t)1 << event.weight_shift;     // Stratified sampling weight
+            if (event.class_index != jma::NO_INDEX) {
+                Totals& t = classes[event.class_index];
+                (alloc ? t.alloc_count : t.free_count) += w;
+                (alloc ? t.alloc_bytes : t.free_bytes) += event.size * w;
+            }
+            if (event.site_index != jma::NO_INDEX) {
+                Totals& t = sites[event.site_index];
+                (alloc ? t.alloc_count : t.free_count) += w;
+                (alloc ? t.alloc_bytes : t.free_bytes) += event.size * w;
+            }
+        } else if (event.type == jma::REC_GC_FINISH) {
+            gcs++;
+        }
+    }
+};
+
+/**
+ * Totals keyed by name, largest live bytes first, at most k
+ */
+static std::vector<std::pair<std::string, Totals>> top_by_name(
+        const std::unordered_map<std::string, Totals>& merged, size_t k) {
+    std::vector<std::pair<std::string, Totals>> out(merged.begin(), merged.end());
+    auto by_live = [](const std::pair<std::string, Totals>& a, const std::pair<std::string, Totals>& b) {
+        return a.second.live_bytes() > b.second.live_bytes();
+    };
+    if (out.size() > k) {
+        std::partial_sort(out.begin(), out.begin() + k, out.end(), by_live);
+        out.resize(k);
+    } else {
+        std::sort(out.begin(), out.end(), by_live);
+    }
+    return out;
+}
+
+static void merge_by_name(const std::unordered_map<uint32_t, Totals>& totals,
+                          const std::unordered_map<uint32_t, std::string>& names,
+                          std::unordered_map<std::string, Totals>& merged) {
+    for (const auto& e : totals) {
+        auto it = names.find(e.first);
+        merged[it != names.end() ? it->second : "unknown"].merge(e.second);
+    }
+}
+
+// ============================================================================
+// Collector
+// ============================================================================
+
+class Collector {
+private:
+    enum SourceKind { SOURCE_LISTEN, SOURCE_CLIENT, SOURCE_QUERY, SOURCE_WAKE, SOURCE_STREAM };
+
+    struct Source {
+        SourceKind kind;
+        uint32_t pid;           // For JVM sources
+    };
+
+    int epoll_fd = -1;
+    int listen_fd = -1;
+    std::string endpoint;
+    size_t ring_mb;
+    std::unordered_map<uint32_t, std::unique_ptr<Jvm>> jvms;
+    std::unordered_map<int, Source> sources;
+    std::unordered_map<int, std::string> pending_lines;   // Client fd -> partial request
+
+    void watch(int fd, uint32_t events, Source source) {
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0) {
+            sources[fd] = source;
+        }
+    }
+
+    void unwatch(int fd) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        sources.erase(fd);
+    }
+
+    void remove_jvm(uint32_t pid) {
+        auto it = jvms.find(pid);
+        if (it == jvms.end()) {
+            return;
+        }
+        Jvm& jvm = *it->second;
+        if (jvm.query.descriptor() >= 0) unwatch(jvm.query.descriptor());
+        if (jvm.streaming) {
+            unwatch(jvm.stream.wake_descriptor());
+            unwatch(jvm.stream.socket_descriptor());
+        }
+        fprintf(stderr, "jma-collector: pid %u detached (%lld events)\n", pid, (long long)jvm.events);
+        jvms.erase(it);
+    }
+
+    // ------------------------------------------------------------------------
+    // Discovery
+    // ------------------------------------------------------------------------
+
+    void discover() {
+        const char* tmp = getenv("TMPDIR");
+        std::string dir = (tmp && *tmp) ? tmp : "/tmp";
+        DIR* d = opendir(dir.c_str());
+        if (!d) {
+            return;
+        }
+        std::vector<uint32_t> found;
+        while (struct dirent* entry = readdir(d)) {
+            unsigned pid;
+            char tail[8];
+            if (sscanf(entry->d_name, "jma-query-%u.so%7s", &pid, tail) == 2 && strcmp(tail, "ck") == 0) {
+                found.push_back(pid);
+            }
+        }
+        closedir(d);
+
+        for (uint32_t pid : found) {
+            if (pid == (uint32_t)getpid() || kill((pid_t)pid, 0) != 0) {
+                continue;       // Stale socket, or a JVM of another user
+            }
+            auto it = jvms.find(pid);
+            if (it == jvms.end()) {
+                attach(pid);
+            } else if (!it->second->streaming) {
+                attach_stream(*it->second);
+            }
+        }
+    }
+
+    void attach(uint32_t pid) {
+        std::unique_ptr<Jvm> jvm(new Jvm());
+        jvm->pid = pid;
+        jvm->attached_at = now_ms();
+        std::string error;
+        if (!jvm->query.connect(pid, &error, 1000)) {
+            return;
+        }
+
+        // Ask the agent to serve its event stream; it starts listening on
+        // its next service tick, so the stream is attached on a later pass
+        jma::QueryResponseHeader reply;
+        std::vector<char> payload;
+        if (!jvm->query.call(jma::QUERY_START_STREAM, (uint32_t)ring_mb, "", &reply, &payload)) {
+            return;
+        }
+        if (reply.status != jma::QUERY_OK) {
+            fprintf(stderr, "jma-collector: pid %u has no event stream; counters only\n", pid);
+        }
+        watch(jvm->query.descriptor(), EPOLLIN | EPOLLRDHUP, {SOURCE_QUERY, pid});
+        fprintf(stderr, "jma-collector: pid %u attached\n", pid);
+        jvms[pid] = std::move(jvm);
+    }
+
+    void attach_stream(Jvm& jvm) {
+        std::string error;
+        if (!jvm.stream.connect(jvm.pid, &error)) {
+            return;     // Not listening yet, or another consumer is attached
+        }
+        jvm.streaming = true;
+        watch(jvm.stream.wake_descriptor(), EPOLLIN, {SOURCE_WAKE, jvm.pid});
+        watch(jvm.stream.socket_descriptor(), EPOLLIN | EPOLLRDHUP, {SOURCE_STREAM, jvm.pid});
+        drain(jvm);
+    }
+
+    // ------------------------------------------------------------------------
+    // Ingestion
+    // ------------------------------------------------------------------------
+
+    /**
+     * Consume everything in the ring, then arm the eventfd
+     */
+    bool drain(Jvm& jvm) {
+        do {
+            if (!jvm.stream.drain([&](const jma::StreamRecordHeader& rh, const char* payload) {
+                    jvm.on_record(rh, payload);
+                })) {
+                return false;
+            }
+        } while (!jvm.stream.arm());
+        return true;
+    }
+
+    void request_stats() {
+        for (auto& e : jvms) {
+            Jvm& jvm = *e.second;
+            if (jvm.stats_pending || jvm.query.descriptor() < 0) {
+                continue;
+            }
+            jma::QueryRequest request;
+            request.magic = jma::QUERY_MAGIC;
+            request.op = jma::QUERY_STATS;
+            request.reserved = 0;
+            request.arg = 0;
+            request.payload_length = 0;
+            jvm.stats_pending = jma::write_fully(jvm.query.descriptor(), &request, sizeof(request));
+        }
+    }
+
+    bool read_stats(Jvm& jvm) {
+        jma::QueryResponseHeader reply;
+        int fd = jvm.query.descriptor();
+        if (!jma::read_fully(fd, &reply, sizeof(reply)) || reply.magic != jma::QUERY_MAGIC ||
+            reply.payload_length > jma::QUERY_MAX_PAYLOAD) {
+            return false;
+        }
+        std::vector<char> payload((size_t)reply.payload_length);
+        if (!jma::read_fully(fd, payload.data(), payload.size())) {
+            return false;
+        }
+        jvm.stats_pending = false;
+        if (reply.op == jma::QUERY_STATS && reply.status == jma::QUERY_OK) {
+            size_t n = std::min<size_t>(payload.size() / 8, jma::STATS_FIELD_COUNT);
+            memcpy(jvm.stats, payload.data(), n * 8);
+        }
+        return true;
+    }
+
+    // ------------------------------------------------------------------------
+    // Endpoint
+    // ------------------------------------------------------------------------
+
+    void write_stats(JsonWriter& json, const Jvm& jvm) {
+        json.key("pid").value((int64_t)jvm.pid);
+        json.key("streaming").value(jvm.streaming);
+        json.key("streamedEvents").value(jvm.events);
+        json.key("streamedGcs").value(jvm.gcs);
+        json.key("streamDropped").value((int64_t)jvm.stream.dropped());
+        json.key("stats").begin_object();
+        for (int i = 0; i < jma::STATS_FIELD_COUNT; i++) {
+            json.key(STATS_FIELD_NAMES[i]).value(jvm.stats[i]);
+        }
+        json.end_object();
+    }
+
+    static void write_top(JsonWriter& json, const char* key, const char* name_key,
+                          const std::vector<std::pair<std::string, Totals>>& entries) {
+        json.key(key).begin_array();
+        for (const auto& e : entries) {
+            json.begin_object();
+            json.key(name_key).value(e.first);
+            json.key("allocationCount").value(e.second.alloc_count);
+            json.key("totalSize").value(e.second.alloc_bytes);
+            json.key("freedCount").value(e.second.free_count);
+            json.key("freedSize").value(e.second.free_bytes);
+            json.key("liveSize").value(e.second.live_bytes());
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_jvms(JsonWriter& json) {
+        json.key("jvms").begin_array();
+        for (const auto& e : jvms) {
+            json.begin_object();
+            write_stats(json, *e.second);
+            json.end_object();
+        }
+        json.end_array();
+    }
+
+    void write_host(JsonWriter& json, bool sites, bool classes, size_t k) {
+        std::unordered_map<std::string, Totals> merged_sites;
+        std::unordered_map<std::string, Totals> merged_classes;
+        int64_t usage = 0;
+        for (const auto& e : jvms) {
+            if (sites) merge_by_name(e.second->sites, e.second->site_names, merged_sites);
+            if (classes) merge_by_name(e.second->classes, e.second->class_names, merged_classes);
+            usage += e.second->stats[jma::STAT_CURRENT_USAGE];
+        }
+        json.key("jvmCount").value((int64_t)jvms.size());
+        json.key("currentUsage").value(usage);
+        if (sites) write_top(json, "allocationSites", "site", top_by_name(merged_sites, k));
+        if (classes) write_top(json, "classes", "className", top_by_name(merged_classes, k));
+    }
+
+    /**
+     * Answer one request line with a JSON document; false for bad requests
+     */
+    bool answer(const std::string& line, FILE* out) {
+        char command[32] = "summary";
+        long first = 0, second = 0;
+        int fields = sscanf(line.c_str(), "%31s %ld %ld", command, &first, &second);
+
+        JsonWriter json(out);
+        json.begin_object();
+        if (fields <= 0 || strcmp(command, "summary") == 0) {
+            write_host(json, true, true, DEFAULT_TOP);
+            write_jvms(json);
+        } else if (strcmp(command, "jvms") == 0) {
+            write_jvms(json);
+        } else if (strcmp(command, "sites") == 0 || strcmp(command, "classes") == 0) {
+            bool sites = command[0] == 's';
+            write_host(json, sites, !sites, fields >= 2 && first > 0 ? (size_t)first : DEFAULT_TOP);
+        } else if (strcmp(command, "jvm") == 0 && fields >= 2) {
+            auto it = jvms.find((uint32_t)first);
+            if (it == jvms.end()) {
+                json.key("error").value("unknown pid");
+            } else {
+                const Jvm& jvm = *it->second;
+                size_t k = fields >= 3 && second > 0 ? (size_t)second : DEFAULT_TOP;
+                std::unordered_map<std::string, Totals> merged_sites;
+                std::unordered_map<std::string, Totals> merged_classes;
+                merge_by_name(jvm.sites, jvm.site_names, merged_sites);
+                merge_by_name(jvm.classes, jvm.class_names, merged_classes);
+                write_stats(json, jvm);
+                write_top(json, "allocationSites", "site", top_by_name(merged_sites, k));
+                write_top(json, "classes", "className", top_by_name(merged_classes, k));
+            }
+        } else {
+            json.key("error").value("unknown request");
+        }
+        json.end_object();
+        json.finish();
+        return true;
+    }
+
+    void serve_client(int fd) {
+        char buf[MAX_REQUEST_LINE];
+        ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+        std::string& line = pending_lines[fd];
+        if (n > 0) {
+            line.append(buf, (size_t)n);
+        }
+        size_t newline = line.find('\n');
+        if (n > 0 && newline == std::string::npos && line.size() < MAX_REQUEST_LINE) {
+            return;     // Wait for the rest of the line
+        }
+        if (newline != std::string::npos) {
+            line.resize(newline);
+        }
+
+        char* text = nullptr;
+        size_t size = 0;
+        FILE* out = open_memstream(&text, &size);
+        if (out) {
+            answer(line, out);
+            fclose(out);
+            jma::write_fully(fd, text, size);
+            free(text);
+        }
+        pending_lines.erase(fd);
+        unwatch(fd);
+        close(fd);
+    }
+
+    bool listen_endpoint() {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (endpoint.size() >= sizeof(addr.sun_path)) {
+            return false;
+        }
+        memcpy(addr.sun_path, endpoint.c_str(), endpoint.size() + 1);
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0) {
+            return false;
+        }
+        unlink(endpoint.c_str());
+        if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0) {
+            close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        chmod(endpoint.c_str(), 0600);
+        watch(listen_fd, EPOLLIN, {SOURCE_LISTEN, 0});
+        return true;
+    }
+
+    void dispatch(const struct epoll_event& ev) {
+        auto it = sources.find(ev.data.fd);
+        if (it == sources.end()) {
+            return;
+        }
+        Source source = it->second;
+
+        if (source.kind == SOURCE_LISTEN) {
+            int fd;
+            while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+                watch(fd, EPOLLIN | EPOLLRDHUP, {SOURCE_CLIENT, 0});
+            }
+            return;
+        }
+        if (source.kind == SOURCE_CLIENT) {
+            serve_client(ev.data.fd);
+            return;
+        }
+
+        auto jit = jvms.find(source.pid);
+        if (jit == jvms.end()) {
+            return;
+        }
+        Jvm& jvm = *jit->second;
+        switch (source.kind) {
+            case SOURCE_QUERY:
+                if ((ev.events & (EPOLLHUP | EPOLLRDHUP | EPOLLERR)) || !read_stats(jvm)) {
+                    remove_jvm(jvm.pid);
+                }
+                break;
+            case SOURCE_WAKE:
+                jvm.stream.consume_wakeup();
+                if (!drain(jvm)) {
+                    remove_jvm(jvm.pid);
+                }
+                break;
+            case SOURCE_STREAM:
+                if (jvm.stream.hung_up()) {
+                    // Agent stopped the stream (or exited): keep what was
+                    // collected if the query server is still up
+                    drain(jvm);
+                    unwatch(jvm.stream.wake_descriptor());
+                    unwatch(jvm.stream.socket_descriptor());
+                    jvm.stream.close();
+                    jvm.streaming = false;
+                    if (kill((pid_t)jvm.pid, 0) != 0) {
+                        remove_jvm(jvm.pid);
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+public:
+    Collector(const std::string& endpoint_path, size_t ring) : endpoint(endpoint_path), ring_mb(ring) {}
+
+    ~Collector() {
+        jvms.clear();
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            unlink(endpoint.c_str());
+        }
+        if (epoll_fd >= 0) {
+            close(epoll_fd);
+        }
+    }
+
+    bool start() {
+        epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        if (epoll_fd < 0) {
+            fprintf(stderr, "jma-collector: epoll_create1 failed: %s\n", strerror(errno));
+            return false;
+        }
+        if (!listen_endpoint()) {
+            fprintf(stderr, "jma-collector: cannot listen on %s\n", endpoint.c_str());
+            return false;
+        }
+        fprintf(stderr, "jma-collector: serving on %s\n", endpoint.c_str());
+        return true;
+    }
+
+    void run(int64_t discover_ms, int64_t stats_ms) {
+        int64_t next_discover = 0;
+        int64_t next_stats = 0;
+        struct epoll_event events[MAX_EPOLL_EVENTS];
+
+        while (!g_stop) {
+            int64_t now = now_ms();
+            if (now >= next_discover) {
+                discover();
+                next_discover = now + discover_ms;
+            }
+            if (now >= next_stats) {
+                request_stats();
+                next_stats = now + stats_ms;
+            }
+
+            int timeout = (int)std::max<int64_t>(0, std::min(next_discover, next_stats) - now_ms());
+            int n = epoll_wait(epoll_fd, events, MAX_EPOLL_EVENTS, timeout);
+            for (int i = 0; i < n; i++) {
+                dispatch(events[i]);
+            }
+        }
+    }
+};
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static void on_signal(int) {
+    g_stop = 1;
+}
+
+static void usage() {
+    fprintf(stderr,
+            "Usage: jma-collector [-s socket] [-m ring_mb] [-d discover_ms] [-p stats_ms]\n"
+            "       Query: echo \"summary|jvms|sites [k]|classes [k]|jvm <pid> [k]\" | socat - UNIX:<socket>\n");
+}
+
+int main(int argc, char** argv) {
+    const char* tmp = getenv("TMPDIR");
+    std::string endpoint = std::string((tmp && *tmp) ? tmp : "/tmp");
+    if (endpoint.back() != '/') endpoint += '/';
+    endpoint += "jma-collector.sock";
+    size_t ring_mb = DEFAULT_RING_MB;
+    int64_t discover_ms = DEFAULT_DISCOVER_MS;
+    int64_t stats_ms = DEFAULT_STATS_MS;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "-s") == 0 && i + 1 < argc) {
+            endpoint = argv[++i];
+        } else if (strcmp(arg, "-m") == 0 && i + 1 < argc) {
+            ring_mb = (size_t)atol(argv[++i]);
+        } else if (strcmp(arg, "-d") == 0 && i + 1 < argc) {
+            discover_ms = atoll(argv[++i]);
+        } else if (strcmp(arg, "-p") == 0 && i + 1 < argc) {
+            stats_ms = atoll(argv[++i]);
+        } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            usage();
+            return 0;
+        } else {
+            usage();
+            return 2;
+        }
+    }
+    if (ring_mb == 0) ring_mb = DEFAULT_RING_MB;
+    if (discover_ms <= 0) discover_ms = DEFAULT_DISCOVER_MS;
+    if (stats_ms <= 0) stats_ms = DEFAULT_STATS_MS;
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    Collector collector(endpoint, ring_mb);
+    if (!collector.start()) {
+        return 1;
+    }
+    collector.run(discover_ms, stats_ms);
+    return 0;
+}
@@ -0,0 +1,108 @@
+/**
+ * JSON Writer - Java Memory Analyzer
+ *
+ * Streaming JSON writer shared by the native tools (jma-analyzer,
+ * jma-collector). Output matches the Java reports' Gson pretty printing.
+ *
+ * @author Java Memory Analyzer Team
+ * @version 1.0.0
+ */
+
+#ifndef JMA_JSON_WRITER_H
+#define JMA_JSON_WRITER_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+namespace jma {
+
+/**
+ * Minimal streaming JSON writer producing Gson-style pretty output
+ * (two-space indent, HTML-safe escaping)
+ */
+class JsonWriter {
+private:
+    FILE* out;
+    std::vector<bool> first;   // Per nesting level: no element written yet
+    bool after_key = false;
+
+    void indent() {
+        fputc('\n', out);
+        for (size_t i = 0; i < first.size(); i++) fputs("  ", out);
+    }
+
+    void before_value() {
+        if (after_key) {
+            after_key = false;
+            return;
+        }
+        if (!first.empty()) {
+            if (!first.back()) fputc(',', out);
+            first.back() = false;
+            indent();
+        }
+    }
+
+    void write_string(const std::string& s) {
+        fputc('"', out);
+        for (unsigned char c : s) {
+            switch (c) {
+                case '"': fputs("\\\"", out); break;
+                case '\\': fputs("\\\\", out); break;
+                case '\n': fputs("\\n", out); break;
+                case '\r': fputs("\\r", out); break;
+                case '\t': fputs("\\t", out); break;
+                case '<': case '>': case '&': case '=': case '\'':
+                    fprintf(out, "\\u%04x", c);
+                    break;
+                default:
+                    if (c < 0x20) fprintf(out, "\\u%04x", c);
+                    else fputc(c, out);
+            }
+        }
+        fputc('"', out);
+    }
+
+    void open(char c) {
+        before_value();
+        fputc(c, out);
+        first.push_back(true);
+    }
+
+    void close(char c) {
+        bool empty = first.back();
+        first.pop_back();
+        if (!empty) indent();
+        fputc(c, out);
+    }
+
+public:
+    explicit JsonWriter(FILE* f) : out(f) {}
+
+    void begin_object() { open('{'); }
+    void end_object() { close('}'); }
+    void begin_array() { open('['); }
+    void end_array() { close(']'); }
+
+    JsonWriter& key(const char* k) {
+        before_value();
+        write_string(k);
+        fputs(": ", out);
+        after_key = true;
+        return *this;
+    }
+
+    void value(const std::string& v) { before_value(); write_string(v); }
+    void value(const char* v) { before_value(); write_string(v); }
+    void value(int64_t v) { before_value(); fprintf(out, "%lld", (long long)v); }
+    void value(bool v) { before_value(); fputs(v ? "true" : "false", out); }
+
+    void finish() { fputc('\n', out); }
+};
+
+} // namespace jma
+
+#endif // JMA_JSON_WRITER_H
@@ -17,6 +17,13 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <signal.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include <unordered_map>
 #include <vector>
@@ -28,6 +35,18 @@
 #include <queue>
 #include <thread>
 #include <fstream>
+#include <deque>
+#include <map>
+#include <memory>
+
+#include "recording_format.h"
+#include "stats_page.h"
+#include "event_stream.h"
+#include "query_protocol.h"
+
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
 
 // ============================================================================
 // Configuration
@@ -36,29 +55,78 @@
 #define MAX_STACK_DEPTH 128
 #define EVENT_QUEUE_SIZE 65536
 #define ALLOCATION_HASH_SIZE 1000003
+#define TRACKER_SLAB_RECORDS 65536      // Tracked object records per slab page (2 MB)
+#define TRACKER_MAX_PAGES 4096          // Slab pages (268M tracked objects)
+#define TRACKER_SITE_SLOTS (1 << 20)    // Site hashes referenced by tracked objects (power of two)
+#define TRACKER_AGE_GENERATIONS 256     // Age index generations (see AllocationTracker)
+#define TRACKER_AGE_GRANULE_MS 1000     // Time span of a new generation
 #define ENABLE_SAMPLING 1
 #define SAMPLING_INTERVAL 10  // Sample every Nth allocation
+#define MAX_TRACKED_CLASSES 65536
+#define CLASS_TAG_BIT ((jlong)1 << 62)  // Tags with this bit set identify classes
+#define SITE_HASH_DEPTH 8               // Frames hashed into an allocation site id
+#define RECORDING_CHUNK_EVENTS 262144   // Seal a recording chunk after N events
+#define RECORDING_CHUNK_MS 10000        // ... or after this many milliseconds
+#define FLIGHT_BLOCK_SIZE 65536         // Flight recorder ring block (bytes)
+#define FLIGHT_MAX_RECORD 64            // Upper bound of one encoded event
+#define FLIGHT_HEAP_REARM_PERCENT 5     // Heap trigger re-arms this far below the threshold
+#define OOM_REPORT_BUFFER (1024 * 1024) // Preallocated OOM report text buffer
+#define OOM_SITE_SLOTS 16384            // Open-addressed site table for the OOM report
+#define OOM_TOP_CLASSES 100
+#define OOM_TOP_SITES 50
+#define OOM_RECENT_EVENTS 256
+#define OOM_MAX_REPORTS 3               // Per process
+#define OOM_BUDGET_MS 2000              // Time budget for walking the tracker
+#define FREE_BATCH_CAPACITY 262144      // Tags buffered per free batch (two batches)
+#define FREE_DRAIN_MS 100               // Drain late ObjectFree tags at least this often
+#define TS_LEVELS 4                     // Time-series resolutions (see TS_LEVEL_SPEC)
+#define GC_TIMELINE_CYCLES 1024         // GC cycles kept by the timeline
+#define GC_TOP_SITES 5                  // Allocation sites attributed to each cycle
+#define GC_ROW_WIDTH (8 + 3 * GC_TOP_SITES)  // jlongs per cycle in getGcCycles
+#define OOM_GC_CYCLES 32
+#define LIFETIME_WALL_BUCKETS 32        // <1ms, then [2^(i-1), 2^i) ms
+#define LIFETIME_GC_BUCKETS 16          // 0 GCs, then [2^(i-1), 2^i) GCs survived
+#define CHURN_ROW_WIDTH 7               // jlongs per site in getChurnSites
+#define OLD_OBJECT_ROW_WIDTH 5          // jlongs per class / site group in getOldObjects
+#define TREND_DEFAULT_WINDOW 10         // Checkpoints per class trend window
+#define TREND_MAX_WINDOW 256
+#define TREND_MIN_INTERVAL_MS 1000      // GC checkpoints at most this often
+#define TREND_PERIOD_MS 10000           // ... and at least this often without GCs
+#define TREND_EWMA_ALPHA 0.25           // Weight of the newest growth rate
+#define TREND_ROW_WIDTH 11              // jlongs per class in getClassTrends
+#define STREAM_DEFAULT_MB 16            // Event stream ring size
+#define STREAM_SERVICE_MS 100           // Accept / hang-up check interval
+#define STREAM_MAX_NAME 4096            // Longer class / site names are truncated (bytes)
+#define QUERY_MAX_CLIENTS 16            // Concurrent query server connections
+#define QUERY_DEFAULT_TOP 20
+#define FILTER_MAX_STACK_TERMS 64       // stack: predicates per filter (method verdict bits)
+#define GOVERNOR_PERIOD_MS 1000         // Overhead measurement period
+#define GOVERNOR_PROBE_EVERY 64         // Callbacks timed: 1 in N per thread (power of two)
+#define GOVERNOR_MIN_PROCESS_CPU_MS 20  // Periods with less process CPU are not judged
+#define GOVERNOR_MAX_INTERVAL 65536     // Sampling interval ceiling
+#define STRATIFIED_WINDOW_MS 1000       // Per-class sampling rates adapt this often
+#define STRATIFIED_MAX_SHIFT 16         // Per-class interval ceiling (2^16)
+#define FRAME_ARENA_BLOCK 65536         // Per-thread arena block for queued stacks (bytes)
+#define FRAME_CACHE_METHODS 65536       // Methods whose frame text is cached
 
 // ============================================================================
 // Data Structures
 // ============================================================================
 
 /**
- * Allocation information for each tracked object
+ * Allocation information for each tracked object (stored packed by
+ * AllocationTracker)
  */
 struct AllocationInfo {
     jlong size;
     jlong timestamp;
-    jclass klass;
-    jobject thread;
-    jvmtiFrameInfo* frames;
-    jint frame_count;
-    uint64_t thread_id;
-    uint32_t hash;
+    uint32_t class_id;
+    uint64_t site_hash;
+    uint32_t gc_epoch;          // GC cycles started before the allocation
+    uint8_t weight_shift;       // Stratified sampling weight (log2)
 
-    AllocationInfo() : size(0), timestamp(0), klass(nullptr),
-                       thread(nullptr), frames(nullptr), frame_count(0),
-                       thread_id(0), hash(0) {}
+    AllocationInfo() : size(0), timestamp(0), class_id(0), site_hash(0), gc_epoch(0),
+                       weight_shift(0) {}
 };
 
 /**
@@ -80,614 +148,6129 @@ struct AllocationEvent {
     jlong tag;
     jlong size;
     jlong timestamp;
-    jclass klass;
-    jthread thread;
+    jlong alloc_timestamp;      // For EVENT_FREE: when the object was allocated
+    uint32_t class_id;
+    uint64_t site_hash;
     jvmtiFrameInfo* frames;
     jint frame_count;
     uint64_t thread_id;
+    uint32_t gcs_survived;      // For EVENT_FREE: GC cycles the object survived
+    uint32_t gc_epoch;          // For EVENT_GC_START / EVENT_GC_FINISH: the cycle's epoch
+    uint8_t weight_shift;       // Stands for 2^weight_shift allocations (StratifiedSampler)
 
     AllocationEvent() : type(EVENT_ALLOC), tag(0), size(0), timestamp(0),
-                        klass(nullptr), thread(nullptr), frames(nullptr),
-                        frame_count(0), thread_id(0) {}
+                        alloc_timestamp(0), class_id(0), site_hash(0),
+                        frames(nullptr), frame_count(0), thread_id(0), gcs_survived(0),
+                        gc_epoch(0), weight_shift(0) {}
 };
 
 /**
  * Lock-free ring buffer for event queue
  * 无锁环形缓冲区（Ring Buffer）
+ *
+ * Multi-producer (any allocating thread), single-consumer (the event
+ * processor thread). Each slot carries a sequence number so producers
+ * claim slots with a CAS and the consumer never sees a half-written event.
+ *
+ * The slots are mapped by reserve() when the agent activates, so a dormant
+ * agent does not pay for them; until then push() drops and pop() is empty.
  */
 class EventQueue {
 private:
-    AllocationEvent buffer[EVENT_QUEUE_SIZE];
+    struct Slot {
+        std::atomic<size_t> sequence;
+        AllocationEvent event;
+    };
+
+    Slot* buffer = nullptr;
     std::atomic<size_t> head{0};
     std::atomic<size_t> tail{0};
-    std::atomic<size_t> count{0};
+    std::atomic<uint64_t> dropped{0};
 
 public:
+    /**
+     * Map and initialize the slots (once, before any producer runs)
+     */
+    bool reserve() {
+        if (buffer) {
+            return true;
+        }
+        void* mapping = mmap(nullptr, sizeof(Slot) * EVENT_QUEUE_SIZE, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        Slot* slots = (Slot*)mapping;
+        for (size_t i = 0; i < EVENT_QUEUE_SIZE; i++) {
+            new (&slots[i]) Slot();
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        buffer = slots;
+        return true;
+    }
+
     bool push(const AllocationEvent& event) {
-        size_t current_tail = tail.load(std::memory_order_relaxed);
-        size_t next_tail = (current_tail + 1) % EVENT_QUEUE_SIZE;
+        if (!buffer) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        size_t pos = tail.load(std::memory_order_relaxed);
+        Slot* slot;
+
+        for (;;) {
+            slot = &buffer[pos % EVENT_QUEUE_SIZE];
+            size_t seq = slot->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
 
-        if (next_tail == head.load(std::memory_order_acquire)) {
-            return false; // Queue full
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return false; // Queue full
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
         }
 
-        buffer[current_tail] = event;
-        tail.store(next_tail, std::memory_order_release);
-        count.fetch_add(1, std::memory_order_relaxed);
+        slot->event = event;
+        slot->sequence.store(pos + 1, std::memory_order_release);
         return true;
     }
 
     bool pop(AllocationEvent& event) {
-        size_t current_head = head.load(std::memory_order_relaxed);
+        if (!buffer) {
+            return false;
+        }
+        size_t pos = head.load(std::memory_order_relaxed);
+        Slot& slot = buffer[pos % EVENT_QUEUE_SIZE];
 
-        if (current_head == tail.load(std::memory_order_acquire)) {
-            return false; // Queue empty
+        if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+            return false; // Queue empty (or next slot still being written)
         }
 
-        event = buffer[current_head];
-        head.store((current_head + 1) % EVENT_QUEUE_SIZE, std::memory_order_release);
-        count.fetch_sub(1, std::memory_order_relaxed);
+        event = slot.event;
+        slot.sequence.store(pos + EVENT_QUEUE_SIZE, std::memory_order_release);
+        head.store(pos + 1, std::memory_order_release);
         return true;
     }
 
     size_t size() const {
-        return count.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t h = head.load(std::memory_order_relaxed);
+        return t > h ? t - h : 0;
     }
 
     bool empty() const {
         return head.load(std::memory_order_relaxed) ==
                tail.load(std::memory_order_relaxed);
     }
+
+    uint64_t get_dropped() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Copy up to max of the newest queued events without consuming them.
+     * Best effort (for diagnostics): a slot consumed or reused while being
+     * copied is skipped. Frame pointers in the copies must not be used.
+     */
+    size_t peek_recent(AllocationEvent* out, size_t max) const {
+        if (!buffer) {
+            return 0;
+        }
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t h = head.load(std::memory_order_acquire);
+        size_t start = (t > h && t - h > max) ? t - max : h;
+        size_t n = 0;
+        for (size_t pos = start; pos < t && n < max; pos++) {
+            const Slot& slot = buffer[pos % EVENT_QUEUE_SIZE];
+            if (slot.sequence.load(std::memory_order_acquire) != pos + 1) {
+                continue;
+            }
+            out[n] = slot.event;
+            if (slot.sequence.load(std::memory_order_acquire) == pos + 1) {
+                out[n].frames = nullptr;
+                n++;
+            }
+        }
+        return n;
+    }
 };
 
 /**
  * Thread-safe allocation tracker
+ *
+ * Tracked objects are packed 32-byte records, two per cache line, kept in
+ * slab pages of TRACKER_SLAB_RECORDS records that are mapped as needed and
+ * unmapped together by clear(). Records are addressed by 32-bit index (0 =
+ * none): bucket heads, hash chains and the free list are indices, so 10M
+ * tracked objects take about 320 MB plus the 4 MB bucket array, and scans
+ * stream through the pages instead of chasing chains. The age list links
+ * live in a parallel page of 8-byte entries per slab page (another 80 MB
+ * per 10M objects), so scans that never follow them keep the dense records.
+ *
+ * A record stores the class id, the index of its site hash in an open-
+ * addressed table (TRACKER_SITE_SLOTS; a site that does not fit is recorded
+ * as unknown), the size in 8-byte units and the allocation time in ms
+ * relative to the newest tracked allocation (exact up to 49 days apart).
+ *
+ * Scans run on a snapshot instead of under the lock (visit_bounded). Opening
+ * a snapshot takes the lock once to record the slab high-water mark and
+ * start a snapshot epoch. During the epoch, records below the mark do not
+ * change: freed records are unlinked from their chains but keep their
+ * contents and go to a retired list, and new records come from fresh slab
+ * space only. The reader therefore sees exactly the objects tracked when it
+ * opened, while producers insert and remove without waiting for it. Retired
+ * records are reclaimed in bulk when the epoch closes. One snapshot is open
+ * at a time; other readers wait for it, producers never do.
+ *
+ * Live records are also indexed by age: each belongs to one of at most
+ * TRACKER_AGE_GENERATIONS generations, a time range with a circular
+ * doubly-linked list (through a sentinel record, tag 0) in insertion
+ * order. A record joins the generation covering its allocation time and
+ * leaves its list in O(1) when released. A new generation spans
+ * TRACKER_AGE_GRANULE_MS; when all are in use, the adjacent pair whose
+ * combined span is smallest relative to its age is spliced together, so
+ * spans grow with age. "Objects older than T" (visit_older) and "evict
+ * the oldest K" (evict_oldest) walk only the generations they need: cost
+ * is the result plus the one generation straddling T.
+ *
+ * The bucket array and site table are mapped by reserve() when the agent
+ * activates; the kernel supplies their zero pages as they are first used.
+ * track() must not run before reserve(); the other operations see an empty
+ * table.
  */
 class AllocationTracker {
 private:
-    struct HashEntry {
-        jlong tag;
-        AllocationInfo info;
-        HashEntry* next;
+    struct alignas(32) Record {
+        jlong tag;                  // 0 = free record (or generation sentinel)
+        uint32_t next;              // Chain or free list link (record index)
+        uint32_t size_units;        // Size / 8, saturating
+        uint32_t site;              // Site table slot + 1 (0 = no site)
+        uint32_t time;              // Allocation time - base_time (ms, mod 2^32)
+        uint32_t gc_epoch;
+        uint16_t class_id;
+        uint8_t weight_shift;
+        uint8_t reserved;
+    };
+
+    static_assert(sizeof(Record) == 32, "Record layout");
+    static_assert(MAX_TRACKED_CLASSES <= 65536, "class ids are stored in 16 bits");
+
+    /**
+     * Age list links of the record with the same index
+     */
+    struct AgeLinks {
+        uint32_t older;
+        uint32_t newer;
+    };
 
-        HashEntry() : tag(0), next(nullptr) {}
+    /**
+     * Allocation times [start, next generation's start), or [start, end)
+     * for the newest
+     */
+    struct Generation {
+        jlong start;
+        jlong end;
+        uint32_t sentinel;          // List head: newer = oldest record, older = newest
     };
 
-    HashEntry* buckets[ALLOCATION_HASH_SIZE];
+    uint32_t* buckets = nullptr;
+    uint64_t* site_hashes = nullptr;
+    Generation generations[TRACKER_AGE_GENERATIONS];   // Oldest first
+    uint32_t generation_count = 0;
+    bool sentinels_ready = false;
+    Record* pages[TRACKER_MAX_PAGES] = {};
+    AgeLinks* link_pages[TRACKER_MAX_PAGES] = {};
+    uint32_t page_count = 0;
+    uint32_t high_water = 1;        // Next never-used record index (0 is reserved)
+    uint32_t free_list = 0;
+    uint32_t retired = 0;           // Records freed during the open snapshot (linked by next)
+    bool snapshot_open = false;
+    std::mutex snapshot_mutex;      // Held by the snapshot reader
+    std::vector<Record> older_buffer;   // visit_older copies, reused
+    std::mutex older_mutex;         // Held by the visit_older caller
+    jlong base_time = 0;            // Record times are relative to this
+    jlong latest_time = 0;          // Newest tracked allocation
     std::mutex mutex;
     std::atomic<uint64_t> total_allocated{0};
     std::atomic<uint64_t> total_freed{0};
     std::atomic<uint64_t> current_usage{0};
     std::atomic<uint64_t> alloc_count{0};
     std::atomic<uint64_t> free_count{0};
+    std::atomic<uint64_t> evicted_count{0};
 
     uint32_t hash_tag(jlong tag) {
         return (uint32_t)(tag ^ (tag >> 32)) % ALLOCATION_HASH_SIZE;
     }
 
-public:
-    AllocationTracker() {
-        memset(buckets, 0, sizeof(buckets));
+    Record& record(uint32_t index) {
+        return pages[index / TRACKER_SLAB_RECORDS][index % TRACKER_SLAB_RECORDS];
     }
 
-    void track(jlong tag, const AllocationInfo& info) {
-        std::lock_guard<std::mutex> lock(mutex);
-
-        uint32_t h = hash_tag(tag);
-        HashEntry* entry = new HashEntry();
-        entry->tag = tag;
-        entry->info = info;
-        entry->next = buckets[h];
-        buckets[h] = entry;
-
-        total_allocated.fetch_add(info.size, std::memory_order_relaxed);
-        current_usage.fetch_add(info.size, std::memory_order_relaxed);
-        alloc_count.fetch_add(1, std::memory_order_relaxed);
+    AgeLinks& links(uint32_t index) {
+        return link_pages[index / TRACKER_SLAB_RECORDS][index % TRACKER_SLAB_RECORDS];
     }
 
-    bool untrack(jlong tag, AllocationInfo& info) {
-        std::lock_guard<std::mutex> lock(mutex);
-
-        uint32_t h = hash_tag(tag);
-        HashEntry* prev = nullptr;
-        HashEntry* curr = buckets[h];
+    static void* map_zeroed(size_t bytes) {
+        void* mapping = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return mapping == MAP_FAILED ? nullptr : mapping;
+    }
 
-        while (curr) {
-            if (curr->tag == tag) {
-                if (prev) {
-                    prev->next = curr->next;
-                } else {
-                    buckets[h] = curr->next;
-                }
+    /**
+     * A free record index (reused first, then from the slab), or 0 when full
+     */
+    uint32_t allocate_record() {
+        if (free_list != 0 && !snapshot_open) {
+            uint32_t index = free_list;
+            free_list = record(index).next;
+            return index;
+        }
+        uint32_t page = high_water / TRACKER_SLAB_RECORDS;
+        if (page >= page_count) {
+            if (page >= TRACKER_MAX_PAGES) {
+                return 0;
+            }
+            void* mapping = map_zeroed(sizeof(Record) * TRACKER_SLAB_RECORDS);
+            if (!mapping) {
+                return 0;
+            }
+            void* link_mapping = map_zeroed(sizeof(AgeLinks) * TRACKER_SLAB_RECORDS);
+            if (!link_mapping) {
+                munmap(mapping, sizeof(Record) * TRACKER_SLAB_RECORDS);
+                return 0;
+            }
+            pages[page] = (Record*)mapping;
+            link_pages[page] = (AgeLinks*)link_mapping;
+            page_count = page + 1;
+        }
+        return high_water++;
+    }
 
-                info = curr->info;
-                total_freed.fetch_add(info.size, std::memory_order_relaxed);
-                current_usage.fetch_sub(info.size, std::memory_order_relaxed);
-                free_count.fetch_add(1, std::memory_order_relaxed);
+    void release_record(uint32_t index) {
+        Record& r = record(index);
+        AgeLinks& l = links(index);
+        links(l.older).newer = l.newer;
+        links(l.newer).older = l.older;
+        if (snapshot_open) {
+            // Keep the contents for the snapshot reader; reclaimed when it closes
+            r.next = retired;
+            retired = index;
+            return;
+        }
+        r.tag = 0;
+        r.next = free_list;
+        free_list = index;
+    }
 
-                delete curr;
-                return true;
+    /**
+     * Take the generation sentinels from the start of an empty slab
+     */
+    bool prepare_sentinels() {
+        for (uint32_t i = 0; i < TRACKER_AGE_GENERATIONS; i++) {
+            uint32_t index = allocate_record();
+            if (index == 0) {
+                return false;
             }
-            prev = curr;
-            curr = curr->next;
+            record(index).tag = 0;
+            links(index).older = links(index).newer = index;
+            generations[i].sentinel = index;
         }
-        return false;
+        generation_count = 0;
+        sentinels_ready = true;
+        return true;
     }
 
-    AllocationInfo* find(jlong tag) {
-        std::lock_guard<std::mutex> lock(mutex);
+    bool generation_empty(uint32_t g) {
+        uint32_t sentinel = generations[g].sentinel;
+        return links(sentinel).newer == sentinel;
+    }
 
-        uint32_t h = hash_tag(tag);
-        HashEntry* curr = buckets[h];
+    jlong generation_upper(uint32_t g) const {
+        return g + 1 < generation_count ? generations[g + 1].start : generations[g].end;
+    }
 
-        while (curr) {
-            if (curr->tag == tag) {
-                return &curr->info;
-            }
-            curr = curr->next;
+    /**
+     * Remove generation g (its list must be empty), recycling its sentinel
+     */
+    void drop_generation(uint32_t g) {
+        uint32_t sentinel = generations[g].sentinel;
+        if (g > 0) {
+            generations[g - 1].end = generations[g].end;    // Still bounds its records
         }
-        return nullptr;
+        memmove(&generations[g], &generations[g + 1], sizeof(Generation) * (generation_count - g - 1));
+        generation_count--;
+        generations[generation_count].sentinel = sentinel;
     }
 
-    uint64_t get_total_allocated() const { return total_allocated.load(); }
-    uint64_t get_total_freed() const { return total_freed.load(); }
-    uint64_t get_current_usage() const { return current_usage.load(); }
-    uint64_t get_alloc_count() const { return alloc_count.load(); }
-    uint64_t get_free_count() const { return free_count.load(); }
-
-    void get_snapshot(std::vector<std::pair<jlong, AllocationInfo>>& snapshot) {
-        std::lock_guard<std::mutex> lock(mutex);
+    /**
+     * Append generation g + 1's list to generation g's and drop g + 1
+     */
+    void merge_generations(uint32_t g) {
+        AgeLinks& into = links(generations[g].sentinel);
+        AgeLinks& from = links(generations[g + 1].sentinel);
+        if (from.newer != generations[g + 1].sentinel) {
+            links(into.older).newer = from.newer;
+            links(from.newer).older = into.older;
+            links(from.older).newer = generations[g].sentinel;
+            into.older = from.older;
+            from.older = from.newer = generations[g + 1].sentinel;
+        }
+        generations[g].end = generations[g + 1].end;
+        drop_generation(g + 1);
+    }
 
-        for (int i = 0; i < ALLOCATION_HASH_SIZE; i++) {
-            HashEntry* curr = buckets[i];
-            while (curr) {
-                snapshot.push_back({curr->tag, curr->info});
-                curr = curr->next;
+    /**
+     * Start a generation for time: drop empty ones, and when all are in
+     * use merge the pair with the smallest span relative to its age
+     */
+    void open_generation(jlong time) {
+        for (uint32_t g = generation_count; g-- > 0;) {
+            if (generation_empty(g)) {
+                drop_generation(g);
+            }
+        }
+        if (generation_count == TRACKER_AGE_GENERATIONS) {
+            uint32_t best = 0;
+            double best_score = 0;
+            for (uint32_t g = 0; g + 1 < generation_count; g++) {
+                double span = (double)(generation_upper(g + 1) - generations[g].start);
+                double age = (double)(time - generations[g].start) + 1;
+                if (g == 0 || span / age < best_score) {
+                    best = g;
+                    best_score = span / age;
+                }
             }
+            merge_generations(best);
         }
+        Generation& fresh = generations[generation_count++];
+        fresh.start = time - time % TRACKER_AGE_GRANULE_MS;
+        fresh.end = fresh.start + TRACKER_AGE_GRANULE_MS;
     }
 
-    void clear() {
-        std::lock_guard<std::mutex> lock(mutex);
+    /**
+     * Append a record to the generation covering its allocation time
+     */
+    void link_age(uint32_t index, jlong time) {
+        if (generation_count == 0 || time >= generations[generation_count - 1].end) {
+            open_generation(time);
+        }
+        uint32_t g = generation_count - 1;
+        while (g > 0 && time < generations[g].start) {
+            g--;
+        }
+        if (time < generations[g].start) {
+            generations[g].start = time;
+        }
+        uint32_t sentinel = generations[g].sentinel;
+        AgeLinks& l = links(index);
+        l.newer = sentinel;
+        l.older = links(sentinel).older;
+        links(l.older).newer = index;
+        links(sentinel).older = index;
+    }
 
-        for (int i = 0; i < ALLOCATION_HASH_SIZE; i++) {
-            HashEntry* curr = buckets[i];
-            while (curr) {
-                HashEntry* next = curr->next;
-                delete curr;
-                curr = next;
+    /**
+     * Slot + 1 of hash in the site table (inserting it), or 0
+     */
+    uint32_t site_index(uint64_t hash) {
+        if (hash == 0) {
+            return 0;
+        }
+        uint32_t slot = (uint32_t)(hash ^ (hash >> 32)) & (TRACKER_SITE_SLOTS - 1);
+        for (int probe = 0; probe < 32; probe++) {
+            if (site_hashes[slot] == hash) {
+                return slot + 1;
+            }
+            if (site_hashes[slot] == 0) {
+                site_hashes[slot] = hash;
+                return slot + 1;
             }
-            buckets[i] = nullptr;
+            slot = (slot + 1) & (TRACKER_SITE_SLOTS - 1);
         }
+        return 0;
     }
-};
 
-// ============================================================================
-// Global State
-// ============================================================================
+    void pack(Record& r, jlong tag, const AllocationInfo& info) {
+        r.tag = tag;
+        r.size_units = (uint32_t)std::min<jlong>((info.size + 7) / 8, UINT32_MAX);
+        r.site = site_index(info.site_hash);
+        r.time = (uint32_t)(info.timestamp - base_time);
+        r.gc_epoch = info.gc_epoch;
+        r.class_id = (uint16_t)info.class_id;
+        r.weight_shift = info.weight_shift;
+        r.reserved = 0;
+    }
 
-static jvmtiEnv* g_jvmti = nullptr;
-static JNIEnv* g_jni_env = nullptr;
-static JavaVM* g_java_vm = nullptr;
-static AllocationTracker g_tracker;
-static EventQueue g_event_queue;
+    void unpack(const Record& r, AllocationInfo& info, jlong latest) const {
+        info.size = (jlong)r.size_units * 8;
+        info.timestamp = latest - (jlong)(uint32_t)((uint32_t)(latest - base_time) - r.time);
+        info.class_id = r.class_id;
+        info.site_hash = r.site ? site_hashes[r.site - 1] : 0;
+        info.gc_epoch = r.gc_epoch;
+        info.weight_shift = r.weight_shift;
+    }
 
-// Java class and method references for JNI callback
-static jclass g_heap_analyzer_class = nullptr;
-static jmethodID g_on_object_alloc_method = nullptr;
+    /**
+     * Unlink the record of tag from its chain; 0 if not tracked
+     */
+    uint32_t unlink(jlong tag) {
+        uint32_t* link = &buckets[hash_tag(tag)];
+        while (*link != 0) {
+            Record& r = record(*link);
+            if (r.tag == tag) {
+                uint32_t index = *link;
+                *link = r.next;
+                return index;
+            }
+            link = &r.next;
+        }
+        return 0;
+    }
 
-static std::atomic<bool> g_agent_active{true};
-static std::atomic<bool> g_sampling_enabled{true};
-static std::atomic<int> g_sampling_interval{10};
-static std::atomic<uint64_t> g_alloc_counter{0};
+    /**
+     * Open a snapshot epoch (snapshot_mutex held); false if the lock cannot
+     * be taken before the deadline
+     */
+    bool open_snapshot(uint32_t* limit, jlong* latest, std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+        while (!lock.try_lock()) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::yield();
+        }
+        snapshot_open = true;
+        *limit = high_water;
+        *latest = latest_time;
+        return true;
+    }
 
-static pthread_mutex_t g_print_mutex = PTHREAD_MUTEX_INITIALIZER;
-static std::thread g_event_processor_thread;
+    /**
+     * Close the epoch: clear the retired records outside the lock, then
+     * splice them into the free list
+     */
+    void close_snapshot() {
+        for (;;) {
+            uint32_t head;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                head = retired;
+                retired = 0;
+                if (head == 0) {
+                    snapshot_open = false;
+                    return;
+                }
+            }
+            uint32_t tail = head;
+            for (uint32_t index = head; index != 0; index = record(index).next) {
+                record(index).tag = 0;
+                tail = index;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            record(tail).next = free_list;
+            free_list = head;
+        }
+    }
 
-// Callback function pointer type
-typedef void (*EventCallback)(const AllocationEvent&);
-static EventCallback g_event_callback = nullptr;
+public:
+    bool reserve() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (buckets && site_hashes) {
+            return true;
+        }
+        buckets = (uint32_t*)map_zeroed(sizeof(uint32_t) * ALLOCATION_HASH_SIZE);
+        site_hashes = (uint64_t*)map_zeroed(sizeof(uint64_t) * TRACKER_SITE_SLOTS);
+        if (buckets && site_hashes) {
+            return true;
+        }
+        // Partial failure: release the region that did map so a later call
+        // starts over and the other operations keep seeing an empty tracker
+        if (buckets) {
+            munmap(buckets, sizeof(uint32_t) * ALLOCATION_HASH_SIZE);
+            buckets = nullptr;
+        }
+        if (site_hashes) {
+            munmap(site_hashes, sizeof(uint64_t) * TRACKER_SITE_SLOTS);
+            site_hashes = nullptr;
+        }
+        return false;
+    }
 
-// ============================================================================
-// Utility Functions
-// ============================================================================
+    void track(jlong tag, const AllocationInfo& info) {
+        std::lock_guard<std::mutex> lock(mutex);
 
-static inline jlong get_current_timestamp() {
-    auto now = std::chrono::system_clock::now();
-    auto duration = now.time_since_epoch();
-    return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
-}
+        if (!sentinels_ready && !prepare_sentinels()) {
+            return;
+        }
+        uint32_t index = allocate_record();
+        if (index == 0) {
+            return;
+        }
+        if (base_time == 0) {
+            base_time = info.timestamp;
+        }
+        latest_time = std::max(latest_time, info.timestamp);
 
-static inline uint64_t get_current_thread_id() {
-    uint64_t thread_id = 0;
-    pthread_mutex_lock(&g_print_mutex);
-    thread_id = (uint64_t)(uintptr_t)pthread_self();
-    pthread_mutex_unlock(&g_print_mutex);
-    return thread_id;
-}
+        uint32_t h = hash_tag(tag);
+        Record& r = record(index);
+        pack(r, tag, info);
+        r.next = buckets[h];
+        buckets[h] = index;
+        link_age(index, info.timestamp);
+
+        // Account the stored size, which untrack() reports back
+        jlong size = (jlong)r.size_units * 8;
+        total_allocated.fetch_add(size, std::memory_order_relaxed);
+        current_usage.fetch_add(size, std::memory_order_relaxed);
+        alloc_count.fetch_add(1, std::memory_order_relaxed);
+    }
 
-static void safe_print(const char* msg) {
-    pthread_mutex_lock(&g_print_mutex);
-    fprintf(stderr, "[JVM TI] %s\n", msg);
-    pthread_mutex_unlock(&g_print_mutex);
-}
+    bool untrack(jlong tag, AllocationInfo& info) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!buckets) {
+            return false;
+        }
 
-static void safe_print(const char* format, int value) {
-    pthread_mutex_lock(&g_print_mutex);
-    fprintf(stderr, "[JVM TI] ");
-    fprintf(stderr, format, value);
-    fprintf(stderr, "\n");
-    pthread_mutex_unlock(&g_print_mutex);
-}
+        uint32_t index = unlink(tag);
+        if (index == 0) {
+            return false;
+        }
+        unpack(record(index), info, latest_time);
+        release_record(index);
 
-// ============================================================================
-// Stack Trace Capture
-// ============================================================================
+        total_freed.fetch_add(info.size, std::memory_order_relaxed);
+        current_usage.fetch_sub(info.size, std::memory_order_relaxed);
+        free_count.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
 
-static jvmtiFrameInfo* capture_stack_trace(jvmtiEnv* jvmti, jint* frame_count,
-                                           jint max_depth = MAX_STACK_DEPTH) {
-    jvmtiFrameInfo* frames = (jvmtiFrameInfo*)malloc(sizeof(jvmtiFrameInfo) * max_depth);
-    if (!frames) return nullptr;
+    /**
+     * Untrack a batch of tags under one lock acquisition. Tags are sorted
+     * by bucket first so the sweep walks the table in order. on_freed is
+     * called (with the lock held) for each tag that was tracked.
+     */
+    template <typename OnFreed>
+    size_t untrack_batch(jlong* tags, size_t count, OnFreed&& on_freed) {
+        std::sort(tags, tags + count, [this](jlong a, jlong b) {
+            return hash_tag(a) < hash_tag(b);
+        });
 
-    // GetStackTrace signature: GetStackTrace(jthread, jint startDepth, jint maxCount, jvmtiFrameInfo*, jint*)
-    jvmtiError err = jvmti->GetStackTrace(NULL, 0, max_depth, frames, frame_count);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!buckets) {
+            return 0;
+        }
+        size_t freed = 0;
+        jlong freed_bytes = 0;
+        AllocationInfo info;
+        for (size_t i = 0; i < count; i++) {
+            uint32_t index = unlink(tags[i]);
+            if (index == 0) {
+                continue;
+            }
+            unpack(record(index), info, latest_time);
+            release_record(index);
+            on_freed(tags[i], info);
+            freed_bytes += info.size;
+            freed++;
+        }
 
-    if (JVMTI_ERROR_NONE != err) {
-        free(frames);
-        return nullptr;
+        total_freed.fetch_add(freed_bytes, std::memory_order_relaxed);
+        current_usage.fetch_sub(freed_bytes, std::memory_order_relaxed);
+        free_count.fetch_add(freed, std::memory_order_relaxed);
+        return freed;
     }
 
-    if (*frame_count <= 0) {
-        free(frames);
-        return nullptr;
+    bool find(jlong tag, AllocationInfo* info) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!buckets) {
+            return false;
+        }
+
+        for (uint32_t index = buckets[hash_tag(tag)]; index != 0; index = record(index).next) {
+            if (record(index).tag == tag) {
+                unpack(record(index), *info, latest_time);
+                return true;
+            }
+        }
+        return false;
     }
 
-    return frames;
-}
+    uint64_t get_total_allocated() const { return total_allocated.load(); }
+    uint64_t get_total_freed() const { return total_freed.load(); }
+    uint64_t get_current_usage() const { return current_usage.load(); }
+    uint64_t get_alloc_count() const { return alloc_count.load(); }
+    uint64_t get_free_count() const { return free_count.load(); }
+    uint64_t get_evicted_count() const { return evicted_count.load(); }
 
-static void free_stack_trace(jvmtiFrameInfo* frames) {
-    if (frames) {
-        free(frames);
+    uint64_t get_tracked_count() const {
+        return alloc_count.load() - free_count.load() - evicted_count.load();
     }
-}
 
-/**
- * Build stack trace string from jvmtiFrameInfo
- * Format: "class.method(file:line);class.method(file:line);..."
- */
-static char* build_stack_trace_string(jvmtiEnv* jvmti, JNIEnv* jni,
-                                       jvmtiFrameInfo* frames, jint frame_count) {
-    if (!frames || frame_count <= 0) {
-        return nullptr;
+    /**
+     * Copy the records allocated at or before cutoff into older_buffer
+     * (older_mutex held); false if they do not fit its current size
+     */
+    bool copy_older(jlong cutoff, size_t* count, jlong* latest) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t n = 0;
+        AllocationInfo info;
+        for (uint32_t g = 0; g < generation_count && generations[g].start <= cutoff; g++) {
+            bool straddles = generation_upper(g) > cutoff + 1;
+            uint32_t sentinel = generations[g].sentinel;
+            for (uint32_t index = links(sentinel).newer; index != sentinel; index = links(index).newer) {
+                const Record& r = record(index);
+                if (straddles) {
+                    unpack(r, info, latest_time);
+                    if (info.timestamp > cutoff) {
+                        continue;
+                    }
+                }
+                if (n == older_buffer.size()) {
+                    return false;
+                }
+                older_buffer[n++] = r;
+            }
+        }
+        *count = n;
+        *latest = latest_time;
+        return true;
     }
 
-    std::string result;
-    for (int i = 0; i < frame_count && i < 20; i++) {  // Limit to 20 frames
-        jvmtiFrameInfo* frame = &frames[i];
-
-        // Get method name
-        char* method_name = nullptr;
-        char* method_sig = nullptr;
-        char* method_generic = nullptr;
-        if (jvmti->GetMethodName(frame->method, &method_name, &method_sig, &method_generic) != JVMTI_ERROR_NONE || !method_name) {
-            method_name = (char*)"unknown";
+    /**
+     * Visit the tracked objects allocated at or before cutoff (ms), oldest
+     * generation first. The walk covers only the generations older than
+     * cutoff and just copies their 32-byte records into a buffer kept
+     * across calls, so allocating threads wait for a memcpy-speed pass
+     * without allocation; if the buffer is too small it is grown outside
+     * the lock and the copy retried. visit(tag, info) then runs without the
+     * tracker lock. One call runs at a time. Returns the number of objects
+     * visited.
+     */
+    template <typename Visitor>
+    size_t visit_older(jlong cutoff, Visitor&& visit) {
+        std::lock_guard<std::mutex> reader(older_mutex);
+        size_t count;
+        jlong latest;
+        while (!copy_older(cutoff, &count, &latest)) {
+            older_buffer.resize(std::max<size_t>(older_buffer.size() * 2, 4096));
         }
 
-        // Get class name
-        char* class_name = nullptr;
-        jclass klass = nullptr;
-        if (jvmti->GetMethodDeclaringClass(frame->method, &klass) == JVMTI_ERROR_NONE && klass) {
-            jvmti->GetClassSignature(klass, &class_name, nullptr);
-        }
-        if (!class_name) {
-            class_name = (char*)"unknown";
+        AllocationInfo info;
+        for (size_t i = 0; i < count; i++) {
+            unpack(older_buffer[i], info, latest);
+            visit(older_buffer[i].tag, info);
         }
+        return count;
+    }
 
-        // Get line number - use GetLineNumberTable
-        jint line_number = 0;
-        jint table_count = 0;
-        jvmtiLineNumberEntry* table = nullptr;
-        if (jvmti->GetLineNumberTable(frame->method, &table_count, &table) == JVMTI_ERROR_NONE && table) {
-            // Find the line number for the current location
-            for (int j = 0; j < table_count; j++) {
-                if (table[j].start_location <= frame->location) {
-                    line_number = table[j].line_number;
-                } else {
-                    break;
-                }
+    /**
+     * Stop tracking the count oldest objects (by generation, then insertion
+     * order). on_evicted(tag, info) is called with the lock held. Their
+     * ObjectFree events are ignored later, like those of untracked objects.
+     */
+    template <typename OnEvicted>
+    size_t evict_oldest(size_t count, OnEvicted&& on_evicted) {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t evicted = 0;
+        jlong evicted_bytes = 0;
+        AllocationInfo info;
+        for (uint32_t g = 0; g < generation_count && evicted < count; g++) {
+            uint32_t sentinel = generations[g].sentinel;
+            while (evicted < count && links(sentinel).newer != sentinel) {
+                uint32_t index = links(sentinel).newer;
+                jlong tag = record(index).tag;
+                unlink(tag);
+                unpack(record(index), info, latest_time);
+                release_record(index);
+                on_evicted(tag, info);
+                evicted_bytes += info.size;
+                evicted++;
             }
-            jvmti->Deallocate((unsigned char*)table);
         }
 
-        // Get source file name
-        char* source_file = nullptr;
-        if (klass) {
-            jvmti->GetSourceFileName(klass, &source_file);
-        }
-        if (!source_file) {
-            source_file = (char*)"unknown";
-        }
+        current_usage.fetch_sub(evicted_bytes, std::memory_order_relaxed);
+        evicted_count.fetch_add(evicted, std::memory_order_relaxed);
+        return evicted;
+    }
 
-        // Build string: "class.method(file:line);"
-        if (i > 0) result += ";";
-        result += class_name;
-        result += ".";
-        result += method_name;
-        result += "(";
-        result += source_file;
-        result += ":";
-        result += std::to_string(line_number);
-        result += ")";
+    void get_snapshot(std::vector<std::pair<jlong, AllocationInfo>>& snapshot) {
+        visit_bounded([&](jlong tag, const AllocationInfo& info) {
+            snapshot.push_back({tag, info});
+        }, std::chrono::steady_clock::time_point::max());
+    }
 
-        // Free JVMTI allocated memory
-        if (method_name && strcmp(method_name, "unknown") != 0) {
-            jvmti->Deallocate((unsigned char*)method_name);
-        }
-        if (method_sig) {
-            jvmti->Deallocate((unsigned char*)method_sig);
-        }
-        if (method_generic) {
-            jvmti->Deallocate((unsigned char*)method_generic);
-        }
-        if (class_name && strcmp(class_name, "unknown") != 0) {
-            jvmti->Deallocate((unsigned char*)class_name);
+    /**
+     * Visit the objects tracked when the call starts (a snapshot, see the
+     * class comment) without holding the tracker lock and without
+     * allocating, giving up when a lock cannot be taken or the deadline
+     * passes. visit(tag, info) runs on the calling thread. Returns true if
+     * every entry was visited.
+     */
+    template <typename Visitor>
+    bool visit_bounded(Visitor&& visit, std::chrono::steady_clock::time_point deadline) {
+        std::unique_lock<std::mutex> reader(snapshot_mutex, std::defer_lock);
+        while (!reader.try_lock()) {
+            if (std::chrono::steady_clock::now() >= deadline) {
+                return false;
+            }
+            std::this_thread::yield();
         }
-        if (source_file && strcmp(source_file, "unknown") != 0) {
-            jvmti->Deallocate((unsigned char*)source_file);
+        uint32_t limit;
+        jlong latest;
+        if (!open_snapshot(&limit, &latest, deadline)) {
+            return false;
         }
-        if (klass) {
-            jni->DeleteLocalRef(klass);
+
+        bool complete = true;
+        AllocationInfo info;
+        for (uint32_t index = 1; index < limit; index++) {
+            const Record& r = record(index);
+            if (r.tag == 0) {
+                continue;
+            }
+            unpack(r, info, latest);
+            visit(r.tag, info);
+            if ((index & 0xFFFF) == 0 && std::chrono::steady_clock::now() >= deadline) {
+                complete = false;
+                break;
+            }
         }
+        close_snapshot();
+        return complete;
     }
 
-    // Copy to C string
-    char* result_str = (char*)malloc(result.length() + 1);
-    strcpy(result_str, result.c_str());
-    return result_str;
-}
 
-// ============================================================================
-// JVMTI Event Callbacks
-// ============================================================================
 
-/**
+    /**
+     * Forget every tracked object and unmap the slab pages
+     */
+    void clear() {
+        std::lock_guard<std::mutex> reader(snapshot_mutex);
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!buckets) {
+            return;
+        }
+
+        for (uint32_t page = 0; page < page_count; page++) {
+            munmap(pages[page], sizeof(Record) * TRACKER_SLAB_RECORDS);
+            munmap(link_pages[page], sizeof(AgeLinks) * TRACKER_SLAB_RECORDS);
+            pages[page] = nullptr;
+            link_pages[page] = nullptr;
+        }
+        page_count = 0;
+        high_water = 1;
+        free_list = 0;
+        generation_count = 0;
+        sentinels_ready = false;
+        memset(buckets, 0, sizeof(uint32_t) * ALLOCATION_HASH_SIZE);
+    }
+};
+
+/**
+ * Buffer of freed tags, filled by ObjectFree during GC
+ *
+ * ObjectFree only appends the tag and the GC epoch it was observed in
+ * (an atomic increment and two stores), so the time the agent adds to a
+ * GC pause no longer depends on the tracker lock. The event processor
+ * swaps the two batches and removes the tags from the tracker in sorted
+ * passes (AllocationTracker::untrack_batch), once their allocation events
+ * have been processed (drain_frees).
+ *
+ * A producer registers in the batch's writer count before re-checking
+ * that the batch is still active; the drainer switches the active batch
+ * before waiting for the writer count to reach zero. Both sides use
+ * sequentially consistent operations, so a tag is either appended to the
+ * batch being drained before the wait completes, or retried on the new
+ * batch. When a batch is full, append fails and the caller falls back to
+ * the per-object path.
+ *
+ * The batches (6 MB) are mapped by reserve() when the agent activates;
+ * until then append fails as if they were full.
+ */
+class FreeBuffer {
+private:
+    struct Batch {
+        std::atomic<uint32_t> writers{0};
+        std::atomic<uint32_t> count{0};
+        jlong tags[FREE_BATCH_CAPACITY];
+        uint32_t epochs[FREE_BATCH_CAPACITY];  // g_gc_epoch seen by each free
+    };
+
+    Batch* batches = nullptr;
+    std::atomic<Batch*> active{nullptr};
+
+public:
+    /**
+     * Map the two batches (once, before ObjectFree is enabled)
+     */
+    bool reserve() {
+        if (batches) {
+            return true;
+        }
+        void* mapping = mmap(nullptr, sizeof(Batch) * 2, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        batches = new (mapping) Batch[2];
+        active.store(&batches[0]);
+        return true;
+    }
+
+    bool append(jlong tag, uint32_t gc_epoch) {
+        for (;;) {
+            Batch* b = active.load();
+            if (!b) {
+                return false;
+            }
+            b->writers.fetch_add(1);
+            if (active.load() != b) {
+                b->writers.fetch_sub(1);
+                continue;
+            }
+            uint32_t index = b->count.fetch_add(1, std::memory_order_relaxed);
+            bool stored = index < FREE_BATCH_CAPACITY;
+            if (stored) {
+                b->tags[index] = tag;
+                b->epochs[index] = gc_epoch;
+            }
+            b->writers.fetch_sub(1);
+            return stored;
+        }
+    }
+
+    /**
+     * Swap batches and append the frees buffered so far to out as
+     * {tag, GC epoch at the free} (single drainer)
+     */
+    void drain(std::vector<std::pair<jlong, uint32_t>>& out) {
+        Batch* b = active.load();
+        if (!b || b->count.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+
+        Batch* next = b == &batches[0] ? &batches[1] : &batches[0];
+        next->count.store(0, std::memory_order_relaxed);
+        active.store(next);
+        while (b->writers.load() != 0) {
+            std::this_thread::yield();
+        }
+
+        uint32_t n = std::min<uint32_t>(b->count.load(std::memory_order_relaxed), FREE_BATCH_CAPACITY);
+        for (uint32_t i = 0; i < n; i++) {
+            out.emplace_back(b->tags[i], b->epochs[i]);
+        }
+    }
+};
+
+/**
+ * Class registry - assigns compact ids to classes
+ *
+ * The id is stored in the class object's JVMTI tag (with CLASS_TAG_BIT set),
+ * so resolving a jclass to its id on the allocation path is a single
+ * GetTag call. The class name is resolved once, when the id is assigned.
+ * Id 0 means "unknown".
+ */
+class ClassRegistry {
+private:
+    // All zero at load (no constructor), so the array stays untouched
+    // .bss until classes are registered
+    std::atomic<const char*> names[MAX_TRACKED_CLASSES];
+    std::atomic<uint32_t> assigned{0};         // Ids handed out; the next is assigned + 1
+    std::mutex mutex;
+
+    /**
+     * Convert a class signature to Class.getName() form:
+     * "Ljava/lang/String;" -> "java.lang.String", "[B" stays "[B",
+     * "[Ljava/lang/Object;" -> "[Ljava.lang.Object;"
+     */
+    static char* signature_to_name(const char* sig) {
+        size_t len = strlen(sig);
+        const char* start = sig;
+        if (sig[0] == 'L' && len >= 2 && sig[len - 1] == ';') {
+            start = sig + 1;
+            len -= 2;
+        }
+        char* name = (char*)malloc(len + 1);
+        if (!name) return nullptr;
+        for (size_t i = 0; i < len; i++) {
+            name[i] = start[i] == '/' ? '.' : start[i];
+        }
+        name[len] = '\0';
+        return name;
+    }
+
+public:
+    uint32_t id_for(jvmtiEnv* jvmti, jclass klass) {
+        if (!klass) return 0;
+
+        jlong tag = 0;
+        if (jvmti->GetTag(klass, &tag) == JVMTI_ERROR_NONE && (tag & CLASS_TAG_BIT)) {
+            return (uint32_t)(tag & 0xFFFFFFFF);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // Another thread may have registered the class meanwhile
+        if (jvmti->GetTag(klass, &tag) == JVMTI_ERROR_NONE && (tag & CLASS_TAG_BIT)) {
+            return (uint32_t)(tag & 0xFFFFFFFF);
+        }
+
+        uint32_t id = assigned.load(std::memory_order_relaxed) + 1;
+        if (id >= MAX_TRACKED_CLASSES) {
+            return 0;
+        }
+
+        char* sig = nullptr;
+        char* name = nullptr;
+        if (jvmti->GetClassSignature(klass, &sig, nullptr) == JVMTI_ERROR_NONE && sig) {
+            name = signature_to_name(sig);
+            jvmti->Deallocate((unsigned char*)sig);
+        }
+        if (!name) {
+            return 0;
+        }
+
+        names[id].store(name, std::memory_order_release);
+        if (jvmti->SetTag(klass, CLASS_TAG_BIT | (jlong)id) != JVMTI_ERROR_NONE) {
+            names[id].store(nullptr, std::memory_order_relaxed);
+            free(name);
+            return 0;
+        }
+        assigned.store(id, std::memory_order_release);
+        return id;
+    }
+
+    const char* name(uint32_t id) const {
+        if (id == 0 || id >= MAX_TRACKED_CLASSES) return "unknown";
+        const char* n = names[id].load(std::memory_order_acquire);
+        return n ? n : "unknown";
+    }
+
+    uint32_t size() const {
+        return assigned.load(std::memory_order_acquire) + 1;
+    }
+};
+
+/**
+ * Allocation site table
+ *
+ * Maps stack hashes to interned site names ("class.method(File.java:line)",
+ * the same format AllocationRecord.getAllocationSite() produces). Several
+ * stack hashes can share one site. Written only by the event processor
+ * thread; names are stored in a deque so references stay valid.
+ */
+class SiteTable {
+private:
+    mutable std::mutex mutex;
+    std::unordered_map<uint64_t, uint32_t> by_hash;
+    std::unordered_map<std::string, uint32_t> by_name;
+    std::deque<std::string> names;
+
+public:
+    bool lookup(uint64_t hash, uint32_t* index) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = by_hash.find(hash);
+        if (it == by_hash.end()) return false;
+        *index = it->second;
+        return true;
+    }
+
+    uint32_t intern(uint64_t hash, const std::string& name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t index;
+        auto it = by_name.find(name);
+        if (it != by_name.end()) {
+            index = it->second;
+        } else {
+            index = (uint32_t)names.size();
+            names.push_back(name);
+            by_name.emplace(name, index);
+        }
+        if (hash != 0) {
+            by_hash.emplace(hash, index);
+        }
+        return index;
+    }
+
+    const char* name(uint32_t index) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return index < names.size() ? names[index].c_str() : "unknown";
+    }
+
+    bool find(const std::string& name, uint32_t* index) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = by_name.find(name);
+        if (it == by_name.end()) return false;
+        *index = it->second;
+        return true;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return names.size();
+    }
+};
+
+// ============================================================================
+// Global State
+// ============================================================================
+
+static jvmtiEnv* g_jvmti = nullptr;
+static JNIEnv* g_jni_env = nullptr;
+static JavaVM* g_java_vm = nullptr;
+static AllocationTracker g_tracker;
+static EventQueue g_event_queue;
+static ClassRegistry g_classes;
+static SiteTable g_sites;
+static FreeBuffer g_free_buffer;
+
+// Java class and method references for JNI callback
+static jclass g_heap_analyzer_class = nullptr;
+static jmethodID g_on_object_alloc_method = nullptr;
+
+static std::atomic<bool> g_agent_active{true};
+static std::atomic<bool> g_vm_live{false};     // VMInit seen (or attached to a live VM)
+static std::atomic<bool> g_sampling_enabled{true};
+static std::atomic<int> g_sampling_interval{10};
+static std::atomic<uint64_t> g_alloc_counter{0};
+static std::atomic<jlong> g_next_object_tag{1};    // Sampled object tags (below CLASS_TAG_BIT)
+static std::atomic<uint32_t> g_gc_epoch{0};         // GC cycles started
+static std::atomic<uint64_t> g_max_tracked{0};      // Tracked object cap, oldest evicted (0 = none)
+
+static pthread_mutex_t g_print_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::thread g_event_processor_thread;
+static JNIEnv* g_processor_jni = nullptr;      // Event processor thread's own JNIEnv
+
+// Callback function pointer type
+typedef void (*EventCallback)(const AllocationEvent&);
+static EventCallback g_event_callback = nullptr;
+
+// ============================================================================
+// Utility Functions
+// ============================================================================
+
+static inline jlong get_current_timestamp() {
+    auto now = std::chrono::system_clock::now();
+    auto duration = now.time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::milliseconds>(duration).count();
+}
+
+static inline uint64_t get_current_thread_id() {
+    uint64_t thread_id = 0;
+    pthread_mutex_lock(&g_print_mutex);
+    thread_id = (uint64_t)(uintptr_t)pthread_self();
+    pthread_mutex_unlock(&g_print_mutex);
+    return thread_id;
+}
+
+static void safe_print(const char* msg) {
+    pthread_mutex_lock(&g_print_mutex);
+    fprintf(stderr, "[JVM TI] %s\n", msg);
+    pthread_mutex_unlock(&g_print_mutex);
+}
+
+static void safe_print(const char* format, int value) {
+    pthread_mutex_lock(&g_print_mutex);
+    fprintf(stderr, "[JVM TI] ");
+    fprintf(stderr, format, value);
+    fprintf(stderr, "\n");
+    pthread_mutex_unlock(&g_print_mutex);
+}
+
+// ============================================================================
+// Stack Trace Capture
+// ============================================================================
+
+/**
+ * Per-thread frame buffer for GetStackTrace on the allocation path
+ *
+ * Frames captured by the callback live here until it returns; what must
+ * outlive it is copied into the FrameArena. A callback nested in another on
+ * the same thread (an allocation made by the upcall) gets no buffer and
+ * records no stack.
+ */
+class ScratchFrames {
+private:
+    static thread_local jvmtiFrameInfo buffer[MAX_STACK_DEPTH];
+    static thread_local bool busy;
+    bool owner;
+
+public:
+    ScratchFrames() : owner(!busy) {
+        busy = true;
+    }
+
+    ~ScratchFrames() {
+        if (owner) {
+            busy = false;
+        }
+    }
+
+    jvmtiFrameInfo* get() const { return owner ? buffer : nullptr; }
+};
+
+thread_local jvmtiFrameInfo ScratchFrames::buffer[MAX_STACK_DEPTH];
+thread_local bool ScratchFrames::busy = false;
+
+/**
+ * Capture the current thread's stack into buffer (MAX_STACK_DEPTH frames).
+ * Returns buffer, or nullptr if there is no buffer or no frames.
+ */
+static jvmtiFrameInfo* capture_stack_trace(jvmtiEnv* jvmti, jvmtiFrameInfo* buffer, jint* frame_count,
+                                           jint max_depth = MAX_STACK_DEPTH) {
+    *frame_count = 0;
+    if (!buffer) return nullptr;
+
+    // GetStackTrace signature: GetStackTrace(jthread, jint startDepth, jint maxCount, jvmtiFrameInfo*, jint*)
+    jvmtiError err = jvmti->GetStackTrace(NULL, 0, std::min<jint>(max_depth, MAX_STACK_DEPTH),
+                                          buffer, frame_count);
+
+    if (JVMTI_ERROR_NONE != err || *frame_count <= 0) {
+        *frame_count = 0;
+        return nullptr;
+    }
+
+    return buffer;
+}
+
+/**
+ * Bump-pointer arenas for the stacks queued with allocation events
+ *
+ * Each allocating thread fills its own block (FRAME_ARENA_BLOCK bytes) with
+ * no locking; every copy is preceded by a pointer to its block. A block
+ * counts its unreleased copies plus one reference held by the filling
+ * thread; the event processor releases copies as it consumes events, and
+ * the block returns to the pool as a whole when the count reaches zero
+ * (after the thread moved on to a new block or exited). Blocks are mapped
+ * with mmap and kept in the pool, so the allocation path never calls
+ * malloc or free; the pool mutex is taken once per block.
+ */
+class FrameArena {
+private:
+    struct Block {
+        std::atomic<uint32_t> live;     // Unreleased copies + 1 while being filled
+        uint32_t used;                  // Bytes handed out (filling thread only)
+        Block* next;                    // Pool link
+    };
+
+    struct alignas(16) Header {
+        Block* block;
+    };
+
+    static const size_t DATA_OFFSET = (sizeof(Block) + 15) & ~(size_t)15;
+
+    /** The block this thread is filling; handed back when the thread exits */
+    struct Owner {
+        Block* block = nullptr;
+        ~Owner();
+    };
+
+    static thread_local Owner owner;
+
+    std::mutex pool_mutex;
+    Block* pool = nullptr;
+    std::atomic<uint64_t> mapped{0};    // Blocks mapped so far
+
+    Block* acquire() {
+        Block* b;
+        {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            b = pool;
+            if (b) {
+                pool = b->next;
+            }
+        }
+        if (!b) {
+            void* mapping = mmap(nullptr, FRAME_ARENA_BLOCK, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping == MAP_FAILED) {
+                return nullptr;
+            }
+            b = new (mapping) Block();
+            mapped.fetch_add(1, std::memory_order_relaxed);
+        }
+        b->used = (uint32_t)DATA_OFFSET;
+        b->next = nullptr;
+        b->live.store(1, std::memory_order_relaxed);
+        return b;
+    }
+
+    void unref(Block* b) {
+        if (b->live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(pool_mutex);
+            b->next = pool;
+            pool = b;
+        }
+    }
+
+public:
+    /**
+     * Copy count frames into this thread's block (nullptr if too large or
+     * no block can be mapped)
+     */
+    jvmtiFrameInfo* copy(const jvmtiFrameInfo* frames, jint count) {
+        size_t need = sizeof(Header) + sizeof(jvmtiFrameInfo) * (size_t)count;
+        if (need > FRAME_ARENA_BLOCK - DATA_OFFSET) {
+            return nullptr;
+        }
+        Block* b = owner.block;
+        if (!b || b->used + need > FRAME_ARENA_BLOCK) {
+            if (b) {
+                unref(b);
+            }
+            b = owner.block = acquire();
+            if (!b) {
+                return nullptr;
+            }
+        }
+        Header* header = (Header*)((char*)b + b->used);
+        header->block = b;
+        b->used += (uint32_t)need;
+        b->live.fetch_add(1, std::memory_order_relaxed);
+        memcpy(header + 1, frames, sizeof(jvmtiFrameInfo) * (size_t)count);
+        return (jvmtiFrameInfo*)(header + 1);
+    }
+
+    /**
+     * Release a copy (any thread, normally the event processor)
+     */
+    void release(jvmtiFrameInfo* frames) {
+        if (frames) {
+            unref(((Header*)frames - 1)->block);
+        }
+    }
+
+    uint64_t blocks() const { return mapped.load(std::memory_order_relaxed); }
+};
+
+static FrameArena g_frame_arena;
+
+thread_local FrameArena::Owner FrameArena::owner;
+
+FrameArena::Owner::~Owner() {
+    if (block) {
+        g_frame_arena.unref(block);
+    }
+}
+
+/**
+ * Hash the top frames of a stack into an allocation site id (FNV-1a)
+ */
+static inline uint64_t hash_frames(const jvmtiFrameInfo* frames, jint frame_count) {
+    if (!frames || frame_count <= 0) {
+        return 0;
+    }
+
+    uint64_t h = 1469598103934665603ULL;
+    for (int i = 0; i < frame_count && i < SITE_HASH_DEPTH; i++) {
+        h ^= (uint64_t)(uintptr_t)frames[i].method;
+        h *= 1099511628211ULL;
+        h ^= (uint64_t)frames[i].location;
+        h *= 1099511628211ULL;
+    }
+    return h != 0 ? h : 1;
+}
+
+/**
+ * Frame text of each method, resolved once: the dotted class name, the
+ * "pkg.Class.method(File.java:" prefix and the line number table.
+ * Describing a frame afterwards is a lookup plus a binary search, with
+ * no JVMTI calls (and no JVMTI Allocate / Deallocate) per sample.
+ *
+ * Entries are never removed or changed, so a looked-up pointer stays
+ * valid without the lock. Past FRAME_CACHE_METHODS methods, frames are
+ * described without being cached.
+ */
+class MethodDescriptions {
+public:
+    struct Entry {
+        std::string class_name;
+        std::string prefix;
+        std::vector<std::pair<jlocation, jint>> lines;     // Sorted by start location
+
+        jint line_at(jlocation location) const {
+            auto it = std::upper_bound(lines.begin(), lines.end(), std::make_pair(location, INT_MAX));
+            return it == lines.begin() ? 0 : (it - 1)->second;
+        }
+    };
+
+private:
+    std::unordered_map<jmethodID, std::unique_ptr<Entry>> entries;
+    std::mutex mutex;
+
+    static void resolve(jvmtiEnv* jvmti, JNIEnv* jni, jmethodID method, Entry& e) {
+        char* method_name = nullptr;
+        if (jvmti->GetMethodName(method, &method_name, nullptr, nullptr) != JVMTI_ERROR_NONE) {
+            method_name = nullptr;
+        }
+
+        jclass klass = nullptr;
+        char* class_sig = nullptr;
+        char* source_file = nullptr;
+        if (jvmti->GetMethodDeclaringClass(method, &klass) == JVMTI_ERROR_NONE && klass) {
+            jvmti->GetClassSignature(klass, &class_sig, nullptr);
+            jvmti->GetSourceFileName(klass, &source_file);
+        }
+
+        if (class_sig) {
+            const char* p = class_sig[0] == 'L' ? class_sig + 1 : class_sig;
+            for (; *p && *p != ';'; p++) {
+                e.class_name += (*p == '/') ? '.' : *p;
+            }
+        } else {
+            e.class_name = "unknown";
+        }
+
+        jint table_count = 0;
+        jvmtiLineNumberEntry* table = nullptr;
+        if (jvmti->GetLineNumberTable(method, &table_count, &table) == JVMTI_ERROR_NONE && table) {
+            e.lines.reserve(table_count);
+            for (int j = 0; j < table_count; j++) {
+                e.lines.emplace_back(table[j].start_location, table[j].line_number);
+            }
+            std::sort(e.lines.begin(), e.lines.end());
+            jvmti->Deallocate((unsigned char*)table);
+        }
+
+        e.prefix = e.class_name;
+        e.prefix += ".";
+        e.prefix += method_name ? method_name : "unknown";
+        e.prefix += "(";
+        e.prefix += source_file ? source_file : "unknown";
+        e.prefix += ":";
+
+        // Free JVMTI allocated memory
+        if (method_name) jvmti->Deallocate((unsigned char*)method_name);
+        if (class_sig) jvmti->Deallocate((unsigned char*)class_sig);
+        if (source_file) jvmti->Deallocate((unsigned char*)source_file);
+        if (klass && jni) {
+            jni->DeleteLocalRef(klass);
+        }
+    }
+
+public:
+    /**
+     * Entry of a method, resolved on first use. If the cache is full the
+     * method is resolved into scratch, which the caller owns.
+     */
+    const Entry* get(jvmtiEnv* jvmti, JNIEnv* jni, jmethodID method, Entry& scratch) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto it = entries.find(method);
+            if (it != entries.end()) {
+                return it->second.get();
+            }
+        }
+
+        std::unique_ptr<Entry> e(new Entry());
+        resolve(jvmti, jni, method, *e);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entries.size() >= FRAME_CACHE_METHODS) {
+            scratch = std::move(*e);
+            return &scratch;
+        }
+        // Another thread may have resolved it meanwhile; keep the first
+        return entries.emplace(method, std::move(e)).first->second.get();
+    }
+};
+
+static MethodDescriptions g_method_descriptions;
+
+/**
+ * Describe one frame as "pkg.Class.method(File.java:line)", the format of
+ * StackTraceElement.toString(). The dotted class name is returned separately.
+ */
+static void describe_frame(jvmtiEnv* jvmti, JNIEnv* jni, const jvmtiFrameInfo& frame,
+                           std::string& class_name, std::string& out) {
+    static thread_local MethodDescriptions::Entry scratch;
+    const MethodDescriptions::Entry* e = g_method_descriptions.get(jvmti, jni, frame.method, scratch);
+
+    class_name = e->class_name;
+    out = e->prefix;
+    out += std::to_string(e->line_at(frame.location));
+    out += ")";
+}
+
+/**
+ * Resolve the allocation site of a stack: the first frame outside the JDK
+ * and analyzer packages, like AllocationRecord.buildAllocationSite()
+ */
+static std::string symbolize_site(jvmtiEnv* jvmti, JNIEnv* jni,
+                                  const jvmtiFrameInfo* frames, jint frame_count) {
+    if (!frames || frame_count <= 0) {
+        return "unknown";
+    }
+
+    std::string class_name;
+    std::string frame_str;
+    std::string first;
+    for (int i = 0; i < frame_count; i++) {
+        describe_frame(jvmti, jni, frames[i], class_name, frame_str);
+        if (i == 0) {
+            first = frame_str;
+        }
+        if (class_name.compare(0, 4, "sun.") != 0 &&
+            class_name.compare(0, 10, "java.lang.") != 0 &&
+            class_name.compare(0, 17, "com.jvm.analyzer.") != 0) {
+            return frame_str;
+        }
+    }
+    return first;
+}
+
+/**
+ * Build stack trace string from jvmtiFrameInfo
+ * Format: "class.method(file:line);class.method(file:line);..."
+ */
+static const char* build_stack_trace_string(jvmtiEnv* jvmti, JNIEnv* jni,
+                                            jvmtiFrameInfo* frames, jint frame_count) {
+    if (!frames || frame_count <= 0) {
+        return nullptr;
+    }
+
+    // Per-thread buffers, reused (valid until the thread's next call)
+    static thread_local std::string result;
+    static thread_local std::string class_name;
+    static thread_local std::string frame_str;
+    result.clear();
+    for (int i = 0; i < frame_count && i < 20; i++) {  // Limit to 20 frames
+        describe_frame(jvmti, jni, frames[i], class_name, frame_str);
+        if (i > 0) result += ";";
+        result += frame_str;
+    }
+    return result.c_str();
+}
+
+// ============================================================================
+// Overhead Governor
+// ============================================================================
+
+/**
+ * Cheap monotonic tick counter for timing callbacks (TSC / virtual counter;
+ * nanoseconds elsewhere). The governor calibrates it against the monotonic
+ * clock every period.
+ */
+static inline uint64_t read_cycle_counter() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t value;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(value));
+    return value;
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static int64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    if (clock_gettime(clock, &ts) != 0) {
+        return 0;
+    }
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Holds the agent's CPU time under a budget (percent of the process's CPU
+ * time) by degrading what each sampled allocation costs.
+ *
+ * Agent CPU per period = the event processor thread's CPU clock + the
+ * estimated time spent in allocation callbacks (one call in
+ * GOVERNOR_PROBE_EVERY per thread is timed with the cycle counter and
+ * scaled up). Over budget, the governor climbs a ladder of levels; well
+ * under budget, it steps back down one level per period:
+ *
+ *   0      configured behavior
+ *   1      no stack strings for the Java callback
+ *   2..4   stack depth 64, 32, 16 (enough for SITE_HASH_DEPTH)
+ *   5..    sampling interval doubled per level
+ *
+ * Every level change is reported on stderr and the current level and
+ * overhead are published in the statistics page. A sampling interval set
+ * by a command while the governor runs becomes its new base.
+ */
+class OverheadGovernor {
+private:
+    static const int SYMBOLS_LEVEL = 1;
+    static const int DEPTH_LEVELS = 3;
+    static const int SAMPLING_LEVEL = SYMBOLS_LEVEL + DEPTH_LEVELS + 1;
+
+    std::atomic<bool> enabled{false};
+    std::atomic<int> budget_ppm{0};             // Parts per million of process CPU
+    std::atomic<int> level{0};
+    std::atomic<int> stack_depth{MAX_STACK_DEPTH};
+    std::atomic<bool> stack_strings{true};
+    std::atomic<uint64_t> callback_cycles{0};
+    std::atomic<int64_t> overhead_ppm{0};       // Last complete period
+
+    // Event processor thread only
+    bool started = false;
+    jlong last_tick = 0;
+    uint64_t last_cycles = 0;
+    int64_t last_mono_ns = 0;
+    int64_t last_thread_ns = 0;
+    int64_t last_process_ns = 0;
+    int base_interval = 1;
+    bool base_sampling = true;
+    int applied_interval = 0;
+
+    int max_level() const {
+        int levels = 0;
+        for (int interval = base_interval; interval < GOVERNOR_MAX_INTERVAL; interval <<= 1) {
+            levels++;
+        }
+        return SAMPLING_LEVEL - 1 + levels;
+    }
+
+    void apply(int new_level) {
+        level.store(new_level, std::memory_order_relaxed);
+        stack_strings.store(new_level < SYMBOLS_LEVEL, std::memory_order_relaxed);
+        int depth = MAX_STACK_DEPTH;
+        for (int i = SYMBOLS_LEVEL; i < new_level && i <= DEPTH_LEVELS; i++) {
+            depth /= 2;
+        }
+        stack_depth.store(depth, std::memory_order_relaxed);
+
+        if (new_level >= SAMPLING_LEVEL) {
+            applied_interval = std::min(base_interval << (new_level - SAMPLING_LEVEL + 1), GOVERNOR_MAX_INTERVAL);
+            g_sampling_interval.store(applied_interval, std::memory_order_release);
+            g_sampling_enabled.store(true, std::memory_order_release);
+        } else {
+            applied_interval = base_interval;
+            g_sampling_interval.store(base_interval, std::memory_order_release);
+            g_sampling_enabled.store(base_sampling, std::memory_order_release);
+        }
+    }
+
+    void report(int from, double overhead) {
+        int to = level.load(std::memory_order_relaxed);
+        bool sampling = g_sampling_enabled.load(std::memory_order_relaxed);
+        fprintf(stderr, "[JVM TI] Governor: agent CPU %.2f%% of process (budget %.2f%%), level %d -> %d: "
+                "sampling 1/%d, stack depth %d, stack strings %s\n",
+                overhead * 100.0, budget_ppm.load(std::memory_order_relaxed) / 10000.0, from, to,
+                sampling ? applied_interval : 1, stack_depth.load(std::memory_order_relaxed),
+                stack_strings.load(std::memory_order_relaxed) ? "on" : "off");
+    }
+
+public:
+    /**
+     * Set the budget in percent of process CPU (<= 0 disables and restores
+     * the configured behavior)
+     */
+    void set_budget(double percent) {
+        if (percent <= 0) {
+            enabled.store(false, std::memory_order_release);
+            return;
+        }
+        budget_ppm.store((int)(percent * 10000.0), std::memory_order_relaxed);
+        enabled.store(true, std::memory_order_release);
+    }
+
+    bool active() const { return enabled.load(std::memory_order_relaxed); }
+    int current_level() const { return level.load(std::memory_order_relaxed); }
+    int64_t last_overhead_ppm() const { return overhead_ppm.load(std::memory_order_relaxed); }
+    double budget_percent() const { return budget_ppm.load(std::memory_order_relaxed) / 10000.0; }
+    jint max_stack_depth() const { return stack_depth.load(std::memory_order_relaxed); }
+    bool build_stack_strings() const { return stack_strings.load(std::memory_order_relaxed); }
+
+    void add_callback_cycles(uint64_t cycles) {
+        callback_cycles.fetch_add(cycles, std::memory_order_relaxed);
+    }
+
+    /**
+     * Measure the last period and adjust (event processor thread)
+     */
+    void tick(jlong now_ms) {
+        if (!enabled.load(std::memory_order_acquire)) {
+            if (started) {
+                // Disabled: restore the configured behavior once
+                started = false;
+                overhead_ppm.store(0, std::memory_order_relaxed);
+                if (level.load(std::memory_order_relaxed) != 0) {
+                    apply(0);
+                    safe_print("Governor disabled; sampling 1/%d restored", base_interval);
+                }
+            }
+            return;
+        }
+        if (now_ms - last_tick < GOVERNOR_PERIOD_MS) {
+            return;
+        }
+
+        uint64_t cycles = read_cycle_counter();
+        int64_t mono_ns = clock_ns(CLOCK_MONOTONIC);
+        int64_t thread_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+        int64_t process_ns = clock_ns(CLOCK_PROCESS_CPUTIME_ID);
+        uint64_t callbacks = callback_cycles.exchange(0, std::memory_order_relaxed);
+
+        if (!started) {
+            started = true;
+            base_interval = g_sampling_interval.load(std::memory_order_relaxed);
+            base_sampling = g_sampling_enabled.load(std::memory_order_relaxed);
+            applied_interval = base_interval;
+        } else {
+            // Sampling changed by a command: take it as the new base
+            int interval = g_sampling_interval.load(std::memory_order_relaxed);
+            if (interval != applied_interval) {
+                base_interval = interval;
+                apply(std::min(level.load(std::memory_order_relaxed), SAMPLING_LEVEL - 1));
+            }
+
+            int64_t process_delta = process_ns - last_process_ns;
+            int64_t mono_delta = mono_ns - last_mono_ns;
+            if (process_delta >= GOVERNOR_MIN_PROCESS_CPU_MS * 1000000LL && mono_delta > 0) {
+                double ns_per_cycle = cycles > last_cycles ? (double)mono_delta / (double)(cycles - last_cycles) : 1.0;
+                double agent_ns = (double)(thread_ns - last_thread_ns) + (double)callbacks * ns_per_cycle;
+                double overhead = agent_ns / (double)process_delta;
+                double budget = budget_ppm.load(std::memory_order_relaxed) / 1e6;
+                overhead_ppm.store((int64_t)(overhead * 1e6), std::memory_order_relaxed);
+
+                int from = level.load(std::memory_order_relaxed);
+                int to = from;
+                if (overhead > budget) {
+                    to = from + (overhead > 4 * budget ? 3 : overhead > 2 * budget ? 2 : 1);
+                } else if (overhead < budget * 0.4 && from > 0) {
+                    to = from - 1;
+                }
+                to = std::max(0, std::min(to, max_level()));
+                if (to != from) {
+                    apply(to);
+                    report(from, overhead);
+                }
+            }
+        }
+
+        last_tick = now_ms;
+        last_cycles = cycles;
+        last_mono_ns = mono_ns;
+        last_thread_ns = thread_ns;
+        last_process_ns = process_ns;
+    }
+};
+
+static OverheadGovernor g_governor;
+
+/**
+ * Times one allocation callback in GOVERNOR_PROBE_EVERY (per thread) while
+ * the governor is enabled
+ */
+class CallbackCostProbe {
+private:
+    uint64_t start = 0;
+
+public:
+    CallbackCostProbe() {
+        static thread_local uint32_t calls = 0;
+        if (g_governor.active() && (++calls & (GOVERNOR_PROBE_EVERY - 1)) == 0) {
+            start = read_cycle_counter();
+        }
+    }
+
+    ~CallbackCostProbe() {
+        if (start) {
+            g_governor.add_callback_cycles((read_cycle_counter() - start) * GOVERNOR_PROBE_EVERY);
+        }
+    }
+};
+
+// ============================================================================
+// Stratified Sampling
+// ============================================================================
+
+/**
+ * Per-class adaptive sampling
+ *
+ * Each class id gets its own power-of-two sampling interval, adapted every
+ * STRATIFIED_WINDOW_MS so that every class collects about the same number
+ * of samples per window: a rare class is sampled at each allocation while
+ * byte[] and String are thinned out. Sampled events carry log2 of their
+ * interval (weight_shift), so samples * 2^shift estimates all allocations.
+ *
+ *   stratified        the total number of samples per window matches what
+ *                     uniform 1/N sampling would take (same overhead); it
+ *                     is split by water-filling: classes allocating less
+ *                     than the level t are sampled fully, the others get
+ *                     at most t samples each (intervals round up, so the
+ *                     total stays at or below the uniform volume)
+ *   stratified=<n>    fixed target of n samples per class per window
+ *
+ * Callbacks touch one counter and one shift byte indexed by class id.
+ * Rates are an exponential average of each class's allocations per window,
+ * computed by the event processor thread. Classes not adapted yet, and
+ * classes whose rate drops below half an allocation per window, use the
+ * uniform interval (rounded up to a power of two).
+ */
+class StratifiedSampler {
+private:
+    static const uint8_t UNADAPTED = 0;
+
+    // Zero-initialized (no constructor), so the per-class arrays are not
+    // touched until classes allocate
+    std::atomic<bool> enabled{false};
+    std::atomic<uint32_t> fixed_target{0};      // 0 = match the uniform sampling volume
+    std::atomic<uint32_t> seen[MAX_TRACKED_CLASSES];
+    std::atomic<uint8_t> shifts[MAX_TRACKED_CLASSES];  // Adapted shift + 1, or UNADAPTED
+
+    // Event processor thread only
+    std::vector<float> rates;
+    std::vector<uint32_t> last_seen;
+    std::vector<std::pair<float, uint32_t>> active;
+    jlong last_window = 0;
+    float level = 0;                            // Last water-filling level (samples per class)
+
+    static uint32_t uniform_interval() {
+        return g_sampling_enabled.load(std::memory_order_relaxed)
+            ? (uint32_t)g_sampling_interval.load(std::memory_order_relaxed) : 1;
+    }
+
+    static uint8_t uniform_shift() {
+        uint32_t interval = uniform_interval();
+        return interval <= 1 ? 0 : (uint8_t)(32 - __builtin_clz(interval - 1));
+    }
+
+    /**
+     * Smallest shift that brings rate down to at most t samples
+     */
+    static uint8_t shift_for(float rate, float t) {
+        uint8_t shift = 0;
+        while (shift < STRATIFIED_MAX_SHIFT && rate / (float)((uint32_t)1 << shift) > t) {
+            shift++;
+        }
+        return shift;
+    }
+
+public:
+    /**
+     * @param target Samples per class per window, 0 to match uniform sampling
+     */
+    void enable(uint32_t target) {
+        fixed_target.store(target, std::memory_order_relaxed);
+        enabled.store(true, std::memory_order_release);
+    }
+
+    void disable() {
+        enabled.store(false, std::memory_order_release);
+    }
+
+    bool active_now() const { return enabled.load(std::memory_order_relaxed); }
+    uint32_t target() const { return fixed_target.load(std::memory_order_relaxed); }
+    float last_level() const { return level; }
+
+    /**
+     * Sampling decision for one allocation (class id 0 = unresolved)
+     *
+     * @return weight shift of the sample, or -1 to skip the allocation
+     */
+    int sample(uint32_t class_id) {
+        uint8_t stored = shifts[class_id].load(std::memory_order_relaxed);
+        uint8_t shift = stored == UNADAPTED ? uniform_shift() : (uint8_t)(stored - 1);
+        uint32_t n = seen[class_id].fetch_add(1, std::memory_order_relaxed);
+        if (n & (((uint32_t)1 << shift) - 1)) {
+            return -1;
+        }
+        return shift;
+    }
+
+    /**
+     * Recompute per-class intervals once per window (event processor thread)
+     */
+    void adapt(jlong now_ms) {
+        if (!enabled.load(std::memory_order_acquire) || now_ms - last_window < STRATIFIED_WINDOW_MS) {
+            return;
+        }
+        last_window = now_ms;
+
+        uint32_t count = std::min<uint32_t>(g_classes.size(), MAX_TRACKED_CLASSES);
+        if (rates.size() < count) {
+            rates.resize(count, -1.0f);
+            last_seen.resize(count, 0);
+        }
+        active.clear();
+        double total = 0;
+        for (uint32_t id = 0; id < count; id++) {
+            // Counters are never reset, so the sampling phase carries over
+            // windows and rare classes are not biased towards sample 0
+            uint32_t value = seen[id].load(std::memory_order_relaxed);
+            float window = (float)(value - last_seen[id]);
+            last_seen[id] = value;
+            float rate = rates[id] < 0 ? window : rates[id] * 0.5f + window * 0.5f;
+            rates[id] = rate;
+            if (rate >= 0.5f) {
+                active.emplace_back(rate, id);
+                total += rate;
+            } else {
+                // Gone quiet: back to the uniform interval, not the shift
+                // left over from when the class was allocating heavily
+                shifts[id].store(UNADAPTED, std::memory_order_relaxed);
+            }
+        }
+        if (active.empty()) {
+            return;
+        }
+
+        // Water-filling: find t with sum(min(rate, t)) = budget
+        float t = (float)fixed_target.load(std::memory_order_relaxed);
+        if (t <= 0) {
+            double budget = total / (double)uniform_interval();
+            double remaining = budget;
+            std::sort(active.begin(), active.end());
+            t = active.back().first;
+            for (size_t i = 0; i < active.size(); i++) {
+                double share = remaining / (double)(active.size() - i);
+                if (active[i].first > share) {
+                    t = (float)share;
+                    break;
+                }
+                remaining -= active[i].first;
+            }
+
+            // Intervals round up to powers of two, which leaves up to half
+            // of the budget unused: raise t while the rounded total fits
+            float lo = t, hi = active.back().first;
+            for (int i = 0; i < 16 && hi - lo > lo * 0.01f; i++) {
+                float mid = (lo + hi) / 2;
+                double samples = 0;
+                for (const auto& a : active) samples += a.first / (float)((uint32_t)1 << shift_for(a.first, mid));
+                (samples <= budget ? lo : hi) = mid;
+            }
+            t = lo;
+        }
+        level = t;
+
+        for (const auto& a : active) {
+            shifts[a.second].store((uint8_t)(shift_for(a.first, t) + 1), std::memory_order_relaxed);
+        }
+    }
+};
+
+static StratifiedSampler g_stratified;
+
+// ============================================================================
+// Event Filter
+// ============================================================================
+
+/**
+ * Allocation filter compiled from an expression
+ *
+ *   expr      := term ('|' term)*
+ *   term      := factor ('&' factor)*
+ *   factor    := '!' factor | '(' expr ')' | predicate
+ *   predicate := class:<prefix> | class=<name> | size<op><n>[k|m]
+ *              | thread:<prefix> | stack:<text>
+ *
+ * <op> is one of < <= > >= =. class names are in Class.getName() form;
+ * stack:<text> matches if any frame's "pkg.Class.method" contains text.
+ * Example: "class:com.example.&size>=1k&!thread:GC"
+ *
+ * The expression is compiled into a short-circuit program for a one-
+ * register machine. Operands of & and | are reordered by cost, so class
+ * and size tests run before the thread name lookup, and the stack is only
+ * captured when a stack: test is actually reached. Thread names are cached
+ * per thread (a later rename is not seen); stack verdicts are cached per
+ * method.
+ */
+class EventFilter {
+public:
+    enum Op : uint8_t {
+        OP_CLASS_PREFIX,
+        OP_CLASS_EXACT,
+        OP_SIZE_LT,
+        OP_SIZE_LE,
+        OP_SIZE_GT,
+        OP_SIZE_GE,
+        OP_SIZE_EQ,
+        OP_THREAD_PREFIX,
+        OP_STACK_CONTAINS,
+        OP_NOT,
+        OP_JUMP_IF_FALSE,
+        OP_JUMP_IF_TRUE
+    };
+
+    struct Insn {
+        Op op;
+        uint32_t arg;           // String index, stack term bit or jump target
+        jlong value;            // Size operand
+    };
+
+    /**
+     * Lazily captured inputs of one allocation
+     */
+    struct Subject {
+        jvmtiEnv* jvmti;
+        JNIEnv* jni;
+        uint32_t class_id;
+        jlong size;
+        jvmtiFrameInfo* frames;     // Captured on demand into scratch
+        jint frame_count;
+        bool stack_captured;
+        jvmtiFrameInfo* scratch;    // The callback's ScratchFrames (nullptr: no stack)
+    };
+
+private:
+    struct Node {
+        Op op;
+        std::string text;
+        jlong value = 0;
+        std::vector<Node> children;     // OP_JUMP_IF_FALSE = and, OP_JUMP_IF_TRUE = or, OP_NOT
+    };
+
+    std::string source;
+    std::vector<Insn> code;
+    std::vector<std::string> strings;
+    std::vector<std::string> stack_terms;
+    std::unordered_map<jmethodID, uint64_t> method_bits;    // Stack term bits matching each method
+    std::mutex method_mutex;
+
+    // ------------------------------------------------------------------------
+    // Parser
+    // ------------------------------------------------------------------------
+
+    struct Parser {
+        const char* p;
+        std::string error;
+
+        void skip() {
+            while (*p == ' ' || *p == '\t') p++;
+        }
+
+        std::string word() {
+            skip();
+            const char* start = p;
+            while (*p && *p != '&' && *p != '|' && *p != ')' && *p != ' ' && *p != '\t') p++;
+            return std::string(start, p - start);
+        }
+
+        bool parse_predicate(const std::string& w, Node& node) {
+            if (w.compare(0, 6, "class:") == 0 && w.size() > 6) {
+                node.op = OP_CLASS_PREFIX;
+                node.text = w.substr(6);
+            } else if (w.compare(0, 6, "class=") == 0 && w.size() > 6) {
+                node.op = OP_CLASS_EXACT;
+                node.text = w.substr(6);
+            } else if (w.compare(0, 7, "thread:") == 0 && w.size() > 7) {
+                node.op = OP_THREAD_PREFIX;
+                node.text = w.substr(7);
+            } else if (w.compare(0, 6, "stack:") == 0 && w.size() > 6) {
+                node.op = OP_STACK_CONTAINS;
+                node.text = w.substr(6);
+            } else if (w.compare(0, 4, "size") == 0) {
+                const char* q = w.c_str() + 4;
+                if (q[0] == '<' && q[1] == '=') { node.op = OP_SIZE_LE; q += 2; }
+                else if (q[0] == '>' && q[1] == '=') { node.op = OP_SIZE_GE; q += 2; }
+                else if (q[0] == '<') { node.op = OP_SIZE_LT; q++; }
+                else if (q[0] == '>') { node.op = OP_SIZE_GT; q++; }
+                else if (q[0] == '=') { node.op = OP_SIZE_EQ; q++; }
+                else return false;
+                char* end = nullptr;
+                node.value = (jlong)strtoll(q, &end, 10);
+                if (end == q) return false;
+                if (*end == 'k' || *end == 'K') { node.value *= 1024; end++; }
+                else if (*end == 'm' || *end == 'M') { node.value *= 1024 * 1024; end++; }
+                if (*end) return false;
+            } else {
+                return false;
+            }
+            return true;
+        }
+
+        bool parse_factor(Node& node) {
+            skip();
+            if (*p == '!') {
+                p++;
+                node.op = OP_NOT;
+                node.children.emplace_back();
+                return parse_factor(node.children.back());
+            }
+            if (*p == '(') {
+                p++;
+                if (!parse_expr(node)) return false;
+                skip();
+                if (*p != ')') {
+                    error = "missing )";
+                    return false;
+                }
+                p++;
+                return true;
+            }
+            std::string w = word();
+            if (!parse_predicate(w, node)) {
+                error = "invalid predicate '" + w + "'";
+                return false;
+            }
+            return true;
+        }
+
+        bool parse_list(Node& node, Op op, char separator, bool (Parser::*operand)(Node&)) {
+            Node first;
+            if (!(this->*operand)(first)) return false;
+            skip();
+            if (*p != separator) {
+                node = std::move(first);
+                return true;
+            }
+            node.op = op;
+            node.children.push_back(std::move(first));
+            while (*p == separator) {
+                p++;
+                node.children.emplace_back();
+                if (!(this->*operand)(node.children.back())) return false;
+                skip();
+            }
+            return true;
+        }
+
+        bool parse_term(Node& node) {
+            return parse_list(node, OP_JUMP_IF_FALSE, '&', &Parser::parse_factor);
+        }
+
+        bool parse_expr(Node& node) {
+            return parse_list(node, OP_JUMP_IF_TRUE, '|', &Parser::parse_term);
+        }
+    };
+
+    // ------------------------------------------------------------------------
+    // Compiler
+    // ------------------------------------------------------------------------
+
+    /**
+     * Relative cost: 0 class/size, 1 thread name, 2 stack walk
+     */
+    static int cost(const Node& node) {
+        switch (node.op) {
+            case OP_THREAD_PREFIX: return 1;
+            case OP_STACK_CONTAINS: return 2;
+            case OP_NOT:
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE: {
+                int c = 0;
+                for (const Node& child : node.children) c = std::max(c, cost(child));
+                return c;
+            }
+            default: return 0;
+        }
+    }
+
+    bool emit(Node& node, std::string* error) {
+        switch (node.op) {
+            case OP_NOT:
+                if (!emit(node.children[0], error)) return false;
+                code.push_back({OP_NOT, 0, 0});
+                return true;
+            case OP_JUMP_IF_FALSE:
+            case OP_JUMP_IF_TRUE: {
+                std::stable_sort(node.children.begin(), node.children.end(),
+                                 [](const Node& a, const Node& b) { return cost(a) < cost(b); });
+                std::vector<size_t> jumps;
+                for (size_t i = 0; i < node.children.size(); i++) {
+                    if (!emit(node.children[i], error)) return false;
+                    if (i + 1 < node.children.size()) {
+                        jumps.push_back(code.size());
+                        code.push_back({node.op, 0, 0});
+                    }
+                }
+                for (size_t j : jumps) {
+                    code[j].arg = (uint32_t)code.size();
+                }
+                return true;
+            }
+            case OP_STACK_CONTAINS:
+                if (stack_terms.size() >= FILTER_MAX_STACK_TERMS) {
+                    *error = "too many stack: predicates";
+                    return false;
+                }
+                code.push_back({OP_STACK_CONTAINS, (uint32_t)stack_terms.size(), 0});
+                stack_terms.push_back(node.text);
+                return true;
+            case OP_CLASS_PREFIX:
+            case OP_CLASS_EXACT:
+            case OP_THREAD_PREFIX:
+                code.push_back({node.op, (uint32_t)strings.size(), 0});
+                strings.push_back(node.text);
+                return true;
+            default:
+                code.push_back({node.op, 0, node.value});
+                return true;
+        }
+    }
+
+    // ------------------------------------------------------------------------
+    // Evaluation helpers
+    // ------------------------------------------------------------------------
+
+    static const std::string& current_thread_name(jvmtiEnv* jvmti, JNIEnv* jni) {
+        thread_local std::string name;
+        thread_local bool resolved = false;
+        if (!resolved) {
+            jvmtiThreadInfo info;
+            memset(&info, 0, sizeof(info));
+            if (jvmti->GetThreadInfo(nullptr, &info) == JVMTI_ERROR_NONE) {
+                if (info.name) {
+                    name = info.name;
+                    jvmti->Deallocate((unsigned char*)info.name);
+                }
+                if (jni) {
+                    if (info.thread_group) jni->DeleteLocalRef(info.thread_group);
+                    if (info.context_class_loader) jni->DeleteLocalRef(info.context_class_loader);
+                }
+            }
+            resolved = true;
+        }
+        return name;
+    }
+
+    /**
+     * Stack term bits matched by one method ("pkg.Class.method")
+     */
+    uint64_t bits_for(jvmtiEnv* jvmti, JNIEnv* jni, jmethodID method) {
+        {
+            std::lock_guard<std::mutex> lock(method_mutex);
+            auto it = method_bits.find(method);
+            if (it != method_bits.end()) {
+                return it->second;
+            }
+        }
+
+        std::string text;
+        jclass klass = nullptr;
+        char* sig = nullptr;
+        if (jvmti->GetMethodDeclaringClass(method, &klass) == JVMTI_ERROR_NONE && klass &&
+            jvmti->GetClassSignature(klass, &sig, nullptr) == JVMTI_ERROR_NONE && sig) {
+            for (const char* c = sig[0] == 'L' ? sig + 1 : sig; *c && *c != ';'; c++) {
+                text += *c == '/' ? '.' : *c;
+            }
+            jvmti->Deallocate((unsigned char*)sig);
+        }
+        if (klass && jni) {
+            jni->DeleteLocalRef(klass);
+        }
+        char* name = nullptr;
+        if (jvmti->GetMethodName(method, &name, nullptr, nullptr) == JVMTI_ERROR_NONE && name) {
+            text += '.';
+            text += name;
+            jvmti->Deallocate((unsigned char*)name);
+        }
+
+        uint64_t bits = 0;
+        for (size_t i = 0; i < stack_terms.size(); i++) {
+            if (text.find(stack_terms[i]) != std::string::npos) {
+                bits |= (uint64_t)1 << i;
+            }
+        }
+        std::lock_guard<std::mutex> lock(method_mutex);
+        method_bits.emplace(method, bits);
+        return bits;
+    }
+
+    bool stack_contains(Subject& subject, uint32_t term) {
+        if (!subject.stack_captured) {
+            subject.frames = capture_stack_trace(subject.jvmti, subject.scratch, &subject.frame_count,
+                                                 g_governor.max_stack_depth());
+            subject.stack_captured = true;
+        }
+        uint64_t bit = (uint64_t)1 << term;
+        for (jint i = 0; subject.frames && i < subject.frame_count; i++) {
+            if (bits_for(subject.jvmti, subject.jni, subject.frames[i].method) & bit) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+public:
+    /**
+     * Compile an expression; nullptr (with error set) if it is invalid
+     */
+    static EventFilter* compile(const char* expression, std::string* error) {
+        Parser parser{expression, ""};
+        Node root;
+        if (!parser.parse_expr(root)) {
+            *error = parser.error;
+            return nullptr;
+        }
+        parser.skip();
+        if (*parser.p) {
+            *error = std::string("unexpected '") + parser.p + "'";
+            return nullptr;
+        }
+
+        EventFilter* filter = new EventFilter();
+        filter->source = expression;
+        if (!filter->emit(root, error)) {
+            delete filter;
+            return nullptr;
+        }
+        return filter;
+    }
+
+    const std::string& expression() const { return source; }
+    size_t size() const { return code.size(); }
+
+    bool accepts(Subject& subject) {
+        bool acc = true;
+        size_t pc = 0;
+        while (pc < code.size()) {
+            const Insn& insn = code[pc++];
+            switch (insn.op) {
+                case OP_CLASS_PREFIX: {
+                    const std::string& prefix = strings[insn.arg];
+                    acc = strncmp(g_classes.name(subject.class_id), prefix.c_str(), prefix.size()) == 0;
+                    break;
+                }
+                case OP_CLASS_EXACT:
+                    acc = strcmp(g_classes.name(subject.class_id), strings[insn.arg].c_str()) == 0;
+                    break;
+                case OP_SIZE_LT: acc = subject.size < insn.value; break;
+                case OP_SIZE_LE: acc = subject.size <= insn.value; break;
+                case OP_SIZE_GT: acc = subject.size > insn.value; break;
+                case OP_SIZE_GE: acc = subject.size >= insn.value; break;
+                case OP_SIZE_EQ: acc = subject.size == insn.value; break;
+                case OP_THREAD_PREFIX: {
+                    const std::string& prefix = strings[insn.arg];
+                    acc = current_thread_name(subject.jvmti, subject.jni).compare(0, prefix.size(), prefix) == 0;
+                    break;
+                }
+                case OP_STACK_CONTAINS:
+                    acc = stack_contains(subject, insn.arg);
+                    break;
+                case OP_NOT:
+                    acc = !acc;
+                    break;
+                case OP_JUMP_IF_FALSE:
+                    if (!acc) pc = insn.arg;
+                    break;
+                case OP_JUMP_IF_TRUE:
+                    if (acc) pc = insn.arg;
+                    break;
+            }
+        }
+        return acc;
+    }
+};
+
+/**
+ * Installed filter. Replaced filters are retired, not freed: a callback may
+ * still be evaluating them, and installs are rare.
+ */
+static std::atomic<EventFilter*> g_filter{nullptr};
+static std::atomic<uint64_t> g_filter_rejected{0};
+static std::mutex g_filter_mutex;
+static std::vector<std::unique_ptr<EventFilter>> g_retired_filters;
+
+static bool install_filter(const char* expression, std::string* error) {
+    EventFilter* filter = nullptr;
+    if (expression && *expression) {
+        filter = EventFilter::compile(expression, error);
+        if (!filter) {
+            return false;
+        }
+    }
+    std::lock_guard<std::mutex> lock(g_filter_mutex);
+    EventFilter* previous = g_filter.exchange(filter, std::memory_order_acq_rel);
+    if (previous) {
+        g_retired_filters.emplace_back(previous);
+    }
+    g_filter_rejected.store(0, std::memory_order_relaxed);
+    return true;
+}
+
+// ============================================================================
+// Class Include / Exclude Lists
+// ============================================================================
+
+/**
+ * Include / exclude matcher over class name prefixes
+ *
+ * Rules are prefixes of Class.getName() names; '/' in a name is read as
+ * '.', so internal names ("java/util/HashMap") match the same rules. The
+ * longest matching rule decides and an exclude beats an include of the
+ * same prefix. A class no rule matches is excluded if there is any include
+ * rule, else included.
+ *
+ * Rules live in a compressed prefix trie flattened into arrays (labels in
+ * one pool, edges sorted by first byte), so a lookup costs one pass over
+ * the name whatever the number of rules. Before the walk, a Bloom filter
+ * over the rules' package parts (up to the last '.') is probed with each
+ * package prefix of the name; a name outside every listed package is
+ * decided without touching the trie. Verdicts are cached per agent class
+ * id (2 bits each), so a class already seen costs one load.
+ *
+ * A matcher is immutable apart from its cache: changing the lists builds
+ * a new one, which also starts with an empty cache.
+ */
+class ClassMatcher {
+public:
+    enum Verdict : int8_t {
+        RULE_NONE = 0,
+        RULE_INCLUDE = 1,
+        RULE_EXCLUDE = 2        // Greater: wins over an include of the same prefix
+    };
+
+private:
+    struct Node {
+        uint32_t label_offset;
+        uint32_t label_length;
+        uint32_t first_edge;
+        uint32_t edge_count;
+        int8_t verdict;
+    };
+
+    struct Edge {
+        char first;
+        uint32_t node;
+    };
+
+    struct BuildNode {
+        std::string label;
+        int8_t verdict = RULE_NONE;
+        std::map<char, std::unique_ptr<BuildNode>> children;
+    };
+
+    std::vector<Node> nodes;            // nodes[0] is the root (empty label)
+    std::vector<Edge> edges;
+    std::string labels;
+    std::vector<uint64_t> bloom;
+    uint64_t bloom_mask = 0;            // Bit index mask; 0 = no Bloom filter
+    bool has_includes = false;
+    size_t rule_count = 0;
+    std::atomic<uint64_t> verdicts[MAX_TRACKED_CLASSES / 32];   // 2 bits per class id
+
+    static char normalize(char c) {
+        return c == '/' ? '.' : c;
+    }
+
+    static uint64_t hash_step(uint64_t h, char c) {
+        return (h ^ (unsigned char)c) * 1099511628211ULL;
+    }
+
+    static const uint64_t HASH_SEED = 14695981039346656037ULL;
+
+    bool bloom_test(uint64_t h) const {
+        uint64_t a = h & bloom_mask;
+        uint64_t b = (h >> 32) & bloom_mask;
+        return (bloom[a >> 6] >> (a & 63) & 1) && (bloom[b >> 6] >> (b & 63) & 1);
+    }
+
+    void bloom_add(uint64_t h) {
+        uint64_t a = h & bloom_mask;
+        uint64_t b = (h >> 32) & bloom_mask;
+        bloom[a >> 6] |= (uint64_t)1 << (a & 63);
+        bloom[b >> 6] |= (uint64_t)1 << (b & 63);
+    }
+
+    static void insert(BuildNode* node, const std::string& key, int8_t verdict) {
+        size_t at = 0;
+        while (at < key.size()) {
+            auto it = node->children.find(key[at]);
+            if (it == node->children.end()) {
+                std::unique_ptr<BuildNode> leaf(new BuildNode());
+                leaf->label = key.substr(at);
+                leaf->verdict = verdict;
+                node->children[key[at]] = std::move(leaf);
+                return;
+            }
+            BuildNode* child = it->second.get();
+            size_t common = 0;
+            while (common < child->label.size() && at + common < key.size() &&
+                   child->label[common] == key[at + common]) {
+                common++;
+            }
+            if (common < child->label.size()) {
+                // Split the edge at the first difference
+                std::unique_ptr<BuildNode> middle(new BuildNode());
+                middle->label = child->label.substr(0, common);
+                std::unique_ptr<BuildNode> rest = std::move(it->second);
+                rest->label.erase(0, common);
+                char first = rest->label[0];
+                middle->children[first] = std::move(rest);
+                it->second = std::move(middle);
+                child = it->second.get();
+            }
+            node = child;
+            at += common;
+        }
+        if (verdict > node->verdict) {
+            node->verdict = verdict;
+        }
+    }
+
+    uint32_t flatten(const BuildNode& source) {
+        uint32_t index = (uint32_t)nodes.size();
+        nodes.push_back({(uint32_t)labels.size(), (uint32_t)source.label.size(), 0, 0, source.verdict});
+        labels += source.label;
+
+        // Edges of one node are contiguous; children are flattened after
+        uint32_t first_edge = (uint32_t)edges.size();
+        for (const auto& child : source.children) {
+            edges.push_back({child.first, 0});
+        }
+        nodes[index].first_edge = first_edge;
+        nodes[index].edge_count = (uint32_t)source.children.size();
+        uint32_t e = first_edge;
+        for (const auto& child : source.children) {
+            uint32_t child_index = flatten(*child.second);
+            edges[e++].node = child_index;
+        }
+        return index;
+    }
+
+    const Edge* find_edge(const Node& node, char c) const {
+        const Edge* lo = edges.data() + node.first_edge;
+        const Edge* hi = lo + node.edge_count;
+        while (lo < hi) {
+            const Edge* mid = lo + (hi - lo) / 2;
+            if (mid->first < c) {
+                lo = mid + 1;
+            } else if (mid->first > c) {
+                hi = mid;
+            } else {
+                return mid;
+            }
+        }
+        return nullptr;
+    }
+
+    int8_t longest_rule(const char* name) const {
+        if (bloom_mask) {
+            bool possible = false;
+            uint64_t h = HASH_SEED;
+            for (const char* p = name; *p; p++) {
+                char c = normalize(*p);
+                h = hash_step(h, c);
+                if (c == '.' && bloom_test(h)) {
+                    possible = true;
+                    break;
+                }
+            }
+            if (!possible) {
+                return RULE_NONE;
+            }
+        }
+
+        int8_t best = RULE_NONE;
+        const Node* node = &nodes[0];
+        const char* p = name;
+        for (;;) {
+            if (node->verdict != RULE_NONE) {
+                best = node->verdict;
+            }
+            if (!*p) {
+                break;
+            }
+            const Edge* edge = find_edge(*node, normalize(*p));
+            if (!edge) {
+                break;
+            }
+            const Node* child = &nodes[edge->node];
+            const char* label = labels.data() + child->label_offset;
+            uint32_t i = 1;
+            while (i < child->label_length && p[i] && normalize(p[i]) == label[i]) {
+                i++;
+            }
+            if (i < child->label_length) {
+                break;
+            }
+            p += i;
+            node = child;
+        }
+        return best;
+    }
+
+public:
+    ClassMatcher() {
+        for (auto& word : verdicts) {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * Build a matcher; empty prefixes are ignored
+     */
+    static ClassMatcher* build(const std::vector<std::string>& include,
+                               const std::vector<std::string>& exclude) {
+        ClassMatcher* matcher = new ClassMatcher();
+        BuildNode root;
+        bool every_package = false;     // A rule without '.' can match any package
+        std::vector<uint64_t> package_hashes;
+
+        for (int pass = 0; pass < 2; pass++) {
+            const std::vector<std::string>& rules = pass == 0 ? include : exclude;
+            for (const std::string& rule : rules) {
+                if (rule.empty()) {
+                    continue;
+                }
+                std::string key(rule);
+                for (char& c : key) c = normalize(c);
+                insert(&root, key, pass == 0 ? RULE_INCLUDE : RULE_EXCLUDE);
+                matcher->rule_count++;
+                if (pass == 0) {
+                    matcher->has_includes = true;
+                }
+
+                size_t dot = key.rfind('.');
+                if (dot == std::string::npos) {
+                    every_package = true;
+                } else {
+                    uint64_t h = HASH_SEED;
+                    for (size_t i = 0; i <= dot; i++) h = hash_step(h, key[i]);
+                    package_hashes.push_back(h);
+                }
+            }
+        }
+
+        matcher->flatten(root);
+
+        if (!every_package && !package_hashes.empty()) {
+            // ~16 bits per package: a few percent false positives with 2 probes
+            size_t bits = 1024;
+            while (bits < package_hashes.size() * 16) bits <<= 1;
+            matcher->bloom.assign(bits / 64, 0);
+            matcher->bloom_mask = bits - 1;
+            for (uint64_t h : package_hashes) {
+                matcher->bloom_add(h);
+            }
+        }
+        return matcher;
+    }
+
+    size_t rules() const { return rule_count; }
+    size_t node_count() const { return nodes.size(); }
+
+    bool excludes_name(const char* name) const {
+        int8_t verdict = longest_rule(name);
+        if (verdict == RULE_NONE) {
+            return has_includes;
+        }
+        return verdict == RULE_EXCLUDE;
+    }
+
+    /**
+     * Verdict for an allocation's class. Class id 0 (unresolved) is never
+     * excluded.
+     */
+    bool excludes(uint32_t class_id) {
+        if (class_id == 0 || class_id >= MAX_TRACKED_CLASSES) {
+            return false;
+        }
+        std::atomic<uint64_t>& word = verdicts[class_id >> 5];
+        unsigned shift = (class_id & 31) * 2;
+        uint64_t cached = (word.load(std::memory_order_relaxed) >> shift) & 3;
+        if (cached) {
+            return cached == 3;
+        }
+        bool excluded = excludes_name(g_classes.name(class_id));
+        word.fetch_or((uint64_t)(excluded ? 3 : 1) << shift, std::memory_order_relaxed);
+        return excluded;
+    }
+};
+
+/**
+ * Installed matcher (nullptr: no lists) and the lists it was built from.
+ * Replaced matchers are retired like filters.
+ */
+static std::atomic<ClassMatcher*> g_class_matcher{nullptr};
+static std::atomic<uint64_t> g_class_excluded{0};
+static std::mutex g_class_lists_mutex;
+static std::vector<std::string> g_include_rules;
+static std::vector<std::string> g_exclude_rules;
+static std::vector<std::unique_ptr<ClassMatcher>> g_retired_matchers;
+
+static void rebuild_class_matcher() {
+    ClassMatcher* matcher = nullptr;
+    if (!g_include_rules.empty() || !g_exclude_rules.empty()) {
+        matcher = ClassMatcher::build(g_include_rules, g_exclude_rules);
+    }
+    ClassMatcher* previous = g_class_matcher.exchange(matcher, std::memory_order_acq_rel);
+    if (previous) {
+        g_retired_matchers.emplace_back(previous);
+    }
+    g_class_excluded.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * Add ';'-separated prefixes to the include or exclude list
+ *
+ * @return number of prefixes added
+ */
+static size_t add_class_rules(bool exclude, const char* list) {
+    std::lock_guard<std::mutex> lock(g_class_lists_mutex);
+    std::vector<std::string>& rules = exclude ? g_exclude_rules : g_include_rules;
+    size_t added = 0;
+    const char* p = list;
+    while (*p) {
+        const char* end = strchr(p, ';');
+        size_t length = end ? (size_t)(end - p) : strlen(p);
+        if (length > 0) {
+            rules.emplace_back(p, length);
+            added++;
+        }
+        p += length;
+        if (*p == ';') p++;
+    }
+    if (added > 0) {
+        rebuild_class_matcher();
+    }
+    return added;
+}
+
+/**
+ * Add the prefixes of a list file (one per line, '#' starts a comment)
+ *
+ * @return number of prefixes added, or -1 if the file cannot be read
+ */
+static long load_class_rules(bool exclude, const char* path) {
+    std::ifstream in(path);
+    if (!in) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(g_class_lists_mutex);
+    std::vector<std::string>& rules = exclude ? g_exclude_rules : g_include_rules;
+    long added = 0;
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos) {
+            continue;
+        }
+        size_t end = line.find_last_not_of(" \t\r");
+        rules.push_back(line.substr(start, end - start + 1));
+        added++;
+    }
+    if (added > 0) {
+        rebuild_class_matcher();
+    }
+    return added;
+}
+
+static void clear_class_rules() {
+    std::lock_guard<std::mutex> lock(g_class_lists_mutex);
+    g_include_rules.clear();
+    g_exclude_rules.clear();
+    rebuild_class_matcher();
+}
+
+// ============================================================================
+// Runtime Controls
+// ============================================================================
+
+/**
+ * Runtime switches for the JVMTI events and the per-allocation capture steps.
+ *
+ * A disabled event is turned off with SetEventNotificationMode, so the VM
+ * stops calling its callback altogether; a disabled feature is skipped inside
+ * CallbackObjectAlloc (stacks, upcalls) or on the processor (symbols).
+ *
+ *   events    alloc (VMObjectAlloc), free (ObjectFree), gc (GC start + finish)
+ *   features  stacks (GetStackTrace), upcalls (HeapAnalyzer.onObjectAlloc),
+ *             symbols (site names and the upcall's stack string)
+ *
+ * Objects allocated while ObjectFree is off are not tagged or tracked; those
+ * freed while it is off stay counted as live, so gc_only() leaves it on: it
+ * only fires for objects tagged before.
+ * escalate() turns everything on and restores the previous settings when its
+ * deadline passes (tick() on the event processor); any explicit change in the
+ * meantime cancels the revert.
+ */
+class RuntimeControls {
+public:
+    enum Event { CONTROL_ALLOC, CONTROL_FREE, CONTROL_GC, CONTROL_EVENT_COUNT };
+    enum Feature { FEATURE_STACKS, FEATURE_UPCALLS, FEATURE_SYMBOLS, FEATURE_COUNT };
+
+private:
+    struct Settings {
+        bool events[CONTROL_EVENT_COUNT];
+        bool features[FEATURE_COUNT];
+    };
+
+    std::atomic<bool> events[CONTROL_EVENT_COUNT];
+    std::atomic<bool> features[FEATURE_COUNT];
+    std::mutex mutex;                   // Serializes changes, escalation and revert
+    jvmtiEnv* jvmti = nullptr;          // Set by install(); events apply from then on
+    Settings saved;                     // Settings before escalate()
+    std::atomic<jlong> revert_at{0};    // Escalation deadline (0 = none)
+
+    static const char* const EVENT_NAMES[CONTROL_EVENT_COUNT];
+    static const char* const FEATURE_NAMES[FEATURE_COUNT];
+
+    void apply_locked(int event) {
+        if (!jvmti) {
+            return;
+        }
+        jvmtiEventMode mode = events[event].load(std::memory_order_relaxed) ? JVMTI_ENABLE : JVMTI_DISABLE;
+        switch (event) {
+            case CONTROL_ALLOC:
+                jvmti->SetEventNotificationMode(mode, JVMTI_EVENT_VM_OBJECT_ALLOC, nullptr);
+                break;
+            case CONTROL_FREE:
+                jvmti->SetEventNotificationMode(mode, JVMTI_EVENT_OBJECT_FREE, nullptr);
+                break;
+            case CONTROL_GC:
+                jvmti->SetEventNotificationMode(mode, JVMTI_EVENT_GARBAGE_COLLECTION_START, nullptr);
+                jvmti->SetEventNotificationMode(mode, JVMTI_EVENT_GARBAGE_COLLECTION_FINISH, nullptr);
+                break;
+        }
+    }
+
+    void set_event_locked(int event, bool on) {
+        if (events[event].exchange(on, std::memory_order_relaxed) != on) {
+            apply_locked(event);
+        }
+    }
+
+    Settings current_locked() const {
+        Settings s;
+        for (int i = 0; i < CONTROL_EVENT_COUNT; i++) s.events[i] = events[i].load(std::memory_order_relaxed);
+        for (int i = 0; i < FEATURE_COUNT; i++) s.features[i] = features[i].load(std::memory_order_relaxed);
+        return s;
+    }
+
+    void restore_locked(const Settings& s) {
+        for (int i = 0; i < CONTROL_EVENT_COUNT; i++) set_event_locked(i, s.events[i]);
+        for (int i = 0; i < FEATURE_COUNT; i++) features[i].store(s.features[i], std::memory_order_relaxed);
+    }
+
+public:
+    RuntimeControls() {
+        for (auto& e : events) e.store(true, std::memory_order_relaxed);
+        for (auto& f : features) f.store(true, std::memory_order_relaxed);
+    }
+
+    static int event_index(const char* name) {
+        for (int i = 0; i < CONTROL_EVENT_COUNT; i++) {
+            if (strcmp(name, EVENT_NAMES[i]) == 0) return i;
+        }
+        return -1;
+    }
+
+    static int feature_index(const char* name) {
+        for (int i = 0; i < FEATURE_COUNT; i++) {
+            if (strcmp(name, FEATURE_NAMES[i]) == 0) return i;
+        }
+        return -1;
+    }
+
+    /**
+     * Enable the wanted events on env (from enable_events, at load or attach)
+     */
+    void install(jvmtiEnv* env) {
+        std::lock_guard<std::mutex> lock(mutex);
+        jvmti = env;
+        for (int i = 0; i < CONTROL_EVENT_COUNT; i++) {
+            if (events[i].load(std::memory_order_relaxed)) apply_locked(i);
+        }
+    }
+
+    void set_event(int event, bool on) {
+        std::lock_guard<std::mutex> lock(mutex);
+        revert_at.store(0, std::memory_order_relaxed);
+        set_event_locked(event, on);
+    }
+
+    void set_feature(int feature, bool on) {
+        std::lock_guard<std::mutex> lock(mutex);
+        revert_at.store(0, std::memory_order_relaxed);
+        features[feature].store(on, std::memory_order_relaxed);
+    }
+
+    /**
+     * GC events only: no allocation callbacks, frees of tracked objects still drain
+     */
+    void gc_only() {
+        std::lock_guard<std::mutex> lock(mutex);
+        revert_at.store(0, std::memory_order_relaxed);
+        set_event_locked(CONTROL_ALLOC, false);
+        set_event_locked(CONTROL_FREE, true);
+        set_event_locked(CONTROL_GC, true);
+    }
+
+    /**
+     * Everything on; for seconds > 0 the previous settings return at the deadline.
+     * Escalating again while escalated only moves the deadline.
+     */
+    void escalate(jlong seconds, jlong now) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (seconds > 0 && revert_at.load(std::memory_order_relaxed) == 0) {
+            saved = current_locked();
+        }
+        Settings all;
+        for (bool& e : all.events) e = true;
+        for (bool& f : all.features) f = true;
+        restore_locked(all);
+        revert_at.store(seconds > 0 ? now + seconds * 1000 : 0, std::memory_order_relaxed);
+    }
+
+    /**
+     * Event processor: revert an escalation whose deadline has passed
+     */
+    bool tick(jlong now) {
+        jlong deadline = revert_at.load(std::memory_order_relaxed);
+        if (deadline == 0 || now < deadline) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (revert_at.load(std::memory_order_relaxed) != deadline) {
+            return false;
+        }
+        revert_at.store(0, std::memory_order_relaxed);
+        restore_locked(saved);
+        return true;
+    }
+
+    /**
+     * Turn the controlled events off without changing the settings ("stop")
+     */
+    void suspend() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!jvmti) {
+            return;
+        }
+        jvmti->SetEventNotificationMode(JVMTI_DISABLE, JVMTI_EVENT_VM_OBJECT_ALLOC, nullptr);
+        jvmti->SetEventNotificationMode(JVMTI_DISABLE, JVMTI_EVENT_OBJECT_FREE, nullptr);
+        jvmti->SetEventNotificationMode(JVMTI_DISABLE, JVMTI_EVENT_GARBAGE_COLLECTION_START, nullptr);
+        jvmti->SetEventNotificationMode(JVMTI_DISABLE, JVMTI_EVENT_GARBAGE_COLLECTION_FINISH, nullptr);
+        jvmti = nullptr;
+    }
+
+    inline bool event_enabled(int event) const {
+        return events[event].load(std::memory_order_relaxed);
+    }
+
+    inline bool stacks() const { return features[FEATURE_STACKS].load(std::memory_order_relaxed); }
+    inline bool upcalls() const { return features[FEATURE_UPCALLS].load(std::memory_order_relaxed); }
+    inline bool symbols() const { return features[FEATURE_SYMBOLS].load(std::memory_order_relaxed); }
+
+    void print_status(jlong now) const {
+        fprintf(stderr, "[JVM TI] Events: alloc=%s free=%s gc=%s; features: stacks=%s upcalls=%s symbols=%s",
+                event_enabled(CONTROL_ALLOC) ? "on" : "off", event_enabled(CONTROL_FREE) ? "on" : "off",
+                event_enabled(CONTROL_GC) ? "on" : "off", stacks() ? "on" : "off",
+                upcalls() ? "on" : "off", symbols() ? "on" : "off");
+        jlong deadline = revert_at.load(std::memory_order_relaxed);
+        if (deadline > now) {
+            fprintf(stderr, " (reverting in %llds)", (long long)((deadline - now + 999) / 1000));
+        }
+        fprintf(stderr, "\n");
+    }
+};
+
+const char* const RuntimeControls::EVENT_NAMES[CONTROL_EVENT_COUNT] = {"alloc", "free", "gc"};
+const char* const RuntimeControls::FEATURE_NAMES[FEATURE_COUNT] = {"stacks", "upcalls", "symbols"};
+
+static RuntimeControls g_controls;
+
+// ============================================================================
+// JVMTI Event Callbacks
+// ============================================================================
+
+/**
  * Object Allocation Event Handler
+ *
+ * Specialized at compile time on the settings that only change on
+ * reconfiguration: stack capture, the native hook (g_event_callback), the
+ * Java upcall (HeapAnalyzer.onObjectAlloc), the event filter, and tracking
+ * (tagging the object and keeping a tracker entry, which only ObjectFree
+ * consumes). select_alloc_callback() picks the specialization for the
+ * current settings; refresh_alloc_callback() swaps it in when they change.
+ * Hook and Java are only selected once their targets are set, and the
+ * targets are only cleared on unload after the events are disabled, so the
+ * specializations call them without re-checking.
+ */
+// 这是 C++ 代码，运行在 JVM 内部
+// 每当有对象分配，JVM 会自动调用这个回调函数
+template <bool Stacks, bool Hook, bool Java, bool Filter, bool Track>
+void JNICALL CallbackObjectAlloc(jvmtiEnv* jvmti_env, JNIEnv* jni_env,
+                                  jthread thread, jobject object,
+                                  jclass object_klass, jlong size) {
+    if (!g_agent_active.load(std::memory_order_relaxed)) {
+        return;
+    }
+    CallbackCostProbe probe;
+
+    // Sampling check: per class (stratified) or every Nth allocation.
+    // The class id is a GetTag on the class object once registered.
+    uint32_t class_id;
+    uint8_t weight_shift = 0;
+    if (g_stratified.active_now()) {
+        class_id = g_classes.id_for(jvmti_env, object_klass);
+        int shift = g_stratified.sample(class_id);
+        if (shift < 0) {
+            return;
+        }
+        weight_shift = (uint8_t)shift;
+    } else {
+        if (g_sampling_enabled.load(std::memory_order_relaxed)) {
+            uint64_t counter = g_alloc_counter.fetch_add(1, std::memory_order_relaxed);
+            if (counter % g_sampling_interval.load(std::memory_order_relaxed) != 0) {
+                return;
+            }
+        }
+        class_id = g_classes.id_for(jvmti_env, object_klass);
+    }
+
+    // Include / exclude lists (a cached bit per class after the first lookup)
+    if (ClassMatcher* matcher = g_class_matcher.load(std::memory_order_acquire)) {
+        if (matcher->excludes(class_id)) {
+            g_class_excluded.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    // Installed filter, before any stack capture (unless it tests the stack)
+    ScratchFrames scratch;
+    jint frame_count = 0;
+    jvmtiFrameInfo* frames = nullptr;
+    bool stack_captured = false;
+    EventFilter* filter = Filter ? g_filter.load(std::memory_order_acquire) : nullptr;
+    if (Filter && filter) {
+        EventFilter::Subject subject = {jvmti_env, jni_env, class_id, size, nullptr, 0, false, scratch.get()};
+        bool accepted = filter->accepts(subject);
+        frames = subject.frames;
+        frame_count = subject.frame_count;
+        stack_captured = subject.stack_captured;
+        if (!accepted) {
+            g_filter_rejected.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    // Tag the sampled object so ObjectFree reports it (untagged objects
+    // are freed silently). Tags are sequential and never reused; without
+    // tracking they only identify the event.
+    jlong tag = g_next_object_tag.fetch_add(1, std::memory_order_relaxed);
+    if (Track) {
+        jvmti_env->SetTag(object, tag);
+    }
+
+    // Capture stack trace
+    if (Stacks && !stack_captured) {
+        frames = capture_stack_trace(jvmti_env, scratch.get(), &frame_count, g_governor.max_stack_depth());
+    }
+
+    // Create allocation info
+    AllocationInfo info;
+    info.size = size;
+    info.timestamp = get_current_timestamp();
+    info.class_id = class_id;
+    info.site_hash = hash_frames(frames, frame_count);
+    info.gc_epoch = g_gc_epoch.load(std::memory_order_relaxed);
+    info.weight_shift = weight_shift;
+
+    // Track allocation
+    if (Track) {
+        g_tracker.track(tag, info);
+    }
+
+    // Create event
+    AllocationEvent event;
+    event.type = EVENT_ALLOC;
+    event.tag = tag;
+    event.size = size;
+    event.timestamp = info.timestamp;
+    event.class_id = class_id;
+    event.site_hash = info.site_hash;
+    event.frame_count = frame_count;
+    event.thread_id = get_current_thread_id();
+    event.weight_shift = weight_shift;
+
+    // Copy frames into this thread's arena (released by the event processor)
+    if (frames && frame_count > 0) {
+        event.frames = g_frame_arena.copy(frames, frame_count);
+        if (!event.frames) {
+            event.frame_count = 0;
+        }
+    }
+
+    // Push to event queue
+    if (!g_event_queue.push(event) && event.frames) {
+        g_frame_arena.release(event.frames);
+        event.frames = nullptr;
+    }
+
+    // Native hook
+    if (Hook) {
+        g_event_callback(event);
+    }
+
+    // ===== Call Java layer via JNI =====
+    // Notify Java layer about this allocation
+    if (Java) {
+        JNIEnv* env = nullptr;
+        bool attached = false;
+
+        // Get JNIEnv for current thread
+        if (g_java_vm->GetEnv((void**)&env, JNI_VERSION_1_8) != JNI_OK) {
+            // Not attached, attach current thread
+            if (g_java_vm->AttachCurrentThread((void**)&env, nullptr) == JNI_OK) {
+                attached = true;
+            }
+        }
+
+        if (env) {
+            // Class name in Class.getName() form, resolved once per class
+            const char* class_name = g_classes.name(class_id);
+
+            // Build stack trace string (dropped first by the governor)
+            const char* stack_trace = g_governor.build_stack_strings() && g_controls.symbols()
+                ? build_stack_trace_string(jvmti_env, env, frames, frame_count) : nullptr;
+
+            // Get thread info
+            std::string thread_name = "unknown";
+            jlong thread_id = get_current_thread_id();
+
+            // Call Java method
+            jstring classNameStr = env->NewStringUTF(class_name);
+            jstring threadNameStr = env->NewStringUTF(thread_name.c_str());
+            jstring stackTraceStr = stack_trace ? env->NewStringUTF(stack_trace) : nullptr;
+
+            env->CallStaticVoidMethod(
+                g_heap_analyzer_class,
+                g_on_object_alloc_method,
+                tag,
+                classNameStr,
+                size,
+                thread_id,
+                threadNameStr,
+                stackTraceStr,
+                (jint)1 << weight_shift
+            );
+
+            // Clean up local refs
+            env->DeleteLocalRef(classNameStr);
+            env->DeleteLocalRef(threadNameStr);
+            if (stackTraceStr) env->DeleteLocalRef(stackTraceStr);
+
+            // Detach if we attached
+            if (attached) {
+                g_java_vm->DetachCurrentThread();
+            }
+        }
+    }
+}
+
+#define ALLOC_VARIANT(m) CallbackObjectAlloc<((m) & 16) != 0, ((m) & 8) != 0, ((m) & 4) != 0, \
+                                            ((m) & 2) != 0, ((m) & 1) != 0>
+
+/**
+ * The CallbackObjectAlloc specialization for the current settings
+ */
+static jvmtiEventVMObjectAlloc select_alloc_callback() {
+    static const jvmtiEventVMObjectAlloc variants[32] = {
+        ALLOC_VARIANT(0), ALLOC_VARIANT(1), ALLOC_VARIANT(2), ALLOC_VARIANT(3),
+        ALLOC_VARIANT(4), ALLOC_VARIANT(5), ALLOC_VARIANT(6), ALLOC_VARIANT(7),
+        ALLOC_VARIANT(8), ALLOC_VARIANT(9), ALLOC_VARIANT(10), ALLOC_VARIANT(11),
+        ALLOC_VARIANT(12), ALLOC_VARIANT(13), ALLOC_VARIANT(14), ALLOC_VARIANT(15),
+        ALLOC_VARIANT(16), ALLOC_VARIANT(17), ALLOC_VARIANT(18), ALLOC_VARIANT(19),
+        ALLOC_VARIANT(20), ALLOC_VARIANT(21), ALLOC_VARIANT(22), ALLOC_VARIANT(23),
+        ALLOC_VARIANT(24), ALLOC_VARIANT(25), ALLOC_VARIANT(26), ALLOC_VARIANT(27),
+        ALLOC_VARIANT(28), ALLOC_VARIANT(29), ALLOC_VARIANT(30), ALLOC_VARIANT(31)
+    };
+    bool hook = g_controls.upcalls() && g_event_callback;
+    bool java = g_controls.upcalls() && g_java_vm && g_heap_analyzer_class && g_on_object_alloc_method;
+    int mode = (g_controls.stacks() ? 16 : 0) |
+               (hook ? 8 : 0) |
+               (java ? 4 : 0) |
+               (g_filter.load(std::memory_order_acquire) ? 2 : 0) |
+               (g_controls.event_enabled(RuntimeControls::CONTROL_FREE) ? 1 : 0);
+    return variants[mode];
+}
+
+#undef ALLOC_VARIANT
+
+static jvmtiEventCallbacks g_callbacks;         // As passed to SetEventCallbacks
+static bool g_callbacks_installed = false;
+static std::mutex g_callbacks_mutex;
+
+/**
+ * Install the callback table (setup_callbacks), or re-install it if the
+ * allocation callback's specialization changed. Cheap when nothing changed;
+ * called after every agent command and escalation revert.
+ */
+static void install_callbacks(jvmtiEnv* jvmti, const jvmtiEventCallbacks* callbacks) {
+    std::lock_guard<std::mutex> lock(g_callbacks_mutex);
+    g_callbacks = *callbacks;
+    g_callbacks.VMObjectAlloc = select_alloc_callback();
+    jvmti->SetEventCallbacks(&g_callbacks, sizeof(g_callbacks));
+    g_callbacks_installed = true;
+}
+
+static void refresh_alloc_callback() {
+    std::lock_guard<std::mutex> lock(g_callbacks_mutex);
+    if (!g_callbacks_installed || !g_jvmti) {
+        return;
+    }
+    jvmtiEventVMObjectAlloc selected = select_alloc_callback();
+    if (g_callbacks.VMObjectAlloc != selected) {
+        g_callbacks.VMObjectAlloc = selected;
+        g_jvmti->SetEventCallbacks(&g_callbacks, sizeof(g_callbacks));
+    }
+}
+
+/**
+ * Garbage Collection Start Event Handler
+ */
+void JNICALL CallbackGarbageCollectionStart(jvmtiEnv* jvmti_env) {
+    if (!g_agent_active.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    uint32_t epoch = g_gc_epoch.fetch_add(1, std::memory_order_relaxed) + 1;
+
+    AllocationEvent event;
+    event.type = EVENT_GC_START;
+    event.timestamp = get_current_timestamp();
+    event.gc_epoch = epoch;
+    g_event_queue.push(event);
+}
+
+/**
+ * Garbage Collection Finish Event Handler
+ */
+void JNICALL CallbackGarbageCollectionFinish(jvmtiEnv* jvmti_env) {
+    if (!g_agent_active.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    AllocationEvent event;
+    event.type = EVENT_GC_FINISH;
+    event.timestamp = get_current_timestamp();
+    event.gc_epoch = g_gc_epoch.load(std::memory_order_relaxed);
+    g_event_queue.push(event);
+}
+
+/**
+ * Object Free Event Handler (VMObjectFree)
+ * Note: This requires -XX:+UnlockDiagnosticVMOptions -XX:+TrackObjectFree
+ */
+void JNICALL CallbackObjectFree(jvmtiEnv* jvmti_env, jlong tag) {
+    if (!g_agent_active.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    // Fast path: buffer the tag, the event processor untracks it in bulk
+    uint32_t epoch = g_gc_epoch.load(std::memory_order_relaxed);
+    if (g_free_buffer.append(tag, epoch)) {
+        return;
+    }
+
+    AllocationInfo info;
+    if (g_tracker.untrack(tag, info)) {
+        AllocationEvent event;
+        event.type = EVENT_FREE;
+        event.tag = tag;
+        event.size = info.size;
+        event.timestamp = get_current_timestamp();
+        event.alloc_timestamp = info.timestamp;
+        event.class_id = info.class_id;
+        event.site_hash = info.site_hash;
+        event.thread_id = get_current_thread_id();
+
+        // The collecting cycle itself is not survived
+        event.gcs_survived = epoch > info.gc_epoch ? epoch - info.gc_epoch - 1 : 0;
+        event.weight_shift = info.weight_shift;
+        g_event_queue.push(event);
+    }
+}
+
+/**
+ * VM Init Event Handler
+ * After this point the event processor thread may attach to the VM.
+ */
+void JNICALL CallbackVMInit(jvmtiEnv* jvmti_env, JNIEnv* jni_env, jthread thread) {
+    g_vm_live.store(true, std::memory_order_release);
+}
+
+/**
+ * VM Death Event Handler
+ */
+void JNICALL CallbackVMDeath(jvmtiEnv* jvmti_env, JNIEnv* jni_env) {
+    g_agent_active.store(false, std::memory_order_release);
+    safe_print("VM Death - Agent shutting down");
+}
+
+// ============================================================================
+// Recording Spooler
+// ============================================================================
+
+/**
+ * Heap usage as reported by java.lang.Runtime
+ */
+struct HeapUsage {
+    jlong used;
+    jlong committed;
+    jlong max;
+
+    HeapUsage() : used(0), committed(0), max(0) {}
+};
+
+/**
+ * Read heap usage through JNI (Runtime.totalMemory/freeMemory/maxMemory).
+ * Must be called on a thread attached to the VM.
+ */
+static HeapUsage read_heap_usage(JNIEnv* jni) {
+    HeapUsage usage;
+    if (!jni || !g_vm_live.load(std::memory_order_acquire)) {
+        return usage;
+    }
+
+    jclass runtime_class = jni->FindClass("java/lang/Runtime");
+    if (!runtime_class) {
+        jni->ExceptionClear();
+        return usage;
+    }
+    jmethodID get_runtime = jni->GetStaticMethodID(runtime_class, "getRuntime", "()Ljava/lang/Runtime;");
+    jmethodID total_memory = jni->GetMethodID(runtime_class, "totalMemory", "()J");
+    jmethodID free_memory = jni->GetMethodID(runtime_class, "freeMemory", "()J");
+    jmethodID max_memory = jni->GetMethodID(runtime_class, "maxMemory", "()J");
+
+    if (get_runtime && total_memory && free_memory && max_memory) {
+        jobject runtime = jni->CallStaticObjectMethod(runtime_class, get_runtime);
+        if (runtime) {
+            usage.committed = jni->CallLongMethod(runtime, total_memory);
+            usage.used = usage.committed - jni->CallLongMethod(runtime, free_memory);
+            usage.max = jni->CallLongMethod(runtime, max_memory);
+            jni->DeleteLocalRef(runtime);
+        }
+    }
+    if (jni->ExceptionCheck()) {
+        jni->ExceptionClear();
+    }
+    jni->DeleteLocalRef(runtime_class);
+    return usage;
+}
+
+/**
+ * Spills processed events to self-contained chunk files
+ * ("<dir>/chunk-<pid>-<seq>.jmr") for offline analysis with jma-analyzer,
+ * and appends each sealed chunk's summary to the time index
+ * ("<dir>/index-<pid>.jmi") used for time-range queries.
+ *
+ * Events are appended by the event processor thread; start/stop may come
+ * from any thread via agent commands.
+ */
+class RecordingSpooler {
+private:
+    std::mutex mutex;
+    std::string directory;
+    bool active = false;
+    jma::ChunkWriter writer;
+    jma::IndexWriter index;
+    uint64_t next_sequence = 0;
+    jlong chunk_opened_at = 0;
+    std::vector<std::pair<std::string, std::string>> properties;
+    std::atomic<size_t> max_events{RECORDING_CHUNK_EVENTS};
+    std::atomic<jlong> max_age_ms{RECORDING_CHUNK_MS};
+    std::atomic<uint64_t> chunks_written{0};
+
+    void open_chunk() {
+        writer.reset(next_sequence++);
+        jma::ChunkHeader& header = writer.mutable_header();
+        header.pid = (uint32_t)getpid();
+        header.sampling_interval = (uint32_t)g_sampling_interval.load(std::memory_order_relaxed);
+        for (const auto& p : properties) {
+            writer.add_property(p.first, p.second);
+        }
+        chunk_opened_at = get_current_timestamp();
+    }
+
+    // Caller holds mutex
+    void seal_chunk(JNIEnv* jni) {
+        if (writer.empty()) {
+            return;
+        }
+
+        HeapUsage usage = read_heap_usage(jni);
+        jma::ChunkHeader& header = writer.mutable_header();
+        header.heap_used = usage.used;
+        header.heap_committed = usage.committed;
+        header.heap_max = usage.max;
+
+        std::string path = directory + "/" + jma::chunk_file_name(header.pid, header.sequence);
+        if (writer.write_file(path)) {
+            chunks_written.fetch_add(1, std::memory_order_relaxed);
+            if (index.is_open() && !index.append_chunk(writer)) {
+                safe_print("Failed to update recording index");
+            }
+        } else {
+            safe_print("Failed to write recording chunk");
+        }
+        open_chunk();
+    }
+
+public:
+    bool start(const char* dir) {
+        if (!dir || !*dir) {
+            return false;
+        }
+        if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        directory = dir;
+        uint32_t pid = (uint32_t)getpid();
+        if (!index.open(directory + "/" + jma::index_file_name(pid), pid)) {
+            safe_print("Failed to open recording index; time-range queries will be unavailable");
+        }
+        active = true;
+        open_chunk();
+        return true;
+    }
+
+    void stop(JNIEnv* jni) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!active) {
+            return;
+        }
+        seal_chunk(jni);
+        index.close();
+        active = false;
+    }
+
+    void flush(JNIEnv* jni) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (active) {
+            seal_chunk(jni);
+        }
+    }
+
+    void set_properties(const std::vector<std::pair<std::string, std::string>>& props) {
+        std::lock_guard<std::mutex> lock(mutex);
+        properties = props;
+        if (active && writer.empty()) {
+            open_chunk();
+        }
+    }
+
+    void set_limits(size_t events, jlong age_ms) {
+        if (events > 0) max_events.store(events, std::memory_order_relaxed);
+        if (age_ms > 0) max_age_ms.store(age_ms, std::memory_order_relaxed);
+    }
+
+    bool is_active() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return active;
+    }
+
+    /**
+     * Append one processed event (site_index is the global SiteTable index,
+     * or jma::NO_INDEX)
+     */
+    void append(const AllocationEvent& event, uint32_t site_index, JNIEnv* jni) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!active) {
+            return;
+        }
+
+        jma::RecordedEvent rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.type = (uint8_t)event.type;
+        rec.weight_shift = event.weight_shift;
+        rec.thread_id = (uint32_t)event.thread_id;
+        rec.timestamp = event.timestamp;
+        rec.tag = event.tag;
+        rec.size = event.size;
+        rec.aux = event.alloc_timestamp;
+        rec.class_index = jma::NO_INDEX;
+        rec.site_index = jma::NO_INDEX;
+
+        if (event.class_id != 0) {
+            rec.class_index = writer.intern_class(event.class_id, g_classes.name(event.class_id));
+        }
+        if (site_index != jma::NO_INDEX) {
+            rec.site_index = writer.intern_site(site_index, g_sites.name(site_index));
+        }
+        writer.append(rec);
+
+        if (writer.event_count() >= max_events.load(std::memory_order_relaxed)) {
+            seal_chunk(jni);
+        }
+    }
+
+    /**
+     * Seal the current chunk if it has been open for too long
+     */
+    void maybe_roll(jlong now, JNIEnv* jni) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (active && !writer.empty() &&
+            now - chunk_opened_at >= max_age_ms.load(std::memory_order_relaxed)) {
+            seal_chunk(jni);
+        }
+    }
+
+    uint64_t get_chunks_written() const {
+        return chunks_written.load(std::memory_order_relaxed);
+    }
+};
+
+static RecordingSpooler g_spooler;
+
+// ============================================================================
+// Time-Series Store
+// ============================================================================
+
+/**
+ * Metrics kept by the time-series store (ids shared with NativeMemoryTracker)
+ */
+enum Metric {
+    METRIC_ALLOC_COUNT = 0,     // Sampled allocations per second
+    METRIC_ALLOC_BYTES = 1,     // Sampled bytes allocated per second
+    METRIC_FREE_COUNT = 2,      // Tracked objects freed per second
+    METRIC_FREE_BYTES = 3,
+    METRIC_LIVE_BYTES = 4,      // Tracked live bytes (gauge)
+    METRIC_GC_COUNT = 5,        // GC cycles per second
+    METRIC_GC_PAUSE_MS = 6,     // One sample per GC cycle
+    METRIC_QUEUE_DEPTH = 7,     // Event queue depth (gauge)
+    METRIC_HEAP_USED = 8,       // Runtime heap usage (gauge)
+    METRIC_HEAP_COMMITTED = 9,
+    METRIC_COUNT = 10
+};
+
+/**
+ * Ring resolution and length per level: 10 minutes at 1s, 2 hours at 10s,
+ * 1 day at 1m, 1 week at 10m
+ */
+static const struct {
+    jlong seconds;
+    size_t slots;
+} TS_LEVEL_SPEC[TS_LEVELS] = {
+    {1, 600}, {10, 720}, {60, 1440}, {600, 1008}
+};
+
+/**
+ * Fixed-memory, multi-resolution metric store (RRD style)
+ *
+ * Every sample updates one bucket per resolution level (constant time);
+ * a bucket keeps min/max/sum/count and is reset when its slot is reused
+ * for a newer interval. Memory is fixed: 3768 buckets of 40 bytes per
+ * metric, about 1.5 MB in total; a week of one metric at 10m resolution
+ * is 1008 buckets. The buckets start zeroed (static storage, no
+ * constructor), so pages are only touched as intervals are filled.
+ */
+class TimeSeriesStore {
+private:
+    struct Bucket {
+        jlong start;            // Interval start (epoch seconds), 0 = empty
+        jlong min;
+        jlong max;
+        jlong sum;
+        jlong count;
+    };
+
+    static constexpr size_t TOTAL_SLOTS = 600 + 720 + 1440 + 1008;
+
+    Bucket buckets[METRIC_COUNT][TOTAL_SLOTS];
+    mutable std::mutex mutex;
+
+    /**
+     * First slot of a level within a metric's buckets
+     */
+    static size_t level_offset(int level) {
+        size_t offset = 0;
+        for (int i = 0; i < level; i++) {
+            offset += TS_LEVEL_SPEC[i].slots;
+        }
+        return offset;
+    }
+
+public:
+
+    static int level_for(jlong resolution_seconds) {
+        for (int level = 0; level < TS_LEVELS; level++) {
+            if (TS_LEVEL_SPEC[level].seconds == resolution_seconds) return level;
+        }
+        return -1;
+    }
+
+    void add(Metric metric, jlong epoch_seconds, jlong value) {
+        if (metric < 0 || metric >= METRIC_COUNT) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int level = 0; level < TS_LEVELS; level++) {
+            jlong res = TS_LEVEL_SPEC[level].seconds;
+            jlong start = epoch_seconds - epoch_seconds % res;
+            Bucket& b = buckets[metric][level_offset(level) + (size_t)(start / res) % TS_LEVEL_SPEC[level].slots];
+            if (b.start != start) {
+                b.start = start;
+                b.min = value;
+                b.max = value;
+                b.sum = 0;
+                b.count = 0;
+            }
+            if (value < b.min) b.min = value;
+            if (value > b.max) b.max = value;
+            b.sum += value;
+            b.count++;
+        }
+    }
+
+    /**
+     * Copy one series, oldest first, as rows of {start_ms, min, max, avg}.
+     * Returns the number of rows written (at most max_rows).
+     */
+    size_t read(Metric metric, int level, jlong now_seconds, jlong* out, size_t max_rows) const {
+        if (metric < 0 || metric >= METRIC_COUNT || level < 0 || level >= TS_LEVELS) {
+            return 0;
+        }
+        jlong res = TS_LEVEL_SPEC[level].seconds;
+        size_t slots = TS_LEVEL_SPEC[level].slots;
+        jlong newest = now_seconds - now_seconds % res;
+        jlong oldest = newest - (jlong)(slots - 1) * res;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t rows = 0;
+        for (jlong start = oldest; start <= newest && rows < max_rows; start += res) {
+            const Bucket& b = buckets[metric][level_offset(level) + (size_t)(start / res) % slots];
+            if (b.start != start || b.count == 0) {
+                continue;
+            }
+            out[rows * 4 + 0] = b.start * 1000;
+            out[rows * 4 + 1] = b.min;
+            out[rows * 4 + 2] = b.max;
+            out[rows * 4 + 3] = b.sum / b.count;
+            rows++;
+        }
+        return rows;
+    }
+
+    static size_t slots(int level) {
+        return (level >= 0 && level < TS_LEVELS) ? TS_LEVEL_SPEC[level].slots : 0;
+    }
+};
+
+static TimeSeriesStore g_metrics;
+
+/**
+ * Per-second metric accumulation, owned by the event processor thread
+ */
+class MetricsSampler {
+private:
+    jlong current_second = 0;
+    jlong alloc_count = 0;
+    jlong alloc_bytes = 0;
+    jlong free_count = 0;
+    jlong free_bytes = 0;
+    jlong gc_count = 0;
+    jlong gc_start = 0;
+    jlong total_gc_count = 0;
+    jlong total_gc_pause_ms = 0;
+    HeapUsage heap;
+
+public:
+    void on_event(const AllocationEvent& event) {
+        // Each sample stands for 2^weight_shift allocations
+        jlong weight = (jlong)1 << event.weight_shift;
+        switch (event.type) {
+            case EVENT_ALLOC:
+                alloc_count += weight;
+                alloc_bytes += event.size * weight;
+                break;
+            case EVENT_FREE:
+                free_count += weight;
+                free_bytes += event.size * weight;
+                break;
+            case EVENT_GC_START:
+                gc_start = event.timestamp;
+                break;
+            case EVENT_GC_FINISH:
+                gc_count++;
+                total_gc_count++;
+                if (gc_start > 0) {
+                    g_metrics.add(METRIC_GC_PAUSE_MS, event.timestamp / 1000, event.timestamp - gc_start);
+                    total_gc_pause_ms += event.timestamp - gc_start;
+                    gc_start = 0;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    /**
+     * Close the current second once the clock moves on: store the
+     * per-second counters and sample the gauges
+     */
+    void tick(jlong now_ms, JNIEnv* jni) {
+        jlong second = now_ms / 1000;
+        if (second == current_second) {
+            return;
+        }
+        if (current_second != 0) {
+            g_metrics.add(METRIC_ALLOC_COUNT, current_second, alloc_count);
+            g_metrics.add(METRIC_ALLOC_BYTES, current_second, alloc_bytes);
+            g_metrics.add(METRIC_FREE_COUNT, current_second, free_count);
+            g_metrics.add(METRIC_FREE_BYTES, current_second, free_bytes);
+            g_metrics.add(METRIC_GC_COUNT, current_second, gc_count);
+            g_metrics.add(METRIC_LIVE_BYTES, current_second, (jlong)g_tracker.get_current_usage());
+            g_metrics.add(METRIC_QUEUE_DEPTH, current_second, (jlong)g_event_queue.size());
+            if (jni) {
+                HeapUsage usage = read_heap_usage(jni);
+                if (usage.max > 0) {
+                    g_metrics.add(METRIC_HEAP_USED, current_second, usage.used);
+                    g_metrics.add(METRIC_HEAP_COMMITTED, current_second, usage.committed);
+                    heap = usage;
+                }
+            }
+        }
+        current_second = second;
+        alloc_count = alloc_bytes = free_count = free_bytes = gc_count = 0;
+    }
+
+    jlong get_total_gc_count() const { return total_gc_count; }
+    jlong get_total_gc_pause_ms() const { return total_gc_pause_ms; }
+    const HeapUsage& last_heap_usage() const { return heap; }
+};
+
+static MetricsSampler g_metrics_sampler;
+
+// ============================================================================
+// GC Timeline
+// ============================================================================
+
+/**
+ * One garbage collection cycle and the sampled allocations that led to it
+ */
+struct GcCycle {
+    struct SiteShare {
+        uint32_t site;          // SiteTable index
+        jlong count;
+        jlong bytes;
+    };
+
+    jlong id;                   // 1-based cycle number since agent start
+    jlong start;                // Epoch milliseconds
+    jlong end;                  // 0 while the cycle is running
+    jlong alloc_count;          // Sampled allocations since the previous cycle started
+    jlong alloc_bytes;
+    jlong freed_count;          // Tracked objects freed by this cycle
+    jlong freed_bytes;
+    uint32_t site_count;
+    SiteShare sites[GC_TOP_SITES];  // Largest sites of the interval, by bytes
+};
+
+/**
+ * Ring of recent GC cycles (GC_TIMELINE_CYCLES), fed by the event processor
+ *
+ * Allocations are attributed to the interval ending at the next GC start;
+ * frees are attributed to the latest cycle, as ObjectFree is posted while
+ * (or right after) the collector runs. Per-site interval counts live in a
+ * processor-owned map that is reduced to the top GC_TOP_SITES when a cycle
+ * starts, so readers only ever see fixed-size records.
+ */
+class GcTimeline {
+private:
+    GcCycle cycles[GC_TIMELINE_CYCLES];
+    jlong total = 0;            // Cycles started
+    mutable std::mutex mutex;
+
+    // Owned by the event processor thread
+    std::unordered_map<uint32_t, GcCycle::SiteShare> interval_sites;
+    jlong interval_count = 0;
+    jlong interval_bytes = 0;
+    std::vector<GcCycle::SiteShare> top_scratch;
+
+    GcCycle& latest() { return cycles[(size_t)((total - 1) % GC_TIMELINE_CYCLES)]; }
+
+    void begin_cycle(jlong timestamp) {
+        GcCycle cycle;
+        memset(&cycle, 0, sizeof(cycle));
+        cycle.start = timestamp;
+        cycle.alloc_count = interval_count;
+        cycle.alloc_bytes = interval_bytes;
+
+        top_scratch.clear();
+        for (const auto& entry : interval_sites) {
+            top_scratch.push_back(entry.second);
+        }
+        size_t n = std::min<size_t>(GC_TOP_SITES, top_scratch.size());
+        std::partial_sort(top_scratch.begin(), top_scratch.begin() + n, top_scratch.end(),
+                          [](const GcCycle::SiteShare& a, const GcCycle::SiteShare& b) {
+                              return a.bytes > b.bytes;
+                          });
+        std::copy(top_scratch.begin(), top_scratch.begin() + n, cycle.sites);
+        cycle.site_count = (uint32_t)n;
+
+        interval_sites.clear();
+        interval_count = 0;
+        interval_bytes = 0;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        cycle.id = ++total;
+        latest() = cycle;
+    }
+
+public:
+    void on_event(const AllocationEvent& event, uint32_t site_index) {
+        jlong weight = (jlong)1 << event.weight_shift;
+        switch (event.type) {
+            case EVENT_ALLOC:
+                interval_count += weight;
+                interval_bytes += event.size * weight;
+                if (site_index != jma::NO_INDEX) {
+                    GcCycle::SiteShare& share = interval_sites[site_index];
+                    share.site = site_index;
+                    share.count += weight;
+                    share.bytes += event.size * weight;
+                }
+                break;
+            case EVENT_GC_START:
+                begin_cycle(event.timestamp);
+                break;
+            case EVENT_GC_FINISH: {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (total > 0 && latest().end == 0) {
+                    latest().end = event.timestamp;
+                }
+                break;
+            }
+            case EVENT_FREE: {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (total > 0) {
+                    latest().freed_count += weight;
+                    latest().freed_bytes += event.size * weight;
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    /**
+     * Copy the cycles that started in [from, to] (epoch ms), oldest first.
+     * Returns the number of cycles written (at most max_cycles, newest kept).
+     */
+    size_t snapshot(jlong from, jlong to, GcCycle* out, size_t max_cycles) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        jlong kept = std::min<jlong>(total, GC_TIMELINE_CYCLES);
+        jlong first = total - kept;
+
+        // Newest matching cycles win when out is too small
+        jlong begin = total;
+        size_t n = 0;
+        while (begin > first && n < max_cycles) {
+            const GcCycle& c = cycles[(size_t)((begin - 1) % GC_TIMELINE_CYCLES)];
+            if (c.start < from) break;
+            begin--;
+            if (c.start <= to) n++;
+        }
+
+        size_t written = 0;
+        for (jlong i = begin; i < total && written < n; i++) {
+            const GcCycle& c = cycles[(size_t)(i % GC_TIMELINE_CYCLES)];
+            if (c.start >= from && c.start <= to) {
+                out[written++] = c;
+            }
+        }
+        return written;
+    }
+
+    jlong cycle_count() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return total;
+    }
+
+    /**
+     * Write the retained timeline as JSON (event processor thread only)
+     */
+    bool write_json(const std::string& path) const {
+        std::vector<GcCycle> copy(GC_TIMELINE_CYCLES);
+        size_t n = snapshot(LLONG_MIN, LLONG_MAX, copy.data(), copy.size());
+
+        FILE* out = fopen(path.c_str(), "w");
+        if (!out) {
+            return false;
+        }
+        fprintf(out, "{\n  \"pid\": %u,\n  \"gcCycles\": [", (unsigned)getpid());
+        for (size_t i = 0; i < n; i++) {
+            const GcCycle& c = copy[i];
+            fprintf(out, "%s\n    {\"id\": %lld, \"start\": %lld, \"end\": %lld, \"durationMs\": %lld, "
+                    "\"allocationCount\": %lld, \"allocationBytes\": %lld, "
+                    "\"freedCount\": %lld, \"freedBytes\": %lld, \"topSites\": [",
+                    i ? "," : "", (long long)c.id, (long long)c.start, (long long)c.end,
+                    (long long)(c.end ? c.end - c.start : -1), (long long)c.alloc_count,
+                    (long long)c.alloc_bytes, (long long)c.freed_count, (long long)c.freed_bytes);
+            for (uint32_t j = 0; j < c.site_count; j++) {
+                fprintf(out, "%s{\"site\": \"", j ? ", " : "");
+                for (const char* p = g_sites.name(c.sites[j].site); *p; p++) {
+                    unsigned char ch = (unsigned char)*p;
+                    if (ch == '"' || ch == '\\') fprintf(out, "\\%c", ch);
+                    else if (ch < 0x20) fprintf(out, "\\u%04x", ch);
+                    else fputc(ch, out);
+                }
+                fprintf(out, "\", \"allocationCount\": %lld, \"totalSize\": %lld}",
+                        (long long)c.sites[j].count, (long long)c.sites[j].bytes);
+            }
+            fprintf(out, "]}");
+        }
+        fprintf(out, "\n  ]\n}\n");
+        return fclose(out) == 0;
+    }
+};
+
+static GcTimeline g_gc_timeline;
+
+// ============================================================================
+// Lifetime Histograms
+// ============================================================================
+
+/**
+ * Per-site lifetime histograms of sampled objects
+ *
+ * Built from ObjectFree: each freed object adds one count to its site's
+ * wall-time histogram (log2 milliseconds) and GC-age histogram (log2 GC
+ * cycles survived). Short-lived churn shows up as mass in the low
+ * buckets; objects promoted and then dropped show up in the high GC-age
+ * buckets. Indexed by SiteTable index; written by the event processor.
+ *
+ * Sampled allocation volume is kept per site as well, so sites can be
+ * ranked by churn: allocated bytes weighted by the fraction of freed
+ * objects that died before the next GC (survived 0 cycles).
+ */
+class LifetimeHistograms {
+public:
+    struct Histogram {
+        jlong count;            // Freed objects
+        jlong total_ms;
+        jlong alloc_count;      // Sampled allocations
+        jlong alloc_bytes;
+        jlong short_bytes;      // Freed before surviving a GC
+        uint32_t wall[LIFETIME_WALL_BUCKETS];
+        uint32_t gcs[LIFETIME_GC_BUCKETS];
+    };
+
+    struct ChurnEntry {
+        uint32_t site;
+        jlong alloc_count;
+        jlong alloc_bytes;
+        jlong freed_count;
+        jlong short_count;
+        jlong short_bytes;
+        jlong churn_bytes;      // alloc_bytes * short_count / freed_count
+    };
+
+    /**
+     * 0 for 0, otherwise 1 + floor(log2(value)), capped at buckets - 1
+     */
+    static int bucket_for(uint64_t value, int buckets) {
+        int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+        return bucket < buckets ? bucket : buckets - 1;
+    }
+
+private:
+    std::vector<Histogram> sites;
+    jlong total_alloc_bytes = 0;
+    jlong first_alloc = 0;
+    mutable std::mutex mutex;
+
+    Histogram& site(uint32_t site_index) {
+        if (site_index >= sites.size()) {
+            Histogram empty;
+            memset(&empty, 0, sizeof(empty));
+            sites.resize((size_t)site_index + 1, empty);
+        }
+        return sites[site_index];
+    }
+
+public:
+    /**
+     * @param weight Allocations the sample stands for (2^weight_shift)
+     */
+    void record_alloc(uint32_t site_index, jlong size, jlong timestamp, jlong weight) {
+        if (site_index == jma::NO_INDEX) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        Histogram& h = site(site_index);
+        h.alloc_count += weight;
+        h.alloc_bytes += size * weight;
+        total_alloc_bytes += size * weight;
+        if (first_alloc == 0) {
+            first_alloc = timestamp;
+        }
+    }
+
+    void record(uint32_t site_index, jlong lifetime_ms, uint32_t gcs_survived, jlong size, jlong weight) {
+        if (site_index == jma::NO_INDEX) {
+            return;
+        }
+        if (lifetime_ms < 0) {
+            lifetime_ms = 0;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Histogram& h = site(site_index);
+        h.count += weight;
+        h.total_ms += lifetime_ms * weight;
+        h.wall[bucket_for((uint64_t)lifetime_ms, LIFETIME_WALL_BUCKETS)] += (uint32_t)weight;
+        h.gcs[bucket_for(gcs_survived, LIFETIME_GC_BUCKETS)] += (uint32_t)weight;
+        if (gcs_survived == 0) {
+            h.short_bytes += size * weight;
+        }
+    }
+
+    /**
+     * Sites ranked by churn (largest first), at most k. Also returns the
+     * sampled bytes allocated by all sites and the observation start.
+     */
+    std::vector<ChurnEntry> top_churn(size_t k, jlong* total_bytes, jlong* since) const {
+        std::vector<ChurnEntry> entries;
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < sites.size(); i++) {
+            const Histogram& h = sites[i];
+            if (h.count == 0 || h.gcs[0] == 0) {
+                continue;
+            }
+            ChurnEntry e;
+            e.site = (uint32_t)i;
+            e.alloc_count = h.alloc_count;
+            e.alloc_bytes = h.alloc_bytes;
+            e.freed_count = h.count;
+            e.short_count = h.gcs[0];
+            e.short_bytes = h.short_bytes;
+            e.churn_bytes = (jlong)((double)h.alloc_bytes * h.gcs[0] / h.count);
+            entries.push_back(e);
+        }
+        *total_bytes = total_alloc_bytes;
+        *since = first_alloc;
+
+        auto by_churn = [](const ChurnEntry& a, const ChurnEntry& b) { return a.churn_bytes > b.churn_bytes; };
+        if (entries.size() > k) {
+            std::partial_sort(entries.begin(), entries.begin() + k, entries.end(), by_churn);
+            entries.resize(k);
+        } else {
+            std::sort(entries.begin(), entries.end(), by_churn);
+        }
+        return entries;
+    }
+
+    /**
+     * Copy one site's histogram; false if none of its objects was freed yet
+     */
+    bool get(uint32_t site_index, Histogram* out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (site_index >= sites.size() || sites[site_index].count == 0) {
+            return false;
+        }
+        *out = sites[site_index];
+        return true;
+    }
+};
+
+static LifetimeHistograms g_lifetimes;
+
+// ============================================================================
+// Live Aggregates
+// ============================================================================
+
+/**
+ * Live (tracked, not yet freed) objects and bytes per class and per site
+ *
+ * Updated by the event processor thread for every processed allocation
+ * and free, so queries never walk the tracker.
+ */
+class LiveAggregates {
+public:
+    struct Entry {
+        jlong live_count;
+        jlong live_bytes;
+        jlong alloc_count;
+        jlong alloc_bytes;
+    };
+
+private:
+    std::vector<Entry> classes;
+    std::vector<Entry> sites;
+    mutable std::mutex mutex;
+
+    static Entry& slot(std::vector<Entry>& table, uint32_t index) {
+        if (index >= table.size()) {
+            table.resize((size_t)index + 1, Entry{0, 0, 0, 0});
+        }
+        return table[index];
+    }
+
+    static void apply(Entry& e, bool alloc, jlong size, jlong weight) {
+        if (alloc) {
+            e.live_count += weight;
+            e.live_bytes += size * weight;
+            e.alloc_count += weight;
+            e.alloc_bytes += size * weight;
+        } else {
+            e.live_count -= weight;
+            e.live_bytes -= size * weight;
+        }
+    }
+
+    static std::vector<std::pair<uint32_t, Entry>> top(const std::vector<Entry>& table, size_t k) {
+        std::vector<std::pair<uint32_t, Entry>> out;
+        for (size_t i = 0; i < table.size(); i++) {
+            if (table[i].alloc_count > 0) {
+                out.emplace_back((uint32_t)i, table[i]);
+            }
+        }
+        auto by_live = [](const std::pair<uint32_t, Entry>& a, const std::pair<uint32_t, Entry>& b) {
+            return a.second.live_bytes > b.second.live_bytes;
+        };
+        if (out.size() > k) {
+            std::partial_sort(out.begin(), out.begin() + k, out.end(), by_live);
+            out.resize(k);
+        } else {
+            std::sort(out.begin(), out.end(), by_live);
+        }
+        return out;
+    }
+
+public:
+    void on_event(const AllocationEvent& event, uint32_t site_index) {
+        if (event.type != EVENT_ALLOC && event.type != EVENT_FREE) {
+            return;
+        }
+        bool alloc = event.type == EVENT_ALLOC;
+        jlong weight = (jlong)1 << event.weight_shift;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (event.class_id != 0) {
+            apply(slot(classes, event.class_id), alloc, event.size, weight);
+        }
+        if (site_index != jma::NO_INDEX) {
+            apply(slot(sites, site_index), alloc, event.size, weight);
+        }
+    }
+
+    std::vector<std::pair<uint32_t, Entry>> top_classes(size_t k) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return top(classes, k);
+    }
+
+    std::vector<std::pair<uint32_t, Entry>> top_sites(size_t k) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return top(sites, k);
+    }
+
+    bool site(uint32_t index, Entry* out) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (index >= sites.size()) {
+            return false;
+        }
+        *out = sites[index];
+        return true;
+    }
+
+    /**
+     * Call visit(class_id, entry) for every class seen, with the lock held
+     */
+    template <typename Visitor>
+    void for_each_class(Visitor&& visit) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < classes.size(); i++) {
+            if (classes[i].alloc_count > 0) {
+                visit((uint32_t)i, classes[i]);
+            }
+        }
+    }
+};
+
+static LiveAggregates g_live;
+
+// ============================================================================
+// Class Trends
+// ============================================================================
+
+/**
+ * Per-class live-count trends over a sliding window of checkpoints
+ *
+ * A checkpoint records every class's live count and bytes (LiveAggregates)
+ * after a GC cycle, at most every TREND_MIN_INTERVAL_MS, and at least every
+ * TREND_PERIOD_MS without GCs. Each class keeps its last window counts in a
+ * ring with running sums. Points are numbered from the oldest in the window
+ * (x = 0), so Σx and Σx² depend only on the point count, and sliding the
+ * window updates Σy and Σxy exactly in integers: a checkpoint costs O(1)
+ * per class, as does the least-squares slope (instances per checkpoint).
+ * Alongside the sums: the increases between consecutive points in the
+ * window (count and total), the current run of increases, and an EWMA of
+ * the growth rate in instances per second.
+ *
+ * Updated by the event processor thread; read by getClassTrends.
+ */
+class ClassTrends {
+public:
+    struct Row {
+        uint32_t class_id;
+        uint32_t points;
+        jlong live_count;
+        jlong live_bytes;
+        jlong min_count;
+        jlong max_count;
+        jlong growth_count;
+        jlong total_growth;
+        jlong streak;
+        double slope;
+        double ewma_rate;
+    };
+
+private:
+    struct Trend {
+        uint32_t points;            // 0 = class not seen yet
+        uint32_t head;              // Ring slot of the oldest point
+        jlong sum_y;
+        jlong sum_xy;
+        jlong growth_count;         // Increases between consecutive points in the window
+        jlong total_growth;
+        jlong streak;               // Consecutive increases up to the newest point
+        jlong live_bytes;           // At the newest point
+        double ewma_rate;           // Instances per second
+    };
+
+    std::vector<Trend> trends;      // By class id
+    std::vector<jlong> rings;       // window counts per class id
+    uint32_t window = TREND_DEFAULT_WINDOW;
+    jlong last_checkpoint = 0;
+    uint64_t checkpoints = 0;
+    mutable std::mutex mutex;
+
+    jlong& point(uint32_t class_id, const Trend& t, uint32_t i) {
+        return rings[(size_t)class_id * window + (t.head + i) % window];
+    }
+
+    void add_point(uint32_t class_id, jlong y, jlong bytes, double seconds) {
+        if (class_id >= trends.size()) {
+            trends.resize((size_t)class_id + 1, Trend{0, 0, 0, 0, 0, 0, 0, 0, 0.0});
+            rings.resize(trends.size() * window, 0);
+        }
+        Trend& t = trends[class_id];
+
+        if (t.points == window) {
+            // Drop the oldest point and renumber the rest from x = 0
+            jlong oldest = point(class_id, t, 0);
+            jlong delta = point(class_id, t, 1) - oldest;
+            if (delta > 0) {
+                t.growth_count--;
+                t.total_growth -= delta;
+            }
+            t.sum_y -= oldest;
+            t.sum_xy -= t.sum_y;
+            t.head = (t.head + 1) % window;
+            t.points--;
+        }
+
+        if (t.points > 0) {
+            jlong delta = y - point(class_id, t, t.points - 1);
+            if (delta > 0) {
+                t.growth_count++;
+                t.total_growth += delta;
+                t.streak++;
+            } else {
+                t.streak = 0;
+            }
+            double rate = seconds > 0 ? delta / seconds : 0;
+            t.ewma_rate = TREND_EWMA_ALPHA * rate + (1 - TREND_EWMA_ALPHA) * t.ewma_rate;
+        }
+
+        point(class_id, t, t.points) = y;
+        t.sum_xy += (jlong)t.points * y;
+        t.sum_y += y;
+        t.points++;
+        t.live_bytes = bytes;
+    }
+
+    void checkpoint(jlong now) {
+        std::lock_guard<std::mutex> lock(mutex);
+        double seconds = last_checkpoint > 0 ? (now - last_checkpoint) / 1000.0 : 0;
+        g_live.for_each_class([&](uint32_t class_id, const LiveAggregates::Entry& entry) {
+            add_point(class_id, entry.live_count, entry.live_bytes, seconds);
+        });
+        last_checkpoint = now;
+        checkpoints++;
+    }
+
+public:
+    /**
+     * Set the window (points per class) and start over; keeps the trends
+     * when the (clamped) window is unchanged
+     */
+    void set_window(uint32_t points) {
+        std::lock_guard<std::mutex> lock(mutex);
+        uint32_t clamped = std::max<uint32_t>(2, std::min<uint32_t>(points, TREND_MAX_WINDOW));
+        if (clamped == window) {
+            return;
+        }
+        window = clamped;
+        trends.clear();
+        rings.clear();
+        checkpoints = 0;
+    }
+
+    /**
+     * Take a checkpoint when one is due; gc_finished marks the end of a GC
+     * cycle, when live counts hold only survivors
+     */
+    void tick(jlong now, bool gc_finished) {
+        jlong elapsed = now - last_checkpoint;
+        if (elapsed >= TREND_PERIOD_MS || (gc_finished && elapsed >= TREND_MIN_INTERVAL_MS)) {
+            checkpoint(now);
+        }
+    }
+
+    /**
+     * Trends of the classes with at least one point; returns the window
+     * and fills the checkpoint count and time of the newest checkpoint
+     */
+    uint32_t snapshot(std::vector<Row>& rows, uint64_t* count, jlong* last) {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (uint32_t class_id = 0; class_id < trends.size(); class_id++) {
+            const Trend& t = trends[class_id];
+            if (t.points == 0) {
+                continue;
+            }
+            Row row;
+            row.class_id = class_id;
+            row.points = t.points;
+            row.live_count = point(class_id, t, t.points - 1);
+            row.live_bytes = t.live_bytes;
+            row.min_count = row.max_count = row.live_count;
+            for (uint32_t i = 0; i + 1 < t.points; i++) {
+                row.min_count = std::min(row.min_count, point(class_id, t, i));
+                row.max_count = std::max(row.max_count, point(class_id, t, i));
+            }
+            row.growth_count = t.growth_count;
+            row.total_growth = t.total_growth;
+            row.streak = t.streak;
+
+            // Least squares over x = 0 .. n-1
+            double n = t.points;
+            double sum_x = n * (n - 1) / 2;
+            double sum_x2 = (n - 1) * n * (2 * n - 1) / 6;
+            double denominator = n * sum_x2 - sum_x * sum_x;
+            row.slope = denominator > 0 ? (n * (double)t.sum_xy - sum_x * (double)t.sum_y) / denominator : 0;
+            row.ewma_rate = t.ewma_rate;
+            rows.push_back(row);
+        }
+        *count = checkpoints;
+        *last = last_checkpoint;
+        return window;
+    }
+};
+
+static ClassTrends g_trends;
+
+// ============================================================================
+// Shared Statistics Page
+// ============================================================================
+
+/**
+ * Publishes the agent's counters into a shared seqlock page (stats_page.h)
+ *
+ * The page is a one-page file mapped MAP_SHARED, so pollers in this JVM
+ * (NativeMemoryTracker maps it as a direct ByteBuffer) and in other
+ * processes read it without JNI or syscalls. Without a file (nostats_shm,
+ * or the file cannot be created) an anonymous mapping still serves the
+ * in-process reader. Written only by the event processor thread, at most
+ * once per millisecond.
+ */
+class StatsPagePublisher {
+private:
+    void* page = nullptr;
+    std::string path;           // Empty when anonymous
+    bool shared = true;
+    jlong last_publish = 0;
+
+public:
+    void set_shared(bool enabled) {
+        shared = enabled;
+    }
+
+    bool open() {
+        if (page) {
+            return true;
+        }
+        uint32_t pid = (uint32_t)getpid();
+        void* mapping = MAP_FAILED;
+        if (shared) {
+            std::string file = jma::stats_page_path(pid);
+            int fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (fd >= 0) {
+                if (ftruncate(fd, (off_t)jma::STATS_PAGE_SIZE) == 0) {
+                    mapping = mmap(nullptr, jma::STATS_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                }
+                ::close(fd);
+                if (mapping != MAP_FAILED) {
+                    path = file;
+                } else {
+                    unlink(file.c_str());
+                }
+            }
+            if (mapping == MAP_FAILED) {
+                fprintf(stderr, "[JVM TI] Cannot create stats page %s; in-process only\n", file.c_str());
+            }
+        }
+        if (mapping == MAP_FAILED) {
+            mapping = mmap(nullptr, jma::STATS_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+
+        memset(mapping, 0, jma::STATS_PAGE_SIZE);
+        jma::StatsPageHeader* header = (jma::StatsPageHeader*)mapping;
+        header->version = jma::STATS_PAGE_VERSION;
+        header->page_size = (uint32_t)jma::STATS_PAGE_SIZE;
+        header->pid = pid;
+        header->field_count = jma::STATS_FIELD_COUNT;
+        header->sequence.store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        memcpy(header->magic, jma::STATS_PAGE_MAGIC, sizeof(header->magic));
+        page = mapping;
+        return true;
+    }
+
+    void close() {
+        if (!page) {
+            return;
+        }
+        munmap(page, jma::STATS_PAGE_SIZE);
+        page = nullptr;
+        if (!path.empty()) {
+            unlink(path.c_str());
+            path.clear();
+        }
+    }
+
+    void* address() const { return page; }
+
+    /**
+     * Write a new version of the counters (event processor thread)
+     */
+    void publish(jlong now_ms) {
+        if (!page || now_ms == last_publish) {
+            return;
+        }
+        last_publish = now_ms;
+
+        jma::StatsPageHeader* header = (jma::StatsPageHeader*)page;
+        std::atomic<int64_t>* fields = jma::stats_page_fields(page);
+        const HeapUsage& heap = g_metrics_sampler.last_heap_usage();
+
+        uint64_t seq = header->sequence.load(std::memory_order_relaxed);
+        header->sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        fields[jma::STAT_UPDATE_TIME].store(now_ms, std::memory_order_relaxed);
+        fields[jma::STAT_TOTAL_ALLOCATED].store((int64_t)g_tracker.get_total_allocated(), std::memory_order_relaxed);
+        fields[jma::STAT_TOTAL_FREED].store((int64_t)g_tracker.get_total_freed(), std::memory_order_relaxed);
+        fields[jma::STAT_CURRENT_USAGE].store((int64_t)g_tracker.get_current_usage(), std::memory_order_relaxed);
+        fields[jma::STAT_ALLOC_COUNT].store((int64_t)g_tracker.get_alloc_count(), std::memory_order_relaxed);
+        fields[jma::STAT_FREE_COUNT].store((int64_t)g_tracker.get_free_count(), std::memory_order_relaxed);
+        fields[jma::STAT_QUEUE_DEPTH].store((int64_t)g_event_queue.size(), std::memory_order_relaxed);
+        fields[jma::STAT_DROPPED_EVENTS].store((int64_t)g_event_queue.get_dropped(), std::memory_order_relaxed);
+        fields[jma::STAT_GC_COUNT].store(g_metrics_sampler.get_total_gc_count(), std::memory_order_relaxed);
+        fields[jma::STAT_GC_TIME_MS].store(g_metrics_sampler.get_total_gc_pause_ms(), std::memory_order_relaxed);
+        fields[jma::STAT_SAMPLING_INTERVAL].store(
+            g_sampling_enabled.load(std::memory_order_relaxed) ? g_sampling_interval.load(std::memory_order_relaxed) : 1,
+            std::memory_order_relaxed);
+        fields[jma::STAT_HEAP_USED].store(heap.used, std::memory_order_relaxed);
+        fields[jma::STAT_HEAP_COMMITTED].store(heap.committed, std::memory_order_relaxed);
+        fields[jma::STAT_HEAP_MAX].store(heap.max, std::memory_order_relaxed);
+        fields[jma::STAT_AGENT_OVERHEAD_PPM].store(g_governor.last_overhead_ppm(), std::memory_order_relaxed);
+        fields[jma::STAT_GOVERNOR_LEVEL].store(g_governor.current_level(), std::memory_order_relaxed);
+
+        header->sequence.store(seq + 2, std::memory_order_release);
+    }
+};
+
+static StatsPagePublisher g_stats_page;
+
+// ============================================================================
+// Live Event Stream
+// ============================================================================
+
+/**
+ * Streams processed events to one external consumer (event_stream.h)
+ *
+ * The agent listens on a Unix domain socket; for each consumer it creates
+ * a memfd ring and an eventfd and hands both over with SCM_RIGHTS, so the
+ * consumer does all aggregation and display in its own process. The event
+ * processor thread is the only producer; a full ring drops events rather
+ * than blocking it. Start/stop requests from other threads are applied by
+ * the processor thread in service().
+ */
+class EventStream {
+private:
+    std::atomic<size_t> requested_mb{0};     // 0 = off
+    size_t active_mb = 0;
+    std::string socket_path;
+    int listen_fd = -1;
+    int client_fd = -1;
+    int wake_fd = -1;
+    void* mapping = nullptr;
+    size_t mapping_size = 0;
+    jma::StreamRingHeader* ring = nullptr;
+    char* data = nullptr;
+    uint64_t capacity = 0;
+    uint64_t head = 0;
+    std::vector<bool> classes_sent;
+    std::vector<bool> sites_sent;
+    jlong last_service = 0;
+
+    static uint32_t align8(size_t n) {
+        return (uint32_t)((n + 7) & ~(size_t)7);
+    }
+
+    bool listen_socket() {
+        socket_path = jma::stream_socket_path((uint32_t)getpid());
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(addr.sun_path)) {
+            return false;
+        }
+        memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0) {
+            return false;
+        }
+        unlink(socket_path.c_str());
+        if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 4) != 0) {
+            ::close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        chmod(socket_path.c_str(), 0600);
+        return true;
+    }
+
+    void close_listener() {
+        if (listen_fd >= 0) {
+            ::close(listen_fd);
+            listen_fd = -1;
+            unlink(socket_path.c_str());
+        }
+    }
+
+    bool attach_consumer(int fd) {
+#ifdef __linux__
+        capacity = 64 * 1024;
+        while (capacity * 2 <= (uint64_t)active_mb * 1024 * 1024) {
+            capacity *= 2;
+        }
+        mapping_size = jma::STREAM_DATA_OFFSET + capacity;
+
+        int memfd = memfd_create("jma-stream", MFD_CLOEXEC);
+        if (memfd < 0) {
+            return false;
+        }
+        if (ftruncate(memfd, (off_t)mapping_size) != 0) {
+            ::close(memfd);
+            return false;
+        }
+        void* m = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        if (m == MAP_FAILED) {
+            ::close(memfd);
+            return false;
+        }
+        wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (wake_fd < 0) {
+            munmap(m, mapping_size);
+            ::close(memfd);
+            return false;
+        }
+
+        jma::StreamRingHeader* header = (jma::StreamRingHeader*)m;
+        memcpy(header->magic, jma::STREAM_MAGIC, sizeof(header->magic));
+        header->version = jma::STREAM_VERSION;
+        header->pid = (uint32_t)getpid();
+        header->capacity = capacity;
+        header->head.store(0, std::memory_order_relaxed);
+        header->dropped.store(0, std::memory_order_relaxed);
+        header->tail.store(0, std::memory_order_relaxed);
+        header->consumer_waiting.store(0, std::memory_order_relaxed);
+
+        jma::StreamHello hello;
+        memcpy(hello.magic, jma::STREAM_MAGIC, sizeof(hello.magic));
+        hello.version = jma::STREAM_VERSION;
+        hello.pid = header->pid;
+        hello.mapping_size = mapping_size;
+
+        int fds[2] = {memfd, wake_fd};
+        bool sent = jma::send_with_fds(fd, &hello, sizeof(hello), fds, 2);
+        ::close(memfd);
+        if (!sent) {
+            munmap(m, mapping_size);
+            ::close(wake_fd);
+            wake_fd = -1;
+            return false;
+        }
+
+        mapping = m;
+        ring = header;
+        data = (char*)m + jma::STREAM_DATA_OFFSET;
+        head = 0;
+        client_fd = fd;
+        classes_sent.assign(MAX_TRACKED_CLASSES, false);
+        sites_sent.clear();
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    void detach_consumer() {
+        if (mapping) {
+            munmap(mapping, mapping_size);
+            mapping = nullptr;
+            ring = nullptr;
+            data = nullptr;
+        }
+        if (wake_fd >= 0) {
+            ::close(wake_fd);
+            wake_fd = -1;
+        }
+        if (client_fd >= 0) {
+            ::close(client_fd);
+            client_fd = -1;
+        }
+    }
+
+    /**
+     * Space for one record, padding to the start of the ring if it would
+     * cross the end. Returns nullptr if the consumer is too far behind.
+     */
+    char* reserve(uint32_t length) {
+        uint64_t offset = head & (capacity - 1);
+        uint64_t pad = offset + length > capacity ? capacity - offset : 0;
+        if (head + pad + length - ring->tail.load(std::memory_order_acquire) > capacity) {
+            return nullptr;
+        }
+        if (pad) {
+            jma::StreamRecordHeader* rh = (jma::StreamRecordHeader*)(data + offset);
+            rh->type = jma::STREAM_PAD;
+            rh->length = (uint32_t)pad;
+            head += pad;
+        }
+        char* record = data + (head & (capacity - 1));
+        head += length;
+        return record;
+    }
+
+    /**
+     * Write an id's name, truncated to STREAM_MAX_NAME bytes (at a UTF-8
+     * character boundary) so that it always fits a ring the consumer has
+     * drained; a longer name would otherwise never fit and every event of
+     * the id would be dropped
+     */
+    bool write_name(uint32_t type, uint32_t id, const char* name) {
+        if (!name) {
+            name = "unknown";
+        }
+        uint32_t len = (uint32_t)strnlen(name, STREAM_MAX_NAME + 1);
+        if (len > STREAM_MAX_NAME) {
+            len = STREAM_MAX_NAME;
+            while (len > 0 && ((unsigned char)name[len] & 0xC0) == 0x80) {
+                len--;
+            }
+        }
+        uint32_t length = align8(sizeof(jma::StreamRecordHeader) + 8 + len);
+        char* record = reserve(length);
+        if (!record) {
+            return false;
+        }
+        jma::StreamRecordHeader* rh = (jma::StreamRecordHeader*)record;
+        rh->type = type;
+        rh->length = length;
+        char* payload = record + sizeof(jma::StreamRecordHeader);
+        memcpy(payload, &id, sizeof(id));
+        memcpy(payload + 4, &len, sizeof(len));
+        memcpy(payload + 8, name, len);
+        return true;
+    }
+
+public:
+    /**
+     * Request the stream on (ring of megabytes) or off (0); any thread
+     */
+    void request(size_t megabytes) {
+        requested_mb.store(megabytes, std::memory_order_release);
+    }
+
+    /**
+     * Start the stream unless it is already on (keeps its ring and consumer)
+     */
+    void ensure(size_t megabytes) {
+        size_t off = 0;
+        requested_mb.compare_exchange_strong(off, megabytes, std::memory_order_acq_rel);
+    }
+
+
+    /**
+     * Apply start/stop requests, accept a consumer and notice when it hangs
+     * up (event processor thread)
+     */
+    void service(jlong now) {
+        if (now - last_service < STREAM_SERVICE_MS) {
+            return;
+        }
+        last_service = now;
+
+        size_t wanted = requested_mb.load(std::memory_order_acquire);
+        if (wanted != active_mb) {
+            detach_consumer();
+            close_listener();
+            active_mb = wanted;
+            if (active_mb > 0) {
+#ifdef __linux__
+                if (listen_socket()) {
+                    fprintf(stderr, "[JVM TI] Event stream listening on %s\n", socket_path.c_str());
+                } else {
+                    fprintf(stderr, "[JVM TI] Cannot listen on %s\n", socket_path.c_str());
+                }
+#else
+                fprintf(stderr, "[JVM TI] Event stream requires Linux (memfd, eventfd)\n");
+#endif
+            }
+        }
+        if (listen_fd < 0) {
+            return;
+        }
+
+        if (client_fd >= 0) {
+            struct pollfd pfd;
+            pfd.fd = client_fd;
+            pfd.events = POLLIN;
+            char byte;
+            if (::poll(&pfd, 1, 0) > 0 && recv(client_fd, &byte, 1, MSG_DONTWAIT) <= 0) {
+                safe_print("Event stream consumer disconnected (%d events dropped)",
+                           (int)ring->dropped.load(std::memory_order_relaxed));
+                detach_consumer();
+            }
+        }
+
+        int fd;
+        while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+            if (client_fd >= 0 || !attach_consumer(fd)) {
+                ::close(fd);    // One consumer at a time
+            } else {
+                safe_print("Event stream consumer attached");
+            }
+        }
+    }
+
+    /**
+     * Append one processed event, preceded by any new class/site name
+     * (event processor thread)
+     */
+    void publish(const AllocationEvent& event, uint32_t site_index) {
+        if (!ring) {
+            return;
+        }
+
+        if (event.class_id != 0 && event.class_id < classes_sent.size() && !classes_sent[event.class_id]) {
+            if (!write_name(jma::STREAM_CLASS, event.class_id, g_classes.name(event.class_id))) {
+                ring->dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            classes_sent[event.class_id] = true;
+        }
+        if (site_index != jma::NO_INDEX) {
+            if (site_index >= sites_sent.size()) {
+                sites_sent.resize(site_index + 1024, false);
+            }
+            if (!sites_sent[site_index]) {
+                if (!write_name(jma::STREAM_SITE, site_index, g_sites.name(site_index))) {
+                    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+                    ring->head.store(head, std::memory_order_release);
+                    return;
+                }
+                sites_sent[site_index] = true;
+            }
+        }
+
+        uint32_t length = align8(sizeof(jma::StreamRecordHeader) + sizeof(jma::RecordedEvent));
+        char* record = reserve(length);
+        if (record) {
+            jma::StreamRecordHeader* rh = (jma::StreamRecordHeader*)record;
+            rh->type = jma::STREAM_EVENT;
+            rh->length = length;
+
+            jma::RecordedEvent rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.type = (uint8_t)event.type;
+            rec.weight_shift = event.weight_shift;
+            rec.thread_id = (uint32_t)event.thread_id;
+            rec.class_index = event.class_id != 0 ? event.class_id : jma::NO_INDEX;
+            rec.site_index = site_index;
+            rec.timestamp = event.timestamp;
+            rec.tag = event.tag;
+            rec.size = event.size;
+            rec.aux = event.alloc_timestamp;
+            memcpy(record + sizeof(jma::StreamRecordHeader), &rec, sizeof(rec));
+        } else {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Publish, then wake the consumer only if it announced a wait
+        ring->head.store(head, std::memory_order_seq_cst);
+        if (ring->consumer_waiting.load(std::memory_order_seq_cst) &&
+            ring->consumer_waiting.exchange(0, std::memory_order_relaxed)) {
+            uint64_t one = 1;
+            if (write(wake_fd, &one, sizeof(one)) < 0) {
+                // Counter saturated; the consumer is awake anyway
+            }
+        }
+    }
+
+    void shutdown() {
+        detach_consumer();
+        close_listener();
+        active_mb = 0;
+        requested_mb.store(0, std::memory_order_relaxed);
+    }
+};
+
+static EventStream g_event_stream;
+
+// ============================================================================
+// Query Server
+// ============================================================================
+
+/**
+ * Local request/response server (query_protocol.h)
+ *
+ * One thread polls a Unix domain socket and its client connections and
+ * answers from the native aggregates (statistics page, LiveAggregates,
+ * SiteTable), so a local CLI or collector can query the JVM without any
+ * Java code running in it. Only QUERY_HEAP_HISTOGRAM does real work: it
+ * attaches the thread to the VM and walks the heap.
+ */
+class QueryServer {
+private:
+    std::thread thread;
+    std::atomic<bool> running{false};
+    bool enabled = true;
+    std::string socket_path;
+    int listen_fd = -1;
+    JNIEnv* jni = nullptr;
+
+    static void reply(int fd, const jma::QueryRequest& request, jma::QueryStatus status,
+                      uint32_t count, uint32_t arg, const std::vector<char>& payload) {
+        jma::QueryResponseHeader header;
+        header.magic = jma::QUERY_MAGIC;
+        header.op = request.op;
+        header.status = status;
+        header.count = count;
+        header.arg = arg;
+        header.payload_length = payload.size();
+        if (jma::write_fully(fd, &header, sizeof(header))) {
+            jma::write_fully(fd, payload.data(), payload.size());
+        }
+    }
+
+    static void append_entries(std::vector<char>& payload,
+                               const std::vector<std::pair<uint32_t, LiveAggregates::Entry>>& entries,
+                               bool by_class) {
+        for (const auto& e : entries) {
+            const char* name = by_class ? g_classes.name(e.first) : g_sites.name(e.first);
+            jma::QueryEntry entry;
+            entry.id = e.first;
+            entry.name_length = (uint32_t)strlen(name);
+            entry.live_count = e.second.live_count;
+            entry.live_bytes = e.second.live_bytes;
+            entry.alloc_count = e.second.alloc_count;
+            entry.alloc_bytes = e.second.alloc_bytes;
+            jma::append_query_entry(payload, entry, name);
+        }
+    }
+
+    static jint JNICALL heap_object(jlong class_tag, jlong size, jlong* tag_ptr, jint length, void* user_data) {
+        if (class_tag & CLASS_TAG_BIT) {
+            uint32_t id = (uint32_t)(class_tag & 0xFFFFFFFF);
+            std::vector<LiveAggregates::Entry>& counts = *(std::vector<LiveAggregates::Entry>*)user_data;
+            if (id < counts.size()) {
+                counts[id].live_count++;
+                counts[id].live_bytes += size;
+            }
+        }
+        return JVMTI_VISIT_OBJECTS;
+    }
+
+    /**
+     * Count all heap objects by class. Every loaded class is registered
+     * first so its objects carry a class tag.
+     */
+    bool heap_histogram(size_t k, std::vector<std::pair<uint32_t, LiveAggregates::Entry>>& out) {
+        if (!g_jvmti || !g_java_vm || !g_vm_live.load(std::memory_order_acquire)) {
+            return false;
+        }
+        if (!jni) {
+            JavaVMAttachArgs args;
+            args.version = JNI_VERSION_1_8;
+            args.name = (char*)"JMA Query Server";
+            args.group = nullptr;
+            if (g_java_vm->AttachCurrentThreadAsDaemon((void**)&jni, &args) != JNI_OK) {
+                jni = nullptr;
+                return false;
+            }
+        }
+
+        jint class_count = 0;
+        jclass* loaded = nullptr;
+        if (g_jvmti->GetLoadedClasses(&class_count, &loaded) != JVMTI_ERROR_NONE) {
+            return false;
+        }
+        for (jint i = 0; i < class_count; i++) {
+            g_classes.id_for(g_jvmti, loaded[i]);
+            jni->DeleteLocalRef(loaded[i]);
+        }
+        g_jvmti->Deallocate((unsigned char*)loaded);
+
+        std::vector<LiveAggregates::Entry> counts(g_classes.size(), LiveAggregates::Entry{0, 0, 0, 0});
+        jvmtiHeapCallbacks callbacks;
+        memset(&callbacks, 0, sizeof(callbacks));
+        callbacks.heap_iteration_callback = heap_object;
+        if (g_jvmti->IterateThroughHeap(0, nullptr, &callbacks, &counts) != JVMTI_ERROR_NONE) {
+            return false;
+        }
+
+        for (size_t i = 1; i < counts.size(); i++) {
+            if (counts[i].live_count > 0) {
+                out.emplace_back((uint32_t)i, counts[i]);
+            }
+        }
+        auto by_bytes = [](const std::pair<uint32_t, LiveAggregates::Entry>& a,
+                           const std::pair<uint32_t, LiveAggregates::Entry>& b) {
+            return a.second.live_bytes > b.second.live_bytes;
+        };
+        if (out.size() > k) {
+            std::partial_sort(out.begin(), out.begin() + k, out.end(), by_bytes);
+            out.resize(k);
+        } else {
+            std::sort(out.begin(), out.end(), by_bytes);
+        }
+        return true;
+    }
+
+    /**
+     * Read and answer one request; false when the client should be dropped
+     */
+    bool serve(int fd) {
+        jma::QueryRequest request;
+        if (!jma::read_fully(fd, &request, sizeof(request)) || request.magic != jma::QUERY_MAGIC ||
+            request.payload_length > jma::QUERY_MAX_PAYLOAD) {
+            return false;
+        }
+        std::string argument(request.payload_length, '\0');
+        if (!jma::read_fully(fd, &argument[0], argument.size())) {
+            return false;
+        }
+
+        std::vector<char> payload;
+        size_t k = request.arg > 0 ? request.arg : QUERY_DEFAULT_TOP;
+        switch (request.op) {
+            case jma::QUERY_STATS: {
+                int64_t values[jma::STATS_FIELD_COUNT];
+                if (!g_stats_page.address() || !jma::read_stats_page(g_stats_page.address(), values)) {
+                    reply(fd, request, jma::QUERY_UNAVAILABLE, 0, 0, payload);
+                    break;
+                }
+                payload.assign((const char*)values, (const char*)values + sizeof(values));
+                reply(fd, request, jma::QUERY_OK, jma::STATS_FIELD_COUNT, 0, payload);
+                break;
+            }
+            case jma::QUERY_TOP_SITES:
+            case jma::QUERY_CLASS_HISTOGRAM: {
+                bool by_class = request.op == jma::QUERY_CLASS_HISTOGRAM;
+                auto entries = by_class ? g_live.top_classes(k) : g_live.top_sites(k);
+                append_entries(payload, entries, by_class);
+                reply(fd, request, jma::QUERY_OK, (uint32_t)entries.size(), 0, payload);
+                break;
+            }
+            case jma::QUERY_SITE_LIVE: {
+                uint32_t index;
+                LiveAggregates::Entry entry;
+                if (!g_sites.find(argument, &index) || !g_live.site(index, &entry)) {
+                    reply(fd, request, jma::QUERY_NOT_FOUND, 0, 0, payload);
+                    break;
+                }
+                append_entries(payload, {{index, entry}}, false);
+                reply(fd, request, jma::QUERY_OK, 1, 0, payload);
+                break;
+            }
+            case jma::QUERY_SET_SAMPLING: {
+                uint32_t previous = g_sampling_enabled.load(std::memory_order_relaxed)
+                    ? (uint32_t)g_sampling_interval.load(std::memory_order_relaxed) : 1;
+                if (request.arg == 0 || request.arg > (uint32_t)INT_MAX) {
+                    reply(fd, request, jma::QUERY_BAD_REQUEST, 0, previous, payload);
+                    break;
+                }
+                g_sampling_interval.store((int)request.arg, std::memory_order_release);
+                g_sampling_enabled.store(true, std::memory_order_release);
+                reply(fd, request, jma::QUERY_OK, 0, previous, payload);
+                break;
+            }
+            case jma::QUERY_HEAP_HISTOGRAM: {
+                std::vector<std::pair<uint32_t, LiveAggregates::Entry>> entries;
+                if (!heap_histogram(k, entries)) {
+                    reply(fd, request, jma::QUERY_UNAVAILABLE, 0, 0, payload);
+                    break;
+                }
+                append_entries(payload, entries, true);
+                reply(fd, request, jma::QUERY_OK, (uint32_t)entries.size(), 0, payload);
+                break;
+            }
+            case jma::QUERY_START_STREAM:
+#ifdef __linux__
+                g_event_stream.ensure(request.arg > 0 ? request.arg : STREAM_DEFAULT_MB);
+                reply(fd, request, jma::QUERY_OK, 0, 0, payload);
+#else
+                reply(fd, request, jma::QUERY_UNAVAILABLE, 0, 0, payload);
+#endif
+                break;
+            default:
+                reply(fd, request, jma::QUERY_UNKNOWN_OP, 0, 0, payload);
+                break;
+        }
+        return true;
+    }
+
+    void loop() {
+        std::vector<struct pollfd> fds;
+        fds.push_back({listen_fd, POLLIN, 0});
+
+        while (running.load(std::memory_order_acquire) && g_agent_active.load(std::memory_order_acquire)) {
+            if (::poll(fds.data(), fds.size(), 200) <= 0) {
+                continue;
+            }
+            for (size_t i = fds.size(); i-- > 1;) {
+                if (fds[i].revents && (!(fds[i].revents & POLLIN) || !serve(fds[i].fd))) {
+                    ::close(fds[i].fd);
+                    fds.erase(fds.begin() + i);
+                }
+            }
+            if (fds[0].revents & POLLIN) {
+                int fd;
+                while ((fd = accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC)) >= 0) {
+                    if (fds.size() > QUERY_MAX_CLIENTS) {
+                        ::close(fd);
+                        continue;
+                    }
+                    struct timeval tv = {1, 0};     // A stalled client cannot block the server
+                    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+                    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+                    fds.push_back({fd, POLLIN, 0});
+                }
+            }
+        }
+
+        for (size_t i = 1; i < fds.size(); i++) {
+            ::close(fds[i].fd);
+        }
+        if (jni && g_java_vm) {
+            g_java_vm->DetachCurrentThread();
+            jni = nullptr;
+        }
+    }
+
+public:
+    void set_enabled(bool value) {
+        enabled = value;
+    }
+
+    bool start() {
+        if (!enabled || running.load()) {
+            return false;
+        }
+        socket_path = jma::query_socket_path((uint32_t)getpid());
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (socket_path.size() >= sizeof(addr.sun_path)) {
+            return false;
+        }
+        memcpy(addr.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listen_fd < 0) {
+            return false;
+        }
+        unlink(socket_path.c_str());
+        if (bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listen_fd, 16) != 0) {
+            fprintf(stderr, "[JVM TI] Cannot listen on %s\n", socket_path.c_str());
+            ::close(listen_fd);
+            listen_fd = -1;
+            return false;
+        }
+        chmod(socket_path.c_str(), 0600);
+
+        running.store(true, std::memory_order_release);
+        thread = std::thread([this] { loop(); });
+        return true;
+    }
+
+    void stop() {
+        running.store(false, std::memory_order_release);
+        if (thread.joinable()) {
+            thread.join();
+        }
+        if (listen_fd >= 0) {
+            ::close(listen_fd);
+            listen_fd = -1;
+            unlink(socket_path.c_str());
+        }
+    }
+};
+
+static QueryServer g_query_server;
+
+// ============================================================================
+// Flight Recorder
+// ============================================================================
+
+/**
+ * Rolling in-memory flight recorder
+ *
+ * Keeps the most recent events in a fixed ring of FLIGHT_BLOCK_SIZE blocks,
+ * allocated once when the recorder is enabled. Events are varint/delta
+ * encoded (typically 8-16 bytes); when the ring is full the oldest block is
+ * overwritten. Every block starts from an absolute timestamp, so blocks
+ * decode independently. Nothing is written to disk until a dump is
+ * triggered (command, heap threshold or OutOfMemoryError); the dump is a
+ * regular recording chunk that jma-analyzer reads.
+ *
+ * Written by the event processor thread; dumps may come from any thread.
  */
-// 这是 C++ 代码，运行在 JVM 内部
-// 每当有对象分配，JVM 会自动调用这个回调函数
-void JNICALL CallbackObjectAlloc(jvmtiEnv* jvmti_env, JNIEnv* jni_env,
-                                  jthread thread, jobject object,
-                                  jclass object_klass, jlong size) {
-    if (!g_agent_active.load(std::memory_order_relaxed)) {
-        return;
+class FlightRecorder {
+private:
+    struct BlockHeader {
+        jlong first_timestamp;
+        jlong last_timestamp;
+        uint32_t used;          // Bytes used, including this header
+        uint32_t events;
+    };
+
+    std::mutex mutex;
+    uint8_t* ring = nullptr;
+    size_t block_count = 0;
+    size_t current = 0;         // Block being written
+    size_t filled = 0;          // Blocks holding data
+    jlong prev_timestamp = 0;
+    jlong prev_tag = 0;
+    std::unordered_map<uint64_t, uint32_t> thread_ids;   // Grows per thread, not per event
+    std::vector<std::pair<std::string, std::string>> properties;
+    std::string directory = ".";
+    std::atomic<jlong> retention_ms{0};          // 0 = everything in the ring
+    std::atomic<int> heap_threshold{0};          // Percent of max heap, 0 = off
+    std::atomic<bool> heap_armed{true};
+    std::atomic<const char*> pending_dump{nullptr};
+    std::atomic<uint64_t> events_recorded{0};
+    std::atomic<uint64_t> dumps_written{0};
+
+    BlockHeader* block(size_t index) {
+        return (BlockHeader*)(ring + index * FLIGHT_BLOCK_SIZE);
+    }
+
+    static inline uint8_t* put_varint(uint8_t* p, uint64_t v) {
+        while (v >= 0x80) {
+            *p++ = (uint8_t)(v | 0x80);
+            v >>= 7;
+        }
+        *p++ = (uint8_t)v;
+        return p;
+    }
+
+    static inline const uint8_t* get_varint(const uint8_t* p, const uint8_t* end, uint64_t& v) {
+        v = 0;
+        for (int shift = 0; p < end && shift < 64; shift += 7) {
+            uint8_t b = *p++;
+            v |= (uint64_t)(b & 0x7F) << shift;
+            if (!(b & 0x80)) return p;
+        }
+        return nullptr;
+    }
+
+    static inline uint64_t zigzag(int64_t v) {
+        return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+    }
+
+    static inline int64_t unzigzag(uint64_t v) {
+        return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+    }
+
+    // Caller holds mutex
+    void start_block(size_t index, jlong timestamp) {
+        BlockHeader* b = block(index);
+        b->first_timestamp = timestamp;
+        b->last_timestamp = timestamp;
+        b->used = sizeof(BlockHeader);
+        b->events = 0;
+        prev_timestamp = timestamp;
+        prev_tag = 0;
+    }
+
+    // Caller holds mutex
+    uint32_t thread_index(uint64_t thread_id) {
+        auto it = thread_ids.find(thread_id);
+        if (it != thread_ids.end()) {
+            return it->second;
+        }
+        uint32_t index = (uint32_t)thread_ids.size() + 1;
+        thread_ids.emplace(thread_id, index);
+        return index;
+    }
+
+    // Caller holds mutex
+    void decode_block(const BlockHeader* b, jlong since, jma::ChunkWriter& out) {
+        const uint8_t* p = (const uint8_t*)b + sizeof(BlockHeader);
+        const uint8_t* end = (const uint8_t*)b + b->used;
+        jlong timestamp = b->first_timestamp;
+        jlong tag = 0;
+
+        for (uint32_t i = 0; i < b->events && p && p < end; i++) {
+            uint8_t type = *p++;
+            uint64_t v;
+            if (!(p = get_varint(p, end, v))) break;
+            timestamp += unzigzag(v);
+
+            jma::RecordedEvent rec;
+            memset(&rec, 0, sizeof(rec));
+            rec.type = type;
+            rec.timestamp = timestamp;
+            rec.class_index = jma::NO_INDEX;
+            rec.site_index = jma::NO_INDEX;
+
+            if (type == EVENT_ALLOC || type == EVENT_FREE) {
+                uint64_t class_id, site, size, thread, tag_delta;
+                if (!(p = get_varint(p, end, class_id)) || !(p = get_varint(p, end, site)) ||
+                    !(p = get_varint(p, end, size)) || !(p = get_varint(p, end, thread)) ||
+                    !(p = get_varint(p, end, tag_delta)) || p >= end) {
+                    break;
+                }
+                tag += unzigzag(tag_delta);
+                rec.weight_shift = *p++;
+                rec.size = (int64_t)size;
+                rec.thread_id = (uint32_t)thread;
+                rec.tag = tag;
+                if (class_id != 0) {
+                    rec.class_index = out.intern_class((uint32_t)class_id, g_classes.name((uint32_t)class_id));
+                }
+                if (site != 0) {
+                    rec.site_index = out.intern_site((uint32_t)(site - 1), g_sites.name((uint32_t)(site - 1)));
+                }
+                if (type == EVENT_FREE) {
+                    uint64_t age;
+                    if (!(p = get_varint(p, end, age))) break;
+                    rec.aux = timestamp - (jlong)age;
+                }
+            }
+
+            if (timestamp >= since) {
+                out.append(rec);
+            }
+        }
+    }
+
+public:
+    /**
+     * Allocate the ring (once); megabytes is rounded to whole blocks
+     */
+    bool enable(size_t megabytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (ring) {
+            return true;
+        }
+        size_t blocks = megabytes * 1024 * 1024 / FLIGHT_BLOCK_SIZE;
+        if (blocks < 2) blocks = 2;
+        ring = (uint8_t*)malloc(blocks * FLIGHT_BLOCK_SIZE);
+        if (!ring) {
+            return false;
+        }
+        block_count = blocks;
+        current = 0;
+        filled = 1;
+        start_block(0, get_current_timestamp());
+        return true;
+    }
+
+    void disable() {
+        std::lock_guard<std::mutex> lock(mutex);
+        free(ring);
+        ring = nullptr;
+        block_count = 0;
+        filled = 0;
+        thread_ids.clear();
     }
 
-    // Sampling check
-    if (g_sampling_enabled.load(std::memory_order_relaxed)) {
-        uint64_t counter = g_alloc_counter.fetch_add(1, std::memory_order_relaxed);
-        if (counter % g_sampling_interval.load(std::memory_order_relaxed) != 0) {
+    bool is_enabled() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ring != nullptr;
+    }
+
+    void set_retention(jlong ms) { retention_ms.store(ms, std::memory_order_relaxed); }
+    void set_heap_threshold(int percent) { heap_threshold.store(percent, std::memory_order_relaxed); }
+
+    void set_directory(const char* dir) {
+        std::lock_guard<std::mutex> lock(mutex);
+        directory = (dir && *dir) ? dir : ".";
+    }
+
+    void set_properties(const std::vector<std::pair<std::string, std::string>>& props) {
+        std::lock_guard<std::mutex> lock(mutex);
+        properties = props;
+    }
+
+    /**
+     * Encode one processed event into the ring (no allocation per event)
+     */
+    void record(const AllocationEvent& event, uint32_t site_index) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!ring) {
             return;
         }
+
+        BlockHeader* b = block(current);
+        if (b->used + FLIGHT_MAX_RECORD > FLIGHT_BLOCK_SIZE) {
+            current = (current + 1) % block_count;
+            if (filled < block_count) filled++;
+            start_block(current, event.timestamp);
+            b = block(current);
+        }
+
+        uint8_t* p = (uint8_t*)b + b->used;
+        *p++ = (uint8_t)event.type;
+        p = put_varint(p, zigzag(event.timestamp - prev_timestamp));
+        if (event.type == EVENT_ALLOC || event.type == EVENT_FREE) {
+            p = put_varint(p, event.class_id);
+            p = put_varint(p, site_index == jma::NO_INDEX ? 0 : (uint64_t)site_index + 1);
+            p = put_varint(p, (uint64_t)event.size);
+            p = put_varint(p, thread_index(event.thread_id));
+            p = put_varint(p, zigzag(event.tag - prev_tag));
+            *p++ = event.weight_shift;
+            if (event.type == EVENT_FREE) {
+                jlong age = event.timestamp - event.alloc_timestamp;
+                p = put_varint(p, (uint64_t)(age > 0 ? age : 0));
+            }
+            prev_tag = event.tag;
+        }
+        prev_timestamp = event.timestamp;
+
+        b->used = (uint32_t)(p - (uint8_t*)b);
+        b->events++;
+        b->last_timestamp = event.timestamp;
+        events_recorded.fetch_add(1, std::memory_order_relaxed);
     }
 
-    // Get object tag
-    // Note: GetObjectTag/SetObjectTag removed in newer JDK, use object address as tag
-    jlong tag = (jlong)(uintptr_t)object;
+    /**
+     * Write the ring contents (oldest first, within the retention window)
+     * as a recording chunk. path may be null to use the flight directory.
+     */
+    bool dump(const char* path, const char* reason, JNIEnv* jni) {
+        HeapUsage usage = read_heap_usage(jni);
+        jma::ChunkWriter writer;
+        std::string target;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!ring) {
+                return false;
+            }
 
-    // Capture stack trace
-    jint frame_count = 0;
-    jvmtiFrameInfo* frames = capture_stack_trace(jvmti_env, &frame_count);
+            jlong retention = retention_ms.load(std::memory_order_relaxed);
+            jlong since = retention > 0 ? get_current_timestamp() - retention : LLONG_MIN;
+            size_t oldest = filled < block_count ? 0 : (current + 1) % block_count;
+            for (size_t i = 0; i < filled; i++) {
+                const BlockHeader* b = block((oldest + i) % block_count);
+                if (b->events > 0 && b->last_timestamp >= since) {
+                    decode_block(b, since, writer);
+                }
+            }
 
-    // Create allocation info
-    AllocationInfo info;
-    info.size = size;
-    info.timestamp = get_current_timestamp();
-    info.klass = object_klass;
-    info.thread = thread;
-    info.frames = frames;
-    info.frame_count = frame_count;
-    info.thread_id = get_current_thread_id();
-    info.hash = (uint32_t)(tag ^ (tag >> 32));
+            for (const auto& prop : properties) {
+                writer.add_property(prop.first, prop.second);
+            }
+            writer.add_property("flight.reason", reason ? reason : "command");
+
+            if (path && *path) {
+                target = path;
+            } else {
+                char name[128];
+                time_t now = time(nullptr);
+                struct tm tm_buf;
+                localtime_r(&now, &tm_buf);
+                char stamp[32];
+                strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm_buf);
+                snprintf(name, sizeof(name), "/flight-%u-%s-%s%s", (unsigned)getpid(), stamp,
+                         reason ? reason : "command", jma::RECORDING_CHUNK_SUFFIX);
+                target = directory + name;
+            }
+        }
 
-    // Track allocation
-    g_tracker.track(tag, info);
+        jma::ChunkHeader& header = writer.mutable_header();
+        header.pid = (uint32_t)getpid();
+        header.sampling_interval = (uint32_t)g_sampling_interval.load(std::memory_order_relaxed);
+        header.heap_used = usage.used;
+        header.heap_committed = usage.committed;
+        header.heap_max = usage.max;
 
-    // Create event
-    AllocationEvent event;
-    event.type = EVENT_ALLOC;
-    event.tag = tag;
-    event.size = size;
-    event.timestamp = info.timestamp;
-    event.klass = (jclass)jni_env->NewGlobalRef(object_klass);
-    event.thread = (jthread)jni_env->NewGlobalRef(thread);
-    event.frame_count = frame_count;
-    event.thread_id = info.thread_id;
+        if (!writer.write_file(target)) {
+            fprintf(stderr, "[JVM TI] Failed to write flight recording %s\n", target.c_str());
+            return false;
+        }
+        dumps_written.fetch_add(1, std::memory_order_relaxed);
+        fprintf(stderr, "[JVM TI] Flight recording (%s, %zu events) written to %s\n",
+                reason ? reason : "command", writer.event_count(), target.c_str());
+
+        // GC timeline beside the recording: "<name>-gc.json"
+        std::string timeline = target;
+        size_t suffix_len = strlen(jma::RECORDING_CHUNK_SUFFIX);
+        if (timeline.size() > suffix_len &&
+            timeline.compare(timeline.size() - suffix_len, suffix_len, jma::RECORDING_CHUNK_SUFFIX) == 0) {
+            timeline.resize(timeline.size() - suffix_len);
+        }
+        timeline += "-gc.json";
+        if (!g_gc_timeline.write_json(timeline)) {
+            fprintf(stderr, "[JVM TI] Failed to write GC timeline %s\n", timeline.c_str());
+        }
+        return true;
+    }
 
-    // Copy frames
-    if (frames && frame_count > 0) {
-        event.frames = (jvmtiFrameInfo*)malloc(sizeof(jvmtiFrameInfo) * frame_count);
-        memcpy(event.frames, frames, sizeof(jvmtiFrameInfo) * frame_count);
+    /**
+     * Ask the event processor thread to dump (safe from any callback)
+     */
+    void request_dump(const char* reason) {
+        pending_dump.store(reason, std::memory_order_release);
     }
 
-    // Push to event queue
-    g_event_queue.push(event);
+    /**
+     * Run a requested dump; called by the event processor thread
+     */
+    void service_requests(JNIEnv* jni) {
+        if (!pending_dump.load(std::memory_order_relaxed)) {
+            return;
+        }
+        const char* reason = pending_dump.exchange(nullptr, std::memory_order_acq_rel);
+        if (reason) {
+            dump(nullptr, reason, jni);
+        }
+    }
 
-    // Call callback if registered
-    if (g_event_callback) {
-        g_event_callback(event);
+    /**
+     * Heap threshold trigger, checked after each GC. Fires once, then
+     * re-arms when usage falls FLIGHT_HEAP_REARM_PERCENT below the threshold.
+     */
+    void check_heap(JNIEnv* jni) {
+        int threshold = heap_threshold.load(std::memory_order_relaxed);
+        if (threshold <= 0 || !jni || !is_enabled()) {
+            return;
+        }
+        HeapUsage usage = read_heap_usage(jni);
+        if (usage.max <= 0) {
+            return;
+        }
+        jlong percent = usage.used * 100 / usage.max;
+        if (percent >= threshold && heap_armed.exchange(false)) {
+            dump(nullptr, "heap", jni);
+        } else if (percent < threshold - FLIGHT_HEAP_REARM_PERCENT) {
+            heap_armed.store(true);
+        }
     }
 
-    // ===== Call Java layer via JNI =====
-    // Notify Java layer about this allocation
-    if (g_java_vm && g_heap_analyzer_class && g_on_object_alloc_method) {
-        JNIEnv* env = nullptr;
-        bool attached = false;
+    uint64_t get_events_recorded() const { return events_recorded.load(std::memory_order_relaxed); }
+    uint64_t get_dumps_written() const { return dumps_written.load(std::memory_order_relaxed); }
+};
 
-        // Get JNIEnv for current thread
-        if (g_java_vm->GetEnv((void**)&env, JNI_VERSION_1_8) != JNI_OK) {
-            // Not attached, attach current thread
-            if (g_java_vm->AttachCurrentThread((void**)&env, nullptr) == JNI_OK) {
-                attached = true;
+static FlightRecorder g_flight;
+
+// ============================================================================
+// OOM Reporter
+// ============================================================================
+
+/**
+ * Writes a snapshot of the agent's state when the VM runs out of a resource
+ *
+ * Runs inside the ResourceExhausted callback, so it must not allocate Java
+ * objects or sizeable native memory: all tables and the output buffer are
+ * mapped and touched once when the agent activates (prepare), so a dormant
+ * agent does not carry them; the report is formatted
+ * with snprintf and written with write(2). Walking the tracker is bounded
+ * by OOM_BUDGET_MS; a truncated walk is marked "complete": false.
+ *
+ * Report: "<dir>/oom-<pid>-<n>.json" with the live-object class histogram,
+ * the top allocation sites (from g_tracker), the newest events still in
+ * g_event_queue and the last OOM_GC_CYCLES cycles of the GC timeline. Optionally a heap dump is started through
+ * HotSpotDiagnosticMXBean, whose references are resolved in advance.
+ */
+class OomReporter {
+private:
+    struct ClassSlot {
+        uint32_t count;
+        jlong bytes;
+    };
+
+    struct SiteSlot {
+        uint64_t hash;
+        uint32_t count;
+        jlong bytes;
+    };
+
+    /**
+     * Report working memory, mapped by prepare()
+     */
+    struct Tables {
+        ClassSlot classes[MAX_TRACKED_CLASSES];
+        SiteSlot sites[OOM_SITE_SLOTS];
+        AllocationEvent recent[OOM_RECENT_EVENTS];
+        GcCycle gc_cycles[OOM_GC_CYCLES];
+        char buffer[OOM_REPORT_BUFFER];
+    };
+
+    Tables* tables = nullptr;
+    ClassSlot* classes = nullptr;
+    SiteSlot* sites = nullptr;
+    char* buffer = nullptr;
+    uint32_t top_classes[OOM_TOP_CLASSES];
+    uint32_t top_sites[OOM_TOP_SITES];
+    size_t length = 0;
+    char directory[1024] = ".";
+
+    std::atomic<bool> busy{false};
+    std::atomic<int> reports_written{0};
+
+    // Heap dump (resolved ahead of time; null when disabled)
+    bool heap_dump_enabled = false;
+    jobject diagnostic_bean = nullptr;
+    jmethodID dump_heap_method = nullptr;
+    jstring heap_dump_path = nullptr;
+    std::atomic<bool> heap_dumped{false};
+
+    void append(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+        if (length >= OOM_REPORT_BUFFER) return;
+        va_list args;
+        va_start(args, format);
+        int n = vsnprintf(buffer + length, OOM_REPORT_BUFFER - length, format, args);
+        va_end(args);
+        if (n > 0) length = std::min((size_t)OOM_REPORT_BUFFER, length + (size_t)n);
+    }
+
+    void append_string(const char* s) {
+        append("\"");
+        for (; s && *s && length < OOM_REPORT_BUFFER - 8; s++) {
+            unsigned char c = (unsigned char)*s;
+            if (c == '"' || c == '\\') append("\\%c", c);
+            else if (c < 0x20) append("\\u%04x", c);
+            else buffer[length++] = (char)c;
+        }
+        append("\"");
+    }
+
+    SiteSlot* site_slot(uint64_t hash) {
+        size_t index = (size_t)(hash % OOM_SITE_SLOTS);
+        for (size_t probe = 0; probe < OOM_SITE_SLOTS; probe++) {
+            SiteSlot* slot = &sites[(index + probe) % OOM_SITE_SLOTS];
+            if (slot->hash == hash || slot->hash == 0) {
+                slot->hash = hash;
+                return slot;
             }
         }
+        return nullptr;   // Table full: site not reported
+    }
 
-        if (env) {
-            // Get class name
-            char* class_sig = nullptr;
-            jvmti_env->GetClassSignature(object_klass, &class_sig, nullptr);
-            std::string class_name = class_sig ? class_sig : "unknown";
-            // Remove L and ; from signature (e.g., "Ljava/lang/String;" -> "java/lang/String")
-            if (class_name[0] == 'L') {
-                class_name = class_name.substr(1, class_name.length() - 2);
+    /**
+     * Keep the n largest entries (by bytes) in top[], without allocation
+     */
+    template <typename Bytes>
+    static size_t select_top(uint32_t* top, size_t capacity, size_t candidates, Bytes bytes_of) {
+        size_t n = 0;
+        for (size_t i = 0; i < candidates; i++) {
+            jlong bytes = bytes_of(i);
+            if (bytes <= 0 || (n == capacity && bytes <= bytes_of(top[n - 1]))) {
+                continue;
+            }
+            size_t pos = n < capacity ? n++ : capacity - 1;
+            while (pos > 0 && bytes_of(top[pos - 1]) < bytes) {
+                top[pos] = top[pos - 1];
+                pos--;
             }
+            top[pos] = (uint32_t)i;
+        }
+        return n;
+    }
 
-            // Build stack trace string
-            char* stack_trace = build_stack_trace_string(jvmti_env, env, frames, frame_count);
+    void start_heap_dump(JNIEnv* jni) {
+        if (!heap_dump_path || !jni || heap_dumped.exchange(true) || jni->ExceptionCheck()) {
+            return;
+        }
+        jni->CallVoidMethod(diagnostic_bean, dump_heap_method, heap_dump_path, (jboolean)JNI_TRUE);
+        if (jni->ExceptionCheck()) {
+            jni->ExceptionClear();
+            safe_print("Heap dump failed");
+        }
+    }
 
-            // Get thread info
-            std::string thread_name = "unknown";
-            jlong thread_id = get_current_thread_id();
+public:
+    void set_directory(const char* dir) {
+        snprintf(directory, sizeof(directory), "%s", (dir && *dir) ? dir : ".");
+    }
 
-            // Call Java method
-            jstring classNameStr = env->NewStringUTF(class_name.c_str());
-            jstring threadNameStr = env->NewStringUTF(thread_name.c_str());
-            jstring stackTraceStr = stack_trace ? env->NewStringUTF(stack_trace) : nullptr;
+    void set_heap_dump(bool enabled) {
+        heap_dump_enabled = enabled;
+    }
 
-            env->CallStaticVoidMethod(
-                g_heap_analyzer_class,
-                g_on_object_alloc_method,
-                tag,
-                classNameStr,
-                size,
-                thread_id,
-                threadNameStr,
-                stackTraceStr
-            );
+    /**
+     * Map the tables and touch them so the pages are resident before they
+     * are needed (once, when the agent activates)
+     */
+    bool prepare() {
+        if (tables) {
+            return true;
+        }
+        void* mapping = mmap(nullptr, sizeof(Tables), PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+        memset(mapping, 0, sizeof(Tables));
+        tables = (Tables*)mapping;
+        classes = tables->classes;
+        sites = tables->sites;
+        buffer = tables->buffer;
+        return true;
+    }
 
-            // Clean up local refs
-            env->DeleteLocalRef(classNameStr);
-            env->DeleteLocalRef(threadNameStr);
-            if (stackTraceStr) env->DeleteLocalRef(stackTraceStr);
-            if (class_sig) jvmti_env->Deallocate((unsigned char*)class_sig);
-            if (stack_trace) free(stack_trace);
+    /**
+     * Resolve the HotSpotDiagnosticMXBean used for the optional heap dump.
+     * Called once on a thread attached to the live VM.
+     */
+    void prepare_heap_dump(JNIEnv* jni) {
+        if (!heap_dump_enabled || !jni || heap_dump_path) {
+            return;
+        }
+
+        jclass factory = jni->FindClass("java/lang/management/ManagementFactory");
+        jclass diagnostic = jni->FindClass("com/sun/management/HotSpotDiagnosticMXBean");
+        if (factory && diagnostic) {
+            jmethodID get_bean = jni->GetStaticMethodID(factory, "getPlatformMXBean",
+                "(Ljava/lang/Class;)Ljava/lang/management/PlatformManagedObject;");
+            dump_heap_method = jni->GetMethodID(diagnostic, "dumpHeap", "(Ljava/lang/String;Z)V");
+            jobject bean = get_bean ? jni->CallStaticObjectMethod(factory, get_bean, diagnostic) : nullptr;
+
+            char path[1200];
+            snprintf(path, sizeof(path), "%s/oom-%u.hprof", directory, (unsigned)getpid());
+            jstring path_str = jni->NewStringUTF(path);
+
+            if (bean && dump_heap_method && path_str) {
+                diagnostic_bean = jni->NewGlobalRef(bean);
+                heap_dump_path = (jstring)jni->NewGlobalRef(path_str);
+            }
+            if (bean) jni->DeleteLocalRef(bean);
+            if (path_str) jni->DeleteLocalRef(path_str);
+        }
+        if (jni->ExceptionCheck()) {
+            jni->ExceptionClear();
+        }
+        if (factory) jni->DeleteLocalRef(factory);
+        if (diagnostic) jni->DeleteLocalRef(diagnostic);
+        if (!heap_dump_path) {
+            safe_print("HotSpotDiagnosticMXBean not available; OOM heap dump disabled");
+        }
+    }
+
+    /**
+     * Write the report (called from the ResourceExhausted callback)
+     */
+    void report(JNIEnv* jni, jint flags, const char* description) {
+        if (!tables || busy.exchange(true)) {
+            return;   // Not activated, or another thread is already reporting
+        }
+        if (reports_written.load() >= OOM_MAX_REPORTS) {
+            busy.store(false);
+            return;
+        }
+
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(OOM_BUDGET_MS);
+        memset(classes, 0, sizeof(tables->classes));
+        memset(sites, 0, sizeof(tables->sites));
+        length = 0;
+
+        // Aggregate live tracked objects by class and site
+        uint32_t class_limit = std::min<uint32_t>(g_classes.size(), MAX_TRACKED_CLASSES);
+        jlong tracked = 0;
+        bool complete = g_tracker.visit_bounded([&](jlong, const AllocationInfo& info) {
+            tracked++;
+            if (info.class_id < class_limit) {
+                classes[info.class_id].count++;
+                classes[info.class_id].bytes += info.size;
+            }
+            if (info.site_hash != 0) {
+                SiteSlot* slot = site_slot(info.site_hash);
+                if (slot) {
+                    slot->count++;
+                    slot->bytes += info.size;
+                }
+            }
+        }, deadline);
+
+        size_t class_count = select_top(top_classes, OOM_TOP_CLASSES, class_limit,
+                                        [this](size_t i) { return classes[i].bytes; });
+        size_t site_count = select_top(top_sites, OOM_TOP_SITES, OOM_SITE_SLOTS,
+                                       [this](size_t i) { return sites[i].bytes; });
+        size_t recent_count = g_event_queue.peek_recent(tables->recent, OOM_RECENT_EVENTS);
+        size_t gc_count = g_gc_timeline.snapshot(LLONG_MIN, LLONG_MAX, tables->gc_cycles, OOM_GC_CYCLES);
+
+        jlong now = get_current_timestamp();
+        time_t secs = (time_t)(now / 1000);
+        struct tm tm_buf;
+        localtime_r(&secs, &tm_buf);
+        char formatted[32];
+        strftime(formatted, sizeof(formatted), "%Y-%m-%d %H:%M:%S", &tm_buf);
+
+        append("{\n  \"reportType\": \"Resource Exhausted\",\n");
+        append("  \"timestamp\": %lld,\n  \"timestampFormatted\": \"%s\",\n", (long long)now, formatted);
+        append("  \"pid\": %u,\n  \"flags\": [", (unsigned)getpid());
+        const char* sep = "";
+        if (flags & JVMTI_RESOURCE_EXHAUSTED_OOM_ERROR) { append("%s\"OOM_ERROR\"", sep); sep = ", "; }
+        if (flags & JVMTI_RESOURCE_EXHAUSTED_JAVA_HEAP) { append("%s\"JAVA_HEAP\"", sep); sep = ", "; }
+        if (flags & JVMTI_RESOURCE_EXHAUSTED_THREADS) { append("%s\"THREADS\"", sep); }
+        append("],\n  \"description\": ");
+        append_string(description ? description : "");
+        append(",\n  \"complete\": %s,\n", complete ? "true" : "false");
+        append("  \"memoryStats\": {\n    \"trackedObjects\": %lld,\n    \"currentUsage\": %llu,\n"
+               "    \"totalAllocated\": %llu,\n    \"totalFreed\": %llu,\n    \"droppedEvents\": %llu\n  },\n",
+               (long long)tracked, (unsigned long long)g_tracker.get_current_usage(),
+               (unsigned long long)g_tracker.get_total_allocated(),
+               (unsigned long long)g_tracker.get_total_freed(),
+               (unsigned long long)g_event_queue.get_dropped());
+
+        append("  \"classHistogram\": [");
+        for (size_t i = 0; i < class_count; i++) {
+            const ClassSlot& c = classes[top_classes[i]];
+            append("%s\n    {\"className\": ", i ? "," : "");
+            append_string(g_classes.name(top_classes[i]));
+            append(", \"instanceCount\": %u, \"totalSize\": %lld, \"avgSize\": %lld}",
+                   c.count, (long long)c.bytes, (long long)(c.count ? c.bytes / c.count : 0));
+        }
+        append("\n  ],\n  \"allocationSites\": [");
+        for (size_t i = 0; i < site_count; i++) {
+            const SiteSlot& site = sites[top_sites[i]];
+            uint32_t index;
+            char unresolved[40];
+            const char* name = unresolved;
+            if (g_sites.lookup(site.hash, &index)) {
+                name = g_sites.name(index);
+            } else {
+                snprintf(unresolved, sizeof(unresolved), "unresolved@%016llx", (unsigned long long)site.hash);
+            }
+            append("%s\n    {\"site\": ", i ? "," : "");
+            append_string(name);
+            append(", \"allocationCount\": %u, \"totalSize\": %lld, \"avgSize\": %lld}",
+                   site.count, (long long)site.bytes, (long long)(site.count ? site.bytes / site.count : 0));
+        }
+        append("\n  ],\n  \"recentEvents\": [");
+        for (size_t i = 0; i < recent_count; i++) {
+            const AllocationEvent& e = tables->recent[i];
+            append("%s\n    {\"type\": %d, \"timestamp\": %lld, \"className\": ",
+                   i ? "," : "", (int)e.type, (long long)e.timestamp);
+            append_string(g_classes.name(e.class_id));
+            append(", \"size\": %lld, \"threadId\": %llu}", (long long)e.size, (unsigned long long)e.thread_id);
+        }
+        append("\n  ],\n  \"gcCycles\": [");
+        for (size_t i = 0; i < gc_count; i++) {
+            const GcCycle& c = tables->gc_cycles[i];
+            append("%s\n    {\"id\": %lld, \"start\": %lld, \"end\": %lld, \"durationMs\": %lld, "
+                   "\"allocationCount\": %lld, \"allocationBytes\": %lld, "
+                   "\"freedCount\": %lld, \"freedBytes\": %lld, \"topSites\": [",
+                   i ? "," : "", (long long)c.id, (long long)c.start, (long long)c.end,
+                   (long long)(c.end ? c.end - c.start : -1), (long long)c.alloc_count,
+                   (long long)c.alloc_bytes, (long long)c.freed_count, (long long)c.freed_bytes);
+            for (uint32_t j = 0; j < c.site_count; j++) {
+                append("%s{\"site\": ", j ? ", " : "");
+                append_string(g_sites.name(c.sites[j].site));
+                append(", \"allocationCount\": %lld, \"totalSize\": %lld}",
+                       (long long)c.sites[j].count, (long long)c.sites[j].bytes);
+            }
+            append("]}");
+        }
+        append("\n  ],\n  \"heapDump\": ");
+        if (heap_dump_path && !heap_dumped.load()) {
+            append("\"%s/oom-%u.hprof\"\n}\n", directory, (unsigned)getpid());
+        } else {
+            append("null\n}\n");
+        }
+
+        int n = reports_written.fetch_add(1) + 1;
+        char path[1200];
+        snprintf(path, sizeof(path), "%s/oom-%u-%d.json", directory, (unsigned)getpid(), n);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            size_t written = 0;
+            while (written < length) {
+                ssize_t w = write(fd, buffer + written, length - written);
+                if (w <= 0) break;
+                written += (size_t)w;
+            }
+            close(fd);
+            fprintf(stderr, "[JVM TI] Resource exhausted; state written to %s\n", path);
+        } else {
+            safe_print("Resource exhausted; cannot write OOM report");
+        }
+
+        start_heap_dump(jni);
+        busy.store(false);
+    }
+};
+
+static OomReporter g_oom_reporter;
+
+/**
+ * Resource Exhausted Event Handler (heap/metaspace OOM, thread exhaustion)
+ */
+void JNICALL CallbackResourceExhausted(jvmtiEnv* jvmti_env, JNIEnv* jni_env, jint flags,
+                                       const void* reserved, const char* description) {
+    g_oom_reporter.report(jni_env, flags, description);
+    g_flight.request_dump("oom");
+}
+
+// ============================================================================
+// Event Processor Thread
+// ============================================================================
 
-            // Detach if we attached
-            if (attached) {
-                g_java_vm->DetachCurrentThread();
-            }
+/**
+ * Collect the system properties recorded in every chunk
+ */
+static std::vector<std::pair<std::string, std::string>> collect_system_properties(jvmtiEnv* jvmti) {
+    static const char* const keys[] = {
+        "java.version", "java.vendor", "java.vm.name", "java.vm.version",
+        "os.name", "os.version", "os.arch"
+    };
+
+    std::vector<std::pair<std::string, std::string>> props;
+    for (const char* key : keys) {
+        char* value = nullptr;
+        if (jvmti->GetSystemProperty(key, &value) == JVMTI_ERROR_NONE && value) {
+            props.emplace_back(key, value);
+            jvmti->Deallocate((unsigned char*)value);
         }
     }
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    props.emplace_back("availableProcessors", std::to_string(cpus > 0 ? cpus : 1));
+    return props;
 }
 
 /**
- * Garbage Collection Start Event Handler
+ * Attach the event processor thread to the VM once it is live, so it can
+ * symbolize stacks and make JNI calls with its own JNIEnv.
  */
-void JNICALL CallbackGarbageCollectionStart(jvmtiEnv* jvmti_env) {
-    if (!g_agent_active.load(std::memory_order_relaxed)) {
+static void attach_processor_thread() {
+    if (g_processor_jni || !g_java_vm || !g_vm_live.load(std::memory_order_acquire)) {
         return;
     }
 
-    AllocationEvent event;
-    event.type = EVENT_GC_START;
-    event.timestamp = get_current_timestamp();
-    g_event_queue.push(event);
+    JavaVMAttachArgs args;
+    args.version = JNI_VERSION_1_8;
+    args.name = (char*)"JMA Event Processor";
+    args.group = nullptr;
+    if (g_java_vm->AttachCurrentThreadAsDaemon((void**)&g_processor_jni, &args) != JNI_OK) {
+        g_processor_jni = nullptr;
+        return;
+    }
+
+    if (g_jvmti) {
+        auto props = collect_system_properties(g_jvmti);
+        g_spooler.set_properties(props);
+        g_flight.set_properties(props);
+    }
+    g_oom_reporter.prepare_heap_dump(g_processor_jni);
 }
 
 /**
- * Garbage Collection Finish Event Handler
+ * Map an event's stack hash to a SiteTable index, symbolizing new sites
  */
-void JNICALL CallbackGarbageCollectionFinish(jvmtiEnv* jvmti_env) {
-    if (!g_agent_active.load(std::memory_order_relaxed)) {
+static uint32_t resolve_site(const AllocationEvent& event) {
+    if (event.site_hash == 0) {
+        return jma::NO_INDEX;
+    }
+
+    uint32_t index;
+    if (g_sites.lookup(event.site_hash, &index)) {
+        return index;
+    }
+    if (event.type != EVENT_ALLOC || !event.frames || !g_processor_jni || !g_jvmti ||
+        !g_controls.symbols()) {
+        // Cannot (or should not) symbolize yet; do not cache the hash
+        return g_sites.intern(0, "unknown");
+    }
+
+    std::string site = symbolize_site(g_jvmti, g_processor_jni, event.frames, event.frame_count);
+    return g_sites.intern(event.site_hash, site);
+}
+
+static void process_event(AllocationEvent& event) {
+    uint32_t site_index = jma::NO_INDEX;
+
+    switch (event.type) {
+        case EVENT_ALLOC:
+        case EVENT_FREE:
+            site_index = resolve_site(event);
+            break;
+        default:
+            break;
+    }
+
+    g_metrics_sampler.on_event(event);
+    g_gc_timeline.on_event(event, site_index);
+    g_live.on_event(event, site_index);
+    jlong weight = (jlong)1 << event.weight_shift;
+    if (event.type == EVENT_ALLOC) {
+        g_lifetimes.record_alloc(site_index, event.size, event.timestamp, weight);
+    } else if (event.type == EVENT_FREE) {
+        g_lifetimes.record(site_index, event.timestamp - event.alloc_timestamp,
+                           event.gcs_survived, event.size, weight);
+    }
+    g_spooler.append(event, site_index, g_processor_jni);
+    g_flight.record(event, site_index);
+    g_event_stream.publish(event, site_index);
+    if (event.type == EVENT_GC_FINISH) {
+        g_flight.check_heap(g_processor_jni);
+        g_trends.tick(event.timestamp, true);
+    }
+
+    // Release frames (their arena block is recycled with its last copy)
+    g_frame_arena.release(event.frames);
+}
+
+/**
+ * Untrack the tags buffered by ObjectFree and process their free events,
+ * but only frees whose allocation event has already been processed, so
+ * every consumer sees an object's ALLOC before its FREE:
+ *
+ *   - frees observed up to max_epoch, when the processor has just popped
+ *     a GC event of that epoch (every object freed by the cycle was
+ *     allocated, and its ALLOC queued, before the cycle started);
+ *   - every buffered free when idle and the queue is still empty after
+ *     the buffer was swapped (the ALLOC of a buffered free was queued
+ *     before the free happened).
+ *
+ * Other frees stay pending for a later call. timestamp is used as the time
+ * of death (the GC that freed them, or the drain time for late frees).
+ */
+static void drain_frees(jlong timestamp, uint32_t max_epoch, bool idle) {
+    static std::vector<std::pair<jlong, uint32_t>> pending;    // {tag, GC epoch at the free}
+    static std::vector<jlong> tags;
+    static std::vector<AllocationEvent> freed;
+
+    g_free_buffer.drain(pending);
+    if (pending.empty()) {
         return;
     }
+    if (idle) {
+        if (!g_event_queue.empty()) {
+            return;
+        }
+        max_epoch = UINT32_MAX;
+    }
 
-    AllocationEvent event;
-    event.type = EVENT_GC_FINISH;
-    event.timestamp = get_current_timestamp();
-    g_event_queue.push(event);
+    auto ready_end = std::stable_partition(pending.begin(), pending.end(),
+        [max_epoch](const std::pair<jlong, uint32_t>& f) { return f.second <= max_epoch; });
+    std::stable_sort(pending.begin(), ready_end,
+        [](const std::pair<jlong, uint32_t>& a, const std::pair<jlong, uint32_t>& b) { return a.second < b.second; });
+
+    freed.clear();
+    uint64_t thread_id = get_current_thread_id();
+    for (auto run = pending.begin(); run != ready_end;) {
+        uint32_t epoch = run->second;
+        tags.clear();
+        for (; run != ready_end && run->second == epoch; ++run) {
+            tags.push_back(run->first);
+        }
+        g_tracker.untrack_batch(tags.data(), tags.size(), [&](jlong tag, const AllocationInfo& info) {
+            AllocationEvent event;
+            event.type = EVENT_FREE;
+            event.tag = tag;
+            event.size = info.size;
+            event.timestamp = timestamp;
+            event.alloc_timestamp = info.timestamp;
+            event.class_id = info.class_id;
+            event.site_hash = info.site_hash;
+            event.thread_id = thread_id;
+            // The collecting cycle itself is not survived
+            event.gcs_survived = epoch > info.gc_epoch ? epoch - info.gc_epoch - 1 : 0;
+            event.weight_shift = info.weight_shift;
+            freed.push_back(event);
+        });
+    }
+    pending.erase(pending.begin(), ready_end);
+
+    for (AllocationEvent& event : freed) {
+        process_event(event);
+    }
 }
 
 /**
- * Object Free Event Handler (VMObjectFree)
- * Note: This requires -XX:+UnlockDiagnosticVMOptions -XX:+TrackObjectFree
+ * Evict the oldest tracked objects while more than g_max_tracked are
+ * tracked. They leave the live aggregates as if freed, but are not
+ * counted as frees or lifetimes.
  */
-void JNICALL CallbackObjectFree(jvmtiEnv* jvmti_env, jlong tag) {
-    if (!g_agent_active.load(std::memory_order_relaxed)) {
+static void enforce_tracked_limit() {
+    uint64_t limit = g_max_tracked.load(std::memory_order_relaxed);
+    uint64_t tracked = g_tracker.get_tracked_count();
+    if (limit == 0 || tracked <= limit) {
         return;
     }
 
-    AllocationInfo info;
-    if (g_tracker.untrack(tag, info)) {
+    static std::vector<AllocationEvent> evicted;
+    evicted.clear();
+    g_tracker.evict_oldest((size_t)(tracked - limit), [&](jlong tag, const AllocationInfo& info) {
         AllocationEvent event;
         event.type = EVENT_FREE;
         event.tag = tag;
         event.size = info.size;
-        event.timestamp = get_current_timestamp();
-        event.thread_id = get_current_thread_id();
-        g_event_queue.push(event);
+        event.alloc_timestamp = info.timestamp;
+        event.class_id = info.class_id;
+        event.site_hash = info.site_hash;
+        event.weight_shift = info.weight_shift;
+        evicted.push_back(event);
+    });
+
+    for (const AllocationEvent& event : evicted) {
+        g_live.on_event(event, resolve_site(event));
     }
 }
 
-/**
- * VM Death Event Handler
- */
-void JNICALL CallbackVMDeath(jvmtiEnv* jvmti_env, JNIEnv* jni_env) {
-    g_agent_active.store(false, std::memory_order_release);
-    safe_print("VM Death - Agent shutting down");
-}
-
-// ============================================================================
-// Event Processor Thread
-// ============================================================================
-
 static void event_processor_loop() {
+    jlong last_roll_check = 0;
+    jlong last_drain = 0;
+
     while (g_agent_active.load(std::memory_order_acquire)) {
+        attach_processor_thread();
+        g_flight.service_requests(g_processor_jni);
+
         AllocationEvent event;
 
         if (g_event_queue.pop(event)) {
-            // Process event
-            switch (event.type) {
-                case EVENT_ALLOC:
-                    // Allocation events are already tracked
-                    break;
-                case EVENT_FREE:
-                    // Free events are already processed
-                    break;
-                case EVENT_GC_START:
-                    safe_print("GC Start detected");
-                    break;
-                case EVENT_GC_FINISH:
-                    safe_print("GC Finish detected");
-                    break;
-                default:
-                    break;
-            }
-
-            // Cleanup global refs
-            if (event.klass && g_jni_env) {
-                g_jni_env->DeleteGlobalRef(event.klass);
+            // Frees of a cycle are processed before its finish event, so
+            // the GC timeline and flight trigger see them
+            if (event.type == EVENT_GC_START) {
+                drain_frees(event.timestamp, event.gc_epoch - 1, false);
+            } else if (event.type == EVENT_GC_FINISH) {
+                drain_frees(event.timestamp, event.gc_epoch, false);
+                last_drain = event.timestamp;
             }
-            if (event.thread && g_jni_env) {
-                g_jni_env->DeleteGlobalRef(event.thread);
+            process_event(event);
+        } else {
+            jlong now = get_current_timestamp();
+            if (now - last_roll_check >= 100) {
+                g_spooler.maybe_roll(now, g_processor_jni);
+                last_roll_check = now;
             }
 
-            // Free frames
-            if (event.frames) {
-                free(event.frames);
-            }
-        } else {
             // No events, sleep briefly
             std::this_thread::sleep_for(std::chrono::microseconds(100));
         }
+
+        // Frees posted after GC finish (deferred ObjectFree), once the
+        // queue has caught up
+        jlong now = get_current_timestamp();
+        if (now - last_drain >= FREE_DRAIN_MS) {
+            drain_frees(now, 0, true);
+            enforce_tracked_limit();
+            last_drain = now;
+        }
+        g_metrics_sampler.tick(now, g_processor_jni);
+        g_governor.tick(now);
+        g_stratified.adapt(now);
+        g_trends.tick(now, false);
+        if (g_controls.tick(now)) {
+            refresh_alloc_callback();
+            safe_print("Escalation ended, previous event settings restored");
+        }
+        g_stats_page.publish(now);
+        g_event_stream.service(now);
+    }
+
+    g_spooler.stop(g_processor_jni);
+
+    if (g_processor_jni && g_java_vm) {
+        g_java_vm->DetachCurrentThread();
+        g_processor_jni = nullptr;
+    }
+}
+
+// ============================================================================
+// Agent Activation
+// ============================================================================
+
+/**
+ * Everything past capabilities and callbacks starts here: the event queue
+ * and tracker table are mapped, the OOM report buffers and statistics page
+ * are set up, the allocation / free / GC / ResourceExhausted events are
+ * enabled and the event processor and query server threads start.
+ *
+ * Runs at load time unless the "dormant" option is given. A dormant agent
+ * only has VMInit and VMDeath enabled and no thread of its own; it stays so
+ * (no reserved memory, no callbacks) until the "activate" command or a
+ * second attach of the same library.
+ */
+static std::mutex g_activation_mutex;
+static std::atomic<bool> g_activated{false};
+static bool g_start_dormant = false;            // "dormant" option
+
+static bool activate_agent() {
+    std::lock_guard<std::mutex> lock(g_activation_mutex);
+    if (g_activated.load(std::memory_order_acquire)) {
+        return true;
     }
+    if (!g_jvmti) {
+        return false;
+    }
+    if (!g_event_queue.reserve() || !g_tracker.reserve()) {
+        fprintf(stderr, "[JVM TI] Cannot reserve event queue / tracker memory\n");
+        return false;
+    }
+    if (!g_free_buffer.reserve()) {
+        fprintf(stderr, "[JVM TI] Cannot reserve free buffer; frees are processed one by one\n");
+    }
+    if (!g_oom_reporter.prepare()) {
+        fprintf(stderr, "[JVM TI] Cannot reserve OOM report memory; OOM reports disabled\n");
+    }
+    g_stats_page.open();
+
+    g_jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_RESOURCE_EXHAUSTED, nullptr);
+    g_controls.install(g_jvmti);
+
+    g_event_processor_thread = std::thread(event_processor_loop);
+    g_query_server.start();
+    g_activated.store(true, std::memory_order_release);
+    return true;
 }
 
 // ============================================================================
 // Agent Commands (Communication with Java layer)
 // ============================================================================
 
+/**
+ * JNIEnv of the calling thread, or nullptr if it is not attached
+ */
+static JNIEnv* current_jni_env() {
+    JNIEnv* env = nullptr;
+    if (!g_java_vm || g_java_vm->GetEnv((void**)&env, JNI_VERSION_1_8) != JNI_OK) {
+        return nullptr;
+    }
+    return env;
+}
+
 static void process_agent_command(const char* command) {
-    if (strncmp(command, "sampling:", 9) == 0) {
+    if (strcmp(command, "activate") == 0) {
+        bool was_active = g_activated.load(std::memory_order_acquire);
+        if (!activate_agent()) {
+            safe_print("Activation failed");
+        } else if (!was_active) {
+            safe_print("Agent activated");
+        }
+    } else if (strncmp(command, "sampling:", 9) == 0) {
         int interval = atoi(command + 9);
         if (interval > 0) {
             g_sampling_interval.store(interval, std::memory_order_release);
@@ -696,10 +6279,134 @@ static void process_agent_command(const char* command) {
     } else if (strcmp(command, "snapshot") == 0) {
         // Trigger snapshot
         safe_print("Snapshot command received");
+    } else if (strncmp(command, "record:start:", 13) == 0) {
+        if (g_spooler.start(command + 13)) {
+            safe_print("Recording started");
+        } else {
+            safe_print("Failed to start recording");
+        }
+    } else if (strcmp(command, "record:stop") == 0) {
+        g_spooler.stop(current_jni_env());
+        safe_print("Recording stopped");
+    } else if (strcmp(command, "record:flush") == 0) {
+        g_spooler.flush(current_jni_env());
+    } else if (strncmp(command, "flight:start:", 13) == 0) {
+        int megabytes = atoi(command + 13);
+        if (megabytes > 0 && g_flight.enable((size_t)megabytes)) {
+            safe_print("Flight recorder enabled (%d MB)", megabytes);
+        } else {
+            safe_print("Failed to enable flight recorder");
+        }
+    } else if (strcmp(command, "flight:stop") == 0) {
+        g_flight.disable();
+        safe_print("Flight recorder disabled");
+    } else if (strcmp(command, "flight:dump") == 0 || strncmp(command, "flight:dump:", 12) == 0) {
+        const char* path = command[11] == ':' ? command + 12 : nullptr;
+        if (!g_flight.dump(path, "command", current_jni_env())) {
+            safe_print("Flight recorder is not enabled");
+        }
+    } else if (strcmp(command, "filter:clear") == 0) {
+        install_filter(nullptr, nullptr);
+        safe_print("Event filter cleared");
+    } else if (strcmp(command, "filter:status") == 0) {
+        EventFilter* filter = g_filter.load(std::memory_order_acquire);
+        fprintf(stderr, "[JVM TI] Event filter: %s (%llu rejected)\n",
+                filter ? filter->expression().c_str() : "none",
+                (unsigned long long)g_filter_rejected.load(std::memory_order_relaxed));
+    } else if (strncmp(command, "filter:", 7) == 0) {
+        std::string error;
+        if (install_filter(command + 7, &error)) {
+            safe_print("Event filter installed (%d instructions)", (int)g_filter.load()->size());
+        } else {
+            fprintf(stderr, "[JVM TI] Invalid filter: %s\n", error.c_str());
+        }
+    } else if (strncmp(command, "classes:include:", 16) == 0) {
+        safe_print("Class include list: %d prefixes added", (int)add_class_rules(false, command + 16));
+    } else if (strncmp(command, "classes:exclude:", 16) == 0) {
+        safe_print("Class exclude list: %d prefixes added", (int)add_class_rules(true, command + 16));
+    } else if (strcmp(command, "classes:clear") == 0) {
+        clear_class_rules();
+        safe_print("Class lists cleared");
+    } else if (strcmp(command, "classes:status") == 0) {
+        ClassMatcher* matcher = g_class_matcher.load(std::memory_order_acquire);
+        fprintf(stderr, "[JVM TI] Class lists: %zu rules, %zu trie nodes (%llu excluded)\n",
+                matcher ? matcher->rules() : 0, matcher ? matcher->node_count() : 0,
+                (unsigned long long)g_class_excluded.load(std::memory_order_relaxed));
+    } else if (strcmp(command, "stratified:off") == 0) {
+        g_stratified.disable();
+        safe_print("Stratified sampling disabled");
+    } else if (strcmp(command, "stratified") == 0 || strncmp(command, "stratified:", 11) == 0) {
+        uint32_t target = command[10] == ':' ? (uint32_t)atol(command + 11) : 0;
+        g_stratified.enable(target);
+        safe_print("Stratified sampling enabled (%d samples per class per window, 0 = auto)", (int)target);
+    } else if (strcmp(command, "governor:off") == 0) {
+        g_governor.set_budget(0);
+        safe_print("Overhead governor disabled");
+    } else if (strcmp(command, "governor:status") == 0) {
+        fprintf(stderr, "[JVM TI] Governor: %s, budget %.2f%%, agent CPU %.2f%%, level %d\n",
+                g_governor.active() ? "on" : "off", g_governor.budget_percent(),
+                g_governor.last_overhead_ppm() / 10000.0, g_governor.current_level());
+    } else if (strncmp(command, "governor:", 9) == 0) {
+        double percent = atof(command + 9);
+        if (percent > 0) {
+            g_governor.set_budget(percent);
+            fprintf(stderr, "[JVM TI] Overhead governor: budget %.2f%% of process CPU\n", percent);
+        }
+    } else if (strcmp(command, "stream:start") == 0 || strncmp(command, "stream:start:", 13) == 0) {
+        int megabytes = command[12] == ':' ? atoi(command + 13) : STREAM_DEFAULT_MB;
+        if (megabytes > 0) {
+            g_event_stream.request((size_t)megabytes);
+        }
+    } else if (strcmp(command, "stream:stop") == 0) {
+        g_event_stream.request(0);
+        safe_print("Event stream stopped");
+    } else if (strcmp(command, "events:status") == 0) {
+        g_controls.print_status(get_current_timestamp());
+    } else if (strcmp(command, "mode:gc") == 0) {
+        g_controls.gc_only();
+        safe_print("GC-only monitoring (allocation events off)");
+    } else if (strcmp(command, "mode:full") == 0 || strncmp(command, "mode:full:", 10) == 0) {
+        int seconds = command[9] == ':' ? atoi(command + 10) : 0;
+        g_controls.escalate(seconds, get_current_timestamp());
+        safe_print("Full allocation profiling enabled (%d s, 0 = until changed)", seconds);
+    } else if (strncmp(command, "events:", 7) == 0 || strncmp(command, "capture:", 8) == 0) {
+        // events:<alloc|free|gc>:<on|off>, capture:<stacks|upcalls|symbols>:<on|off>
+        bool is_event = command[0] == 'e';
+        const char* name = strchr(command, ':') + 1;
+        const char* state = strchr(name, ':');
+        std::string key = state ? std::string(name, state - name) : std::string(name);
+        bool on = state && strcmp(state + 1, "on") == 0;
+        int index = is_event ? RuntimeControls::event_index(key.c_str())
+                             : RuntimeControls::feature_index(key.c_str());
+        if (index < 0 || !state || (!on && strcmp(state + 1, "off") != 0)) {
+            fprintf(stderr, "[JVM TI] Unknown control: %s\n", command);
+        } else {
+            if (is_event) {
+                g_controls.set_event(index, on);
+            } else {
+                g_controls.set_feature(index, on);
+            }
+            fprintf(stderr, "[JVM TI] %s %s %s\n", is_event ? "Event" : "Capture", key.c_str(), on ? "on" : "off");
+        }
+    } else if (strncmp(command, "trend:window:", 13) == 0) {
+        int points = atoi(command + 13);
+        if (points > 0) {
+            g_trends.set_window((uint32_t)points);
+            safe_print("Class trend window set to %d checkpoints", points);
+        }
+    } else if (strncmp(command, "maxtracked:", 11) == 0) {
+        long long limit = atoll(command + 11);
+        g_max_tracked.store(limit > 0 ? (uint64_t)limit : 0, std::memory_order_relaxed);
+        fprintf(stderr, "[JVM TI] Tracked objects capped at %lld (0 = unlimited)\n",
+                limit > 0 ? limit : 0);
     } else if (strcmp(command, "stop") == 0) {
         g_agent_active.store(false, std::memory_order_release);
+        g_controls.suspend();
         safe_print("Stop command received");
     }
+
+    // Filter and capture settings select the allocation callback
+    refresh_alloc_callback();
 }
 
 /**
@@ -713,6 +6420,132 @@ static void ExecuteCommand(jvmtiEnv* jvmti_env, const char* command) {
 // Agent Initialization
 // ============================================================================
 
+/**
+ * Parse agent options (comma separated)
+ *
+ *   sampling=<n>       sample every Nth allocation
+ *   nosampling         record every allocation
+ *   record=<dir>       spill events to chunk files in <dir>
+ *   chunk_events=<n>   seal a chunk after N events
+ *   chunk_ms=<ms>      seal a chunk after this many milliseconds
+ *   flight=<MB>        keep recent events in an in-memory ring of this size
+ *   flight_sec=<s>     dump only the last N seconds of the ring
+ *   flight_dir=<dir>   directory for flight recording dumps
+ *   flight_heap=<pct>  dump when heap usage after a GC reaches pct of max
+ *   oom_dir=<dir>      directory for ResourceExhausted reports (default ".")
+ *   oom_heapdump       also start a heap dump on ResourceExhausted
+ *   nostats_shm        keep the statistics page private to this process
+ *   stream[=<MB>]      serve live events to an external consumer (Linux)
+ *   noquery            do not start the local query server
+ *   filter=<expr>      only record allocations matching expr (see EventFilter;
+ *                      the expression cannot contain ',')
+ *   include=<p;p>      only record classes under these name prefixes
+ *   exclude=<p;p>      never record classes under these name prefixes
+ *   include_file=<f>   include prefixes listed in f (one per line)
+ *   exclude_file=<f>   exclude prefixes listed in f (one per line)
+ *   budget=<pct>       hold agent CPU under pct of process CPU (e.g. 1 or
+ *                      0.5) by degrading stacks and sampling (OverheadGovernor)
+ *   stratified[=<n>]   per-class adaptive sampling, n samples per class per
+ *                      window (default: as many samples as uniform sampling)
+ *   gconly             start with allocation events off (see mode:full)
+ *   no<event>          start with an event off: noalloc, nofree, nogc
+ *   no<feature>        start with a capture step off: nostacks, noupcalls,
+ *                      nosymbols (RuntimeControls)
+ *   dormant            load without reserving memory, enabling events or
+ *                      starting threads until "activate" (activate_agent)
+ *   maxtracked=<n>     track at most n objects, evicting the oldest
+ *   trend_window=<n>   checkpoints per class trend window (ClassTrends)
+ */
+static void parse_agent_options(char* options) {
+    if (!options) {
+        return;
+    }
+
+    char* saveptr = nullptr;
+    char* opt = strtok_r(options, ",", &saveptr);
+    while (opt) {
+        if (strncmp(opt, "sampling=", 9) == 0) {
+            int interval = atoi(opt + 9);
+            if (interval > 0) {
+                g_sampling_interval.store(interval, std::memory_order_release);
+            }
+        } else if (strcmp(opt, "nosampling") == 0) {
+            g_sampling_enabled.store(false, std::memory_order_release);
+        } else if (strncmp(opt, "record=", 7) == 0) {
+            if (!g_spooler.start(opt + 7)) {
+                fprintf(stderr, "[JVM TI] Cannot record to %s\n", opt + 7);
+            }
+        } else if (strncmp(opt, "chunk_events=", 13) == 0) {
+            g_spooler.set_limits((size_t)atol(opt + 13), 0);
+        } else if (strncmp(opt, "chunk_ms=", 9) == 0) {
+            g_spooler.set_limits(0, (jlong)atol(opt + 9));
+        } else if (strncmp(opt, "flight=", 7) == 0) {
+            int megabytes = atoi(opt + 7);
+            if (megabytes <= 0 || !g_flight.enable((size_t)megabytes)) {
+                fprintf(stderr, "[JVM TI] Cannot enable flight recorder (%s)\n", opt + 7);
+            }
+        } else if (strncmp(opt, "flight_sec=", 11) == 0) {
+            g_flight.set_retention((jlong)atol(opt + 11) * 1000);
+        } else if (strncmp(opt, "flight_dir=", 11) == 0) {
+            g_flight.set_directory(opt + 11);
+        } else if (strncmp(opt, "flight_heap=", 12) == 0) {
+            g_flight.set_heap_threshold(atoi(opt + 12));
+        } else if (strncmp(opt, "oom_dir=", 8) == 0) {
+            g_oom_reporter.set_directory(opt + 8);
+        } else if (strcmp(opt, "oom_heapdump") == 0) {
+            g_oom_reporter.set_heap_dump(true);
+        } else if (strcmp(opt, "nostats_shm") == 0) {
+            g_stats_page.set_shared(false);
+        } else if (strcmp(opt, "stream") == 0) {
+            g_event_stream.request(STREAM_DEFAULT_MB);
+        } else if (strncmp(opt, "stream=", 7) == 0) {
+            int megabytes = atoi(opt + 7);
+            g_event_stream.request(megabytes > 0 ? (size_t)megabytes : STREAM_DEFAULT_MB);
+        } else if (strcmp(opt, "noquery") == 0) {
+            g_query_server.set_enabled(false);
+        } else if (strncmp(opt, "filter=", 7) == 0) {
+            std::string error;
+            if (!install_filter(opt + 7, &error)) {
+                fprintf(stderr, "[JVM TI] Invalid filter %s: %s\n", opt + 7, error.c_str());
+            }
+        } else if (strcmp(opt, "stratified") == 0) {
+            g_stratified.enable(0);
+        } else if (strncmp(opt, "stratified=", 11) == 0) {
+            g_stratified.enable((uint32_t)atol(opt + 11));
+        } else if (strncmp(opt, "budget=", 7) == 0) {
+            double percent = atof(opt + 7);
+            if (percent > 0) {
+                g_governor.set_budget(percent);
+            }
+        } else if (strcmp(opt, "dormant") == 0) {
+            g_start_dormant = true;
+        } else if (strncmp(opt, "trend_window=", 13) == 0) {
+            int points = atoi(opt + 13);
+            if (points > 0) {
+                g_trends.set_window((uint32_t)points);
+            }
+        } else if (strncmp(opt, "maxtracked=", 11) == 0) {
+            long long limit = atoll(opt + 11);
+            g_max_tracked.store(limit > 0 ? (uint64_t)limit : 0, std::memory_order_relaxed);
+        } else if (strcmp(opt, "gconly") == 0) {
+            g_controls.gc_only();
+        } else if (strncmp(opt, "no", 2) == 0 && RuntimeControls::event_index(opt + 2) >= 0) {
+            g_controls.set_event(RuntimeControls::event_index(opt + 2), false);
+        } else if (strncmp(opt, "no", 2) == 0 && RuntimeControls::feature_index(opt + 2) >= 0) {
+            g_controls.set_feature(RuntimeControls::feature_index(opt + 2), false);
+        } else if (strncmp(opt, "include=", 8) == 0) {
+            add_class_rules(false, opt + 8);
+        } else if (strncmp(opt, "exclude=", 8) == 0) {
+            add_class_rules(true, opt + 8);
+        } else if (strncmp(opt, "include_file=", 13) == 0 || strncmp(opt, "exclude_file=", 13) == 0) {
+            if (load_class_rules(opt[0] == 'e', opt + 13) < 0) {
+                fprintf(stderr, "[JVM TI] Cannot read class list %s\n", opt + 13);
+            }
+        }
+        opt = strtok_r(nullptr, ",", &saveptr);
+    }
+}
+
 /**
  * Enable required JVMTI capabilities
  */
@@ -732,7 +6565,21 @@ static jvmtiError enable_capabilities(jvmtiEnv* jvmti) {
     caps.can_get_source_file_name = 1;
     caps.can_get_line_numbers = 1;
 
-    return jvmti->AddCapabilities(&caps);
+    jvmtiError err = jvmti->AddCapabilities(&caps);
+    if (err != JVMTI_ERROR_NONE) {
+        return err;
+    }
+
+    // Optional: ResourceExhausted for Java heap and thread exhaustion
+    // (OutOfMemoryError from other causes is reported without them)
+    jvmtiCapabilities optional;
+    memset(&optional, 0, sizeof(optional));
+    optional.can_generate_resource_exhaustion_heap_events = 1;
+    optional.can_generate_resource_exhaustion_threads_events = 1;
+    if (jvmti->AddCapabilities(&optional) != JVMTI_ERROR_NONE) {
+        fprintf(stderr, "[JVM TI] ResourceExhausted capabilities not available\n");
+    }
+    return JVMTI_ERROR_NONE;
 }
 
 /**
@@ -742,26 +6589,36 @@ static void setup_callbacks(jvmtiEnv* jvmti) {
     jvmtiEventCallbacks callbacks;
     memset(&callbacks, 0, sizeof(callbacks));
 
-    callbacks.VMObjectAlloc = CallbackObjectAlloc;
+    callbacks.VMInit = CallbackVMInit;
     callbacks.ObjectFree = CallbackObjectFree;
     callbacks.GarbageCollectionStart = CallbackGarbageCollectionStart;
     callbacks.GarbageCollectionFinish = CallbackGarbageCollectionFinish;
     callbacks.VMDeath = CallbackVMDeath;
+    callbacks.ResourceExhausted = CallbackResourceExhausted;
 
-    jvmti->SetEventCallbacks(&callbacks, sizeof(callbacks));
+    // VMObjectAlloc: the CallbackObjectAlloc specialization for the settings
+    install_callbacks(jvmti, &callbacks);
 }
 
 /**
- * Enable events
+ * Enable the lifecycle events; the others are enabled by activate_agent()
  */
 static void enable_events(jvmtiEnv* jvmti) {
-    jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_VM_OBJECT_ALLOC, nullptr);
-    jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_OBJECT_FREE, nullptr);
-    jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_GARBAGE_COLLECTION_START, nullptr);
-    jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_GARBAGE_COLLECTION_FINISH, nullptr);
+    jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_VM_INIT, nullptr);
     jvmti->SetEventNotificationMode(JVMTI_ENABLE, JVMTI_EVENT_VM_DEATH, nullptr);
 }
 
+/**
+ * Activate now, or report that the agent waits for "activate"
+ */
+static bool start_or_stay_dormant() {
+    if (g_start_dormant) {
+        fprintf(stderr, "[JVM TI] Agent dormant until activated\n");
+        return true;
+    }
+    return activate_agent();
+}
+
 /**
  * Native method registration
  */
@@ -780,6 +6637,13 @@ static void register_native_methods(jvmtiEnv* jvmti, JNIEnv* env) {
 JNIEXPORT jint JNICALL Agent_OnAttach(JavaVM* vm, char* options, void* reserved) {
     fprintf(stderr, "[JVM TI] Agent_OnAttach called, options: %s\n", options ? options : "none");
 
+    // Attaching a library that is already loaded (e.g. dormant): apply options, activate
+    if (g_jvmti) {
+        parse_agent_options(options);
+        refresh_alloc_callback();
+        return activate_agent() ? JNI_OK : JNI_ERR;
+    }
+
     JNIEnv* env = nullptr;
     if (vm->GetEnv((void**)&env, JNI_VERSION_1_8) != JNI_OK) {
         fprintf(stderr, "[JVM TI] Failed to get JNIEnv\n");
@@ -787,6 +6651,7 @@ JNIEXPORT jint JNICALL Agent_OnAttach(JavaVM* vm, char* options, void* reserved)
     }
     g_jni_env = env;  // Save global JNI env
     g_java_vm = vm;   // Save Java VM pointer
+    g_vm_live.store(true, std::memory_order_release);  // Attaching implies a live VM
 
     if (vm->GetEnv((void**)&g_jvmti, JNI_VERSION_1_8) != JNI_OK) {
         fprintf(stderr, "[JVM TI] Failed to get JVMTI env\n");
@@ -800,7 +6665,7 @@ JNIEXPORT jint JNICALL Agent_OnAttach(JavaVM* vm, char* options, void* reserved)
         g_on_object_alloc_method = env->GetStaticMethodID(
             g_heap_analyzer_class,
             "onObjectAlloc",
-            "(JLjava/lang/String;JJLjava/lang/String;Ljava/lang/String;)V"
+            "(JLjava/lang/String;JJLjava/lang/String;Ljava/lang/String;I)V"
         );
         if (g_on_object_alloc_method) {
             fprintf(stderr, "[JVM TI] Found onObjectAlloc method for callback\n");
@@ -813,20 +6678,7 @@ JNIEXPORT jint JNICALL Agent_OnAttach(JavaVM* vm, char* options, void* reserved)
     }
 
     // Parse options
-    if (options) {
-        char* opt = strtok(options, ",");
-        while (opt) {
-            if (strncmp(opt, "sampling=", 9) == 0) {
-                int interval = atoi(opt + 9);
-                if (interval > 0) {
-                    g_sampling_interval.store(interval, std::memory_order_release);
-                }
-            } else if (strcmp(opt, "nosampling") == 0) {
-                g_sampling_enabled.store(false, std::memory_order_release);
-            }
-            opt = strtok(nullptr, ",");
-        }
-    }
+    parse_agent_options(options);
 
     // Enable capabilities
     jvmtiError err = enable_capabilities(g_jvmti);
@@ -838,11 +6690,11 @@ JNIEXPORT jint JNICALL Agent_OnAttach(JavaVM* vm, char* options, void* reserved)
     // Setup callbacks
     setup_callbacks(g_jvmti);
 
-    // Enable events
+    // Enable events, start the event processor thread (unless dormant)
     enable_events(g_jvmti);
-
-    // Start event processor thread
-    g_event_processor_thread = std::thread(event_processor_loop);
+    if (!start_or_stay_dormant()) {
+        return JNI_ERR;
+    }
 
     fprintf(stderr, "[JVM TI] Agent successfully attached\n");
     return JNI_OK;
@@ -883,7 +6735,7 @@ JNIEXPORT jint JNICALL Agent_OnLoad(JavaVM* vm, char* options, void* reserved) {
             g_on_object_alloc_method = g_jni_env->GetStaticMethodID(
                 g_heap_analyzer_class,
                 "onObjectAlloc",
-                "(JLjava/lang/String;JJLjava/lang/String;Ljava/lang/String;)V"
+                "(JLjava/lang/String;JJLjava/lang/String;Ljava/lang/String;I)V"
             );
             if (g_on_object_alloc_method) {
                 fprintf(stderr, "[JVM TI] Found onObjectAlloc method for callback\n");
@@ -897,20 +6749,7 @@ JNIEXPORT jint JNICALL Agent_OnLoad(JavaVM* vm, char* options, void* reserved) {
     }
 
     // Parse options
-    if (options) {
-        char* opt = strtok(options, ",");
-        while (opt) {
-            if (strncmp(opt, "sampling=", 9) == 0) {
-                int interval = atoi(opt + 9);
-                if (interval > 0) {
-                    g_sampling_interval.store(interval, std::memory_order_release);
-                }
-            } else if (strcmp(opt, "nosampling") == 0) {
-                g_sampling_enabled.store(false, std::memory_order_release);
-            }
-            opt = strtok(nullptr, ",");
-        }
-    }
+    parse_agent_options(options);
 
     // Enable capabilities
     jvmtiError err = enable_capabilities(g_jvmti);
@@ -923,12 +6762,14 @@ JNIEXPORT jint JNICALL Agent_OnLoad(JavaVM* vm, char* options, void* reserved) {
     // Setup callbacks
     setup_callbacks(g_jvmti);
 
-    // Enable events
+    // Enable events, start the event processor thread (unless dormant)
     enable_events(g_jvmti);
-    fprintf(stderr, "[JVM TI] Events enabled\n");
-
-    // Start event processor thread
-    g_event_processor_thread = std::thread(event_processor_loop);
+    if (!start_or_stay_dormant()) {
+        return JNI_ERR;
+    }
+    if (g_activated.load(std::memory_order_acquire)) {
+        fprintf(stderr, "[JVM TI] Events enabled\n");
+    }
 
     fprintf(stderr, "[JVM TI] Agent successfully loaded\n");
     return JNI_OK;
@@ -945,8 +6786,13 @@ JNIEXPORT void JNICALL Agent_OnUnload(JavaVM* vm) {
     if (g_event_processor_thread.joinable()) {
         g_event_processor_thread.join();
     }
+    g_query_server.stop();
 
     // Cleanup
+    g_spooler.stop(current_jni_env());
+    g_flight.disable();
+    g_stats_page.close();
+    g_event_stream.shutdown();
     g_tracker.clear();
 
     if (g_jvmti) {
@@ -996,6 +6842,16 @@ JNIEXPORT void JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_getMemoryS
     env->ReleaseLongArrayElements(stats, stats_arr, 0);
 }
 
+/**
+ * The shared statistics page as a read-only view (direct ByteBuffer),
+ * or null if it could not be mapped
+ */
+JNIEXPORT jobject JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_mapStatsPage
+    (JNIEnv* env, jclass clazz) {
+    void* page = g_stats_page.address();
+    return page ? env->NewDirectByteBuffer(page, (jlong)jma::STATS_PAGE_SIZE) : nullptr;
+}
+
 /**
  * Send command to agent
  */
@@ -1014,7 +6870,9 @@ JNIEXPORT void JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_sendComman
  */
 JNIEXPORT jboolean JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_isAgentActive
     (JNIEnv* env, jclass clazz) {
-    return g_agent_active.load(std::memory_order_relaxed) ? JNI_TRUE : JNI_FALSE;
+    // A dormant agent is loaded but collects nothing until activated
+    return g_activated.load(std::memory_order_acquire) && g_agent_active.load(std::memory_order_relaxed)
+        ? JNI_TRUE : JNI_FALSE;
 }
 
 /**
@@ -1038,4 +6896,268 @@ JNIEXPORT void JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_setSamplin
     }
 }
 
+/**
+ * Read one metric series in bulk
+ *
+ * Returns rows of {startMillis, min, max, avg}, oldest first, for the
+ * given resolution (1, 10, 60 or 600 seconds); empty if unknown.
+ */
+JNIEXPORT jlongArray JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_getTimeSeries
+    (JNIEnv* env, jclass clazz, jint metric, jint resolution_seconds) {
+    int level = TimeSeriesStore::level_for(resolution_seconds);
+    size_t max_rows = TimeSeriesStore::slots(level);
+    std::vector<jlong> rows(max_rows * 4);
+
+    size_t count = g_metrics.read((Metric)metric, level, get_current_timestamp() / 1000,
+                                  rows.data(), max_rows);
+
+    jlongArray result = env->NewLongArray((jsize)(count * 4));
+    if (result && count > 0) {
+        env->SetLongArrayRegion(result, 0, (jsize)(count * 4), rows.data());
+    }
+    return result;
+}
+
+/**
+ * GC cycles that started in [fromMillis, toMillis], oldest first, as rows of
+ * GC_ROW_WIDTH: id, start, end, duration, allocCount, allocBytes, freedCount,
+ * freedBytes, then {siteIndex, count, bytes} per top site (siteIndex -1 when
+ * unused). Site names come from getSiteName.
+ */
+JNIEXPORT jlongArray JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_getGcCycles
+    (JNIEnv* env, jclass clazz, jlong from_millis, jlong to_millis) {
+    std::vector<GcCycle> cycles(GC_TIMELINE_CYCLES);
+    size_t count = g_gc_timeline.snapshot(from_millis, to_millis, cycles.data(), cycles.size());
+
+    std::vector<jlong> rows(count * GC_ROW_WIDTH, 0);
+    for (size_t i = 0; i < count; i++) {
+        const GcCycle& c = cycles[i];
+        jlong* row = &rows[i * GC_ROW_WIDTH];
+        row[0] = c.id;
+        row[1] = c.start;
+        row[2] = c.end;
+        row[3] = c.end ? c.end - c.start : -1;
+        row[4] = c.alloc_count;
+        row[5] = c.alloc_bytes;
+        row[6] = c.freed_count;
+        row[7] = c.freed_bytes;
+        for (uint32_t j = 0; j < GC_TOP_SITES; j++) {
+            row[8 + j * 3] = j < c.site_count ? (jlong)c.sites[j].site : -1;
+            row[9 + j * 3] = j < c.site_count ? c.sites[j].count : 0;
+            row[10 + j * 3] = j < c.site_count ? c.sites[j].bytes : 0;
+        }
+    }
+
+    jlongArray result = env->NewLongArray((jsize)rows.size());
+    if (result && !rows.empty()) {
+        env->SetLongArrayRegion(result, 0, (jsize)rows.size(), rows.data());
+    }
+    return result;
+}
+
+/**
+ * Lifetime histogram of a site's freed objects: count, total lifetime (ms),
+ * LIFETIME_WALL_BUCKETS wall-time buckets, LIFETIME_GC_BUCKETS GC-age
+ * buckets. Null when the site is unknown or none of its objects was freed.
+ */
+JNIEXPORT jlongArray JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_getLifetimeHistogram
+    (JNIEnv* env, jclass clazz, jstring site) {
+    if (!site) {
+        return nullptr;
+    }
+    const char* chars = env->GetStringUTFChars(site, nullptr);
+    if (!chars) {
+        return nullptr;
+    }
+    uint32_t index;
+    bool known = g_sites.find(chars, &index);
+    env->ReleaseStringUTFChars(site, chars);
+
+    LifetimeHistograms::Histogram h;
+    if (!known || !g_lifetimes.get(index, &h)) {
+        return nullptr;
+    }
+
+    jlong row[2 + LIFETIME_WALL_BUCKETS + LIFETIME_GC_BUCKETS];
+    row[0] = h.count;
+    row[1] = h.total_ms;
+    for (int i = 0; i < LIFETIME_WALL_BUCKETS; i++) row[2 + i] = h.wall[i];
+    for (int i = 0; i < LIFETIME_GC_BUCKETS; i++) row[2 + LIFETIME_WALL_BUCKETS + i] = h.gcs[i];
+
+    jsize length = (jsize)(sizeof(row) / sizeof(row[0]));
+    jlongArray result = env->NewLongArray(length);
+    if (result) {
+        env->SetLongArrayRegion(result, 0, length, row);
+    }
+    return result;
+}
+
+/**
+ * Sites ranked by short-lived allocation volume (churn). Returns
+ * {totalAllocBytes, elapsedMs} followed by at most limit rows of
+ * CHURN_ROW_WIDTH: siteIndex, allocCount, allocBytes, freedCount,
+ * shortLivedCount, shortLivedBytes, churnBytes. Counts are sampled.
+ */
+JNIEXPORT jlongArray JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_getChurnSites
+    (JNIEnv* env, jclass clazz, jint limit) {
+    jlong total_bytes = 0;
+    jlong since = 0;
+    std::vector<LifetimeHistograms::ChurnEntry> entries =
+        g_lifetimes.top_churn(limit > 0 ? (size_t)limit : SIZE_MAX, &total_bytes, &since);
+
+    std::vector<jlong> rows;
+    rows.reserve(2 + entries.size() * CHURN_ROW_WIDTH);
+    rows.push_back(total_bytes);
+    rows.push_back(since > 0 ? get_current_timestamp() - since : 0);
+    for (const auto& e : entries) {
+        rows.push_back(e.site);
+        rows.push_back(e.alloc_count);
+        rows.push_back(e.alloc_bytes);
+        rows.push_back(e.freed_count);
+        rows.push_back(e.short_count);
+        rows.push_back(e.short_bytes);
+        rows.push_back(e.churn_bytes);
+    }
+
+    jlongArray result = env->NewLongArray((jsize)rows.size());
+    if (result) {
+        env->SetLongArrayRegion(result, 0, (jsize)rows.size(), rows.data());
+    }
+    return result;
+}
+
+/**
+ * Tracked objects allocated at least minAgeMs ago, grouped by class and
+ * site, as rows of OLD_OBJECT_ROW_WIDTH: classId, siteIndex (-1 when
+ * unknown), count, bytes, oldest allocation time (ms). Counts and bytes
+ * are weighted by the sampling weight. Names come from getClassName and
+ * getSiteName. Walks only the tracker's generations older than the cutoff.
+ */
+JNIEXPORT jlongArray JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_getOldObjects
+    (JNIEnv* env, jclass clazz, jlong min_age_ms) {
+    struct Group {
+        jlong count;
+        jlong bytes;
+        jlong oldest;
+
+        void add(jlong n, jlong size, jlong timestamp) {
+            oldest = count == 0 ? timestamp : std::min(oldest, timestamp);
+            count += n;
+            bytes += size;
+        }
+    };
+
+    // Grouped after the tracker lock is released
+    std::map<std::pair<uint32_t, uint64_t>, Group> by_hash;
+    g_tracker.visit_older(get_current_timestamp() - std::max<jlong>(min_age_ms, 0),
+                          [&](jlong, const AllocationInfo& info) {
+        jlong weight = (jlong)1 << info.weight_shift;
+        by_hash[{info.class_id, info.site_hash}].add(weight, info.size * weight, info.timestamp);
+    });
+
+    // Several stack hashes can share one site
+    std::map<std::pair<uint32_t, jlong>, Group> groups;
+    for (const auto& entry : by_hash) {
+        uint32_t index;
+        jlong site = entry.first.second != 0 && g_sites.lookup(entry.first.second, &index) ? (jlong)index : -1;
+        const Group& g = entry.second;
+        groups[{entry.first.first, site}].add(g.count, g.bytes, g.oldest);
+    }
+
+    std::vector<jlong> rows;
+    rows.reserve(groups.size() * OLD_OBJECT_ROW_WIDTH);
+    for (const auto& entry : groups) {
+        rows.push_back(entry.first.first);
+        rows.push_back(entry.first.second);
+        rows.push_back(entry.second.count);
+        rows.push_back(entry.second.bytes);
+        rows.push_back(entry.second.oldest);
+    }
+
+    jlongArray result = env->NewLongArray((jsize)rows.size());
+    if (result && !rows.empty()) {
+        env->SetLongArrayRegion(result, 0, (jsize)rows.size(), rows.data());
+    }
+    return result;
+}
+
+/**
+ * Per-class live-count trends: {window, checkpoints, lastCheckpointMillis}
+ * followed by one row of TREND_ROW_WIDTH per class: classId, points,
+ * liveCount, liveBytes, minCount, maxCount, growthCount, totalGrowth,
+ * streak, then the raw bits of two doubles: slope (instances per
+ * checkpoint) and EWMA growth rate (instances per second).
+ */
+JNIEXPORT jlongArray JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_getClassTrends
+    (JNIEnv* env, jclass clazz) {
+    std::vector<ClassTrends::Row> trends;
+    uint64_t checkpoints = 0;
+    jlong last = 0;
+    uint32_t window = g_trends.snapshot(trends, &checkpoints, &last);
+
+    std::vector<jlong> rows;
+    rows.reserve(3 + trends.size() * TREND_ROW_WIDTH);
+    rows.push_back(window);
+    rows.push_back((jlong)checkpoints);
+    rows.push_back(last);
+    for (const ClassTrends::Row& t : trends) {
+        jlong slope_bits;
+        jlong rate_bits;
+        memcpy(&slope_bits, &t.slope, sizeof(slope_bits));
+        memcpy(&rate_bits, &t.ewma_rate, sizeof(rate_bits));
+        rows.push_back(t.class_id);
+        rows.push_back(t.points);
+        rows.push_back(t.live_count);
+        rows.push_back(t.live_bytes);
+        rows.push_back(t.min_count);
+        rows.push_back(t.max_count);
+        rows.push_back(t.growth_count);
+        rows.push_back(t.total_growth);
+        rows.push_back(t.streak);
+        rows.push_back(slope_bits);
+        rows.push_back(rate_bits);
+    }
+
+    jlongArray result = env->NewLongArray((jsize)rows.size());
+    if (result) {
+        env->SetLongArrayRegion(result, 0, (jsize)rows.size(), rows.data());
+    }
+    return result;
+}
+
+/**
+ * Name of an agent class id ("java.lang.String" form)
+ */
+JNIEXPORT jstring JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_getClassName
+    (JNIEnv* env, jclass clazz, jint id) {
+    return env->NewStringUTF(id >= 0 ? g_classes.name((uint32_t)id) : "unknown");
+}
+
+/**
+ * Symbolized name of an allocation site index
+ */
+JNIEXPORT jstring JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_getSiteName
+    (JNIEnv* env, jclass clazz, jint index) {
+    return env->NewStringUTF(index >= 0 ? g_sites.name((uint32_t)index) : "unknown");
+}
+
+/**
+ * Verdict of the agent's include / exclude lists for a class name (either
+ * "java.util.HashMap" or "java/util/HashMap"); false when no lists are set
+ */
+JNIEXPORT jboolean JNICALL Java_com_jvm_analyzer_core_NativeMemoryTracker_isClassExcluded
+    (JNIEnv* env, jclass clazz, jstring name) {
+    ClassMatcher* matcher = g_class_matcher.load(std::memory_order_acquire);
+    if (!matcher || !name) {
+        return JNI_FALSE;
+    }
+    const char* chars = env->GetStringUTFChars(name, nullptr);
+    if (!chars) {
+        return JNI_FALSE;
+    }
+    bool excluded = matcher->excludes_name(chars);
+    env->ReleaseStringUTFChars(name, chars);
+    return excluded ? JNI_TRUE : JNI_FALSE;
+}
+
 } // extern "C"
@@ -0,0 +1,239 @@
+/**
+ * Query Protocol - Java Memory Analyzer
+ *
+ * Binary request/response protocol of the agent's local query server.
+ * The agent listens on a Unix domain socket ("<tmp>/jma-query-<pid>.sock")
+ * and answers from its native aggregates, so a local CLI or collector can
+ * query a JVM without loading any analyzer classes into it.
+ *
+ * Every message is a fixed header followed by payload_length bytes:
+ *
+ *   QueryRequest        op, arg, payload (QUERY_SITE_LIVE: site name)
+ *   QueryResponseHeader op, status, count, arg, payload
+ *
+ * Entry replies (sites, classes, heap histogram) carry count QueryEntry
+ * records, each followed by name_length name bytes padded to 8 bytes.
+ * QUERY_STATS replies carry int64[STATS_FIELD_COUNT] (stats_page.h).
+ * Requests on one connection are answered in order. Native byte order.
+ *
+ * @author Java Memory Analyzer Team
+ * @version 1.0.0
+ */
+
+#ifndef JMA_QUERY_PROTOCOL_H
+#define JMA_QUERY_PROTOCOL_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include <string>
+#include <vector>
+
+namespace jma {
+
+static const uint32_t QUERY_MAGIC = 0x514D414A;     // "JMAQ"
+static const uint32_t QUERY_MAX_PAYLOAD = 4096;     // Request payload limit
+
+enum QueryOp : uint16_t {
+    QUERY_STATS = 1,            // Counters
+    QUERY_TOP_SITES = 2,        // arg = k; live bytes by allocation site
+    QUERY_CLASS_HISTOGRAM = 3,  // arg = k; live bytes by class
+    QUERY_SITE_LIVE = 4,        // payload = site name; one entry
+    QUERY_SET_SAMPLING = 5,     // arg = interval (1 = every allocation, at most INT_MAX); reply arg = previous
+    QUERY_HEAP_HISTOGRAM = 6,   // arg = k; walks the heap now (all objects, not only sampled)
+    QUERY_START_STREAM = 7      // arg = ring MB; starts the event stream (event_stream.h)
+};
+
+enum QueryStatus : uint16_t {
+    QUERY_OK = 0,
+    QUERY_UNKNOWN_OP = 1,
+    QUERY_NOT_FOUND = 2,
+    QUERY_UNAVAILABLE = 3,
+    QUERY_BAD_REQUEST = 4
+};
+
+struct QueryRequest {
+    uint32_t magic;
+    uint16_t op;
+    uint16_t reserved;
+    uint32_t arg;
+    uint32_t payload_length;
+};
+
+struct QueryResponseHeader {
+    uint32_t magic;
+    uint16_t op;
+    uint16_t status;
+    uint32_t count;
+    uint32_t arg;
+    uint64_t payload_length;
+};
+
+/**
+ * Live counts are objects still tracked (sampled allocations minus frees);
+ * heap histogram entries only fill live_count / live_bytes
+ */
+struct QueryEntry {
+    uint32_t id;                // Agent class id or site index
+    uint32_t name_length;
+    int64_t live_count;
+    int64_t live_bytes;
+    int64_t alloc_count;
+    int64_t alloc_bytes;
+};
+
+static_assert(sizeof(QueryRequest) == 16, "QueryRequest layout");
+static_assert(sizeof(QueryResponseHeader) == 24, "QueryResponseHeader layout");
+static_assert(sizeof(QueryEntry) == 40, "QueryEntry layout");
+
+struct QueryReplyEntry {
+    uint32_t id;
+    std::string name;
+    int64_t live_count;
+    int64_t live_bytes;
+    int64_t alloc_count;
+    int64_t alloc_bytes;
+};
+
+inline std::string query_socket_path(uint32_t pid) {
+    const char* tmp = getenv("TMPDIR");
+    std::string dir = (tmp && *tmp) ? tmp : "/tmp";
+    if (dir.back() != '/') dir += '/';
+    char name[64];
+    snprintf(name, sizeof(name), "jma-query-%u.sock", pid);
+    return dir + name;
+}
+
+/**
+ * Append one entry and its padded name to a reply payload
+ */
+inline void append_query_entry(std::vector<char>& out, const QueryEntry& entry, const char* name) {
+    size_t at = out.size();
+    size_t padded = (entry.name_length + 7) & ~(size_t)7;
+    out.resize(at + sizeof(QueryEntry) + padded, 0);
+    memcpy(out.data() + at, &entry, sizeof(entry));
+    memcpy(out.data() + at + sizeof(entry), name, entry.name_length);
+}
+
+inline bool parse_query_entries(const std::vector<char>& payload, uint32_t count,
+                                std::vector<QueryReplyEntry>& out) {
+    size_t at = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        QueryEntry entry;
+        if (at + sizeof(entry) > payload.size()) return false;
+        memcpy(&entry, payload.data() + at, sizeof(entry));
+        at += sizeof(entry);
+        size_t padded = (entry.name_length + 7) & ~(size_t)7;
+        if (at + padded > payload.size()) return false;
+        out.push_back({entry.id, std::string(payload.data() + at, entry.name_length),
+                       entry.live_count, entry.live_bytes, entry.alloc_count, entry.alloc_bytes});
+        at += padded;
+    }
+    return true;
+}
+
+inline bool read_fully(int fd, void* data, size_t length) {
+    char* p = (char*)data;
+    while (length > 0) {
+        ssize_t n = recv(fd, p, length, 0);
+        if (n <= 0) return false;
+        p += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+inline bool write_fully(int fd, const void* data, size_t length) {
+    const char* p = (const char*)data;
+    while (length > 0) {
+        ssize_t n = send(fd, p, length, MSG_NOSIGNAL);
+        if (n <= 0) return false;
+        p += n;
+        length -= (size_t)n;
+    }
+    return true;
+}
+
+/**
+ * Blocking client of one agent's query server
+ */
+class QueryClient {
+private:
+    int fd = -1;
+
+public:
+    ~QueryClient() { close(); }
+
+    bool connect(uint32_t pid, std::string* error, int timeout_ms = 5000) {
+        return connect_path(query_socket_path(pid), error, timeout_ms);
+    }
+
+    bool connect_path(const std::string& path, std::string* error, int timeout_ms = 5000) {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (path.size() >= sizeof(addr.sun_path)) {
+            if (error) *error = "socket path too long: " + path;
+            return false;
+        }
+        memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+        fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            if (error) *error = "cannot connect to " + path;
+            close();
+            return false;
+        }
+        struct timeval tv;
+        tv.tv_sec = timeout_ms / 1000;
+        tv.tv_usec = (timeout_ms % 1000) * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        return true;
+    }
+
+    void close() {
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+    }
+
+    int descriptor() const { return fd; }
+
+    /**
+     * Send one request and wait for its reply. Returns false on I/O error.
+     */
+    bool call(QueryOp op, uint32_t arg, const std::string& payload,
+              QueryResponseHeader* reply, std::vector<char>* reply_payload) {
+        if (fd < 0 || payload.size() > QUERY_MAX_PAYLOAD) {
+            return false;
+        }
+        QueryRequest request;
+        request.magic = QUERY_MAGIC;
+        request.op = op;
+        request.reserved = 0;
+        request.arg = arg;
+        request.payload_length = (uint32_t)payload.size();
+        if (!write_fully(fd, &request, sizeof(request)) ||
+            !write_fully(fd, payload.data(), payload.size()) ||
+            !read_fully(fd, reply, sizeof(*reply)) || reply->magic != QUERY_MAGIC) {
+            close();
+            return false;
+        }
+        reply_payload->resize((size_t)reply->payload_length);
+        if (!read_fully(fd, reply_payload->data(), reply_payload->size())) {
+            close();
+            return false;
+        }
+        return true;
+    }
+};
+
+} // namespace jma
+
+#endif // JMA_QUERY_PROTOCOL_H
@@ -0,0 +1,1028 @@
+/**
+ * Recording Analyzer - Java Memory Analyzer
+ *
+ * Standalone offline analyzer for the chunked recordings spilled by the
+ * JVMTI agent (agent option record=<dir> or command "record:start:<dir>").
+ * Chunks are parsed in parallel across all cores; per-chunk aggregates are
+ * merged and printed as the same JSON document ReportGenerator
+ * .generateJsonReport() produces, plus recording-only sections
+ * (allocationSites, objectLifetimes, allocationRate, recording).
+ *
+ * With --from/--to it instead answers a time-range query from the
+ * recording's time index: top-K allocation sites (or classes) in the
+ * window, reading only the index and the chunks at the window edges.
+ *
+ * With --live it attaches to a running agent's event stream (agent option
+ * stream, see event_stream.h) and prints the top allocation sites and
+ * classes every interval until the JVM exits or the stream is stopped.
+ *
+ * With --query it sends one request to a running agent's query server
+ * (see query_protocol.h) and prints the reply as JSON.
+ *
+ * Usage: jma-analyzer [-j threads] [-o output.json] [-i interval_ms]
+ *                     [-n top_sites] <dir|chunk.jmr>...
+ *        jma-analyzer --from <time> --to <time> [-n k] [--by site|class]
+ *                     [-o output.json] <dir>
+ *        jma-analyzer --live <pid> [-i interval_ms] [-n k]
+ *        jma-analyzer --query <pid> stats|sites|classes|heap|site=<name>|sampling=<n>
+ *                     [-n k] [-o output.json]
+ *
+ * @author Java Memory Analyzer Team
+ * @version 1.0.0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "json_writer.h"
+#include "recording_format.h"
+#include "recording_index.h"
+#include "query_protocol.h"
+#include "stats_page.h"
+#ifdef __linux__
+#include "event_stream.h"
+#endif
+
+// ============================================================================
+// Configuration
+// ============================================================================
+
+#define LIFETIME_BUCKETS 32            // log2(ms) lifetime histogram buckets
+#define DEFAULT_RATE_INTERVAL_MS 1000
+#define GENERATOR_VERSION "1.0.0"
+
+// ============================================================================
+// Aggregates
+// ============================================================================
+
+struct ClassAggregate {
+    int64_t live_count = 0;
+    int64_t live_bytes = 0;
+
+    void merge(const ClassAggregate& o) {
+        live_count += o.live_count;
+        live_bytes += o.live_bytes;
+    }
+};
+
+struct SiteAggregate {
+    int64_t alloc_count = 0;
+    int64_t alloc_bytes = 0;
+    int64_t freed_count = 0;
+    int64_t lifetime_sum_ms = 0;
+
+    void merge(const SiteAggregate& o) {
+        alloc_count += o.alloc_count;
+        alloc_bytes += o.alloc_bytes;
+        freed_count += o.freed_count;
+        lifetime_sum_ms += o.lifetime_sum_ms;
+    }
+};
+
+struct RateBucket {
+    int64_t allocations = 0;
+    int64_t bytes = 0;
+};
+
+/**
+ * Lifetime distribution; bucket i counts lifetimes in [2^(i-1), 2^i) ms
+ * (bucket 0 holds lifetimes under 1 ms)
+ */
+struct LifetimeHistogram {
+    int64_t buckets[LIFETIME_BUCKETS] = {0};
+    int64_t count = 0;
+    int64_t sum_ms = 0;
+    int64_t max_ms = 0;
+
+    void add(int64_t lifetime_ms) {
+        if (lifetime_ms < 0) lifetime_ms = 0;
+        int bucket = 0;
+        while (bucket < LIFETIME_BUCKETS - 1 && ((int64_t)1 << bucket) <= lifetime_ms) {
+            bucket++;
+        }
+        buckets[bucket]++;
+        count++;
+        sum_ms += lifetime_ms;
+        max_ms = std::max(max_ms, lifetime_ms);
+    }
+
+    void merge(const LifetimeHistogram& o) {
+        for (int i = 0; i < LIFETIME_BUCKETS; i++) buckets[i] += o.buckets[i];
+        count += o.count;
+        sum_ms += o.sum_ms;
+        max_ms = std::max(max_ms, o.max_ms);
+    }
+};
+
+/**
+ * GC events at the edges of a chunk, used to pair GC start/finish events
+ * that straddle chunk boundaries. Merged in chunk order.
+ */
+struct GcBoundary {
+    bool valid = false;
+    bool has_gc_events = false;
+    uint32_t pid = 0;
+    uint64_t sequence = 0;
+    int64_t start_time = 0;
+    int64_t leading_finish = -1;    // Finish seen before any start
+    int64_t trailing_start = -1;    // Start not followed by a finish
+};
+
+/**
+ * Order-independent aggregates; one per worker, merged at the end
+ */
+struct Aggregate {
+    std::unordered_map<std::string, ClassAggregate> classes;
+    std::unordered_map<std::string, SiteAggregate> sites;
+    std::unordered_map<int64_t, RateBucket> rate;
+    LifetimeHistogram lifetimes;
+
+    int64_t chunks = 0;
+    int64_t events = 0;
+    int64_t alloc_count = 0;
+    int64_t alloc_bytes = 0;
+    int64_t free_count = 0;
+    int64_t free_bytes = 0;
+    int64_t gc_count = 0;
+    int64_t gc_time_ms = 0;
+    int64_t start_time = INT64_MAX;
+    int64_t end_time = INT64_MIN;
+
+    // Heap usage and properties from the most recent chunk
+    int64_t heap_time = INT64_MIN;
+    int64_t heap_used = 0;
+    int64_t heap_committed = 0;
+    int64_t heap_max = 0;
+    std::map<std::string, std::string> properties;
+
+    void merge(const Aggregate& o) {
+        for (const auto& e : o.classes) classes[e.first].merge(e.second);
+        for (const auto& e : o.sites) sites[e.first].merge(e.second);
+        for (const auto& e : o.rate) {
+            RateBucket& b = rate[e.first];
+            b.allocations += e.second.allocations;
+            b.bytes += e.second.bytes;
+        }
+        lifetimes.merge(o.lifetimes);
+        chunks += o.chunks;
+        events += o.events;
+        alloc_count += o.alloc_count;
+        alloc_bytes += o.alloc_bytes;
+        free_count += o.free_count;
+        free_bytes += o.free_bytes;
+        gc_count += o.gc_count;
+        gc_time_ms += o.gc_time_ms;
+        start_time = std::min(start_time, o.start_time);
+        end_time = std::max(end_time, o.end_time);
+        if (o.heap_time > heap_time) {
+            heap_time = o.heap_time;
+            heap_used = o.heap_used;
+            heap_committed = o.heap_committed;
+            heap_max = o.heap_max;
+            if (!o.properties.empty()) properties = o.properties;
+        }
+    }
+};
+
+// ============================================================================
+// Chunk Parsing
+// ============================================================================
+
+/**
+ * Parse one chunk and fold it into the worker's aggregate. Per-chunk
+ * tables are indexed by the chunk's dense class/site indices, so the
+ * per-event loop does no hashing.
+ */
+static bool parse_chunk(const std::string& path, int64_t interval_ms,
+                        Aggregate& acc, GcBoundary& boundary) {
+    jma::ChunkReader reader;
+    std::string error;
+    if (!reader.open(path, &error)) {
+        fprintf(stderr, "jma-analyzer: %s\n", error.c_str());
+        return false;
+    }
+
+    const jma::ChunkHeader& header = reader.header();
+    std::vector<ClassAggregate> classes(header.class_count);
+    std::vector<SiteAggregate> sites(header.site_count);
+    std::unordered_map<int64_t, RateBucket> rate;
+
+    boundary.valid = true;
+    boundary.pid = header.pid;
+    boundary.sequence = header.sequence;
+    boundary.start_time = header.start_time;
+
+    int64_t open_gc_start = -1;
+    const jma::RecordedEvent* events = reader.events();
+    uint32_t count = reader.event_count();
+
+    for (uint32_t i = 0; i < count; i++) {
+        const jma::RecordedEvent& e = events[i];
+        switch (e.type) {
+            case jma::REC_ALLOC: {
+                int64_t w = (int64_t)1 << e.weight_shift;     // Stratified sampling weight
+                acc.alloc_count += w;
+                acc.alloc_bytes += e.size * w;
+                if (e.class_index < classes.size()) {
+                    classes[e.class_index].live_count += w;
+                    classes[e.class_index].live_bytes += e.size * w;
+                }
+                if (e.site_index < sites.size()) {
+                    sites[e.site_index].alloc_count += w;
+                    sites[e.site_index].alloc_bytes += e.size * w;
+                }
+                int64_t bucket = e.timestamp - e.timestamp % interval_ms;
+                RateBucket& b = rate[bucket];
+                b.allocations += w;
+                b.bytes += e.size * w;
+                break;
+            }
+            case jma::REC_FREE: {
+                int64_t w = (int64_t)1 << e.weight_shift;
+                acc.free_count += w;
+                acc.free_bytes += e.size * w;
+                if (e.class_index < classes.size()) {
+                    classes[e.class_index].live_count -= w;
+                    classes[e.class_index].live_bytes -= e.size * w;
+                }
+                if (e.aux > 0) {
+                    int64_t lifetime = e.timestamp - e.aux;
+                    acc.lifetimes.add(lifetime);
+                    if (e.site_index < sites.size()) {
+                        sites[e.site_index].freed_count += w;
+                        sites[e.site_index].lifetime_sum_ms += std::max<int64_t>(lifetime, 0) * w;
+                    }
+                }
+                break;
+            }
+            case jma::REC_GC_START:
+                boundary.has_gc_events = true;
+                acc.gc_count++;
+                open_gc_start = e.timestamp;
+                break;
+            case jma::REC_GC_FINISH:
+                boundary.has_gc_events = true;
+                if (open_gc_start >= 0) {
+                    acc.gc_time_ms += e.timestamp - open_gc_start;
+                    open_gc_start = -1;
+                } else if (boundary.leading_finish < 0) {
+                    boundary.leading_finish = e.timestamp;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    boundary.trailing_start = open_gc_start;
+
+    for (uint32_t i = 0; i < classes.size(); i++) {
+        if (classes[i].live_count != 0 || classes[i].live_bytes != 0) {
+            acc.classes[std::string(reader.class_name(i))].merge(classes[i]);
+        }
+    }
+    for (uint32_t i = 0; i < sites.size(); i++) {
+        acc.sites[std::string(reader.site_name(i))].merge(sites[i]);
+    }
+    for (const auto& e : rate) {
+        RateBucket& b = acc.rate[e.first];
+        b.allocations += e.second.allocations;
+        b.bytes += e.second.bytes;
+    }
+
+    acc.chunks++;
+    acc.events += count;
+    if (count > 0) {
+        acc.start_time = std::min<int64_t>(acc.start_time, header.start_time);
+        acc.end_time = std::max<int64_t>(acc.end_time, header.end_time);
+    }
+    if (header.end_time > acc.heap_time) {
+        acc.heap_time = header.end_time;
+        acc.heap_used = header.heap_used;
+        acc.heap_committed = header.heap_committed;
+        acc.heap_max = header.heap_max;
+        acc.properties.clear();
+        for (const auto& p : reader.properties()) {
+            acc.properties[std::string(p.first)] = std::string(p.second);
+        }
+    }
+    return true;
+}
+
+/**
+ * Pair GC start/finish events across chunk boundaries (chunks of each
+ * process in sequence order)
+ */
+static int64_t merge_gc_boundaries(std::vector<GcBoundary>& boundaries) {
+    std::sort(boundaries.begin(), boundaries.end(), [](const GcBoundary& a, const GcBoundary& b) {
+        if (a.pid != b.pid) return a.pid < b.pid;
+        return a.sequence < b.sequence;
+    });
+
+    int64_t extra_ms = 0;
+    int64_t pending_start = -1;
+    uint32_t pid = 0;
+    for (const GcBoundary& b : boundaries) {
+        if (!b.valid) continue;
+        if (b.pid != pid) {
+            pending_start = -1;
+            pid = b.pid;
+        }
+        if (!b.has_gc_events) continue;
+        if (b.leading_finish >= 0 && pending_start >= 0) {
+            extra_ms += b.leading_finish - pending_start;
+        }
+        pending_start = b.trailing_start;
+    }
+    return extra_ms;
+}
+
+// ============================================================================
+// JSON Output
+// ============================================================================
+
+using jma::JsonWriter;
+
+static std::string format_timestamp(int64_t millis) {
+    time_t secs = (time_t)(millis / 1000);
+    struct tm tm_buf;
+    localtime_r(&secs, &tm_buf);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm_buf);
+    return buf;
+}
+
+static std::string property(const Aggregate& agg, const char* key) {
+    auto it = agg.properties.find(key);
+    return it != agg.properties.end() ? it->second : "unknown";
+}
+
+static void write_report(FILE* out, const Aggregate& agg, int64_t gc_time_ms,
+                         int64_t interval_ms, size_t top_sites,
+                         int threads, int64_t parse_ms) {
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    JsonWriter json(out);
+    json.begin_object();
+    json.key("reportType").value("Java Memory Analysis");
+    json.key("generatorVersion").value(GENERATOR_VERSION);
+    json.key("timestamp").value(now);
+    json.key("timestampFormatted").value(format_timestamp(now));
+
+    // System info (recorded by the agent)
+    json.key("systemInfo").begin_object();
+    json.key("javaVersion").value(property(agg, "java.version"));
+    json.key("javaVendor").value(property(agg, "java.vendor"));
+    json.key("jvmName").value(property(agg, "java.vm.name"));
+    json.key("jvmVersion").value(property(agg, "java.vm.version"));
+    json.key("osName").value(property(agg, "os.name"));
+    json.key("osVersion").value(property(agg, "os.version"));
+    json.key("osArchitecture").value(property(agg, "os.arch"));
+    json.key("availableProcessors").value((int64_t)atoll(property(agg, "availableProcessors").c_str()));
+    json.end_object();
+
+    // Memory stats (heap usage when the last chunk was sealed)
+    json.key("memoryStats").begin_object();
+    json.key("usedMemory").value(agg.heap_used);
+    json.key("totalMemory").value(agg.heap_committed);
+    json.key("maxMemory").value(agg.heap_max);
+    json.key("freeMemory").value(agg.heap_committed - agg.heap_used);
+    json.end_object();
+
+    // Class histogram (live sampled objects at the end of the recording)
+    std::vector<std::pair<std::string, ClassAggregate>> classes;
+    for (const auto& e : agg.classes) {
+        if (e.second.live_count > 0) classes.emplace_back(e.first, e.second);
+    }
+    std::sort(classes.begin(), classes.end(), [](const auto& a, const auto& b) {
+        return a.second.live_bytes > b.second.live_bytes;
+    });
+    json.key("classHistogram").begin_array();
+    for (const auto& c : classes) {
+        json.begin_object();
+        json.key("className").value(c.first);
+        json.key("instanceCount").value(c.second.live_count);
+        json.key("totalSize").value(std::max<int64_t>(c.second.live_bytes, 0));
+        json.key("avgSize").value(std::max<int64_t>(c.second.live_bytes, 0) / c.second.live_count);
+        json.end_object();
+    }
+    json.end_array();
+
+    // GC stats (JVMTI does not distinguish collectors)
+    json.key("gcStats").begin_array();
+    json.begin_object();
+    json.key("name").value("JVMTI GarbageCollection events");
+    json.key("collectionCount").value(agg.gc_count);
+    json.key("collectionTime").value(gc_time_ms);
+    json.end_object();
+    json.end_array();
+
+    // Allocation sites
+    std::vector<std::pair<std::string, SiteAggregate>> sites(agg.sites.begin(), agg.sites.end());
+    std::sort(sites.begin(), sites.end(), [](const auto& a, const auto& b) {
+        return a.second.alloc_bytes > b.second.alloc_bytes;
+    });
+    if (top_sites > 0 && sites.size() > top_sites) {
+        sites.resize(top_sites);
+    }
+    json.key("allocationSites").begin_array();
+    for (const auto& s : sites) {
+        json.begin_object();
+        json.key("site").value(s.first);
+        json.key("allocationCount").value(s.second.alloc_count);
+        json.key("totalSize").value(s.second.alloc_bytes);
+        json.key("avgSize").value(s.second.alloc_count > 0 ? s.second.alloc_bytes / s.second.alloc_count : 0);
+        json.key("freedCount").value(s.second.freed_count);
+        json.key("avgLifetimeMs").value(s.second.freed_count > 0 ? s.second.lifetime_sum_ms / s.second.freed_count : 0);
+        json.end_object();
+    }
+    json.end_array();
+
+    // Object lifetimes
+    json.key("objectLifetimes").begin_object();
+    json.key("freedObjects").value(agg.lifetimes.count);
+    json.key("avgLifetimeMs").value(agg.lifetimes.count > 0 ? agg.lifetimes.sum_ms / agg.lifetimes.count : 0);
+    json.key("maxLifetimeMs").value(agg.lifetimes.max_ms);
+    json.key("histogram").begin_array();
+    for (int i = 0; i < LIFETIME_BUCKETS; i++) {
+        if (agg.lifetimes.buckets[i] == 0) continue;
+        json.begin_object();
+        json.key("upperBoundMs").value((int64_t)1 << i);
+        json.key("count").value(agg.lifetimes.buckets[i]);
+        json.end_object();
+    }
+    json.end_array();
+    json.end_object();
+
+    // Allocation rate time series
+    std::vector<std::pair<int64_t, RateBucket>> rate(agg.rate.begin(), agg.rate.end());
+    std::sort(rate.begin(), rate.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    json.key("allocationRate").begin_object();
+    json.key("intervalMs").value(interval_ms);
+    json.key("samples").begin_array();
+    for (const auto& r : rate) {
+        json.begin_object();
+        json.key("timestamp").value(r.first);
+        json.key("allocations").value(r.second.allocations);
+        json.key("bytes").value(r.second.bytes);
+        json.end_object();
+    }
+    json.end_array();
+    json.end_object();
+
+    // Recording summary
+    json.key("recording").begin_object();
+    json.key("chunks").value(agg.chunks);
+    json.key("events").value(agg.events);
+    json.key("allocations").value(agg.alloc_count);
+    json.key("allocatedBytes").value(agg.alloc_bytes);
+    json.key("frees").value(agg.free_count);
+    json.key("freedBytes").value(agg.free_bytes);
+    json.key("startTime").value(agg.events > 0 ? agg.start_time : 0);
+    json.key("endTime").value(agg.events > 0 ? agg.end_time : 0);
+    json.key("parseThreads").value((int64_t)threads);
+    json.key("parseTimeMs").value(parse_ms);
+    json.end_object();
+
+    json.end_object();
+    json.finish();
+}
+
+// ============================================================================
+// Time-Range Query
+// ============================================================================
+
+/**
+ * Parse a query time: epoch milliseconds or local "YYYY-MM-DD HH:MM[:SS]"
+ */
+static bool parse_time(const char* text, int64_t& out) {
+    char* end = nullptr;
+    long long millis = strtoll(text, &end, 10);
+    if (end && *end == '\0' && end != text) {
+        out = millis;
+        return true;
+    }
+
+    struct tm tm_buf;
+    memset(&tm_buf, 0, sizeof(tm_buf));
+    const char* rest = strptime(text, "%Y-%m-%d %H:%M:%S", &tm_buf);
+    if (!rest || *rest) {
+        memset(&tm_buf, 0, sizeof(tm_buf));
+        rest = strptime(text, "%Y-%m-%d %H:%M", &tm_buf);
+    }
+    if (!rest || *rest) {
+        return false;
+    }
+    tm_buf.tm_isdst = -1;
+    out = (int64_t)mktime(&tm_buf) * 1000;
+    return true;
+}
+
+static int run_query(const std::string& dir, int64_t from, int64_t to, size_t k,
+                     jma::GroupBy group, FILE* out) {
+    auto started = std::chrono::steady_clock::now();
+
+    jma::RecordingIndex index;
+    std::string error;
+    if (!index.open(dir, &error)) {
+        fprintf(stderr, "jma-analyzer: %s\n", error.c_str());
+        return 1;
+    }
+    jma::QueryResult result = index.top(from, to, k, group);
+
+    int64_t query_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started).count();
+
+    bool by_class = group == jma::GROUP_BY_CLASS;
+    JsonWriter json(out);
+    json.begin_object();
+    json.key("from").value(from);
+    json.key("fromFormatted").value(format_timestamp(from));
+    json.key("to").value(to);
+    json.key("toFormatted").value(format_timestamp(to));
+    json.key("groupBy").value(by_class ? "class" : "site");
+    json.key("allocations").value(result.total_count);
+    json.key("allocatedBytes").value(result.total_bytes);
+    json.key(by_class ? "topClasses" : "allocationSites").begin_array();
+    for (const auto& e : result.entries) {
+        json.begin_object();
+        json.key(by_class ? "className" : "site").value(e.name);
+        json.key("allocationCount").value(e.count);
+        json.key("totalSize").value(e.bytes);
+        json.key("avgSize").value(e.count > 0 ? e.bytes / e.count : 0);
+        json.end_object();
+    }
+    json.end_array();
+    json.key("query").begin_object();
+    json.key("indexedChunks").value((int64_t)index.chunk_count());
+    json.key("chunksFromSummary").value((int64_t)result.chunks_from_summary);
+    json.key("chunksScanned").value((int64_t)result.chunks_scanned);
+    json.key("exact").value(result.exact);
+    json.key("queryTimeMs").value(query_ms);
+    json.end_object();
+    json.end_object();
+    json.finish();
+
+    if (!result.exact) {
+        fprintf(stderr, "jma-analyzer: some chunks in the window could not be read; result is partial\n");
+    }
+    return 0;
+}
+
+// ============================================================================
+// Agent Query
+// ============================================================================
+
+static const char* const STATS_FIELD_NAMES[jma::STATS_FIELD_COUNT] = {
+    "updateTime", "totalAllocated", "totalFreed", "currentUsage", "allocationCount",
+    "freeCount", "queueDepth", "droppedEvents", "gcCount", "gcTimeMs",
+    "samplingInterval", "heapUsed", "heapCommitted", "heapMax", "agentOverheadPpm",
+    "governorLevel"
+};
+
+static const char* query_status_name(uint16_t status) {
+    switch (status) {
+        case jma::QUERY_OK: return "ok";
+        case jma::QUERY_UNKNOWN_OP: return "unknown request";
+        case jma::QUERY_NOT_FOUND: return "not found";
+        case jma::QUERY_UNAVAILABLE: return "unavailable";
+        default: return "bad request";
+    }
+}
+
+static int run_agent_query(uint32_t pid, const std::string& request, size_t k, FILE* out) {
+    jma::QueryOp op;
+    uint32_t arg = (uint32_t)k;
+    std::string payload;
+    if (request == "stats") {
+        op = jma::QUERY_STATS;
+    } else if (request == "sites") {
+        op = jma::QUERY_TOP_SITES;
+    } else if (request == "classes") {
+        op = jma::QUERY_CLASS_HISTOGRAM;
+    } else if (request == "heap") {
+        op = jma::QUERY_HEAP_HISTOGRAM;
+    } else if (request.compare(0, 5, "site=") == 0) {
+        op = jma::QUERY_SITE_LIVE;
+        payload = request.substr(5);
+    } else if (request.compare(0, 9, "sampling=") == 0) {
+        op = jma::QUERY_SET_SAMPLING;
+        arg = (uint32_t)atol(request.c_str() + 9);
+    } else {
+        fprintf(stderr, "jma-analyzer: unknown query: %s\n", request.c_str());
+        return 2;
+    }
+
+    auto started = std::chrono::steady_clock::now();
+    jma::QueryClient client;
+    std::string error;
+    jma::QueryResponseHeader reply;
+    std::vector<char> reply_payload;
+    if (!client.connect(pid, &error, op == jma::QUERY_HEAP_HISTOGRAM ? 60000 : 5000)) {
+        fprintf(stderr, "jma-analyzer: %s\n", error.c_str());
+        return 1;
+    }
+    if (!client.call(op, arg, payload, &reply, &reply_payload)) {
+        fprintf(stderr, "jma-analyzer: query failed\n");
+        return 1;
+    }
+    int64_t query_us = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started).count();
+    if (reply.status != jma::QUERY_OK) {
+        fprintf(stderr, "jma-analyzer: %s: %s\n", request.c_str(), query_status_name(reply.status));
+        return 1;
+    }
+
+    JsonWriter json(out);
+    json.begin_object();
+    json.key("pid").value((int64_t)pid);
+    json.key("request").value(request);
+    if (op == jma::QUERY_STATS) {
+        json.key("stats").begin_object();
+        for (uint32_t i = 0; i < reply.count && i < jma::STATS_FIELD_COUNT && (i + 1) * 8 <= reply_payload.size(); i++) {
+            int64_t v;
+            memcpy(&v, reply_payload.data() + i * 8, sizeof(v));
+            json.key(STATS_FIELD_NAMES[i]).value(v);
+        }
+        json.end_object();
+    } else if (op == jma::QUERY_SET_SAMPLING) {
+        json.key("previousInterval").value((int64_t)reply.arg);
+        json.key("samplingInterval").value((int64_t)arg);
+    } else {
+        std::vector<jma::QueryReplyEntry> entries;
+        jma::parse_query_entries(reply_payload, reply.count, entries);
+        bool by_site = op == jma::QUERY_TOP_SITES || op == jma::QUERY_SITE_LIVE;
+        json.key(by_site ? "allocationSites" : "classes").begin_array();
+        for (const auto& e : entries) {
+            json.begin_object();
+            json.key(by_site ? "site" : "className").value(e.name);
+            json.key("liveCount").value(e.live_count);
+            json.key("liveBytes").value(e.live_bytes);
+            if (op != jma::QUERY_HEAP_HISTOGRAM) {
+                json.key("allocationCount").value(e.alloc_count);
+                json.key("totalSize").value(e.alloc_bytes);
+            }
+            json.end_object();
+        }
+        json.end_array();
+    }
+    json.key("queryTimeMicros").value(query_us);
+    json.end_object();
+    json.finish();
+    return 0;
+}
+
+// ============================================================================
+// Live Stream
+// ============================================================================
+
+#ifdef __linux__
+
+/**
+ * Per-name totals of one live interval and of the whole session
+ */
+struct LiveEntry {
+    int64_t count = 0;
+    int64_t bytes = 0;
+    int64_t freed_bytes = 0;
+};
+
+static void print_live_top(FILE* out, const char* title,
+                           const std::unordered_map<uint32_t, LiveEntry>& entries,
+                           const std::unordered_map<uint32_t, std::string>& names, size_t k) {
+    std::vector<std::pair<uint32_t, LiveEntry>> sorted(entries.begin(), entries.end());
+    size_t n = std::min(k, sorted.size());
+    std::partial_sort(sorted.begin(), sorted.begin() + n, sorted.end(),
+                      [](const auto& a, const auto& b) { return a.second.bytes > b.second.bytes; });
+
+    fprintf(out, "  %-60s %12s %14s %14s\n", title, "allocs", "bytes", "freed");
+    for (size_t i = 0; i < n; i++) {
+        auto it = names.find(sorted[i].first);
+        std::string name = it != names.end() ? it->second : "unknown";
+        if (name.size() > 60) {
+            name = "..." + name.substr(name.size() - 57);
+        }
+        fprintf(out, "  %-60s %12lld %14lld %14lld\n", name.c_str(),
+                (long long)sorted[i].second.count, (long long)sorted[i].second.bytes,
+                (long long)sorted[i].second.freed_bytes);
+    }
+}
+
+static int run_live(uint32_t pid, int64_t interval_ms, size_t k, FILE* out) {
+    jma::StreamConsumer consumer;
+    std::string error;
+    if (!consumer.connect(pid, &error)) {
+        fprintf(stderr, "jma-analyzer: %s\n", error.c_str());
+        return 1;
+    }
+    fprintf(stderr, "jma-analyzer: streaming from pid %u (Ctrl-C to stop)\n", consumer.pid());
+
+    std::unordered_map<uint32_t, std::string> class_names;
+    std::unordered_map<uint32_t, std::string> site_names;
+    std::unordered_map<uint32_t, LiveEntry> classes;
+    std::unordered_map<uint32_t, LiveEntry> sites;
+    int64_t events = 0, alloc_bytes = 0, freed_bytes = 0, gcs = 0;
+    int64_t total_events = 0;
+
+    auto handler = [&](const jma::StreamRecordHeader& rh, const char* payload) {
+        if (rh.type == jma::STREAM_CLASS || rh.type == jma::STREAM_SITE) {
+            uint32_t id;
+            std::string_view name;
+            if (jma::StreamConsumer::parse_name(rh, payload, &id, &name)) {
+                (rh.type == jma::STREAM_CLASS ? class_names : site_names)[id] = std::string(name);
+            }
+            return;
+        }
+        if (rh.type != jma::STREAM_EVENT || rh.length < sizeof(rh) + sizeof(jma::RecordedEvent)) {
+            return;
+        }
+        jma::RecordedEvent event;
+        memcpy(&event, payload, sizeof(event));
+        events++;
+        int64_t w = (int64_t)1 << event.weight_shift;
+        if (event.type == jma::REC_ALLOC) {
+            alloc_bytes += event.size * w;
+            if (event.class_index != jma::NO_INDEX) {
+                LiveEntry& e = classes[event.class_index];
+                e.count += w;
+                e.bytes += event.size * w;
+            }
+            if (event.site_index != jma::NO_INDEX) {
+                LiveEntry& e = sites[event.site_index];
+                e.count += w;
+                e.bytes += event.size * w;
+            }
+        } else if (event.type == jma::REC_FREE) {
+            freed_bytes += event.size * w;
+            if (event.class_index != jma::NO_INDEX) {
+                classes[event.class_index].freed_bytes += event.size * w;
+            }
+            if (event.site_index != jma::NO_INDEX) {
+                sites[event.site_index].freed_bytes += event.size * w;
+            }
+        } else if (event.type == jma::REC_GC_FINISH) {
+            gcs++;
+        }
+    };
+
+    auto next_report = std::chrono::steady_clock::now() + std::chrono::milliseconds(interval_ms);
+    bool open = true;
+    while (open) {
+        auto now = std::chrono::steady_clock::now();
+        int wait_ms = (int)std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+            next_report - now).count());
+        open = consumer.poll(handler, wait_ms);
+
+        if (std::chrono::steady_clock::now() >= next_report || !open) {
+            total_events += events;
+            fprintf(out, "[%s] events %lld, allocated %lld B, freed %lld B, GCs %lld, dropped %llu\n",
+                    format_timestamp(std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count()).c_str(),
+                    (long long)events, (long long)alloc_bytes, (long long)freed_bytes,
+                    (long long)gcs, (unsigned long long)consumer.dropped());
+            print_live_top(out, "Top allocation sites", sites, site_names, k);
+            print_live_top(out, "Top classes", classes, class_names, k);
+            fputc('\n', out);
+            fflush(out);
+
+            classes.clear();
+            sites.clear();
+            events = alloc_bytes = freed_bytes = gcs = 0;
+            next_report = std::chrono::steady_clock::now() + std::chrono::milliseconds(interval_ms);
+        }
+    }
+
+    fprintf(stderr, "jma-analyzer: stream closed after %lld events\n", (long long)total_events);
+    return 0;
+}
+
+#endif // __linux__
+
+// ============================================================================
+// Main
+// ============================================================================
+
+static bool has_suffix(const std::string& s, const char* suffix) {
+    size_t n = strlen(suffix);
+    return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+static void collect_inputs(const char* arg, std::vector<std::string>& files) {
+    struct stat st;
+    if (stat(arg, &st) != 0) {
+        fprintf(stderr, "jma-analyzer: cannot access %s\n", arg);
+        return;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        files.push_back(arg);
+        return;
+    }
+
+    DIR* dir = opendir(arg);
+    if (!dir) {
+        fprintf(stderr, "jma-analyzer: cannot open directory %s\n", arg);
+        return;
+    }
+    std::vector<std::string> found;
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (has_suffix(name, jma::RECORDING_CHUNK_SUFFIX)) {
+            found.push_back(std::string(arg) + "/" + name);
+        }
+    }
+    closedir(dir);
+    std::sort(found.begin(), found.end());
+    files.insert(files.end(), found.begin(), found.end());
+}
+
+static void usage() {
+    fprintf(stderr,
+            "Usage: jma-analyzer [-j threads] [-o output.json] [-i interval_ms] [-n top_sites]\n"
+            "                    <recording-dir|chunk.jmr>...\n"
+            "       jma-analyzer --from <time> --to <time> [-n k] [--by site|class]\n"
+            "                    [-o output.json] <recording-dir>\n"
+            "       jma-analyzer --live <pid> [-i interval_ms] [-n k]\n"
+            "       jma-analyzer --query <pid> stats|sites|classes|heap|site=<name>|sampling=<n>\n"
+            "                    [-n k] [-o output.json]\n"
+            "       <time> is epoch milliseconds or \"YYYY-MM-DD HH:MM[:SS]\"\n");
+}
+
+int main(int argc, char** argv) {
+    int threads = (int)std::thread::hardware_concurrency();
+    const char* output_path = nullptr;
+    int64_t interval_ms = DEFAULT_RATE_INTERVAL_MS;
+    size_t top_sites = 0;
+    std::vector<std::string> files;
+    std::vector<std::string> dirs;
+    int64_t query_from = INT64_MIN;
+    int64_t query_to = INT64_MAX;
+    bool query = false;
+    jma::GroupBy group = jma::GROUP_BY_SITE;
+    long live_pid = 0;
+    long query_pid = 0;
+    std::string query_request;
+
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (strcmp(arg, "-j") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(arg, "-o") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else if (strcmp(arg, "-i") == 0 && i + 1 < argc) {
+            interval_ms = atoll(argv[++i]);
+        } else if (strcmp(arg, "-n") == 0 && i + 1 < argc) {
+            top_sites = (size_t)atoll(argv[++i]);
+        } else if ((strcmp(arg, "--from") == 0 || strcmp(arg, "--to") == 0) && i + 1 < argc) {
+            int64_t& target = strcmp(arg, "--from") == 0 ? query_from : query_to;
+            if (!parse_time(argv[++i], target)) {
+                fprintf(stderr, "jma-analyzer: invalid time: %s\n", argv[i]);
+                return 2;
+            }
+            query = true;
+        } else if (strcmp(arg, "--live") == 0 && i + 1 < argc) {
+            live_pid = atol(argv[++i]);
+            if (live_pid <= 0) {
+                fprintf(stderr, "jma-analyzer: invalid pid: %s\n", argv[i]);
+                return 2;
+            }
+        } else if (strcmp(arg, "--query") == 0 && i + 2 < argc) {
+            query_pid = atol(argv[++i]);
+            query_request = argv[++i];
+            if (query_pid <= 0) {
+                fprintf(stderr, "jma-analyzer: invalid pid: %s\n", argv[i - 1]);
+                return 2;
+            }
+        } else if (strcmp(arg, "--by") == 0 && i + 1 < argc) {
+            group = strcmp(argv[++i], "class") == 0 ? jma::GROUP_BY_CLASS : jma::GROUP_BY_SITE;
+        } else if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+            usage();
+            return 0;
+        } else if (arg[0] == '-') {
+            usage();
+            return 2;
+        } else {
+            dirs.push_back(arg);
+        }
+    }
+
+    if (query_pid > 0) {
+        FILE* out = output_path ? fopen(output_path, "w") : stdout;
+        if (!out) {
+            fprintf(stderr, "jma-analyzer: cannot write %s\n", output_path);
+            return 1;
+        }
+        int rc = run_agent_query((uint32_t)query_pid, query_request, top_sites > 0 ? top_sites : 20, out);
+        if (out != stdout) {
+            fclose(out);
+        }
+        return rc;
+    }
+
+    if (live_pid > 0) {
+#ifdef __linux__
+        return run_live((uint32_t)live_pid, interval_ms > 0 ? interval_ms : DEFAULT_RATE_INTERVAL_MS,
+                        top_sites > 0 ? top_sites : 10, stdout);
+#else
+        fprintf(stderr, "jma-analyzer: --live requires Linux\n");
+        return 1;
+#endif
+    }
+
+    if (query) {
+        if (dirs.size() != 1) {
+            usage();
+            return 2;
+        }
+        FILE* out = output_path ? fopen(output_path, "w") : stdout;
+        if (!out) {
+            fprintf(stderr, "jma-analyzer: cannot write %s\n", output_path);
+            return 1;
+        }
+        int rc = run_query(dirs[0], query_from, query_to, top_sites > 0 ? top_sites : 10, group, out);
+        if (out != stdout) {
+            fclose(out);
+        }
+        return rc;
+    }
+
+    for (const auto& dir : dirs) {
+        collect_inputs(dir.c_str(), files);
+    }
+    if (files.empty()) {
+        usage();
+        return 2;
+    }
+    if (threads <= 0) threads = 1;
+    if ((size_t)threads > files.size()) threads = (int)files.size();
+    if (interval_ms <= 0) interval_ms = DEFAULT_RATE_INTERVAL_MS;
+
+    auto started = std::chrono::steady_clock::now();
+
+    // Parse chunks in parallel; each worker folds chunks into its own aggregate
+    std::vector<Aggregate> partials(threads);
+    std::vector<GcBoundary> boundaries(files.size());
+    std::atomic<size_t> next_file{0};
+    std::atomic<int> failures{0};
+
+    auto worker = [&](int id) {
+        for (;;) {
+            size_t index = next_file.fetch_add(1, std::memory_order_relaxed);
+            if (index >= files.size()) break;
+            if (!parse_chunk(files[index], interval_ms, partials[id], boundaries[index])) {
+                failures.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (int t = 1; t < threads; t++) {
+        pool.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& t : pool) {
+        t.join();
+    }
+
+    Aggregate total;
+    for (const Aggregate& partial : partials) {
+        total.merge(partial);
+    }
+    int64_t gc_time_ms = total.gc_time_ms + merge_gc_boundaries(boundaries);
+
+    int64_t parse_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - started).count();
+
+    FILE* out = stdout;
+    if (output_path) {
+        out = fopen(output_path, "w");
+        if (!out) {
+            fprintf(stderr, "jma-analyzer: cannot write %s\n", output_path);
+            return 1;
+        }
+    }
+    write_report(out, total, gc_time_ms, interval_ms, top_sites, threads, parse_ms);
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    if (failures.load() > 0) {
+        fprintf(stderr, "jma-analyzer: %d of %zu chunks could not be read\n",
+                failures.load(), files.size());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,649 @@
+/**
+ * Recording Format - Java Memory Analyzer
+ *
+ * On-disk layout of the chunked recordings spilled by the JVMTI agent and
+ * read back by the offline analyzer. This header has no JNI/JVMTI
+ * dependency so that standalone tools can be built from it.
+ *
+ * Chunk file layout (little-endian, native alignment):
+ *
+ *   ChunkHeader
+ *   string section   properties (key, value), class names, site names;
+ *                    each string is a uint32 length followed by its bytes,
+ *                    padded to a multiple of 8 bytes
+ *   RecordedEvent[event_count]
+ *
+ * Every chunk is self-contained: class and site indices in its events refer
+ * only to its own string section, so chunks can be parsed independently.
+ *
+ * Next to the chunks the agent appends a sparse time index per process
+ * ("index-<pid>.jmi"): one record per sealed chunk with its time range and
+ * a summary of its top classes and sites (by allocated bytes), plus class
+ * and site name definitions keyed by the agent's process-wide ids. Time
+ * range queries read only the index and the chunks at the window edges.
+ *
+ * Index file layout:
+ *
+ *   IndexFileHeader
+ *   { IndexRecordHeader, payload padded to 8 bytes }*
+ *
+ *   IDX_CLASS / IDX_SITE   uint32 id, uint32 length, name bytes
+ *   IDX_CHUNK              ChunkSummary, SummaryEntry[class_count],
+ *                          SummaryEntry[site_count]
+ *
+ * @author Java Memory Analyzer Team
+ * @version 1.0.0
+ */
+
+#ifndef JMA_RECORDING_FORMAT_H
+#define JMA_RECORDING_FORMAT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace jma {
+
+// ============================================================================
+// Format Definitions
+// ============================================================================
+
+static const char RECORDING_MAGIC[8] = {'J', 'M', 'A', 'R', 'E', 'C', '0', '1'};
+static const uint32_t RECORDING_VERSION = 1;
+static const char* const RECORDING_CHUNK_SUFFIX = ".jmr";
+
+static const char INDEX_MAGIC[8] = {'J', 'M', 'A', 'I', 'D', 'X', '0', '1'};
+static const uint32_t INDEX_VERSION = 1;
+static const char* const RECORDING_INDEX_SUFFIX = ".jmi";
+static const size_t SUMMARY_MAX_ENTRIES = 512;   // Per chunk, per table
+
+/**
+ * Recorded event types (mirror the agent's EventType values)
+ */
+enum RecordType : uint8_t {
+    REC_ALLOC = 1,
+    REC_FREE = 2,
+    REC_GC_START = 3,
+    REC_GC_FINISH = 4
+};
+
+/**
+ * Chunk file header
+ */
+struct ChunkHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t sequence;
+    int64_t start_time;         // First event timestamp (ms)
+    int64_t end_time;           // Last event timestamp (ms)
+    int64_t heap_used;          // Runtime heap usage when the chunk was sealed
+    int64_t heap_committed;
+    int64_t heap_max;
+    uint32_t pid;
+    uint32_t sampling_interval;
+    uint32_t event_count;
+    uint32_t property_count;
+    uint32_t class_count;
+    uint32_t site_count;
+    uint64_t strings_size;      // Bytes in the string section (padded)
+};
+
+/**
+ * Fixed-size event record
+ *
+ * For REC_FREE events aux holds the allocation timestamp, so lifetimes can
+ * be computed without matching the allocation in another chunk.
+ * weight_shift is set by stratified sampling: the event stands for
+ * 2^weight_shift allocations of its class (0 under uniform sampling).
+ */
+struct RecordedEvent {
+    uint8_t type;
+    uint8_t weight_shift;
+    uint8_t reserved[2];
+    uint32_t thread_id;
+    uint32_t class_index;       // Index into the chunk class table
+    uint32_t site_index;        // Index into the chunk site table
+    int64_t timestamp;
+    int64_t tag;
+    int64_t size;
+    int64_t aux;
+};
+
+/**
+ * Index record types
+ */
+enum IndexRecordType : uint32_t {
+    IDX_CLASS = 1,
+    IDX_SITE = 2,
+    IDX_CHUNK = 3
+};
+
+struct IndexFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pid;
+};
+
+struct IndexRecordHeader {
+    uint32_t type;
+    uint32_t length;            // Payload bytes (padded)
+};
+
+/**
+ * Per-chunk summary stored in the index. A table is complete when its
+ * cutoff is 0; otherwise entries below cutoff bytes were omitted.
+ */
+struct ChunkSummary {
+    uint64_t sequence;
+    int64_t start_time;
+    int64_t end_time;
+    uint32_t event_count;
+    uint32_t class_count;       // Class entries that follow
+    uint32_t site_count;        // Site entries that follow the classes
+    uint32_t reserved;
+    int64_t alloc_count;        // Weighted by the stratified sampling weight
+    int64_t alloc_bytes;
+    int64_t class_cutoff;       // Bytes of the largest omitted class
+    int64_t site_cutoff;        // Bytes of the largest omitted site
+};
+
+struct SummaryEntry {
+    uint32_t id;                // Process-wide class/site id
+    uint32_t count;             // Weighted allocations, saturating
+    int64_t bytes;
+};
+
+static_assert(sizeof(ChunkHeader) == 96, "ChunkHeader layout changed");
+static_assert(sizeof(RecordedEvent) == 48, "RecordedEvent layout changed");
+static_assert(sizeof(ChunkSummary) == 72, "ChunkSummary layout changed");
+static_assert(sizeof(SummaryEntry) == 16, "SummaryEntry layout changed");
+
+static const uint32_t NO_INDEX = 0xFFFFFFFFu;
+
+static inline size_t pad8(size_t n) {
+    return (n + 7) & ~(size_t)7;
+}
+
+static inline std::string chunk_file_name(uint32_t pid, uint64_t sequence) {
+    char name[64];
+    snprintf(name, sizeof(name), "chunk-%u-%08llu%s", pid,
+             (unsigned long long)sequence, RECORDING_CHUNK_SUFFIX);
+    return name;
+}
+
+static inline std::string index_file_name(uint32_t pid) {
+    char name[64];
+    snprintf(name, sizeof(name), "index-%u%s", pid, RECORDING_INDEX_SUFFIX);
+    return name;
+}
+
+// ============================================================================
+// Chunk Writer
+// ============================================================================
+
+/**
+ * Builds one chunk in memory and writes it out atomically.
+ *
+ * Classes and sites are interned by the caller's global ids and renumbered
+ * densely per chunk. Not thread-safe; owned by a single writer thread.
+ */
+class ChunkWriter {
+public:
+    /**
+     * Allocation totals for one class or site of the chunk, weighted by
+     * each event's stratified sampling weight
+     */
+    struct TableEntry {
+        uint32_t global_id;
+        std::string name;
+        int64_t count;
+        int64_t bytes;
+    };
+
+private:
+    ChunkHeader header;
+    std::vector<std::pair<std::string, std::string>> properties;
+    std::vector<TableEntry> classes;
+    std::vector<TableEntry> sites;
+    std::unordered_map<uint32_t, uint32_t> class_map;
+    std::unordered_map<uint32_t, uint32_t> site_map;
+    std::vector<RecordedEvent> events;
+    int64_t alloc_count;
+    int64_t alloc_bytes;
+
+    static void append_string(std::string& out, const std::string& s) {
+        uint32_t len = (uint32_t)s.size();
+        out.append((const char*)&len, sizeof(len));
+        out.append(s);
+    }
+
+public:
+    ChunkWriter() {
+        reset(0);
+    }
+
+    void reset(uint64_t sequence) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+        header.version = RECORDING_VERSION;
+        header.header_size = sizeof(ChunkHeader);
+        header.sequence = sequence;
+        properties.clear();
+        classes.clear();
+        sites.clear();
+        class_map.clear();
+        site_map.clear();
+        events.clear();
+        alloc_count = 0;
+        alloc_bytes = 0;
+    }
+
+    ChunkHeader& mutable_header() { return header; }
+
+    void add_property(const std::string& key, const std::string& value) {
+        properties.emplace_back(key, value);
+    }
+
+    bool has_class(uint32_t global_id) const {
+        return class_map.count(global_id) != 0;
+    }
+
+    bool has_site(uint32_t global_id) const {
+        return site_map.count(global_id) != 0;
+    }
+
+    uint32_t intern_class(uint32_t global_id, const char* name) {
+        auto it = class_map.find(global_id);
+        if (it != class_map.end()) {
+            return it->second;
+        }
+        uint32_t index = (uint32_t)classes.size();
+        classes.push_back(TableEntry{global_id, name ? name : "unknown", 0, 0});
+        class_map.emplace(global_id, index);
+        return index;
+    }
+
+    uint32_t intern_site(uint32_t global_id, const char* name) {
+        auto it = site_map.find(global_id);
+        if (it != site_map.end()) {
+            return it->second;
+        }
+        uint32_t index = (uint32_t)sites.size();
+        sites.push_back(TableEntry{global_id, name ? name : "unknown", 0, 0});
+        site_map.emplace(global_id, index);
+        return index;
+    }
+
+    void append(const RecordedEvent& event) {
+        if (events.empty() || event.timestamp < header.start_time) {
+            header.start_time = event.timestamp;
+        }
+        if (event.timestamp > header.end_time) {
+            header.end_time = event.timestamp;
+        }
+        if (event.type == REC_ALLOC) {
+            int64_t w = (int64_t)1 << event.weight_shift;     // Stratified sampling weight
+            alloc_count += w;
+            alloc_bytes += event.size * w;
+            if (event.class_index < classes.size()) {
+                classes[event.class_index].count += w;
+                classes[event.class_index].bytes += event.size * w;
+            }
+            if (event.site_index < sites.size()) {
+                sites[event.site_index].count += w;
+                sites[event.site_index].bytes += event.size * w;
+            }
+        }
+        events.push_back(event);
+    }
+
+    size_t event_count() const { return events.size(); }
+    bool empty() const { return events.empty(); }
+
+    const ChunkHeader& current_header() const { return header; }
+    const std::vector<TableEntry>& class_table() const { return classes; }
+    const std::vector<TableEntry>& site_table() const { return sites; }
+    int64_t allocation_count() const { return alloc_count; }
+    int64_t allocation_bytes() const { return alloc_bytes; }
+
+    /**
+     * Write the chunk to path (via a temporary file and rename, so readers
+     * never observe a partial chunk).
+     */
+    bool write_file(const std::string& path) {
+        std::string strings;
+        for (const auto& p : properties) {
+            append_string(strings, p.first);
+            append_string(strings, p.second);
+        }
+        for (const auto& c : classes) append_string(strings, c.name);
+        for (const auto& s : sites) append_string(strings, s.name);
+        strings.resize(pad8(strings.size()), '\0');
+
+        header.event_count = (uint32_t)events.size();
+        header.property_count = (uint32_t)properties.size();
+        header.class_count = (uint32_t)classes.size();
+        header.site_count = (uint32_t)sites.size();
+        header.strings_size = strings.size();
+
+        std::string tmp_path = path + ".tmp";
+        FILE* f = fopen(tmp_path.c_str(), "wb");
+        if (!f) {
+            return false;
+        }
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+        ok = ok && (strings.empty() || fwrite(strings.data(), strings.size(), 1, f) == 1);
+        ok = ok && (events.empty() ||
+                    fwrite(events.data(), sizeof(RecordedEvent), events.size(), f) == events.size());
+        ok = (fclose(f) == 0) && ok;
+        if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+            unlink(tmp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+};
+
+// ============================================================================
+// Index Writer
+// ============================================================================
+
+/**
+ * Appends chunk summaries to a process's index file. Names are defined
+ * once per id, the first time a chunk summary refers to them. Records are
+ * flushed per chunk; readers ignore a truncated trailing record.
+ */
+class IndexWriter {
+private:
+    FILE* file;
+    std::unordered_set<uint32_t> classes_defined;
+    std::unordered_set<uint32_t> sites_defined;
+
+    bool write_record(uint32_t type, const std::string& payload) {
+        std::string padded = payload;
+        padded.resize(pad8(padded.size()), '\0');
+        IndexRecordHeader rh;
+        rh.type = type;
+        rh.length = (uint32_t)padded.size();
+        return fwrite(&rh, sizeof(rh), 1, file) == 1 &&
+               (padded.empty() || fwrite(padded.data(), padded.size(), 1, file) == 1);
+    }
+
+    bool define_name(uint32_t type, uint32_t id, const std::string& name) {
+        std::string payload;
+        uint32_t len = (uint32_t)name.size();
+        payload.append((const char*)&id, sizeof(id));
+        payload.append((const char*)&len, sizeof(len));
+        payload.append(name);
+        return write_record(type, payload);
+    }
+
+    /**
+     * Top entries by bytes; returns the bytes of the largest omitted entry
+     */
+    static int64_t top_entries(const std::vector<ChunkWriter::TableEntry>& table,
+                               std::vector<const ChunkWriter::TableEntry*>& out) {
+        out.clear();
+        for (const auto& e : table) {
+            if (e.count > 0) out.push_back(&e);
+        }
+        if (out.size() <= SUMMARY_MAX_ENTRIES) {
+            return 0;
+        }
+        std::nth_element(out.begin(), out.begin() + SUMMARY_MAX_ENTRIES, out.end(),
+                         [](const ChunkWriter::TableEntry* a, const ChunkWriter::TableEntry* b) {
+                             return a->bytes > b->bytes;
+                         });
+        int64_t cutoff = 0;
+        for (size_t i = SUMMARY_MAX_ENTRIES; i < out.size(); i++) {
+            cutoff = std::max(cutoff, out[i]->bytes);
+        }
+        out.resize(SUMMARY_MAX_ENTRIES);
+        return cutoff;
+    }
+
+public:
+    IndexWriter() : file(nullptr) {}
+
+    ~IndexWriter() {
+        close();
+    }
+
+    IndexWriter(const IndexWriter&) = delete;
+    IndexWriter& operator=(const IndexWriter&) = delete;
+
+    bool open(const std::string& path, uint32_t pid) {
+        close();
+        file = fopen(path.c_str(), "ab");
+        if (!file) {
+            return false;
+        }
+        if (ftell(file) == 0) {
+            IndexFileHeader fh;
+            memcpy(fh.magic, INDEX_MAGIC, sizeof(fh.magic));
+            fh.version = INDEX_VERSION;
+            fh.pid = pid;
+            if (fwrite(&fh, sizeof(fh), 1, file) != 1) {
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void close() {
+        if (file) {
+            fclose(file);
+            file = nullptr;
+        }
+        classes_defined.clear();
+        sites_defined.clear();
+    }
+
+    bool is_open() const { return file != nullptr; }
+
+    /**
+     * Append the summary of a chunk that has just been written
+     */
+    bool append_chunk(const ChunkWriter& chunk) {
+        if (!file) {
+            return false;
+        }
+
+        std::vector<const ChunkWriter::TableEntry*> top_classes;
+        std::vector<const ChunkWriter::TableEntry*> top_sites;
+        int64_t class_cutoff = top_entries(chunk.class_table(), top_classes);
+        int64_t site_cutoff = top_entries(chunk.site_table(), top_sites);
+
+        bool ok = true;
+        for (const auto* e : top_classes) {
+            if (classes_defined.insert(e->global_id).second) {
+                ok = ok && define_name(IDX_CLASS, e->global_id, e->name);
+            }
+        }
+        for (const auto* e : top_sites) {
+            if (sites_defined.insert(e->global_id).second) {
+                ok = ok && define_name(IDX_SITE, e->global_id, e->name);
+            }
+        }
+
+        const ChunkHeader& header = chunk.current_header();
+        ChunkSummary summary;
+        memset(&summary, 0, sizeof(summary));
+        summary.sequence = header.sequence;
+        summary.start_time = header.start_time;
+        summary.end_time = header.end_time;
+        summary.event_count = (uint32_t)chunk.event_count();
+        summary.class_count = (uint32_t)top_classes.size();
+        summary.site_count = (uint32_t)top_sites.size();
+        summary.alloc_count = chunk.allocation_count();
+        summary.alloc_bytes = chunk.allocation_bytes();
+        summary.class_cutoff = class_cutoff;
+        summary.site_cutoff = site_cutoff;
+
+        std::string payload((const char*)&summary, sizeof(summary));
+        for (const auto* table : {&top_classes, &top_sites}) {
+            for (const auto* e : *table) {
+                SummaryEntry entry = {e->global_id, (uint32_t)std::min<int64_t>(e->count, UINT32_MAX), e->bytes};
+                payload.append((const char*)&entry, sizeof(entry));
+            }
+        }
+        ok = ok && write_record(IDX_CHUNK, payload);
+        return fflush(file) == 0 && ok;
+    }
+};
+
+// ============================================================================
+// Chunk Reader
+// ============================================================================
+
+/**
+ * Memory-maps one chunk file and exposes its tables without copying.
+ */
+class ChunkReader {
+private:
+    void* mapping;
+    size_t mapping_size;
+    const ChunkHeader* hdr;
+    const RecordedEvent* event_array;
+    std::vector<std::pair<std::string_view, std::string_view>> property_list;
+    std::vector<std::string_view> class_names;
+    std::vector<std::string_view> site_names;
+
+    static bool read_string(const char*& p, const char* end, std::string_view& out) {
+        uint32_t len;
+        if ((size_t)(end - p) < sizeof(len)) return false;
+        memcpy(&len, p, sizeof(len));
+        p += sizeof(len);
+        if ((size_t)(end - p) < len) return false;
+        out = std::string_view(p, len);
+        p += len;
+        return true;
+    }
+
+public:
+    ChunkReader() : mapping(nullptr), mapping_size(0), hdr(nullptr), event_array(nullptr) {}
+
+    ~ChunkReader() {
+        close();
+    }
+
+    ChunkReader(const ChunkReader&) = delete;
+    ChunkReader& operator=(const ChunkReader&) = delete;
+
+    void close() {
+        if (mapping) {
+            munmap(mapping, mapping_size);
+            mapping = nullptr;
+        }
+        hdr = nullptr;
+        event_array = nullptr;
+        property_list.clear();
+        class_names.clear();
+        site_names.clear();
+    }
+
+    bool open(const std::string& path, std::string* error) {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            if (error) *error = "cannot open " + path;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ChunkHeader)) {
+            ::close(fd);
+            if (error) *error = "truncated chunk " + path;
+            return false;
+        }
+        mapping_size = (size_t)st.st_size;
+        mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            if (error) *error = "cannot map " + path;
+            return false;
+        }
+        madvise(mapping, mapping_size, MADV_SEQUENTIAL);
+
+        hdr = (const ChunkHeader*)mapping;
+        if (memcmp(hdr->magic, RECORDING_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != RECORDING_VERSION || hdr->header_size < sizeof(ChunkHeader)) {
+            if (error) *error = "not a recording chunk: " + path;
+            close();
+            return false;
+        }
+
+        const char* base = (const char*)mapping;
+        const char* p = base + hdr->header_size;
+        const char* end = base + mapping_size;
+        if ((size_t)(end - p) < hdr->strings_size) {
+            if (error) *error = "truncated string section in " + path;
+            close();
+            return false;
+        }
+        const char* strings_end = p + hdr->strings_size;
+
+        bool ok = true;
+        for (uint32_t i = 0; ok && i < hdr->property_count; i++) {
+            std::string_view key, value;
+            ok = read_string(p, strings_end, key) && read_string(p, strings_end, value);
+            if (ok) property_list.emplace_back(key, value);
+        }
+        class_names.reserve(hdr->class_count);
+        for (uint32_t i = 0; ok && i < hdr->class_count; i++) {
+            std::string_view name;
+            ok = read_string(p, strings_end, name);
+            if (ok) class_names.push_back(name);
+        }
+        site_names.reserve(hdr->site_count);
+        for (uint32_t i = 0; ok && i < hdr->site_count; i++) {
+            std::string_view name;
+            ok = read_string(p, strings_end, name);
+            if (ok) site_names.push_back(name);
+        }
+
+        size_t events_bytes = (size_t)hdr->event_count * sizeof(RecordedEvent);
+        if (!ok || (size_t)(end - strings_end) < events_bytes) {
+            if (error) *error = "corrupt chunk " + path;
+            close();
+            return false;
+        }
+        event_array = (const RecordedEvent*)strings_end;
+        return true;
+    }
+
+    const ChunkHeader& header() const { return *hdr; }
+    const RecordedEvent* events() const { return event_array; }
+    uint32_t event_count() const { return hdr ? hdr->event_count : 0; }
+
+    const std::vector<std::pair<std::string_view, std::string_view>>& properties() const {
+        return property_list;
+    }
+
+    std::string_view class_name(uint32_t index) const {
+        return index < class_names.size() ? class_names[index] : std::string_view("unknown");
+    }
+
+    std::string_view site_name(uint32_t index) const {
+        return index < site_names.size() ? site_names[index] : std::string_view("unknown");
+    }
+};
+
+} // namespace jma
+
+#endif // JMA_RECORDING_FORMAT_H
@@ -0,0 +1,327 @@
+/**
+ * Recording Index - Java Memory Analyzer
+ *
+ * Time-range queries over a recording directory. Loads the sparse chunk
+ * index written by the agent ("index-<pid>.jmi"), seeks to the chunks that
+ * overlap a window by binary search on their start times, and answers
+ * top-K queries from the per-chunk summaries. Only chunks cut by the window
+ * edges, or whose summary was truncated, are opened and scanned.
+ *
+ * @author Java Memory Analyzer Team
+ * @version 1.0.0
+ */
+
+#ifndef JMA_RECORDING_INDEX_H
+#define JMA_RECORDING_INDEX_H
+
+#include <dirent.h>
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "recording_format.h"
+
+namespace jma {
+
+/**
+ * Query grouping
+ */
+enum GroupBy {
+    GROUP_BY_SITE,
+    GROUP_BY_CLASS
+};
+
+/**
+ * One row of a top-K result
+ */
+struct TopEntry {
+    std::string name;
+    int64_t count;
+    int64_t bytes;
+};
+
+struct QueryResult {
+    std::vector<TopEntry> entries;
+    int64_t total_count = 0;            // Allocations in the window
+    int64_t total_bytes = 0;
+    uint32_t chunks_from_summary = 0;   // Answered from the index alone
+    uint32_t chunks_scanned = 0;        // Opened and scanned
+    bool exact = true;                  // False if a needed chunk was unreadable
+};
+
+class RecordingIndex {
+private:
+    /**
+     * One mapped index file (one recorded process)
+     */
+    struct IndexFile {
+        void* mapping = nullptr;
+        size_t size = 0;
+        uint32_t pid = 0;
+        std::unordered_map<uint32_t, std::string_view> class_names;
+        std::unordered_map<uint32_t, std::string_view> site_names;
+
+        ~IndexFile() {
+            if (mapping) munmap(mapping, size);
+        }
+    };
+
+    struct IndexedChunk {
+        uint32_t file;
+        const ChunkSummary* summary;
+        const SummaryEntry* classes;
+        const SummaryEntry* sites;
+    };
+
+    std::string directory;
+    std::vector<std::unique_ptr<IndexFile>> files;
+    std::vector<IndexedChunk> chunks;   // Sorted by start time
+    int64_t max_span = 0;               // Longest chunk time range
+
+    bool load_file(const std::string& path, std::string* error) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            if (error) *error = "cannot open " + path;
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(IndexFileHeader)) {
+            ::close(fd);
+            if (error) *error = "truncated index " + path;
+            return false;
+        }
+
+        std::unique_ptr<IndexFile> index(new IndexFile());
+        index->size = (size_t)st.st_size;
+        index->mapping = mmap(nullptr, index->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (index->mapping == MAP_FAILED) {
+            index->mapping = nullptr;
+            if (error) *error = "cannot map " + path;
+            return false;
+        }
+
+        const char* base = (const char*)index->mapping;
+        const IndexFileHeader* fh = (const IndexFileHeader*)base;
+        if (memcmp(fh->magic, INDEX_MAGIC, sizeof(fh->magic)) != 0 || fh->version != INDEX_VERSION) {
+            if (error) *error = "not a recording index: " + path;
+            return false;
+        }
+        index->pid = fh->pid;
+
+        uint32_t file_id = (uint32_t)files.size();
+        const char* p = base + sizeof(IndexFileHeader);
+        const char* end = base + index->size;
+
+        // Walk record headers; a truncated trailing record is ignored
+        while ((size_t)(end - p) >= sizeof(IndexRecordHeader)) {
+            const IndexRecordHeader* rh = (const IndexRecordHeader*)p;
+            const char* payload = p + sizeof(IndexRecordHeader);
+            if ((size_t)(end - payload) < rh->length) {
+                break;
+            }
+
+            if ((rh->type == IDX_CLASS || rh->type == IDX_SITE) && rh->length >= 8) {
+                uint32_t id, len;
+                memcpy(&id, payload, sizeof(id));
+                memcpy(&len, payload + 4, sizeof(len));
+                if (len <= rh->length - 8) {
+                    auto& names = rh->type == IDX_CLASS ? index->class_names : index->site_names;
+                    names[id] = std::string_view(payload + 8, len);
+                }
+            } else if (rh->type == IDX_CHUNK && rh->length >= sizeof(ChunkSummary)) {
+                const ChunkSummary* summary = (const ChunkSummary*)payload;
+                size_t entries = (size_t)summary->class_count + summary->site_count;
+                if (sizeof(ChunkSummary) + entries * sizeof(SummaryEntry) <= rh->length) {
+                    const SummaryEntry* first = (const SummaryEntry*)(payload + sizeof(ChunkSummary));
+                    chunks.push_back(IndexedChunk{file_id, summary, first, first + summary->class_count});
+                    max_span = std::max(max_span, summary->end_time - summary->start_time);
+                }
+            }
+            p = payload + rh->length;
+        }
+
+        files.push_back(std::move(index));
+        return true;
+    }
+
+    std::string chunk_path(const IndexedChunk& chunk) const {
+        return directory + "/" + chunk_file_name(files[chunk.file]->pid, chunk.summary->sequence);
+    }
+
+    /**
+     * Aggregate allocations of one chunk inside [from, to] by scanning it
+     */
+    bool scan_chunk(const IndexedChunk& chunk, int64_t from, int64_t to, GroupBy group,
+                    std::unordered_map<std::string, TopEntry>& by_name, QueryResult& result) const {
+        ChunkReader reader;
+        if (!reader.open(chunk_path(chunk), nullptr)) {
+            return false;
+        }
+
+        const ChunkHeader& header = reader.header();
+        uint32_t table_size = group == GROUP_BY_CLASS ? header.class_count : header.site_count;
+        std::vector<TopEntry> local(table_size, TopEntry{std::string(), 0, 0});
+
+        const RecordedEvent* events = reader.events();
+        for (uint32_t i = 0; i < reader.event_count(); i++) {
+            const RecordedEvent& e = events[i];
+            if (e.type != REC_ALLOC || e.timestamp < from || e.timestamp > to) {
+                continue;
+            }
+            int64_t w = (int64_t)1 << e.weight_shift;     // Stratified sampling weight
+            result.total_count += w;
+            result.total_bytes += e.size * w;
+            uint32_t index = group == GROUP_BY_CLASS ? e.class_index : e.site_index;
+            if (index < table_size) {
+                local[index].count += w;
+                local[index].bytes += e.size * w;
+            }
+        }
+
+        for (uint32_t i = 0; i < table_size; i++) {
+            if (local[i].count == 0) continue;
+            std::string name(group == GROUP_BY_CLASS ? reader.class_name(i) : reader.site_name(i));
+            TopEntry& entry = by_name[name];
+            entry.count += local[i].count;
+            entry.bytes += local[i].bytes;
+        }
+        result.chunks_scanned++;
+        return true;
+    }
+
+public:
+    /**
+     * Load every index file in a recording directory
+     */
+    bool open(const std::string& dir, std::string* error) {
+        directory = dir;
+        files.clear();
+        chunks.clear();
+        max_span = 0;
+
+        DIR* d = opendir(dir.c_str());
+        if (!d) {
+            if (error) *error = "cannot open directory " + dir;
+            return false;
+        }
+        std::vector<std::string> paths;
+        size_t suffix_len = strlen(RECORDING_INDEX_SUFFIX);
+        while (struct dirent* entry = readdir(d)) {
+            std::string name = entry->d_name;
+            if (name.size() > suffix_len &&
+                name.compare(name.size() - suffix_len, suffix_len, RECORDING_INDEX_SUFFIX) == 0) {
+                paths.push_back(dir + "/" + name);
+            }
+        }
+        closedir(d);
+
+        if (paths.empty()) {
+            if (error) *error = "no recording index in " + dir;
+            return false;
+        }
+        std::sort(paths.begin(), paths.end());
+        for (const auto& path : paths) {
+            if (!load_file(path, error)) {
+                return false;
+            }
+        }
+
+        std::sort(chunks.begin(), chunks.end(), [](const IndexedChunk& a, const IndexedChunk& b) {
+            return a.summary->start_time < b.summary->start_time;
+        });
+        return true;
+    }
+
+    size_t chunk_count() const { return chunks.size(); }
+
+    int64_t start_time() const {
+        return chunks.empty() ? 0 : chunks.front().summary->start_time;
+    }
+
+    int64_t end_time() const {
+        int64_t end = 0;
+        for (const auto& c : chunks) end = std::max(end, c.summary->end_time);
+        return end;
+    }
+
+    /**
+     * Top-K allocation sites or classes (by allocated bytes) in [from, to]
+     * (epoch milliseconds, inclusive). k == 0 returns all entries.
+     *
+     * Chunks that lie entirely inside the window and have complete
+     * summaries are answered from the index; the others are scanned.
+     */
+    QueryResult top(int64_t from, int64_t to, size_t k, GroupBy group) const {
+        QueryResult result;
+
+        // Seek to the first chunk that can overlap the window
+        int64_t seek = from - max_span;
+        auto it = std::lower_bound(chunks.begin(), chunks.end(), seek,
+                                   [](const IndexedChunk& c, int64_t t) {
+                                       return c.summary->start_time < t;
+                                   });
+
+        // Summary entries are keyed by (index file, id) until the end, so
+        // the hot loop hashes integers rather than names
+        std::unordered_map<uint64_t, TopEntry> by_id;
+        std::unordered_map<std::string, TopEntry> by_name;
+
+        for (; it != chunks.end() && it->summary->start_time <= to; ++it) {
+            const IndexedChunk& chunk = *it;
+            const ChunkSummary* s = chunk.summary;
+            if (s->end_time < from) {
+                continue;
+            }
+
+            bool inside = s->start_time >= from && s->end_time <= to;
+            int64_t cutoff = group == GROUP_BY_CLASS ? s->class_cutoff : s->site_cutoff;
+            if (inside && cutoff == 0) {
+                const SummaryEntry* entries = group == GROUP_BY_CLASS ? chunk.classes : chunk.sites;
+                uint32_t count = group == GROUP_BY_CLASS ? s->class_count : s->site_count;
+                for (uint32_t i = 0; i < count; i++) {
+                    TopEntry& entry = by_id[((uint64_t)chunk.file << 32) | entries[i].id];
+                    entry.count += entries[i].count;
+                    entry.bytes += entries[i].bytes;
+                }
+                result.total_count += s->alloc_count;
+                result.total_bytes += s->alloc_bytes;
+                result.chunks_from_summary++;
+            } else if (!scan_chunk(chunk, from, to, group, by_name, result)) {
+                result.exact = false;
+            }
+        }
+
+        for (const auto& e : by_id) {
+            const IndexFile& file = *files[e.first >> 32];
+            const auto& names = group == GROUP_BY_CLASS ? file.class_names : file.site_names;
+            auto name = names.find((uint32_t)e.first);
+            TopEntry& entry = by_name[name != names.end() ? std::string(name->second) : "unknown"];
+            entry.count += e.second.count;
+            entry.bytes += e.second.bytes;
+        }
+
+        result.entries.reserve(by_name.size());
+        for (auto& e : by_name) {
+            e.second.name = e.first;
+            result.entries.push_back(std::move(e.second));
+        }
+        auto by_bytes = [](const TopEntry& a, const TopEntry& b) { return a.bytes > b.bytes; };
+        if (k > 0 && result.entries.size() > k) {
+            std::partial_sort(result.entries.begin(), result.entries.begin() + k,
+                              result.entries.end(), by_bytes);
+            result.entries.resize(k);
+        } else {
+            std::sort(result.entries.begin(), result.entries.end(), by_bytes);
+        }
+        return result;
+    }
+};
+
+} // namespace jma
+
+#endif // JMA_RECORDING_INDEX_H
@@ -0,0 +1,129 @@
+/**
+ * Shared Statistics Page - Java Memory Analyzer
+ *
+ * Layout of the statistics page the JVMTI agent publishes for polling
+ * consumers. The agent maps one page MAP_SHARED from a file
+ * ("/dev/shm/jma-stats-<pid>" on Linux, "$TMPDIR/jma-stats-<pid>"
+ * elsewhere), so the Java layer (as a direct ByteBuffer) and other
+ * processes can read it without any JNI call or syscall per poll.
+ * This header has no JNI/JVMTI dependency.
+ *
+ * Page layout (native byte order):
+ *
+ *   StatsPageHeader   magic, version, page size, pid, sequence
+ *   int64[STATS_FIELD_COUNT] counters, see StatsField
+ *
+ * The page is a seqlock with a single writer (the agent's event
+ * processor thread): the sequence is odd while an update is in progress.
+ * A reader copies the counters between two reads of an even, unchanged
+ * sequence (read_stats_page).
+ *
+ * @author Java Memory Analyzer Team
+ * @version 1.0.0
+ */
+
+#ifndef JMA_STATS_PAGE_H
+#define JMA_STATS_PAGE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+
+namespace jma {
+
+static const char STATS_PAGE_MAGIC[8] = {'J', 'M', 'A', 'S', 'T', 'A', 'T', '1'};
+static const uint32_t STATS_PAGE_VERSION = 1;
+static const size_t STATS_PAGE_SIZE = 4096;
+
+/**
+ * Counter slots (indices shared with SharedStatsPage.java)
+ */
+enum StatsField {
+    STAT_UPDATE_TIME = 0,       // Epoch ms of the last update
+    STAT_TOTAL_ALLOCATED = 1,   // Tracked bytes allocated
+    STAT_TOTAL_FREED = 2,
+    STAT_CURRENT_USAGE = 3,
+    STAT_ALLOC_COUNT = 4,
+    STAT_FREE_COUNT = 5,
+    STAT_QUEUE_DEPTH = 6,       // Event queue depth
+    STAT_DROPPED_EVENTS = 7,
+    STAT_GC_COUNT = 8,
+    STAT_GC_TIME_MS = 9,        // Cumulative GC pause
+    STAT_SAMPLING_INTERVAL = 10,
+    STAT_HEAP_USED = 11,        // Sampled once per second
+    STAT_HEAP_COMMITTED = 12,
+    STAT_HEAP_MAX = 13,
+    STAT_AGENT_OVERHEAD_PPM = 14,   // Agent CPU per million of process CPU (governor period)
+    STAT_GOVERNOR_LEVEL = 15,       // 0 = configured behavior
+    STATS_FIELD_COUNT = 16
+};
+
+struct StatsPageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t pid;
+    uint32_t field_count;
+    std::atomic<uint64_t> sequence;
+};
+
+static_assert(sizeof(StatsPageHeader) == 32, "StatsPageHeader layout");
+static_assert(sizeof(StatsPageHeader) + STATS_FIELD_COUNT * 8 <= STATS_PAGE_SIZE, "stats page overflow");
+
+inline std::atomic<int64_t>* stats_page_fields(void* page) {
+    return (std::atomic<int64_t>*)((char*)page + sizeof(StatsPageHeader));
+}
+
+/**
+ * Path of the page file of a process
+ */
+inline std::string stats_page_path(uint32_t pid) {
+    char name[64];
+    snprintf(name, sizeof(name), "jma-stats-%u", pid);
+#ifdef __linux__
+    return std::string("/dev/shm/") + name;
+#else
+    const char* tmp = getenv("TMPDIR");
+    std::string dir = (tmp && *tmp) ? tmp : "/tmp";
+    if (dir.back() != '/') dir += '/';
+    return dir + name;
+#endif
+}
+
+/**
+ * Consistent copy of the counters. Returns false if the page is not a
+ * statistics page or no stable copy was obtained within max_attempts.
+ */
+inline bool read_stats_page(const void* page, int64_t* out, int max_attempts = 1000) {
+    const StatsPageHeader* header = (const StatsPageHeader*)page;
+    if (memcmp(header->magic, STATS_PAGE_MAGIC, sizeof(header->magic)) != 0) {
+        return false;
+    }
+    const std::atomic<int64_t>* fields = stats_page_fields((void*)page);
+    uint32_t count = std::min<uint32_t>(header->field_count, STATS_FIELD_COUNT);
+
+    for (int attempt = 0; attempt < max_attempts; attempt++) {
+        uint64_t before = header->sequence.load(std::memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            out[i] = fields[i].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (header->sequence.load(std::memory_order_relaxed) == before) {
+            for (uint32_t i = count; i < STATS_FIELD_COUNT; i++) out[i] = 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace jma
+
+#endif // JMA_STATS_PAGE_H
@@ -81,6 +81,8 @@ public class MemoryAnalyzerCli {
         commands.put("histogram", new HistogramCommand());
         commands.put("report", new ReportCommand());
         commands.put("gc", new GcCommand());
+        commands.put("churn", new ChurnCommand());
+        commands.put("filter", new FilterCommand());
         commands.put("watch", new WatchCommand());
         commands.put("debug", new DebugCommand());
         commands.put("exit", new ExitCommand());
@@ -183,6 +185,8 @@ public class MemoryAnalyzerCli {
         System.out.printf("  %-15s %s%n", "histogram", "显示类直方图");
         System.out.printf("  %-15s %s%n", "leaks", "检测内存泄漏");
         System.out.printf("  %-15s %s%n", "gc", "显示 GC 统计");
+        System.out.printf("  %-15s %s%n", "churn [limit]", "短命对象高频分配点排行");
+        System.out.printf("  %-15s %s%n", "filter <expr>", "设置代理端分配事件过滤器");
         System.out.printf("  %-15s %s%n", "watch", "实时监控内存");
         System.out.printf("  %-15s %s%n", "report", "生成报告");
         System.out.printf("  %-15s %s%n", "debug", "调试模式（生成测试数据）");
@@ -573,6 +577,84 @@ public class MemoryAnalyzerCli {
         }
     }
 
+    private class ChurnCommand implements Command {
+        public String getName() { return "churn"; }
+        public String getDescription() { return "短命对象高频分配点排行"; }
+        public String getUsage() { return "churn [limit]"; }
+        public void execute(String[] args) {
+            if (!NativeMemoryTracker.isNativeAvailable()) {
+                System.err.println("原生代理未加载，无法获取对象生命周期数据。");
+                return;
+            }
+
+            int limit = 20;
+            if (args.length > 0) {
+                try {
+                    limit = Integer.parseInt(args[0]);
+                } catch (NumberFormatException e) {
+                    // Use default
+                }
+            }
+
+            NativeMemoryTracker.ChurnReport report = NativeMemoryTracker.readChurnReport(limit);
+            if (report.sites.isEmpty()) {
+                System.out.println("尚无对象回收数据（需要至少一次 GC）。");
+                return;
+            }
+
+            System.out.printf("观察时长：%d 秒，采样分配总量：%d KB%n",
+                report.elapsedMillis / 1000, report.totalAllocationBytes / 1024);
+            System.out.println();
+            System.out.printf("%-4s %-50s %12s %10s %10s %14s%n",
+                "#", "分配点", "分配/秒", "短命比例", "总量占比", "短命字节/秒");
+            System.out.println(new String(new char[105]).replace('\0', '-'));
+
+            int i = 0;
+            for (NativeMemoryTracker.ChurnSite site : report.sites) {
+                String name = site.site.length() > 48
+                    ? "..." + site.site.substring(site.site.length() - 45)
+                    : site.site;
+                System.out.printf("%-4d %-50s %12.1f %9.1f%% %9.1f%% %14.0f%n",
+                    i + 1, name, report.getAllocationsPerSecond(site),
+                    site.getShortLivedRatio() * 100, report.getVolumeShare(site) * 100,
+                    report.getChurnBytesPerSecond(site));
+                i++;
+            }
+
+            System.out.println();
+            System.out.println("短命对象：在下一次 GC 前即被回收。排名靠前的分配点适合对象复用或避免分配，以降低 Young GC 频率。");
+        }
+    }
+
+    private class FilterCommand implements Command {
+        public String getName() { return "filter"; }
+        public String getDescription() { return "设置代理端分配事件过滤器"; }
+        public String getUsage() { return "filter <expr>|clear|status"; }
+        public void execute(String[] args) {
+            if (!NativeMemoryTracker.isNativeAvailable()) {
+                System.err.println("原生代理未加载，无法设置过滤器。");
+                return;
+            }
+            if (args.length == 0) {
+                System.out.println("用法: " + getUsage());
+                System.out.println("  谓词: class:<前缀>  class=<类名>  size<|<=|>|>=|=<n>[k|m]  thread:<前缀>  stack:<文本>");
+                System.out.println("  组合: & | ! ( )，例如 filter class:com.example. & size>=1k & !thread:GC");
+                return;
+            }
+
+            String expression = String.join(" ", args);
+            if (expression.equals("clear")) {
+                NativeMemoryTracker.clearEventFilter();
+                System.out.println("过滤器已清除。");
+            } else if (expression.equals("status")) {
+                NativeMemoryTracker.command("filter:status");
+            } else {
+                NativeMemoryTracker.setEventFilter(expression);
+                System.out.println("过滤器已发送（编译结果见代理输出）: " + expression);
+            }
+        }
+    }
+
     private class WatchCommand implements Command {
         public String getName() { return "watch"; }
         public String getDescription() { return "实时监控内存"; }
@@ -590,6 +672,10 @@ public class MemoryAnalyzerCli {
             System.out.println("正在监控内存使用 (Ctrl+C 停止)...");
             System.out.println();
 
+            // Agent counters come from the shared statistics page (no JNI per poll)
+            SharedStatsPage page = NativeMemoryTracker.getStatsPage();
+            long[] agentStats = new long[SharedStatsPage.FIELD_COUNT];
+
             scheduler = Executors.newScheduledThreadPool(1);
             scheduler.scheduleAtFixedRate(() -> {
                 Runtime runtime = Runtime.getRuntime();
@@ -597,9 +683,17 @@ public class MemoryAnalyzerCli {
                 long max = runtime.maxMemory();
                 double percent = (double) used / max * 100;
 
-                System.out.printf("[%tT] 已用：%6d MB (%5.1f%%) | 空闲：%6d MB | 最大：%6d MB%n",
+                String agent = "";
+                if (page != null && page.read(agentStats)) {
+                    agent = String.format(" | 跟踪：%6d MB | 队列：%6d | GC：%d",
+                        agentStats[SharedStatsPage.CURRENT_USAGE] / 1024 / 1024,
+                        agentStats[SharedStatsPage.QUEUE_DEPTH],
+                        agentStats[SharedStatsPage.GC_COUNT]);
+                }
+
+                System.out.printf("[%tT] 已用：%6d MB (%5.1f%%) | 空闲：%6d MB | 最大：%6d MB%s%n",
                     new Date(), used / 1024 / 1024, percent,
-                    runtime.freeMemory() / 1024 / 1024, max / 1024 / 1024);
+                    runtime.freeMemory() / 1024 / 1024, max / 1024 / 1024, agent);
             }, 0, interval, TimeUnit.MILLISECONDS);
         }
     }
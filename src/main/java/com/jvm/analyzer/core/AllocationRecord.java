@@ -25,6 +25,7 @@ public class AllocationRecord {
     private final String threadName; // 线程名
     private final StackTraceElement[] stackTrace; // 调用栈！最关键！
     private final String allocationSite; // 分配位置（简化版）
+    private final int weight; // 代表的分配次数（分层采样权重，默认 1）
 
     private final int hashCode;
 
@@ -43,6 +44,17 @@ public class AllocationRecord {
      */
     public AllocationRecord(long objectId, String className, long size, long timestamp, long threadId,
             String threadName, StackTraceElement[] stackTrace) {
+        this(objectId, className, size, timestamp, threadId, threadName, stackTrace, 1);
+    }
+
+    /**
+     * Create allocation record standing for several allocations
+     *
+     * @param weight Allocations this sample represents (the agent's per-class
+     *               sampling interval under stratified sampling)
+     */
+    public AllocationRecord(long objectId, String className, long size, long timestamp, long threadId,
+            String threadName, StackTraceElement[] stackTrace, int weight) {
         this.objectId = objectId;
         this.className = className;
         this.size = size;
@@ -51,6 +63,7 @@ public class AllocationRecord {
         this.threadName = threadName;
         this.stackTrace = stackTrace != null ? Arrays.copyOf(stackTrace, stackTrace.length) : new StackTraceElement[0];
         this.allocationSite = buildAllocationSite(this.stackTrace);
+        this.weight = Math.max(1, weight);
         this.hashCode = Objects.hash(objectId, className);
     }
 
@@ -98,6 +111,14 @@ public class AllocationRecord {
         return size;
     }
 
+    /**
+     * Number of allocations this sample represents (1 unless the agent
+     * samples per class)
+     */
+    public int getWeight() {
+        return weight;
+    }
+
     /**
      * Get timestamp
      */
@@ -0,0 +1,170 @@
+package com.jvm.analyzer.core;
+
+import java.util.Arrays;
+import java.util.Collection;
+import java.util.Collections;
+
+/**
+ * Class Prefix Matcher - include / exclude lists over class name prefixes
+ *
+ * Java counterpart of the agent's ClassMatcher with the same semantics:
+ * '/' in names and prefixes is read as '.', the longest matching prefix
+ * decides, an exclude beats an include of the same prefix, and a class no
+ * prefix matches is excluded only if there are include prefixes.
+ *
+ * Prefixes are stored in a compressed prefix trie, so a lookup is one pass
+ * over the name however many prefixes are listed. Instances are immutable
+ * and thread-safe.
+ *
+ * @author Java Memory Analyzer Team
+ * @version 1.0.0
+ */
+public final class ClassPrefixMatcher {
+
+    private static final byte NONE = 0;
+    private static final byte INCLUDE = 1;
+    private static final byte EXCLUDE = 2;
+
+    private static final class Node {
+        String label;
+        byte verdict = NONE;
+        char[] firsts = new char[0];    // Sorted first characters of the children
+        Node[] children = new Node[0];
+
+        Node(String label) {
+            this.label = label;
+        }
+
+        int find(char c) {
+            return Arrays.binarySearch(firsts, c);
+        }
+
+        void add(Node child) {
+            int at = -find(child.label.charAt(0)) - 1;
+            firsts = insert(firsts, at, child.label.charAt(0));
+            Node[] grown = new Node[children.length + 1];
+            System.arraycopy(children, 0, grown, 0, at);
+            grown[at] = child;
+            System.arraycopy(children, at, grown, at + 1, children.length - at);
+            children = grown;
+        }
+
+        private static char[] insert(char[] array, int at, char c) {
+            char[] grown = new char[array.length + 1];
+            System.arraycopy(array, 0, grown, 0, at);
+            grown[at] = c;
+            System.arraycopy(array, at, grown, at + 1, array.length - at);
+            return grown;
+        }
+    }
+
+    private final Node root = new Node("");
+    private final boolean hasIncludes;
+    private final int size;
+
+    public ClassPrefixMatcher(Collection<String> include, Collection<String> exclude) {
+        int count = 0;
+        for (String prefix : include) {
+            if (insert(prefix, INCLUDE)) {
+                count++;
+            }
+        }
+        hasIncludes = count > 0;
+        for (String prefix : exclude) {
+            if (insert(prefix, EXCLUDE)) {
+                count++;
+            }
+        }
+        size = count;
+    }
+
+    /**
+     * Matcher that only excludes
+     */
+    public static ClassPrefixMatcher excluding(String... prefixes) {
+        return new ClassPrefixMatcher(Collections.<String>emptyList(), Arrays.asList(prefixes));
+    }
+
+    private static char normalize(char c) {
+        return c == '/' ? '.' : c;
+    }
+
+    private boolean insert(String prefix, byte verdict) {
+        if (prefix == null || prefix.isEmpty()) {
+            return false;
+        }
+        String key = prefix.replace('/', '.');
+        Node node = root;
+        int at = 0;
+        while (at < key.length()) {
+            int index = node.find(key.charAt(at));
+            if (index < 0) {
+                Node leaf = new Node(key.substring(at));
+                leaf.verdict = verdict;
+                node.add(leaf);
+                return true;
+            }
+            Node child = node.children[index];
+            int common = 0;
+            while (common < child.label.length() && at + common < key.length()
+                   && child.label.charAt(common) == key.charAt(at + common)) {
+                common++;
+            }
+            if (common < child.label.length()) {
+                // Split the edge at the first difference
+                Node middle = new Node(child.label.substring(0, common));
+                child.label = child.label.substring(common);
+                middle.add(child);
+                node.children[index] = middle;
+                child = middle;
+            }
+            node = child;
+            at += common;
+        }
+        if (verdict > node.verdict) {
+            node.verdict = verdict;
+        }
+        return true;
+    }
+
+    /**
+     * @param className Binary ("java.util.HashMap") or internal ("java/util/HashMap") name
+     */
+    public boolean isExcluded(String className) {
+        byte best = NONE;
+        Node node = root;
+        int at = 0;
+        int length = className.length();
+        while (true) {
+            if (node.verdict != NONE) {
+                best = node.verdict;
+            }
+            if (at == length) {
+                break;
+            }
+            int index = node.find(normalize(className.charAt(at)));
+            if (index < 0) {
+                break;
+            }
+            Node child = node.children[index];
+            String label = child.label;
+            if (at + label.length() > length) {
+                break;
+            }
+            int i = 1;
+            while (i < label.length() && normalize(className.charAt(at + i)) == label.charAt(i)) {
+                i++;
+            }
+            if (i < label.length()) {
+                break;
+            }
+            at += i;
+            node = child;
+        }
+        return best == NONE ? hasIncludes : best == EXCLUDE;
+    }
+
+    public int size() {
+        return size;
+    }
+}
@@ -1,5 +1,11 @@
 package com.jvm.analyzer.core;
 
+import java.nio.ByteBuffer;
+import java.util.ArrayList;
+import java.util.HashMap;
+import java.util.List;
+import java.util.Map;
+
 /**
  * Native Memory Tracker - JNI bridge to JVMTI Agent
  *
@@ -29,21 +35,60 @@ public class NativeMemoryTracker {
         }
     }
 
+    // Time-series metric ids (must match the agent's Metric enum)
+    public static final int METRIC_ALLOC_COUNT = 0;
+    public static final int METRIC_ALLOC_BYTES = 1;
+    public static final int METRIC_FREE_COUNT = 2;
+    public static final int METRIC_FREE_BYTES = 3;
+    public static final int METRIC_LIVE_BYTES = 4;
+    public static final int METRIC_GC_COUNT = 5;
+    public static final int METRIC_GC_PAUSE_MS = 6;
+    public static final int METRIC_QUEUE_DEPTH = 7;
+    public static final int METRIC_HEAP_USED = 8;
+    public static final int METRIC_HEAP_COMMITTED = 9;
+
+    // Time-series resolutions in seconds (retention: 10min, 2h, 1 day, 1 week)
+    public static final int[] RESOLUTIONS = {1, 10, 60, 600};
+
+    // Layout of getClassTrends: a header, then one row per class
+    public static final int TREND_HEADER = 3;       // window, checkpoints, lastCheckpointMillis
+    public static final int TREND_HEADER_WINDOW = 0;
+    public static final int TREND_HEADER_CHECKPOINTS = 1;
+    public static final int TREND_ROW_WIDTH = 11;
+    public static final int TREND_CLASS_ID = 0;
+    public static final int TREND_POINTS = 1;
+    public static final int TREND_LIVE_COUNT = 2;
+    public static final int TREND_LIVE_BYTES = 3;
+    public static final int TREND_MIN_COUNT = 4;
+    public static final int TREND_MAX_COUNT = 5;
+    public static final int TREND_GROWTH_COUNT = 6;
+    public static final int TREND_TOTAL_GROWTH = 7;
+    public static final int TREND_STREAK = 8;
+    public static final int TREND_SLOPE = 9;        // Double.longBitsToDouble: instances per checkpoint
+    public static final int TREND_EWMA_RATE = 10;   // Double.longBitsToDouble: instances per second
+
     private static volatile boolean nativeAvailable = false;
     private static volatile long lastStatsTime = 0;
     private static volatile long[] cachedStats = new long[5];
 
+    // Shared statistics page of the loaded agent (null when unavailable)
+    private static volatile SharedStatsPage statsPage;
+
     static {
         // Check if native library is available
         try {
             nativeAvailable = isAgentActive();
+            if (nativeAvailable) {
+                statsPage = SharedStatsPage.fromNative(mapStatsPage());
+            }
         } catch (UnsatisfiedLinkError e) {
             nativeAvailable = false;
         }
     }
 
     /**
-     * Check if native agent is available and active
+     * Check if native agent is available and active (activated, not dormant
+     * and not stopped)
      */
     public static native boolean isAgentActive();
 
@@ -69,6 +114,64 @@ public class NativeMemoryTracker {
      */
     public static native void setSamplingInterval(int interval);
 
+    /**
+     * Read one metric series from the native time-series store
+     * @return rows of [startMillis, min, max, avg], oldest first
+     */
+    public static native long[] getTimeSeries(int metric, int resolutionSeconds);
+
+    /**
+     * GC cycles that started in [fromMillis, toMillis], oldest first
+     * @return rows of GC_ROW_WIDTH values (see GcCycle)
+     */
+    public static native long[] getGcCycles(long fromMillis, long toMillis);
+
+    /**
+     * Lifetime histogram of a site's freed sampled objects
+     * @return count, total lifetime ms, wall-time buckets, GC-age buckets;
+     *         null if the site is unknown or none of its objects was freed
+     */
+    public static native long[] getLifetimeHistogram(String site);
+
+    /**
+     * Sites ranked by short-lived allocation volume
+     * @return totalAllocBytes, elapsedMs, then rows of ChurnSite.ROW_WIDTH
+     */
+    public static native long[] getChurnSites(int limit);
+
+    /**
+     * Tracked objects allocated at least minAgeMs ago, grouped by class and site
+     * @return rows of OldObjectGroup.ROW_WIDTH values (see OldObjectGroup)
+     */
+    public static native long[] getOldObjects(long minAgeMs);
+
+    /**
+     * Per-class live-count trends over the agent's checkpoint window
+     * @return TREND_HEADER values, then rows of TREND_ROW_WIDTH (TREND_* offsets)
+     */
+    public static native long[] getClassTrends();
+
+    /**
+     * Name of a native class id
+     */
+    public static native String getClassName(int id);
+
+    /**
+     * Symbolized name of a native allocation site index
+     */
+    public static native String getSiteName(int index);
+
+    /**
+     * Verdict of the agent's class include / exclude lists for a binary or
+     * internal class name (false when no lists are set)
+     */
+    public static native boolean isClassExcluded(String className);
+
+    /**
+     * The agent's shared statistics page as a direct ByteBuffer (called once)
+     */
+    private static native ByteBuffer mapStatsPage();
+
     /**
      * Check if native library is available
      */
@@ -77,9 +180,51 @@ public class NativeMemoryTracker {
     }
 
     /**
-     * Get current memory statistics (thread-safe, cached)
+     * Check if the native agent is loaded and collecting: a dormant or
+     * stopped agent is loaded but its metrics and tables stay empty
      */
-    public static synchronized MemoryStats getStats() {
+    public static boolean isCollecting() {
+        return nativeAvailable && isAgentActive();
+    }
+
+    /**
+     * Check if the agent is collecting and its tracker holds live objects.
+     * Objects are only tracked while the free event is enabled; otherwise
+     * the age index stays empty.
+     */
+    public static boolean isTrackingObjects() {
+        if (!isCollecting()) {
+            return false;
+        }
+        MemoryStats stats = getStats();
+        return stats.allocationCount > stats.freeCount;
+    }
+
+    /**
+     * Shared statistics page of the loaded agent, or null
+     */
+    public static SharedStatsPage getStatsPage() {
+        return statsPage;
+    }
+
+    /**
+     * Get current memory statistics (thread-safe)
+     *
+     * Reads the shared statistics page when the agent published one (no
+     * JNI call, no lock); otherwise falls back to the JNI copy.
+     */
+    public static MemoryStats getStats() {
+        SharedStatsPage page = statsPage;
+        if (page != null) {
+            MemoryStats stats = page.readMemoryStats();
+            if (stats != null) {
+                return stats;
+            }
+        }
+        return getStatsViaJni();
+    }
+
+    private static synchronized MemoryStats getStatsViaJni() {
         long now = System.currentTimeMillis();
         long[] stats = new long[5];
 
@@ -118,6 +263,495 @@ public class NativeMemoryTracker {
         }
     }
 
+    /**
+     * Activate an agent loaded with the "dormant" option: reserve its
+     * buffers, enable its events and start its threads. No effect when the
+     * agent is already active.
+     */
+    public static void activate() {
+        command("activate");
+        if (nativeAvailable && statsPage == null) {
+            statsPage = SharedStatsPage.fromNative(mapStatsPage());
+        }
+    }
+
+    /**
+     * Enable the native flight recorder (fixed in-memory ring of recent events)
+     *
+     * @param megabytes Ring size
+     */
+    public static void startFlightRecorder(int megabytes) {
+        command("flight:start:" + megabytes);
+    }
+
+    /**
+     * Dump the flight recorder ring to a recording file (.jmr)
+     *
+     * @param path Output file, or null for the agent's flight directory
+     */
+    public static void dumpFlightRecording(String path) {
+        command(path == null ? "flight:dump" : "flight:dump:" + path);
+    }
+
+    /**
+     * Serve live events to an external consumer (jma-analyzer --live) over a
+     * shared-memory ring; Linux only
+     *
+     * @param megabytes Ring size
+     */
+    public static void startEventStream(int megabytes) {
+        command("stream:start:" + megabytes);
+    }
+
+    public static void stopEventStream() {
+        command("stream:stop");
+    }
+
+    /**
+     * Record only allocations matching a filter expression, evaluated in the
+     * agent before any stack capture, e.g. "class:com.example. &amp; size&gt;=1k".
+     * Predicates: class:&lt;prefix&gt;, class=&lt;name&gt;, size&lt;op&gt;&lt;n&gt;[k|m],
+     * thread:&lt;prefix&gt;, stack:&lt;text&gt;; combined with &amp;, |, ! and parentheses.
+     */
+    public static void setEventFilter(String expression) {
+        command("filter:" + expression);
+    }
+
+    public static void clearEventFilter() {
+        command("filter:clear");
+    }
+
+    /**
+     * Record only classes under these name prefixes (e.g. "com.example.");
+     * applies to the agent's callbacks and to classes instrumented later.
+     * The longest matching include or exclude prefix decides.
+     */
+    public static void includeClasses(String... prefixes) {
+        command("classes:include:" + String.join(";", prefixes));
+    }
+
+    /**
+     * Never record classes under these name prefixes
+     */
+    public static void excludeClasses(String... prefixes) {
+        command("classes:exclude:" + String.join(";", prefixes));
+    }
+
+    public static void clearClassLists() {
+        command("classes:clear");
+    }
+
+    /**
+     * Hold the agent's CPU time under a share of the process's CPU time;
+     * the agent degrades stack strings, stack depth and then the sampling
+     * interval as needed, and reports each change. The current level and
+     * overhead are in the statistics page (GOVERNOR_LEVEL,
+     * AGENT_OVERHEAD_PPM).
+     *
+     * @param percent Budget, e.g. 1.0 for 1%
+     */
+    public static void setOverheadBudget(double percent) {
+        command("governor:" + percent);
+    }
+
+    public static void disableOverheadGovernor() {
+        command("governor:off");
+    }
+
+    /**
+     * Sample each class at its own adaptive rate so rare classes collect as
+     * many samples as hot ones; each sample carries its weight, and the
+     * class statistics (and so TimeWindowAnalyzer) become estimates of all
+     * allocations
+     *
+     * @param samplesPerClass Target samples per class per second, or 0 to
+     *                        spend the same total samples as uniform sampling
+     */
+    public static void enableStratifiedSampling(int samplesPerClass) {
+        command("stratified:" + samplesPerClass);
+    }
+
+    public static void disableStratifiedSampling() {
+        command("stratified:off");
+    }
+
+    /**
+     * Turn one JVMTI event on or off in the VM (SetEventNotificationMode),
+     * so a disabled event costs nothing
+     *
+     * @param event "alloc", "free" or "gc"
+     */
+    public static void setEventEnabled(String event, boolean enabled) {
+        command("events:" + event + ":" + (enabled ? "on" : "off"));
+    }
+
+    /**
+     * Turn one per-allocation capture step on or off
+     *
+     * @param feature "stacks", "upcalls" or "symbols"
+     */
+    public static void setCaptureEnabled(String feature, boolean enabled) {
+        command("capture:" + feature + ":" + (enabled ? "on" : "off"));
+    }
+
+    /**
+     * GC events only; frees of already tracked objects are still reported
+     */
+    public static void gcOnlyMode() {
+        command("mode:gc");
+    }
+
+    /**
+     * Enable every event and capture step, restoring the previous settings
+     * after the given time
+     *
+     * @param seconds Duration, or 0 to keep full profiling until changed
+     */
+    public static void escalate(int seconds) {
+        command("mode:full:" + seconds);
+    }
+
+    /**
+     * Set how many checkpoints (GC cycles, or periodic samples without GCs)
+     * the agent's class trends cover; clears the trends
+     */
+    public static void setTrendWindow(int checkpoints) {
+        command("trend:window:" + checkpoints);
+    }
+
+    /**
+     * Cap the objects tracked by the agent; the oldest are evicted first
+     *
+     * @param limit Maximum tracked objects, or 0 for no limit
+     */
+    public static void setMaxTrackedObjects(long limit) {
+        command("maxtracked:" + limit);
+    }
+
+    /**
+     * Read a metric series (empty when the native agent is not available)
+     *
+     * @param metric            One of the METRIC_* constants
+     * @param resolutionSeconds One of RESOLUTIONS
+     */
+    public static TimeSeries readTimeSeries(int metric, int resolutionSeconds) {
+        long[] rows = nativeAvailable ? getTimeSeries(metric, resolutionSeconds) : null;
+        return new TimeSeries(metric, resolutionSeconds, rows != null ? rows : new long[0]);
+    }
+
+    /**
+     * One metric series at one resolution
+     */
+    public static class TimeSeries {
+        public final int metric;
+        public final int resolutionSeconds;
+        public final long[] timestamps;
+        public final long[] min;
+        public final long[] max;
+        public final long[] avg;
+
+        public TimeSeries(int metric, int resolutionSeconds, long[] rows) {
+            this.metric = metric;
+            this.resolutionSeconds = resolutionSeconds;
+            int n = rows.length / 4;
+            this.timestamps = new long[n];
+            this.min = new long[n];
+            this.max = new long[n];
+            this.avg = new long[n];
+            for (int i = 0; i < n; i++) {
+                timestamps[i] = rows[i * 4];
+                min[i] = rows[i * 4 + 1];
+                max[i] = rows[i * 4 + 2];
+                avg[i] = rows[i * 4 + 3];
+            }
+        }
+
+        public int size() {
+            return timestamps.length;
+        }
+
+        public boolean isEmpty() {
+            return timestamps.length == 0;
+        }
+    }
+
+    /**
+     * Read the native GC timeline for a time range (empty when the native
+     * agent is not available)
+     */
+    public static List<GcCycle> readGcTimeline(long fromMillis, long toMillis) {
+        List<GcCycle> cycles = new ArrayList<>();
+        long[] rows = nativeAvailable ? getGcCycles(fromMillis, toMillis) : null;
+        if (rows == null) {
+            return cycles;
+        }
+
+        Map<Integer, String> siteNames = new HashMap<>();
+        for (int offset = 0; offset + GcCycle.ROW_WIDTH <= rows.length; offset += GcCycle.ROW_WIDTH) {
+            GcCycle cycle = new GcCycle(rows, offset);
+            for (int i = 0; i < GcCycle.TOP_SITES; i++) {
+                int site = (int) rows[offset + 8 + i * 3];
+                if (site < 0) {
+                    break;
+                }
+                String name = siteNames.computeIfAbsent(site, NativeMemoryTracker::getSiteName);
+                cycle.topSites.add(new GcCycle.SiteShare(name,
+                    rows[offset + 9 + i * 3], rows[offset + 10 + i * 3]));
+            }
+            cycles.add(cycle);
+        }
+        return cycles;
+    }
+
+    /**
+     * One GC cycle of the native timeline, with the sampled allocations
+     * made since the previous cycle and the sites that made most of them
+     */
+    public static class GcCycle {
+        static final int TOP_SITES = 5;
+        static final int ROW_WIDTH = 8 + 3 * TOP_SITES;
+
+        public final long id;
+        public final long startTime;
+        public final long endTime;          // 0 while the cycle is running
+        public final long durationMs;       // -1 while the cycle is running
+        public final long allocationCount;
+        public final long allocationBytes;
+        public final long freedCount;
+        public final long freedBytes;
+        public final List<SiteShare> topSites = new ArrayList<>();
+
+        GcCycle(long[] rows, int offset) {
+            this.id = rows[offset];
+            this.startTime = rows[offset + 1];
+            this.endTime = rows[offset + 2];
+            this.durationMs = rows[offset + 3];
+            this.allocationCount = rows[offset + 4];
+            this.allocationBytes = rows[offset + 5];
+            this.freedCount = rows[offset + 6];
+            this.freedBytes = rows[offset + 7];
+        }
+
+        public static class SiteShare {
+            public final String site;
+            public final long allocationCount;
+            public final long totalSize;
+
+            public SiteShare(String site, long allocationCount, long totalSize) {
+                this.site = site;
+                this.allocationCount = allocationCount;
+                this.totalSize = totalSize;
+            }
+        }
+
+        @Override
+        public String toString() {
+            return String.format("GC#%d[%dms, allocs=%d, bytes=%d, freed=%d]",
+                id, durationMs, allocationCount, allocationBytes, freedCount);
+        }
+    }
+
+    /**
+     * Read the lifetime distribution of a site ("class.method(File.java:line)")
+     *
+     * @return the histogram, or null if no object from the site was freed yet
+     *         or the native agent is not available
+     */
+    public static LifetimeHistogram readLifetimeHistogram(String site) {
+        long[] data = nativeAvailable ? getLifetimeHistogram(site) : null;
+        return data != null ? new LifetimeHistogram(site, data) : null;
+    }
+
+    /**
+     * Log-scale lifetime distribution of the freed objects of one site.
+     * Bucket 0 holds lifetimes below 1 ms (or 0 GCs survived); bucket i
+     * holds [2^(i-1), 2^i).
+     */
+    public static class LifetimeHistogram {
+        public static final int WALL_BUCKETS = 32;
+        public static final int GC_BUCKETS = 16;
+
+        public final String site;
+        public final long count;
+        public final long totalMillis;
+        public final long[] wallBuckets = new long[WALL_BUCKETS];
+        public final long[] gcBuckets = new long[GC_BUCKETS];
+
+        LifetimeHistogram(String site, long[] data) {
+            this.site = site;
+            this.count = data[0];
+            this.totalMillis = data[1];
+            System.arraycopy(data, 2, wallBuckets, 0, WALL_BUCKETS);
+            System.arraycopy(data, 2 + WALL_BUCKETS, gcBuckets, 0, GC_BUCKETS);
+        }
+
+        /**
+         * Lower bound of a bucket (milliseconds or GC cycles)
+         */
+        public static long bucketLowerBound(int bucket) {
+            return bucket == 0 ? 0 : 1L << (bucket - 1);
+        }
+
+        public double getAverageMillis() {
+            return count > 0 ? (double) totalMillis / count : 0;
+        }
+
+        /**
+         * Upper bound of the bucket containing the given percentile (0-100)
+         */
+        public long percentileMillis(double percentile) {
+            return percentile(wallBuckets, percentile);
+        }
+
+        public long percentileGcCycles(double percentile) {
+            return percentile(gcBuckets, percentile);
+        }
+
+        /**
+         * Fraction of freed objects that survived at least one GC
+         */
+        public double getSurvivorRatio() {
+            return count > 0 ? 1.0 - (double) gcBuckets[0] / count : 0;
+        }
+
+        private long percentile(long[] buckets, double percentile) {
+            long target = (long) Math.ceil(count * percentile / 100.0);
+            long seen = 0;
+            for (int i = 0; i < buckets.length; i++) {
+                seen += buckets[i];
+                if (seen >= target && seen > 0) {
+                    return 1L << i;
+                }
+            }
+            return 1L << (buckets.length - 1);
+        }
+    }
+
+    /**
+     * Rank allocation sites by churn (empty when the native agent is not
+     * available)
+     *
+     * @param limit Maximum number of sites, 0 for all
+     */
+    public static ChurnReport readChurnReport(int limit) {
+        long[] data = nativeAvailable ? getChurnSites(limit) : null;
+        if (data == null || data.length < 2) {
+            return new ChurnReport(0, 0, new ArrayList<>());
+        }
+
+        List<ChurnSite> sites = new ArrayList<>();
+        for (int offset = 2; offset + ChurnSite.ROW_WIDTH <= data.length; offset += ChurnSite.ROW_WIDTH) {
+            sites.add(new ChurnSite(getSiteName((int) data[offset]), data, offset));
+        }
+        return new ChurnReport(data[0], data[1], sites);
+    }
+
+    /**
+     * Sites ranked by churn: sampled allocation volume weighted by the
+     * fraction of freed objects that died before the next GC
+     */
+    public static class ChurnReport {
+        public final long totalAllocationBytes;   // Sampled, all sites
+        public final long elapsedMillis;          // Observation window
+        public final List<ChurnSite> sites;
+
+        public ChurnReport(long totalAllocationBytes, long elapsedMillis, List<ChurnSite> sites) {
+            this.totalAllocationBytes = totalAllocationBytes;
+            this.elapsedMillis = elapsedMillis;
+            this.sites = sites;
+        }
+
+        /**
+         * Share of the total sampled allocation volume made by a site
+         */
+        public double getVolumeShare(ChurnSite site) {
+            return totalAllocationBytes > 0 ? (double) site.allocationBytes / totalAllocationBytes : 0;
+        }
+
+        public double getAllocationsPerSecond(ChurnSite site) {
+            return elapsedMillis > 0 ? site.allocationCount * 1000.0 / elapsedMillis : 0;
+        }
+
+        public double getChurnBytesPerSecond(ChurnSite site) {
+            return elapsedMillis > 0 ? site.churnBytes * 1000.0 / elapsedMillis : 0;
+        }
+    }
+
+    /**
+     * One site of a churn ranking (sampled counts)
+     */
+    public static class ChurnSite {
+        static final int ROW_WIDTH = 7;
+
+        public final String site;
+        public final long allocationCount;
+        public final long allocationBytes;
+        public final long freedCount;
+        public final long shortLivedCount;      // Freed before surviving a GC
+        public final long shortLivedBytes;
+        public final long churnBytes;           // Ranking score
+
+        ChurnSite(String site, long[] data, int offset) {
+            this.site = site;
+            this.allocationCount = data[offset + 1];
+            this.allocationBytes = data[offset + 2];
+            this.freedCount = data[offset + 3];
+            this.shortLivedCount = data[offset + 4];
+            this.shortLivedBytes = data[offset + 5];
+            this.churnBytes = data[offset + 6];
+        }
+
+        public double getShortLivedRatio() {
+            return freedCount > 0 ? (double) shortLivedCount / freedCount : 0;
+        }
+    }
+
+    /**
+     * Objects the agent has tracked for at least minAgeMs, grouped by class
+     * and allocation site (empty when the native agent is not available).
+     * Only the part of the agent's age index older than the cutoff is read.
+     */
+    public static List<OldObjectGroup> readOldObjects(long minAgeMs) {
+        long[] data = nativeAvailable ? getOldObjects(minAgeMs) : null;
+        List<OldObjectGroup> groups = new ArrayList<>();
+        if (data == null) {
+            return groups;
+        }
+
+        Map<Integer, String> classNames = new HashMap<>();
+        Map<Integer, String> siteNames = new HashMap<>();
+        for (int offset = 0; offset + OldObjectGroup.ROW_WIDTH <= data.length; offset += OldObjectGroup.ROW_WIDTH) {
+            int classId = (int) data[offset];
+            int siteIndex = (int) data[offset + 1];
+            String className = classNames.computeIfAbsent(classId, NativeMemoryTracker::getClassName);
+            String site = siteIndex < 0 ? "unknown" : siteNames.computeIfAbsent(siteIndex, NativeMemoryTracker::getSiteName);
+            groups.add(new OldObjectGroup(className, site, data, offset));
+        }
+        return groups;
+    }
+
+    /**
+     * Old tracked objects of one class allocated at one site (counts and
+     * bytes are estimates of all allocations when the agent samples)
+     */
+    public static class OldObjectGroup {
+        static final int ROW_WIDTH = 5;
+
+        public final String className;
+        public final String site;
+        public final long count;
+        public final long bytes;
+        public final long oldestTimestamp;      // Allocation time (ms)
+
+        OldObjectGroup(String className, String site, long[] data, int offset) {
+            this.className = className;
+            this.site = site;
+            this.count = data[offset + 2];
+            this.bytes = data[offset + 3];
+            this.oldestTimestamp = data[offset + 4];
+        }
+    }
+
     /**
      * Memory statistics holder
      */
@@ -0,0 +1,161 @@
+package com.jvm.analyzer.core;
+
+import java.io.IOException;
+import java.lang.invoke.MethodHandles;
+import java.lang.invoke.VarHandle;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.MappedByteBuffer;
+import java.nio.channels.FileChannel;
+import java.nio.file.Path;
+import java.nio.file.Paths;
+import java.nio.file.StandardOpenOption;
+
+/**
+ * Shared Statistics Page - lock-free reader of the agent's counters
+ *
+ * The native agent publishes its counters into one shared page protected
+ * by a seqlock (see stats_page.h). In the agent's own JVM the page is
+ * obtained as a direct ByteBuffer once; other processes map the page file
+ * ("/dev/shm/jma-stats-&lt;pid&gt;" on Linux). Each read is a handful of
+ * memory loads: no JNI transition, no lock, no system call.
+ *
+ * Instances are thread-safe.
+ *
+ * @author Java Memory Analyzer Team
+ * @version 1.0.0
+ */
+public class SharedStatsPage {
+
+    // Counter slots (must match StatsField in stats_page.h)
+    public static final int UPDATE_TIME = 0;
+    public static final int TOTAL_ALLOCATED = 1;
+    public static final int TOTAL_FREED = 2;
+    public static final int CURRENT_USAGE = 3;
+    public static final int ALLOC_COUNT = 4;
+    public static final int FREE_COUNT = 5;
+    public static final int QUEUE_DEPTH = 6;
+    public static final int DROPPED_EVENTS = 7;
+    public static final int GC_COUNT = 8;
+    public static final int GC_TIME_MS = 9;
+    public static final int SAMPLING_INTERVAL = 10;
+    public static final int HEAP_USED = 11;
+    public static final int HEAP_COMMITTED = 12;
+    public static final int HEAP_MAX = 13;
+    public static final int AGENT_OVERHEAD_PPM = 14;
+    public static final int GOVERNOR_LEVEL = 15;
+    public static final int FIELD_COUNT = 16;
+
+    private static final byte[] MAGIC = {'J', 'M', 'A', 'S', 'T', 'A', 'T', '1'};
+    private static final int PAGE_SIZE = 4096;
+    private static final int SEQUENCE_OFFSET = 24;
+    private static final int FIELDS_OFFSET = 32;
+    private static final int MAX_ATTEMPTS = 1000;
+
+    private static final VarHandle LONGS =
+        MethodHandles.byteBufferViewVarHandle(long[].class, ByteOrder.nativeOrder());
+
+    private final ByteBuffer page;
+    private final int pid;
+
+    private SharedStatsPage(ByteBuffer page) {
+        this.page = page;
+        this.pid = page.order(ByteOrder.nativeOrder()).getInt(16);
+    }
+
+    /**
+     * Page of the agent loaded in this JVM, or null if unavailable
+     */
+    static SharedStatsPage fromNative(ByteBuffer buffer) {
+        if (buffer == null || buffer.capacity() < PAGE_SIZE || !hasMagic(buffer)) {
+            return null;
+        }
+        return new SharedStatsPage(buffer);
+    }
+
+    /**
+     * Map the page of another process running the agent
+     *
+     * @throws IOException if the page file does not exist or is not a stats page
+     */
+    public static SharedStatsPage open(int pid) throws IOException {
+        return open(pagePath(pid));
+    }
+
+    public static SharedStatsPage open(Path path) throws IOException {
+        try (FileChannel channel = FileChannel.open(path, StandardOpenOption.READ)) {
+            MappedByteBuffer buffer = channel.map(FileChannel.MapMode.READ_ONLY, 0, PAGE_SIZE);
+            if (!hasMagic(buffer)) {
+                throw new IOException("Not a statistics page: " + path);
+            }
+            return new SharedStatsPage(buffer);
+        }
+    }
+
+    /**
+     * Page file location used by the agent
+     */
+    public static Path pagePath(int pid) {
+        String name = "jma-stats-" + pid;
+        if (System.getProperty("os.name", "").toLowerCase().contains("linux")) {
+            return Paths.get("/dev/shm", name);
+        }
+        String tmp = System.getenv("TMPDIR");
+        return Paths.get(tmp != null && !tmp.isEmpty() ? tmp : "/tmp", name);
+    }
+
+    private static boolean hasMagic(ByteBuffer buffer) {
+        for (int i = 0; i < MAGIC.length; i++) {
+            if (buffer.get(i) != MAGIC[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    public int getPid() {
+        return pid;
+    }
+
+    /**
+     * Copy a consistent version of all counters into values
+     *
+     * @return false if the writer kept the page busy for too long
+     */
+    public boolean read(long[] values) {
+        for (int attempt = 0; attempt < MAX_ATTEMPTS; attempt++) {
+            long before = (long) LONGS.getAcquire(page, SEQUENCE_OFFSET);
+            if ((before & 1) != 0) {
+                Thread.onSpinWait();
+                continue;
+            }
+            for (int i = 0; i < FIELD_COUNT; i++) {
+                values[i] = (long) LONGS.get(page, FIELDS_OFFSET + i * 8);
+            }
+            VarHandle.loadLoadFence();
+            if ((long) LONGS.getAcquire(page, SEQUENCE_OFFSET) == before) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Single counter (not consistent with other counters)
+     */
+    public long get(int field) {
+        return (long) LONGS.getAcquire(page, FIELDS_OFFSET + field * 8);
+    }
+
+    /**
+     * Counters as MemoryStats, or null if no consistent copy was obtained
+     */
+    public NativeMemoryTracker.MemoryStats readMemoryStats() {
+        long[] values = new long[FIELD_COUNT];
+        if (!read(values)) {
+            return null;
+        }
+        return new NativeMemoryTracker.MemoryStats(values[TOTAL_ALLOCATED], values[TOTAL_FREED],
+            values[CURRENT_USAGE], values[ALLOC_COUNT], values[FREE_COUNT], values[UPDATE_TIME]);
+    }
+}
@@ -1,13 +1,13 @@
 package com.jvm.analyzer.heap;
 
+import com.jvm.analyzer.core.ClassPrefixMatcher;
+import com.jvm.analyzer.core.NativeMemoryTracker;
 import org.objectweb.asm.*;
 import org.objectweb.asm.commons.*;
 import org.objectweb.asm.tree.*;
 
 import java.lang.instrument.ClassFileTransformer;
 import java.security.ProtectionDomain;
-import java.util.HashSet;
-import java.util.Set;
 
 /**
  * Allocation Class Transformer - Instruments classes for object allocation tracking
@@ -20,34 +20,38 @@ import java.util.Set;
  */
 public class AllocationClassTransformer implements ClassFileTransformer {
 
-    // Classes to exclude from instrumentation
-    private static final Set<String> EXCLUDED_CLASSES = new HashSet<>();
-
-    static {
-        // Exclude internal classes
-        EXCLUDED_CLASSES.add("java/lang/Object");
-        EXCLUDED_CLASSES.add("java/lang/String");
-        EXCLUDED_CLASSES.add("java/lang/Class");
-        EXCLUDED_CLASSES.add("java/lang/Thread");
-        EXCLUDED_CLASSES.add("java/lang/System");
-        EXCLUDED_CLASSES.add("java/lang/Runnable");
-        EXCLUDED_CLASSES.add("java/lang/Cloneable");
-        EXCLUDED_CLASSES.add("java/lang/Comparable");
-        EXCLUDED_CLASSES.add("java/lang/Throwable");
-        EXCLUDED_CLASSES.add("java/lang/Exception");
-        EXCLUDED_CLASSES.add("java/lang/RuntimeException");
-        EXCLUDED_CLASSES.add("java/lang/Error");
-        EXCLUDED_CLASSES.add("java/lang/StringBuilder");
-        EXCLUDED_CLASSES.add("java/lang/StringFactory");
-
-        // Exclude IntelliJ IDEA debugger classes to prevent conflicts
-        EXCLUDED_CLASSES.add("com/intellij/rt/debugger/agent/");
-        EXCLUDED_CLASSES.add("com/jvm/analyzer/heap/AllocationClassTransformer");
-        EXCLUDED_CLASSES.add("com/jvm/analyzer/heap/InstrumentedAllocationRecorder");
-
-        // Exclude array classes
-        EXCLUDED_CLASSES.add("[");
-    }
+    // Classes to exclude from instrumentation (internal names)
+    private static final ClassPrefixMatcher EXCLUDED_CLASSES = ClassPrefixMatcher.excluding(
+        // Internal classes
+        "java/lang/Object",
+        "java/lang/String",
+        "java/lang/Class",
+        "java/lang/Thread",
+        "java/lang/System",
+        "java/lang/Runnable",
+        "java/lang/Cloneable",
+        "java/lang/Comparable",
+        "java/lang/Throwable",
+        "java/lang/Exception",
+        "java/lang/RuntimeException",
+        "java/lang/Error",
+        "java/lang/StringBuilder",
+        "java/lang/StringFactory",
+
+        // IntelliJ IDEA debugger classes (prevents conflicts)
+        "com/intellij/rt/debugger/agent/",
+        "com/jvm/analyzer/heap/AllocationClassTransformer",
+        "com/jvm/analyzer/heap/InstrumentedAllocationRecorder",
+
+        // Array classes
+        "[",
+
+        // Core Java classes that are loaded very early
+        // These classes are needed for basic JVM operation
+        "java/", "javax/", "sun/", "jdk/");
+
+    // Also consult the native agent's include / exclude lists
+    private final boolean nativeLists = NativeMemoryTracker.isNativeAvailable();
 
     @Override
     public byte[] transform(ClassLoader loader, String className,
@@ -59,18 +63,6 @@ public class AllocationClassTransformer implements ClassFileTransformer {
             return null;
         }
 
-        // Skip arrays
-        if (className.startsWith("[")) {
-            return null;
-        }
-
-        // Skip core Java classes that are loaded very early
-        // These classes are needed for basic JVM operation
-        if (className.startsWith("java/") || className.startsWith("javax/") ||
-            className.startsWith("sun/") || className.startsWith("jdk/")) {
-            return null;
-        }
-
         try {
             // Transform the class
             return transformClass(classfileBuffer);
@@ -85,12 +77,8 @@ public class AllocationClassTransformer implements ClassFileTransformer {
      * Check if class should be excluded
      */
     private boolean isExcluded(String className) {
-        for (String excluded : EXCLUDED_CLASSES) {
-            if (className.startsWith(excluded)) {
-                return true;
-            }
-        }
-        return false;
+        return EXCLUDED_CLASSES.isExcluded(className)
+            || (nativeLists && NativeMemoryTracker.isClassExcluded(className));
     }
 
     /**
@@ -32,7 +32,8 @@ public class AllocationRecorder {
     // Recording thread
     private volatile Thread recorderThread;
 
-    // Memory usage history
+    // Memory usage history (Java-only mode; with the native agent the
+    // history comes from its time-series store)
     private final ConcurrentLinkedQueue<MemorySample> memoryHistory = new ConcurrentLinkedQueue<>();
     private final int maxHistorySize = 1000;
 
@@ -112,6 +113,10 @@ public class AllocationRecorder {
      * Sample current memory usage
      */
     private void sampleMemory() {
+        if (NativeMemoryTracker.isCollecting()) {
+            return;
+        }
+
         MemoryMXBean memoryMXBean = ManagementFactory.getMemoryMXBean();
         MemoryUsage heapUsage = memoryMXBean.getHeapMemoryUsage();
 
@@ -187,14 +192,39 @@ public class AllocationRecorder {
      * Get memory history
      */
     public List<MemorySample> getMemoryHistory() {
+        if (NativeMemoryTracker.isCollecting()) {
+            List<MemorySample> samples = getMemoryHistory(NativeMemoryTracker.RESOLUTIONS[0]);
+            if (!samples.isEmpty()) {
+                return samples;
+            }
+        }
         return new ArrayList<>(memoryHistory);
     }
 
+    /**
+     * Get memory history at a native time-series resolution (1, 10, 60 or
+     * 600 seconds; averages per interval)
+     */
+    public List<MemorySample> getMemoryHistory(int resolutionSeconds) {
+        NativeMemoryTracker.TimeSeries used = NativeMemoryTracker.readTimeSeries(
+            NativeMemoryTracker.METRIC_HEAP_USED, resolutionSeconds);
+        NativeMemoryTracker.TimeSeries committed = NativeMemoryTracker.readTimeSeries(
+            NativeMemoryTracker.METRIC_HEAP_COMMITTED, resolutionSeconds);
+        long max = ManagementFactory.getMemoryMXBean().getHeapMemoryUsage().getMax();
+
+        List<MemorySample> samples = new ArrayList<>(used.size());
+        int n = Math.min(used.size(), committed.size());
+        for (int i = 0; i < n; i++) {
+            samples.add(new MemorySample(used.timestamps[i], used.avg[i], committed.avg[i], max));
+        }
+        return samples;
+    }
+
     /**
      * Get memory history size
      */
     public int getHistorySize() {
-        return memoryHistory.size();
+        return getMemoryHistory().size();
     }
 
     /**
@@ -38,7 +38,13 @@ public class HeapAnalyzer {
 
     private final ReadWriteLock snapshotLock = new ReentrantReadWriteLock();
     private final List<MemorySnapshot> snapshots = new CopyOnWriteArrayList<>();
-    private final ConcurrentLinkedQueue<AllocationRecord> recentAllocations = new ConcurrentLinkedQueue<>();
+
+    // Recent allocations: fixed-size ring, overwritten in place (no per-record
+    // queue nodes). Full history lives in the native flight recorder.
+    private static final int RECENT_CAPACITY = 10000;
+    private final AtomicReferenceArray<AllocationRecord> recentAllocations =
+        new AtomicReferenceArray<>(RECENT_CAPACITY);
+    private final AtomicLong recentCursor = new AtomicLong();
 
     // Statistics 统计
     private final ThreadSafeCounter allocCounter = new ThreadSafeCounter();
@@ -157,7 +163,7 @@ public class HeapAnalyzer {
         builder.setClassStats(classStats);
 
         // Add recent allocations
-        for (AllocationRecord record : recentAllocations) {
+        for (AllocationRecord record : getRecentAllocations(RECENT_CAPACITY)) {
             builder.addAllocation(record);
         }
 
@@ -218,12 +224,8 @@ public class HeapAnalyzer {
      * Record allocation (called from AllocationRecorder)
      */
     public void recordAllocation(AllocationRecord record) {
-        recentAllocations.offer(record);
-
-        // Limit queue size
-        while (recentAllocations.size() > 10000) {
-            recentAllocations.poll();
-        }
+        long slot = recentCursor.getAndIncrement();
+        recentAllocations.set((int) (slot % RECENT_CAPACITY), record);
 
         // Update statistics
         allocCounter.add(record.getSize());
@@ -235,14 +237,19 @@ public class HeapAnalyzer {
     }
 
     /**
-     * Get recent allocations
+     * Get the most recent allocations, oldest first
+     *
+     * @param limit Maximum number of records (negative is treated as 0)
      */
     public List<AllocationRecord> getRecentAllocations(int limit) {
-        List<AllocationRecord> list = new ArrayList<>();
-        int count = 0;
-        for (AllocationRecord record : recentAllocations) {
-            list.add(record);
-            if (++count >= limit) break;
+        long end = recentCursor.get();
+        long start = Math.max(0, end - Math.min(Math.max(0, limit), RECENT_CAPACITY));
+        List<AllocationRecord> list = new ArrayList<>((int) (end - start));
+        for (long i = start; i < end; i++) {
+            AllocationRecord record = recentAllocations.get((int) (i % RECENT_CAPACITY));
+            if (record != null) {
+                list.add(record);
+            }
         }
         return list;
     }
@@ -299,7 +306,10 @@ public class HeapAnalyzer {
      */
     public void clear() {
         snapshots.clear();
-        recentAllocations.clear();
+        for (int i = 0; i < RECENT_CAPACITY; i++) {
+            recentAllocations.set(i, null);
+        }
+        recentCursor.set(0);
         allocCounter.reset();
         classAllocCounter.clear();
         threadAllocCounter.clear();
@@ -346,9 +356,12 @@ public class HeapAnalyzer {
      * @param threadId  Thread ID that allocated the object
      * @param threadName Thread name
      * @param stackTrace Stack trace elements (format: "class.method(file:line)")
+     * @param weight    Allocations this sample stands for (1 unless the agent
+     *                  uses stratified per-class sampling)
      */
     public static void onObjectAlloc(long tag, String className, long size,
-                                      long threadId, String threadName, String stackTrace) {
+                                      long threadId, String threadName, String stackTrace,
+                                      int weight) {
         if (instance != null) {
             // Always record allocation, regardless of analyzing state
             // This allows capturing allocations even before startAnalysis() is called
@@ -359,7 +372,8 @@ public class HeapAnalyzer {
                 System.currentTimeMillis(),
                 threadId,
                 threadName,
-                parseStackTrace(stackTrace)
+                parseStackTrace(stackTrace),
+                weight
             );
             instance.recordAllocation(record);
         }
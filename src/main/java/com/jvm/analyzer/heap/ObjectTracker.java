@@ -23,6 +23,12 @@ public class ObjectTracker {
     // Object registry: objectId -> AllocationRecord
     private final ConcurrentHashMap<Long, AllocationRecord> objectRegistry =new ConcurrentHashMap<>();
 
+    // Tracked records by allocation timestamp, insertion order within one
+    // timestamp; removed records are skipped and dropped lazily.
+    // Guarded by registryLock.
+    private final TreeMap<Long, ArrayDeque<AllocationRecord>> ageOrder = new TreeMap<>();
+    private int ageOrderSize = 0;
+
     // Class statistics: className -> ClassInfo
     private final ConcurrentHashMap<String, ClassInfo> classStats =new ConcurrentHashMap<>();
 
@@ -95,26 +101,46 @@ public class ObjectTracker {
      * Perform cleanup of old entries
      */
     private void performCleanup() {
-        // Remove entries that exceed size limit (oldest first)
-        while (objectRegistry.size() > maxTrackedObjects) {
-            Map.Entry<Long, AllocationRecord> oldest = null;
-            long oldestTime = Long.MAX_VALUE;
-
-            for (Map.Entry<Long, AllocationRecord> entry : objectRegistry.entrySet()) {
-                if (entry.getValue().getTimestamp() < oldestTime) {
-                    oldestTime = entry.getValue().getTimestamp();
-                    oldest = entry;
+        registryLock.writeLock().lock();
+        try {
+            // Remove entries that exceed size limit (oldest first)
+            while (objectRegistry.size() > maxTrackedObjects && !ageOrder.isEmpty()) {
+                Map.Entry<Long, ArrayDeque<AllocationRecord>> first = ageOrder.firstEntry();
+                AllocationRecord oldest = first.getValue().pollFirst();
+                ageOrderSize--;
+                if (first.getValue().isEmpty()) {
+                    ageOrder.remove(first.getKey());
+                }
+                if (isLive(oldest)) {
+                    remove(oldest.getObjectId());
                 }
             }
 
-            if (oldest != null) {
-                remove(oldest.getKey());
-            } else {
-                break;
+            // Drop removed records once they outnumber the live ones
+            if (ageOrderSize > 2 * objectRegistry.size() + 1024) {
+                ageOrderSize = 0;
+                Iterator<ArrayDeque<AllocationRecord>> it = ageOrder.values().iterator();
+                while (it.hasNext()) {
+                    ArrayDeque<AllocationRecord> records = it.next();
+                    records.removeIf(record -> !isLive(record));
+                    if (records.isEmpty()) {
+                        it.remove();
+                    }
+                    ageOrderSize += records.size();
+                }
             }
+        } finally {
+            registryLock.writeLock().unlock();
         }
     }
 
+    /**
+     * Whether an ageOrder entry is still the tracked record of its object
+     */
+    private boolean isLive(AllocationRecord record) {
+        return objectRegistry.get(record.getObjectId()) == record;
+    }
+
     /**
      * Track an object allocation
      *
@@ -134,14 +160,17 @@ public class ObjectTracker {
 
             // Add to registry
             objectRegistry.put(record.getObjectId(), record);
+            ageOrder.computeIfAbsent(record.getTimestamp(), t -> new ArrayDeque<>()).addLast(record);
+            ageOrderSize++;
             trackedCount.incrementAndGet();
             totalTracked.incrementAndGet();
 
-            // Update class statistics
-            updateClassStats(record.getClassName(), record.getSize());
+            // Update class statistics (weighted: estimates of all allocations
+            // when the agent samples per class)
+            updateClassStats(record.getClassName(), record.getSize(), record.getWeight());
 
             // Update site statistics
-            updateSiteStats(record.getAllocationSite(), record.getSize());
+            updateSiteStats(record.getAllocationSite(), record.getSize(), record.getWeight());
 
         } finally {
             registryLock.writeLock().unlock();
@@ -151,15 +180,15 @@ public class ObjectTracker {
     /**
      * Update class statistics
      */
-    private void updateClassStats(String className, long size) {
+    private void updateClassStats(String className, long size, int weight) {
         classStats.compute(className, (key, info) -> {
             if (info == null) {
-                return new ClassInfo(className, 1, size);
+                return new ClassInfo(className, weight, size * weight);
             }
             return new ClassInfo(
                 className,
-                info.instanceCount + 1,
-                info.totalSize + size
+                info.instanceCount + weight,
+                info.totalSize + size * weight
             );
         });
     }
@@ -167,15 +196,15 @@ public class ObjectTracker {
     /**
      * Update site statistics
      */
-    private void updateSiteStats(String site, long size) {
+    private void updateSiteStats(String site, long size, int weight) {
         siteStats.compute(site, (key, info) -> {
             if (info == null) {
-                return new SiteInfo(site, 1, size);
+                return new SiteInfo(site, weight, size * weight);
             }
             return new SiteInfo(
                 site,
-                info.allocationCount + 1,
-                info.totalSize + size
+                info.allocationCount + weight,
+                info.totalSize + size * weight
             );
         });
     }
@@ -195,14 +224,15 @@ public class ObjectTracker {
                 totalFreed.incrementAndGet();
 
                 // Update class statistics
+                int weight = record.getWeight();
                 classStats.compute(record.getClassName(), (key, info) -> {
-                    if (info == null || info.instanceCount <= 1) {
+                    if (info == null || info.instanceCount <= weight) {
                         return null;
                     }
                     return new ClassInfo(
                         info.className,
-                        info.instanceCount - 1,
-                        info.totalSize - record.getSize()
+                        info.instanceCount - weight,
+                        info.totalSize - record.getSize() * weight
                     );
                 });
             }
@@ -337,10 +367,18 @@ public class ObjectTracker {
     public List<AllocationRecord> getObjectsOlderThan(long ageMs) {
         long cutoff = System.currentTimeMillis() - ageMs;
         List<AllocationRecord> result = new ArrayList<>();
-        for (AllocationRecord record : objectRegistry.values()) {
-            if (record.getTimestamp() <= cutoff) {
-                result.add(record);
+        registryLock.readLock().lock();
+        try {
+            // Oldest first, only the timestamps at or before the cutoff
+            for (ArrayDeque<AllocationRecord> records : ageOrder.headMap(cutoff, true).values()) {
+                for (AllocationRecord record : records) {
+                    if (isLive(record)) {
+                        result.add(record);
+                    }
+                }
             }
+        } finally {
+            registryLock.readLock().unlock();
         }
         return result;
     }
@@ -352,6 +390,8 @@ public class ObjectTracker {
         registryLock.writeLock().lock();
         try {
             objectRegistry.clear();
+            ageOrder.clear();
+            ageOrderSize = 0;
             classStats.clear();
             siteStats.clear();
             trackedCount.set(0);
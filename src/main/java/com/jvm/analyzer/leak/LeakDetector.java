@@ -146,6 +146,10 @@ public class LeakDetector {
      * Detect leaks by object age
      */
     private List<LeakCandidate> detectByAge() {
+        if (NativeMemoryTracker.isTrackingObjects()) {
+            return detectByNativeAge();
+        }
+
         List<LeakCandidate> candidates = new ArrayList<>();
 
         // Find objects older than threshold
@@ -177,6 +181,46 @@ public class LeakDetector {
         return candidates;
     }
 
+    /**
+     * Age-based detection from the agent's age index, which returns old
+     * objects already grouped by class and site
+     */
+    private List<LeakCandidate> detectByNativeAge() {
+        Map<String, List<NativeMemoryTracker.OldObjectGroup>> byClass = new HashMap<>();
+        for (NativeMemoryTracker.OldObjectGroup group : NativeMemoryTracker.readOldObjects(ageThresholdMs)) {
+            byClass.computeIfAbsent(group.className, k -> new ArrayList<>()).add(group);
+        }
+
+        List<LeakCandidate> candidates = new ArrayList<>();
+        for (Map.Entry<String, List<NativeMemoryTracker.OldObjectGroup>> entry : byClass.entrySet()) {
+            long count = 0;
+            long bytes = 0;
+            NativeMemoryTracker.OldObjectGroup topSite = null;
+            for (NativeMemoryTracker.OldObjectGroup group : entry.getValue()) {
+                count += group.count;
+                bytes += group.bytes;
+                if (topSite == null || group.count > topSite.count) {
+                    topSite = group;
+                }
+            }
+
+            if (count >= growthThreshold) {
+                candidates.add(new LeakCandidate(
+                    entry.getKey(),
+                    (int) Math.min(count, Integer.MAX_VALUE),
+                    bytes,
+                    LeakType.AGE_BASED,
+                    topSite.site,
+                    Collections.emptyList(),
+                    String.format("Found %d objects older than %d seconds",
+                        count, ageThresholdMs / 1000)
+                ));
+            }
+        }
+
+        return candidates;
+    }
+
     /**
      * Detect leaks by growth pattern
      */
@@ -225,15 +269,16 @@ public class LeakDetector {
             TimeWindowAnalyzer.WindowStats stats = entry.getValue();
 
             // Check for consistent growth
+            // (current counts come from currentStats, or from the agent
+            // when it supplies the trends)
             if (stats.isConsistentGrowth() && stats.growthCount >= 3) {
-                ObjectTracker.ClassInfo info = currentStats.get(entry.getKey());
-                if (info != null && info.instanceCount >= growthThreshold) {
-                    List<AllocationRecord> records = objectTracker.getObjectsByClass(info.className);
+                if (stats.currentInstances > 0 && stats.currentInstances >= growthThreshold) {
+                    List<AllocationRecord> records = objectTracker.getObjectsByClass(stats.className);
 
                     candidates.add(new LeakCandidate(
-                        info.className,
-                        info.instanceCount,
-                        info.totalSize,
+                        stats.className,
+                        stats.currentInstances,
+                        stats.currentSize,
                         LeakType.WINDOW_BASED,
                         getTopAllocationSite(records),
                         records,
@@ -12,6 +12,12 @@ import java.util.concurrent.atomic.*;
  * Provides sliding window analysis for detecting memory growth patterns.
  * Used for leak detection and trend analysis.
  *
+ * Each class keeps running regression sums over its window, updated in
+ * O(1) per snapshot. Once the native agent has checkpointed its per-class
+ * trends (after each GC), analyze() reads those instead (one array, see
+ * NativeMemoryTracker.getClassTrends), which cover every sampled
+ * allocation; until then it uses the snapshot window.
+ *
  * Thread-safe implementation.
  *
  * @author Java Memory Analyzer Team
@@ -34,6 +40,14 @@ public class TimeWindowAnalyzer {
      */
     public TimeWindowAnalyzer(int windowSize) {
         this.windowSize = windowSize;
+        if (NativeMemoryTracker.isNativeAvailable()) {
+            // Resizing resets the agent's trends: only when it differs
+            long[] trends = NativeMemoryTracker.getClassTrends();
+            if (trends == null || trends.length < NativeMemoryTracker.TREND_HEADER
+                    || trends[NativeMemoryTracker.TREND_HEADER_WINDOW] != windowSize) {
+                NativeMemoryTracker.setTrendWindow(windowSize);
+            }
+        }
     }
 
     /**
@@ -70,32 +84,9 @@ public class TimeWindowAnalyzer {
      */
     private void updateClassStats(MemorySnapshot snapshot) {
         for (Map.Entry<String, MemorySnapshot.ClassStats> entry : snapshot.getClassStats().entrySet()) {
-            String className = entry.getKey();
             MemorySnapshot.ClassStats stats = entry.getValue();
-
-            classStats.compute(className, (key, existing) -> {
-                ClassWindowStats newStats = new ClassWindowStats(className);
-
-                if (existing != null) {
-                    newStats.instanceCounts = new long[Math.min(windowSize, existing.instanceCounts.length + 1)];
-                    System.arraycopy(existing.instanceCounts, 0, newStats.instanceCounts,
-                                    1, existing.instanceCounts.length);
-                    newStats.instanceCounts[0] = stats.instanceCount;
-
-                    newStats.sizeValues = new long[Math.min(windowSize, existing.sizeValues.length + 1)];
-                    System.arraycopy(existing.sizeValues, 0, newStats.sizeValues,
-                                    1, existing.sizeValues.length);
-                    newStats.sizeValues[0] = stats.totalSize;
-
-                    newStats.count = Math.min(windowSize, existing.count + 1);
-                } else {
-                    newStats.instanceCounts = new long[]{stats.instanceCount};
-                    newStats.sizeValues = new long[]{stats.totalSize};
-                    newStats.count = 1;
-                }
-
-                return newStats;
-            });
+            classStats.computeIfAbsent(entry.getKey(), name -> new ClassWindowStats(name, windowSize))
+                .add(stats.instanceCount, snapshot.getTimestamp());
         }
     }
 
@@ -105,6 +96,14 @@ public class TimeWindowAnalyzer {
      * @return Map of class name to window stats
      */
     public Map<String, WindowStats> analyze(Map<String, ObjectTracker.ClassInfo> currentStats) {
+        if (NativeMemoryTracker.isCollecting()) {
+            long[] trends = NativeMemoryTracker.getClassTrends();
+            if (trends != null && trends.length >= NativeMemoryTracker.TREND_HEADER
+                    && trends[NativeMemoryTracker.TREND_HEADER_CHECKPOINTS] > 0) {
+                return analyzeNative(trends);
+            }
+        }
+
         Map<String, WindowStats> results = new ConcurrentHashMap<>();
 
         for (Map.Entry<String, ClassWindowStats> entry : classStats.entrySet()) {
@@ -123,68 +122,58 @@ public class TimeWindowAnalyzer {
     }
 
     /**
-     * Create window stats for a class
+     * Window stats from the agent's class trends (current instances and
+     * size are the agent's live counts)
      */
-    private WindowStats createWindowStats(ClassWindowStats stats, ObjectTracker.ClassInfo current) {
-        if (stats.count < 3) {
-            return null;
-        }
-
-        // Calculate growth pattern
-        int growthCount = 0;
-        long totalGrowth = 0;
-        long maxInstanceCount = 0;
-        long minInstanceCount = Long.MAX_VALUE;
-
-        for (int i = 0; i < stats.count - 1; i++) {
-            long delta = stats.instanceCounts[i] - stats.instanceCounts[i + 1];
-            if (delta > 0) {
-                growthCount++;
-                totalGrowth += delta;
+    private Map<String, WindowStats> analyzeNative(long[] data) {
+        Map<String, WindowStats> results = new HashMap<>();
+
+        for (int row = NativeMemoryTracker.TREND_HEADER;
+             row + NativeMemoryTracker.TREND_ROW_WIDTH <= data.length;
+             row += NativeMemoryTracker.TREND_ROW_WIDTH) {
+            if (data[row + NativeMemoryTracker.TREND_POINTS] < 3) { // Need at least 3 data points
+                continue;
             }
+            String className = NativeMemoryTracker.getClassName((int) data[row + NativeMemoryTracker.TREND_CLASS_ID]);
+            results.put(className, new WindowStats(
+                className,
+                (int) data[row + NativeMemoryTracker.TREND_GROWTH_COUNT],
+                data[row + NativeMemoryTracker.TREND_TOTAL_GROWTH],
+                data[row + NativeMemoryTracker.TREND_MAX_COUNT],
+                data[row + NativeMemoryTracker.TREND_MIN_COUNT],
+                Double.longBitsToDouble(data[row + NativeMemoryTracker.TREND_SLOPE]),
+                (int) Math.min(data[row + NativeMemoryTracker.TREND_LIVE_COUNT], Integer.MAX_VALUE),
+                data[row + NativeMemoryTracker.TREND_LIVE_BYTES],
+                (int) data[row + NativeMemoryTracker.TREND_STREAK],
+                Double.longBitsToDouble(data[row + NativeMemoryTracker.TREND_EWMA_RATE])
+            ));
         }
 
-        for (int i = 0; i < stats.count; i++) {
-            maxInstanceCount = Math.max(maxInstanceCount, stats.instanceCounts[i]);
-            minInstanceCount = Math.min(minInstanceCount, stats.instanceCounts[i]);
-        }
-
-        // Calculate trend (linear regression slope)
-        double slope = calculateSlope(stats.instanceCounts, stats.count);
-
-        return new WindowStats(
-            stats.className,
-            growthCount,
-            totalGrowth,
-            maxInstanceCount,
-            minInstanceCount,
-            slope,
-            current != null ? current.instanceCount : 0,
-            current != null ? current.totalSize : 0
-        );
+        return results;
     }
 
     /**
-     * Calculate linear regression slope
+     * Create window stats for a class
      */
-    private double calculateSlope(long[] values, int count) {
-        if (count < 2) return 0;
-
-        double sumX = 0, sumY = 0, sumXY = 0, sumX2 = 0;
-
-        for (int i = 0; i < count; i++) {
-            double x = i;
-            double y = values[i];
-            sumX += x;
-            sumY += y;
-            sumXY += x * y;
-            sumX2 += x * x;
-        }
-
-        double denominator = count * sumX2 - sumX * sumX;
-        if (Math.abs(denominator) < 0.0001) return 0;
+    private WindowStats createWindowStats(ClassWindowStats stats, ObjectTracker.ClassInfo current) {
+        synchronized (stats) {
+            if (stats.count < 3) {
+                return null;
+            }
 
-        return (count * sumXY - sumX * sumY) / denominator;
+            return new WindowStats(
+                stats.className,
+                stats.growthCount,
+                stats.totalGrowth,
+                stats.max(),
+                stats.min(),
+                stats.slope(),
+                current != null ? current.instanceCount : 0,
+                current != null ? current.totalSize : 0,
+                stats.streak,
+                stats.ewmaRate
+            );
+        }
     }
 
     /**
@@ -241,21 +230,104 @@ public class TimeWindowAnalyzer {
             this.snapshotId = snapshot.getSnapshotId();
             this.timestamp = snapshot.getTimestamp();
             this.heapUsed = snapshot.getTotalHeapUsed();
-            this.classStats = new HashMap<>(snapshot.getClassStats());
+            this.classStats = snapshot.getClassStats();     // Immutable view
         }
     }
 
     /**
      * Class window statistics
+     *
+     * The last window instance counts in a ring, with running sums for the
+     * regression. Points are numbered from the oldest (x = 0), so sum(x) and
+     * sum(x^2) depend only on count, and dropping the oldest point updates
+     * sum(y) and sum(xy) exactly. Same scheme as the agent's ClassTrends.
+     * Guarded by the instance monitor.
      */
     public static class ClassWindowStats {
+        private static final double EWMA_ALPHA = 0.25;
+
         public final String className;
-        public long[] instanceCounts;
-        public long[] sizeValues;
+        private final long[] instanceCounts;   // Ring, oldest at head
+        private int head;
         public int count;
-
-        public ClassWindowStats(String className) {
+        private long sumY;
+        private long sumXY;
+        public int growthCount;                 // Increases between consecutive points
+        public long totalGrowth;
+        public int streak;                      // Consecutive increases up to the newest
+        public double ewmaRate;                 // Instances per second
+        private long lastTimestamp;
+
+        public ClassWindowStats(String className, int windowSize) {
             this.className = className;
+            this.instanceCounts = new long[Math.max(2, windowSize)];
+        }
+
+        private long point(int i) {
+            return instanceCounts[(head + i) % instanceCounts.length];
+        }
+
+        synchronized void add(long instances, long timestamp) {
+            if (count == instanceCounts.length) {
+                // Drop the oldest point and renumber the rest from x = 0
+                long oldest = point(0);
+                long delta = point(1) - oldest;
+                if (delta > 0) {
+                    growthCount--;
+                    totalGrowth -= delta;
+                }
+                sumY -= oldest;
+                sumXY -= sumY;
+                head = (head + 1) % instanceCounts.length;
+                count--;
+            }
+
+            if (count > 0) {
+                long delta = instances - point(count - 1);
+                if (delta > 0) {
+                    growthCount++;
+                    totalGrowth += delta;
+                    streak++;
+                } else {
+                    streak = 0;
+                }
+                double seconds = (timestamp - lastTimestamp) / 1000.0;
+                double rate = seconds > 0 ? delta / seconds : 0;
+                ewmaRate = EWMA_ALPHA * rate + (1 - EWMA_ALPHA) * ewmaRate;
+            }
+
+            instanceCounts[(head + count) % instanceCounts.length] = instances;
+            sumXY += (long) count * instances;
+            sumY += instances;
+            count++;
+            lastTimestamp = timestamp;
+        }
+
+        /**
+         * Least-squares slope in instances per snapshot
+         */
+        synchronized double slope() {
+            double n = count;
+            double sumX = n * (n - 1) / 2;
+            double sumX2 = (n - 1) * n * (2 * n - 1) / 6;
+            double denominator = n * sumX2 - sumX * sumX;
+            return denominator > 0 ? (n * sumXY - sumX * sumY) / denominator : 0;
+        }
+
+        synchronized long min() {
+            long min = Long.MAX_VALUE;
+            for (int i = 0; i < count; i++) {
+                min = Math.min(min, point(i));
+            }
+            return min;
+        }
+
+        synchronized long max() {
+            long max = 0;
+            for (int i = 0; i < count; i++) {
+                max = Math.max(max, point(i));
+            }
+            return max;
         }
     }
 
@@ -271,10 +343,13 @@ public class TimeWindowAnalyzer {
         public final double slope;
         public final int currentInstances;
         public final long currentSize;
+        public final int growthStreak;          // Consecutive increases up to the newest point
+        public final double ewmaGrowthRate;     // Instances per second
 
         public WindowStats(String className, int growthCount, long totalGrowth,
                           long maxInstanceCount, long minInstanceCount,
-                          double slope, int currentInstances, long currentSize) {
+                          double slope, int currentInstances, long currentSize,
+                          int growthStreak, double ewmaGrowthRate) {
             this.className = className;
             this.growthCount = growthCount;
             this.totalGrowth = totalGrowth;
@@ -283,6 +358,8 @@ public class TimeWindowAnalyzer {
             this.slope = slope;
             this.currentInstances = currentInstances;
             this.currentSize = currentSize;
+            this.growthStreak = growthStreak;
+            this.ewmaGrowthRate = ewmaGrowthRate;
         }
 
         /**
@@ -305,8 +382,8 @@ public class TimeWindowAnalyzer {
 
         @Override
         public String toString() {
-            return String.format("WindowStats{class=%s, growth=%d, totalGrowth=%d, slope=%.2f}",
-                className, growthCount, totalGrowth, slope);
+            return String.format("WindowStats{class=%s, growth=%d, totalGrowth=%d, slope=%.2f, rate=%.2f/s}",
+                className, growthCount, totalGrowth, slope, ewmaGrowthRate);
         }
     }
 }
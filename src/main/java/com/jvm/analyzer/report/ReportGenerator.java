@@ -130,6 +130,12 @@ public class ReportGenerator {
         html.append(generateAllocationSitesTable());
         html.append("    </section>\n");
 
+        // Allocation Churn
+        html.append("    <section class=\"section\">\n");
+        html.append("      <h2>Allocation Churn (Short-Lived Objects)</h2>\n");
+        html.append(generateChurnTable());
+        html.append("    </section>\n");
+
         // Leak Detection Results
         html.append("    <section class=\"section\">\n");
         html.append("      <h2>Leak Detection Results</h2>\n");
@@ -379,6 +385,36 @@ public class ReportGenerator {
         return sb.toString();
     }
 
+    /**
+     * Generate allocation churn table (native agent only)
+     */
+    private String generateChurnTable() {
+        NativeMemoryTracker.ChurnReport report = NativeMemoryTracker.readChurnReport(20);
+        if (report.sites.isEmpty()) {
+            return "<p>No churn data available. Requires the native agent and at least one GC.</p>\n";
+        }
+
+        StringBuilder sb = new StringBuilder();
+        sb.append("<table>\n");
+        sb.append("  <tr><th>#</th><th>Allocation Site</th><th>Allocations/s</th><th>Short-Lived</th>"
+            + "<th>Volume Share</th><th>Short-Lived Bytes/s</th></tr>\n");
+
+        int i = 0;
+        for (NativeMemoryTracker.ChurnSite site : report.sites) {
+            sb.append("  <tr>");
+            sb.append("<td>").append(++i).append("</td>");
+            sb.append("<td><code>").append(escapeHtml(site.site)).append("</code></td>");
+            sb.append("<td>").append(String.format("%.1f", report.getAllocationsPerSecond(site))).append("</td>");
+            sb.append("<td>").append(String.format("%.1f%%", site.getShortLivedRatio() * 100)).append("</td>");
+            sb.append("<td>").append(String.format("%.1f%%", report.getVolumeShare(site) * 100)).append("</td>");
+            sb.append("<td>").append(formatBytes((long) report.getChurnBytesPerSecond(site))).append("</td>");
+            sb.append("</tr>\n");
+        }
+
+        sb.append("</table>\n");
+        return sb.toString();
+    }
+
     /**
      * Generate leak detection section
      */
@@ -466,6 +502,40 @@ public class ReportGenerator {
         }
         report.add("classHistogram", classHistogram);
 
+        // Allocation sites (same shape as the offline jma-analyzer output)
+        JsonArray allocationSites = new JsonArray();
+        if (heapAnalyzer != null) {
+            Map<String, ObjectTracker.SiteInfo> siteStats = heapAnalyzer.getObjectTracker().getSiteStatistics();
+            List<ObjectTracker.SiteInfo> sorted = new ArrayList<>(siteStats.values());
+            sorted.sort(Comparator.comparingLong((ObjectTracker.SiteInfo s) -> s.totalSize).reversed());
+
+            for (ObjectTracker.SiteInfo info : sorted) {
+                JsonObject siteEntry = new JsonObject();
+                siteEntry.addProperty("site", info.site);
+                siteEntry.addProperty("allocationCount", info.allocationCount);
+                siteEntry.addProperty("totalSize", info.totalSize);
+                siteEntry.addProperty("avgSize", info.avgSize);
+                allocationSites.add(siteEntry);
+            }
+        }
+        report.add("allocationSites", allocationSites);
+
+        // Allocation churn (native agent only; sampled counts)
+        NativeMemoryTracker.ChurnReport churn = NativeMemoryTracker.readChurnReport(50);
+        JsonArray churnSites = new JsonArray();
+        for (NativeMemoryTracker.ChurnSite site : churn.sites) {
+            JsonObject churnEntry = new JsonObject();
+            churnEntry.addProperty("site", site.site);
+            churnEntry.addProperty("allocationCount", site.allocationCount);
+            churnEntry.addProperty("allocationBytes", site.allocationBytes);
+            churnEntry.addProperty("allocationsPerSecond", churn.getAllocationsPerSecond(site));
+            churnEntry.addProperty("shortLivedRatio", site.getShortLivedRatio());
+            churnEntry.addProperty("volumeShare", churn.getVolumeShare(site));
+            churnEntry.addProperty("churnBytesPerSecond", churn.getChurnBytesPerSecond(site));
+            churnSites.add(churnEntry);
+        }
+        report.add("churnSites", churnSites);
+
         // GC stats
         JsonArray gcStats = new JsonArray();
         for (GarbageCollectorMXBean bean : ManagementFactory.getGarbageCollectorMXBeans()) {
@@ -0,0 +1,151 @@
+package com.jvm.analyzer.core;
+
+import org.junit.jupiter.api.*;
+import static org.junit.jupiter.api.Assertions.*;
+
+import java.util.*;
+
+/**
+ * Unit tests for ClassPrefixMatcher
+ */
+public class ClassPrefixMatcherTest {
+
+    private static ClassPrefixMatcher matcher(List<String> include, List<String> exclude) {
+        return new ClassPrefixMatcher(include, exclude);
+    }
+
+    @Test
+    public void testEmptyMatcherExcludesNothing() {
+        ClassPrefixMatcher m = matcher(Collections.emptyList(), Collections.emptyList());
+        assertEquals(0, m.size());
+        assertFalse(m.isExcluded("java.lang.String"));
+        assertFalse(m.isExcluded(""));
+    }
+
+    @Test
+    public void testExcludeOnlyDefaultsToIncluded() {
+        ClassPrefixMatcher m = ClassPrefixMatcher.excluding("java.", "sun.");
+        assertTrue(m.isExcluded("java.util.HashMap"));
+        assertTrue(m.isExcluded("sun.misc.Unsafe"));
+        assertFalse(m.isExcluded("com.example.Foo"), "Unmatched classes are included without include prefixes");
+        assertFalse(m.isExcluded("javax.swing.JFrame"), "A prefix matches characters, not words");
+    }
+
+    @Test
+    public void testIncludeOnlyDefaultsToExcluded() {
+        ClassPrefixMatcher m = matcher(Arrays.asList("com.example."), Collections.emptyList());
+        assertFalse(m.isExcluded("com.example.Foo"));
+        assertTrue(m.isExcluded("com.other.Foo"), "Unmatched classes are excluded when there are include prefixes");
+        assertTrue(m.isExcluded("com.example"), "The name must cover the whole prefix");
+    }
+
+    @Test
+    public void testEmptyAndNullPrefixesAreIgnored() {
+        ClassPrefixMatcher m = matcher(Arrays.asList("", null), Arrays.asList(""));
+        assertEquals(0, m.size());
+        assertFalse(m.isExcluded("com.example.Foo"), "Ignored includes do not switch the default");
+    }
+
+    @Test
+    public void testSlashAndDotNames() {
+        ClassPrefixMatcher dotted = ClassPrefixMatcher.excluding("java.util.");
+        assertTrue(dotted.isExcluded("java.util.HashMap"));
+        assertTrue(dotted.isExcluded("java/util/HashMap"));
+
+        ClassPrefixMatcher slashed = ClassPrefixMatcher.excluding("java/util/");
+        assertTrue(slashed.isExcluded("java.util.HashMap"));
+        assertTrue(slashed.isExcluded("java/util/HashMap"));
+        assertFalse(slashed.isExcluded("java/lang/String"));
+    }
+
+    @Test
+    public void testLongestPrefixWins() {
+        ClassPrefixMatcher m = matcher(
+            Arrays.asList("com.example.", "com.example.internal.api."),
+            Arrays.asList("com.example.internal."));
+        assertFalse(m.isExcluded("com.example.Foo"));
+        assertTrue(m.isExcluded("com.example.internal.Impl"));
+        assertFalse(m.isExcluded("com.example.internal.api.Service"));
+    }
+
+    @Test
+    public void testExcludeBeatsIncludeOfSamePrefix() {
+        List<String> same = Arrays.asList("com.example.");
+        assertTrue(matcher(same, same).isExcluded("com.example.Foo"));
+        assertTrue(matcher(Arrays.asList("com/example/"), same).isExcluded("com.example.Foo"),
+            "'/' and '.' spellings are the same prefix");
+    }
+
+    @Test
+    public void testEdgeSplits() {
+        // Each prefix splits an edge of the previous ones at a different point
+        ClassPrefixMatcher m = matcher(
+            Arrays.asList("com.example.alpha", "com.ex", "com.example.alphabet"),
+            Arrays.asList("com.example.al", "com.exa"));
+        assertEquals(5, m.size());
+        assertFalse(m.isExcluded("com.ex"));
+        assertFalse(m.isExcluded("com.extra.Foo"));
+        assertTrue(m.isExcluded("com.exa"));
+        assertTrue(m.isExcluded("com.example.Foo"));
+        assertTrue(m.isExcluded("com.example.alp"));
+        assertFalse(m.isExcluded("com.example.alpha"));
+        assertFalse(m.isExcluded("com.example.alphab"));
+        assertFalse(m.isExcluded("com.example.alphabet.Soup"));
+        assertTrue(m.isExcluded("com.e"), "Shorter than every prefix");
+        assertTrue(m.isExcluded("org.Foo"));
+    }
+
+    @Test
+    public void testMatchesBruteForce() {
+        Random random = new Random(42);
+        String alphabet = "ab./";
+        for (int round = 0; round < 200; round++) {
+            List<String> include = new ArrayList<>();
+            List<String> exclude = new ArrayList<>();
+            int prefixes = random.nextInt(8);
+            for (int i = 0; i < prefixes; i++) {
+                String prefix = randomName(random, alphabet, 1 + random.nextInt(5));
+                (random.nextBoolean() ? include : exclude).add(prefix);
+            }
+            ClassPrefixMatcher m = matcher(include, exclude);
+            for (int i = 0; i < 50; i++) {
+                String name = randomName(random, alphabet, random.nextInt(7));
+                assertEquals(bruteForce(include, exclude, name), m.isExcluded(name),
+                    "include=" + include + " exclude=" + exclude + " name=" + name);
+            }
+        }
+    }
+
+    private static String randomName(Random random, String alphabet, int length) {
+        StringBuilder sb = new StringBuilder();
+        for (int i = 0; i < length; i++) {
+            sb.append(alphabet.charAt(random.nextInt(alphabet.length())));
+        }
+        return sb.toString();
+    }
+
+    /**
+     * Reference semantics: longest matching prefix, exclude wins ties
+     */
+    private static boolean bruteForce(List<String> include, List<String> exclude, String className) {
+        String name = className.replace('/', '.');
+        int bestInclude = -1;
+        int bestExclude = -1;
+        for (String prefix : include) {
+            String p = prefix.replace('/', '.');
+            if (name.startsWith(p)) {
+                bestInclude = Math.max(bestInclude, p.length());
+            }
+        }
+        for (String prefix : exclude) {
+            String p = prefix.replace('/', '.');
+            if (name.startsWith(p)) {
+                bestExclude = Math.max(bestExclude, p.length());
+            }
+        }
+        if (bestInclude < 0 && bestExclude < 0) {
+            return !include.isEmpty();
+        }
+        return bestExclude >= bestInclude;
+    }
+}
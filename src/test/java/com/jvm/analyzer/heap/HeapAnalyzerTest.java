@@ -89,6 +89,44 @@ public class HeapAnalyzerTest {
         assertTrue(recent.size() <= 5, "Should return at most 5 records");
     }
 
+    @Test
+    public void testRecentAllocationsAreNewestInOldestFirstOrder() {
+        // More than the ring holds, so it wraps
+        int total = 10005;
+        for (int i = 0; i < total; i++) {
+            AllocationRecord record = new AllocationRecord.Builder()
+                .setObjectId(i)
+                .setClassName("test.TestClass")
+                .setSize(16L)
+                .build();
+            heapAnalyzer.recordAllocation(record);
+        }
+
+        List<AllocationRecord> recent = heapAnalyzer.getRecentAllocations(3);
+        assertEquals(3, recent.size());
+        assertEquals(total - 3, recent.get(0).getObjectId());
+        assertEquals(total - 2, recent.get(1).getObjectId());
+        assertEquals(total - 1, recent.get(2).getObjectId());
+
+        List<AllocationRecord> all = heapAnalyzer.getRecentAllocations(Integer.MAX_VALUE);
+        assertEquals(10000, all.size(), "Limited to the ring capacity");
+        assertEquals(total - 10000, all.get(0).getObjectId());
+        assertEquals(total - 1, all.get(all.size() - 1).getObjectId());
+    }
+
+    @Test
+    public void testRecentAllocationsWithNonPositiveLimit() {
+        AllocationRecord record = new AllocationRecord.Builder()
+            .setObjectId(1L)
+            .setClassName("test.TestClass")
+            .setSize(16L)
+            .build();
+        heapAnalyzer.recordAllocation(record);
+
+        assertTrue(heapAnalyzer.getRecentAllocations(0).isEmpty());
+        assertTrue(heapAnalyzer.getRecentAllocations(-5).isEmpty(), "Negative limit should return nothing");
+    }
+
     @Test
     public void testGetSnapshots() {
         heapAnalyzer.startAnalysis();
@@ -0,0 +1,130 @@
+package com.jvm.analyzer.heap;
+
+import com.jvm.analyzer.core.*;
+import org.junit.jupiter.api.*;
+import static org.junit.jupiter.api.Assertions.*;
+
+import java.util.*;
+
+/**
+ * Unit tests for ObjectTracker eviction and age scans
+ */
+public class ObjectTrackerTest {
+
+    private ObjectTracker tracker;
+
+    @AfterEach
+    public void tearDown() {
+        if (tracker != null) {
+            tracker.stop();
+            tracker.clear();
+        }
+    }
+
+    private static AllocationRecord record(long objectId, long timestamp) {
+        return new AllocationRecord.Builder()
+            .setObjectId(objectId)
+            .setClassName("test.TestClass")
+            .setSize(64L)
+            .setTimestamp(timestamp)
+            .build();
+    }
+
+    private static Set<Long> ids(Collection<AllocationRecord> records) {
+        Set<Long> ids = new HashSet<>();
+        for (AllocationRecord record : records) {
+            ids.add(record.getObjectId());
+        }
+        return ids;
+    }
+
+    private void waitForCleanup(long trackedCount) throws InterruptedException {
+        long deadline = System.currentTimeMillis() + 5000;
+        while (tracker.getTrackedCount() > trackedCount && System.currentTimeMillis() < deadline) {
+            Thread.sleep(10);
+        }
+    }
+
+    @Test
+    public void testOlderThanReturnsExactlyTheOldRecords() {
+        tracker = new ObjectTracker(100000, 60000);
+        long now = System.currentTimeMillis();
+
+        // Inserted seconds out of timestamp order
+        tracker.track(record(1, now - 1000));
+        tracker.track(record(2, now - 60000));
+        tracker.track(record(3, now - 500));
+        tracker.track(record(4, now - 30000));
+        tracker.track(record(5, now - 120000));
+
+        assertEquals(new HashSet<>(Arrays.asList(2L, 4L, 5L)), ids(tracker.getObjectsOlderThan(10000)));
+        assertEquals(new HashSet<>(Arrays.asList(2L, 5L)), ids(tracker.getObjectsOlderThan(45000)));
+        assertTrue(tracker.getObjectsOlderThan(600000).isEmpty(), "Nothing is ten minutes old");
+    }
+
+    @Test
+    public void testOlderThanIsOldestFirst() {
+        tracker = new ObjectTracker(100000, 60000);
+        long now = System.currentTimeMillis();
+        tracker.track(record(1, now - 20000));
+        tracker.track(record(2, now - 40000));
+        tracker.track(record(3, now - 30000));
+
+        List<AllocationRecord> old = tracker.getObjectsOlderThan(10000);
+        assertEquals(3, old.size());
+        assertEquals(2L, old.get(0).getObjectId());
+        assertEquals(3L, old.get(1).getObjectId());
+        assertEquals(1L, old.get(2).getObjectId());
+    }
+
+    @Test
+    public void testOlderThanSkipsRemovedAndRetrackedRecords() {
+        tracker = new ObjectTracker(100000, 60000);
+        long now = System.currentTimeMillis();
+        tracker.track(record(1, now - 60000));
+        tracker.track(record(2, now - 60000));
+        tracker.remove(1);
+
+        // Id 2 reused by a new allocation
+        tracker.remove(2);
+        tracker.track(record(2, now));
+
+        assertTrue(tracker.getObjectsOlderThan(10000).isEmpty(), "Removed records should not be reported");
+        assertEquals(Collections.singleton(2L), ids(tracker.getObjectsOlderThan(0)));
+    }
+
+    @Test
+    public void testCleanupEvictsOldestFirst() throws InterruptedException {
+        tracker = new ObjectTracker(10, 20);
+        long now = System.currentTimeMillis();
+
+        // Newest first, so insertion order is the reverse of age order
+        for (int i = 0; i < 30; i++) {
+            tracker.track(record(i, now - i * 1000L));
+        }
+        waitForCleanup(10);
+
+        assertEquals(10, tracker.getTrackedCount());
+        for (int i = 0; i < 30; i++) {
+            assertEquals(i < 10, tracker.isTracked(i), "Object " + i + " tracked");
+        }
+    }
+
+    @Test
+    public void testCleanupSkipsRemovedRecords() throws InterruptedException {
+        tracker = new ObjectTracker(5, 20);
+        long now = System.currentTimeMillis();
+        for (int i = 0; i < 10; i++) {
+            tracker.track(record(i, now + i));
+        }
+
+        // The oldest are already gone: only 3 and 4 need evicting
+        for (int i = 0; i < 3; i++) {
+            tracker.remove(i);
+        }
+        waitForCleanup(5);
+
+        assertEquals(5, tracker.getTrackedCount());
+        assertEquals(new HashSet<>(Arrays.asList(5L, 6L, 7L, 8L, 9L)), ids(tracker.getAllTracked()));
+    }
+}
@@ -0,0 +1,151 @@
+package com.jvm.analyzer.leak;
+
+import com.jvm.analyzer.core.*;
+import org.junit.jupiter.api.*;
+import static org.junit.jupiter.api.Assertions.*;
+
+import java.util.*;
+
+/**
+ * Unit tests for TimeWindowAnalyzer
+ */
+public class TimeWindowAnalyzerTest {
+
+    private static final double EPSILON = 1e-9;
+
+    /**
+     * Add points to the stats and check each step against a regression
+     * recomputed from the last windowSize points
+     */
+    private static void checkAgainstBruteForce(int windowSize, long[] points) {
+        TimeWindowAnalyzer.ClassWindowStats stats =
+            new TimeWindowAnalyzer.ClassWindowStats("test.TestClass", windowSize);
+        List<Long> history = new ArrayList<>();
+        int streak = 0;
+        double ewmaRate = 0;
+
+        for (int i = 0; i < points.length; i++) {
+            long timestamp = 1000L * (i + 1);
+            stats.add(points[i], timestamp);
+
+            // Unwindowed: streak and EWMA run over the whole history
+            if (!history.isEmpty()) {
+                long delta = points[i] - history.get(history.size() - 1);
+                streak = delta > 0 ? streak + 1 : 0;
+                ewmaRate = 0.25 * delta + 0.75 * ewmaRate;
+            }
+            history.add(points[i]);
+            List<Long> window = history.subList(Math.max(0, history.size() - windowSize), history.size());
+
+            String step = "window=" + windowSize + " step=" + i;
+            assertEquals(window.size(), stats.count, step);
+            assertEquals(bruteForceSlope(window), stats.slope(), EPSILON, step);
+            assertEquals(Collections.min(window).longValue(), stats.min(), step);
+            assertEquals(Collections.max(window).longValue(), stats.max(), step);
+
+            int growthCount = 0;
+            long totalGrowth = 0;
+            for (int k = 1; k < window.size(); k++) {
+                long delta = window.get(k) - window.get(k - 1);
+                if (delta > 0) {
+                    growthCount++;
+                    totalGrowth += delta;
+                }
+            }
+            assertEquals(growthCount, stats.growthCount, step);
+            assertEquals(totalGrowth, stats.totalGrowth, step);
+            assertEquals(streak, stats.streak, step);
+            assertEquals(ewmaRate, stats.ewmaRate, EPSILON, step);
+        }
+    }
+
+    /**
+     * Least-squares slope with points numbered from the oldest (x = 0)
+     */
+    private static double bruteForceSlope(List<Long> window) {
+        int n = window.size();
+        double sumX = 0;
+        double sumY = 0;
+        double sumXY = 0;
+        double sumX2 = 0;
+        for (int x = 0; x < n; x++) {
+            double y = window.get(x);
+            sumX += x;
+            sumY += y;
+            sumXY += x * y;
+            sumX2 += (double) x * x;
+        }
+        double denominator = n * sumX2 - sumX * sumX;
+        return denominator > 0 ? (n * sumXY - sumX * sumY) / denominator : 0;
+    }
+
+    @Test
+    public void testSlopeOfLinearGrowthAcrossWrapAround() {
+        TimeWindowAnalyzer.ClassWindowStats stats =
+            new TimeWindowAnalyzer.ClassWindowStats("test.TestClass", 5);
+        for (int i = 0; i < 13; i++) {
+            stats.add(100 + 7L * i, 1000L * i);
+        }
+        assertEquals(5, stats.count);
+        assertEquals(7.0, stats.slope(), EPSILON);
+        assertEquals(4, stats.growthCount, "Increases inside the window only");
+        assertEquals(28, stats.totalGrowth);
+        assertEquals(12, stats.streak, "The streak is not limited to the window");
+        assertEquals(100 + 7 * 8, stats.min());
+        assertEquals(100 + 7 * 12, stats.max());
+    }
+
+    @Test
+    public void testDropOldestMatchesBruteForce() {
+        // Rises, falls and plateaus, several times around each ring
+        long[] points = {5, 9, 9, 4, 12, 30, 30, 29, 1, 0, 0, 17, 18, 19, 3, 50, 49, 49, 60, 2, 8};
+        for (int windowSize = 2; windowSize <= 8; windowSize++) {
+            checkAgainstBruteForce(windowSize, points);
+        }
+    }
+
+    @Test
+    public void testRandomSeriesMatchesBruteForce() {
+        Random random = new Random(42);
+        for (int round = 0; round < 50; round++) {
+            int windowSize = 2 + random.nextInt(12);
+            long[] points = new long[windowSize * (2 + random.nextInt(4)) + random.nextInt(windowSize)];
+            long value = random.nextInt(1000);
+            for (int i = 0; i < points.length; i++) {
+                value = Math.max(0, value + random.nextInt(201) - 100);
+                points[i] = value;
+            }
+            checkAgainstBruteForce(windowSize, points);
+        }
+    }
+
+    @Test
+    public void testAnalyzeUsesSnapshotsWithoutAgentData() {
+        TimeWindowAnalyzer analyzer = new TimeWindowAnalyzer(4);
+        long now = System.currentTimeMillis();
+        for (int i = 0; i < 6; i++) {
+            analyzer.addSnapshot(new MemorySnapshot.Builder()
+                .setSnapshotId(i)
+                .setTimestamp(now + 1000L * i)
+                .addClassStat("test.Growing", 10 * (i + 1), 160L * (i + 1))
+                .addClassStat("test.Steady", 50, 800L)
+                .build());
+        }
+        if (NativeMemoryTracker.isCollecting()) {
+            return;   // The agent's trends take over once checkpointed
+        }
+
+        Map<String, TimeWindowAnalyzer.WindowStats> results = analyzer.analyze(Collections.emptyMap());
+        TimeWindowAnalyzer.WindowStats growing = results.get("test.Growing");
+        assertNotNull(growing, "Classes with enough points are analyzed from the snapshots");
+        assertEquals(10.0, growing.slope, EPSILON);
+        assertEquals(3, growing.growthCount);
+        assertEquals(30, growing.minInstanceCount);
+        assertEquals(60, growing.maxInstanceCount);
+
+        TimeWindowAnalyzer.WindowStats steady = results.get("test.Steady");
+        assertNotNull(steady);
+        assertEquals(0.0, steady.slope, EPSILON);
+        assertEquals(0, steady.growthCount);
+    }
+}